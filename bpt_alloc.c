@@ -0,0 +1,182 @@
+/* Copyright(c) Brayden Zhang
+ * Mail: pczhang2010@gmail.com
+ */
+#include <assert.h>
+#include <sys/mman.h>
+
+#include "bptree.h"
+
+/* Size of memory for a node of the type */
+static size_t
+bpt_node_size(int type)
+{
+	return type == LEAF ? BPT_LEAF_NODE_SIZE : BPT_INDEX_NODE_SIZE;
+}
+
+static void*
+bpt_calloc_alloc(bpt_allocator* a, int type)
+{
+	(void) a;
+	return my_aligned_calloc(BPT_NODE_ALIGN, bpt_node_size(type));
+}
+
+static void
+bpt_calloc_free(bpt_allocator* a, void* n, int type)
+{
+	(void) a;
+	(void) type;
+	free(n);
+}
+
+bpt_allocator bpt_calloc_allocator = {
+	bpt_calloc_alloc,
+	bpt_calloc_free,
+	NULL,
+};
+
+/* Header at the beginning of each slab, it links all slabs of an allocator */
+struct bpt_slab
+{
+	struct bpt_slab* next;
+
+	/* 1 if the slab is mapped by MAP_HUGETLB, so it is released by
+	 * munmap; otherwise by free.
+	 */
+	int mapped;
+};
+
+/* Size of the slab header, the node slots start after it */
+#define BPT_SLAB_HDR_BYTES BPT_NODE_ROUND_UP(sizeof(struct bpt_slab))
+
+/* Node slots of one size */
+struct bpt_slab_class
+{
+	size_t slot_size;
+
+	/* Freed slots, linked by their first word */
+	void* free_list;
+
+	/* Unused part of the newest slab */
+	char* cur;
+	char* end;
+};
+
+struct bpt_slab_allocator
+{
+	/* Must be the first member, the allocator is passed as bpt_allocator */
+	bpt_allocator base;
+
+	int flags;
+
+	/* Slots of leaf nodes and index nodes */
+	struct bpt_slab_class cls[2];
+
+	/* All slabs of the allocator */
+	struct bpt_slab* slabs;
+};
+
+/* Get a new slab from the system, use huge pages if asked for */
+static struct bpt_slab*
+bpt_slab_new(struct bpt_slab_allocator* sa)
+{
+	struct bpt_slab* s = NULL;
+	int mapped = 0;
+
+#ifdef MAP_HUGETLB
+	if(sa->flags & BPT_SLAB_HUGEPAGE){
+		s = mmap(NULL, BPT_SLAB_BYTES, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+		if(s == MAP_FAILED)
+			s = NULL;
+		else mapped = 1;
+	}
+#endif
+	if(s == NULL){
+		/* No reserved huge pages, ask for transparent huge pages. The
+		 * slots are zeroed when allocated, so the slab is not touched
+		 * before madvise.
+		 */
+		if(posix_memalign((void**) &s, BPT_SLAB_BYTES, 
+				BPT_SLAB_BYTES) != 0){
+			fprintf(stderr, "Memory allocation failed\n");
+			exit(-1);
+		}
+#ifdef MADV_HUGEPAGE
+		if(sa->flags & BPT_SLAB_HUGEPAGE)
+			madvise(s, BPT_SLAB_BYTES, MADV_HUGEPAGE);
+#endif
+	}
+
+	s->mapped = mapped;
+	s->next = sa->slabs;
+	sa->slabs = s;
+	return s;
+}
+
+static void*
+bpt_slab_alloc(bpt_allocator* a, int type)
+{
+	struct bpt_slab_allocator* sa = (struct bpt_slab_allocator*) a;
+	struct bpt_slab_class* c = &sa->cls[type];
+	void* n;
+
+	if(c->free_list){
+		/* Recycle a freed node */
+		n = c->free_list;
+		c->free_list = *(void**) n;
+	}else{
+		if(c->cur + c->slot_size > c->end){
+			char* s = (char*) bpt_slab_new(sa);
+			c->cur = s + BPT_SLAB_HDR_BYTES;
+			c->end = s + BPT_SLAB_BYTES;
+		}
+		n = c->cur;
+		c->cur += c->slot_size;
+	}
+	memset(n, 0, c->slot_size);
+	return n;
+}
+
+static void
+bpt_slab_free(bpt_allocator* a, void* n, int type)
+{
+	struct bpt_slab_allocator* sa = (struct bpt_slab_allocator*) a;
+	struct bpt_slab_class* c = &sa->cls[type];
+
+	*(void**) n = c->free_list;
+	c->free_list = n;
+}
+
+static void
+bpt_slab_destroy(bpt_allocator* a)
+{
+	struct bpt_slab_allocator* sa = (struct bpt_slab_allocator*) a;
+	struct bpt_slab* s = sa->slabs;
+
+	while(s){
+		struct bpt_slab* next = s->next;
+		if(s->mapped)
+			munmap(s, BPT_SLAB_BYTES);
+		else free(s);
+		s = next;
+	}
+	free(sa);
+}
+
+bpt_allocator*
+bpt_slab_allocator_create(int flags)
+{
+	struct bpt_slab_allocator* sa =
+		my_calloc(sizeof(struct bpt_slab_allocator));
+
+	assert(BPT_SLAB_HDR_BYTES + BPT_LEAF_NODE_SIZE <= BPT_SLAB_BYTES
+		&& BPT_SLAB_HDR_BYTES + BPT_INDEX_NODE_SIZE <= BPT_SLAB_BYTES);
+
+	sa->base.alloc = bpt_slab_alloc;
+	sa->base.free = bpt_slab_free;
+	sa->base.destroy = bpt_slab_destroy;
+	sa->flags = flags;
+	sa->cls[LEAF].slot_size = BPT_LEAF_NODE_SIZE;
+	sa->cls[INDEX].slot_size = BPT_INDEX_NODE_SIZE;
+	return &sa->base;
+}
@@ -0,0 +1,46 @@
+/* Copyright(c) Brayden Zhang
+ * Mail: pczhang2010@gmail.com
+ */
+
+#ifndef _BPT_ALLOC_H
+#define _BPT_ALLOC_H
+
+/* Node allocator of the B-Plus-Tree. Each tree allocates its nodes from one
+ * allocator, given to bpt_init_alloc(); bpt_init() uses the calloc allocator.
+ */
+typedef struct __bpt_allocator bpt_allocator;
+struct __bpt_allocator
+{
+	/* Return zeroed memory for a node of the type, aligned to
+	 * BPT_NODE_ALIGN.
+	 */
+	void* (*alloc) (bpt_allocator* a, int type);
+
+	/* Give back the memory of a node of the type */
+	void (*free) (bpt_allocator* a, void* n, int type);
+
+	/* Release all the memory of the allocator, and the allocator itself,
+	 * without freeing the nodes one by one. NULL if the allocator can not
+	 * do it, then the nodes are freed one by one.
+	 */
+	void (*destroy) (bpt_allocator* a);
+};
+
+/* Allocator with one my_aligned_calloc/free call per node. Shared by all the
+ * trees using it.
+ */
+extern bpt_allocator bpt_calloc_allocator;
+
+/* Flags of bpt_slab_allocator_create */
+#define BPT_SLAB_HUGEPAGE 0x1   /* Back the slabs by huge pages if possible */
+
+/* Size of one slab. Also the size of a huge page on x86-64. */
+#define BPT_SLAB_BYTES (2 * 1024 * 1024)
+
+/* Create an allocator which carves node slots out of big slabs, and recycles
+ * the freed nodes by free lists. It should be used by only one tree; destroy
+ * of the tree releases all the slabs at once.
+ */
+bpt_allocator* bpt_slab_allocator_create (int flags);
+
+#endif /* end of _BPT_ALLOC_H */
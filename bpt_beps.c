@@ -0,0 +1,611 @@
+/* Copyright(c) Brayden Zhang
+ * Mail: pczhang2010@gmail.com
+ */
+#include <assert.h>
+
+#include "bpt_beps.h"
+
+/* Buffer of index node n, NULL if it has none and create is 0 */
+static struct bpt_msgbuf*
+bpt_beps_buf(bpt_node* n, int create)
+{
+	struct bpt_msgbuf* buf = (struct bpt_msgbuf*) n->version;
+	if(buf == NULL && create){
+		buf = (struct bpt_msgbuf*) my_calloc(
+				sizeof(struct bpt_msgbuf));
+		n->version = (unsigned long) buf;
+	}
+	return buf;
+}
+
+static void*
+bpt_beps_realloc(void* p, long size)
+{
+	p = realloc(p, size);
+	if(p == NULL){
+		fprintf(stderr, "Memory allocation failed\n");
+		exit(-1);
+	}
+	return p;
+}
+
+static int
+bpt_msg_cmp(const void* a, const void* b)
+{
+	const struct bpt_msg* x = (const struct bpt_msg*) a;
+	const struct bpt_msg* y = (const struct bpt_msg*) b;
+	if(x->k != y->k)
+		return x->k < y->k ? -1 : 1;
+	return x->seq < y->seq ? -1 : x->seq > y->seq;
+}
+
+static void bpt_beps_sort (struct bpt_msgbuf* buf);
+
+/* Index of the first message of buf whose key >= k */
+static int
+bpt_beps_lower(struct bpt_msgbuf* buf, bpt_key_t k)
+{
+	int a = 0, b;
+
+	if(buf == NULL)
+		return 0;
+	bpt_beps_sort(buf);
+	b = buf->n;
+	while(a < b){
+		int mid = (a + b) / 2;
+		if(buf->m[mid].k < k)
+			a = mid + 1;
+		else b = mid;
+	}
+	return a;
+}
+
+/* Merge the n sorted messages m into buf. From the last one back, each one
+ * goes after the messages of buf which are before it, which move together.
+ */
+static void
+bpt_beps_merge(struct bpt_msgbuf* buf, struct bpt_msg* m, int n)
+{
+	int i, j;
+
+	bpt_beps_sort(buf);
+	i = buf->n;
+	if(buf->n + n > buf->cap){
+		buf->cap = 2 * buf->cap;
+		if(buf->cap < buf->n + n)
+			buf->cap = buf->n + n;
+		buf->m = (struct bpt_msg*) bpt_beps_realloc(buf->m,
+				buf->cap * sizeof(struct bpt_msg));
+	}
+	for(j = n - 1; j >= 0; j--){
+		/* The first of buf[0, i) after m[j] */
+		int a = 0, b = i;
+		while(a < b){
+			int mid = (a + b) / 2;
+			if(bpt_msg_cmp(&buf->m[mid], &m[j]) < 0)
+				a = mid + 1;
+			else b = mid;
+		}
+		memmove(buf->m + a + j + 1, buf->m + a, 
+				(i - a) * sizeof(struct bpt_msg));
+		buf->m[a + j] = m[j];
+		i = a;
+	}
+	buf->n += n;
+	buf->sorted = buf->n;
+}
+
+/* Sort the appended messages of buf in */
+static void
+bpt_beps_sort(struct bpt_msgbuf* buf)
+{
+	struct bpt_msg* m;
+	int n = buf->n - buf->sorted;
+
+	if(n == 0)
+		return;
+	qsort(buf->m + buf->sorted, n, sizeof(struct bpt_msg), bpt_msg_cmp);
+	if(buf->sorted == 0){
+		buf->sorted = buf->n;
+		return;
+	}
+	m = (struct bpt_msg*) my_calloc(n * sizeof(struct bpt_msg));
+	memcpy(m, buf->m + buf->sorted, n * sizeof(struct bpt_msg));
+	buf->n = buf->sorted;
+	bpt_beps_merge(buf, m, n);
+	free(m);
+}
+
+/* Remove messages [a, e) of buf */
+static void
+bpt_beps_remove(struct bpt_msgbuf* buf, int a, int e)
+{
+	memmove(buf->m + a, buf->m + e, (buf->n - e) * sizeof(struct bpt_msg));
+	buf->n -= e - a;
+	buf->sorted = buf->n;
+}
+
+/* Move messages [a, e) of buf into the buffer of node to */
+static void
+bpt_beps_move(struct bpt_msgbuf* buf, int a, int e, bpt_node* to)
+{
+	if(e <= a)
+		return;
+	bpt_beps_merge(bpt_beps_buf(to, 1), buf->m + a, e - a);
+	bpt_beps_remove(buf, a, e);
+}
+
+/* Height of node n, 0 for a leaf */
+static int
+bpt_beps_height(bpt_node* n)
+{
+	int h = 0;
+	for(; ! bpt_is_leaf(n); h++)
+		n = n->recs.i_rec.c_arr[0];
+	return h;
+}
+
+static void*
+bpt_beps_alloc(bpt_allocator* a, int type)
+{
+	bpt_beps* b = (bpt_beps*) a;
+	if(type == INDEX)
+		b->index_smo++;
+	return bpt_calloc_allocator.alloc(&bpt_calloc_allocator, type);
+}
+
+/* The messages of a freed index node become orphans. Its first child is
+ * still in the tree(merges and the root removal copy the children), which
+ * gives the height of the node.
+ */
+static void
+bpt_beps_free(bpt_allocator* a, void* p, int type)
+{
+	bpt_beps* b = (bpt_beps*) a;
+	bpt_node* n = (bpt_node*) p;
+	struct bpt_msgbuf* buf;
+	int i;
+
+	if(type == INDEX){
+		b->index_smo++;
+		if((buf = bpt_beps_buf(n, 0)) != NULL){
+			int h = buf->n ? bpt_beps_height(n) : 0;
+			if(b->n_orphan + buf->n > b->cap_orphan){
+				b->cap_orphan = 2 * (b->n_orphan + buf->n);
+				b->orphan = (struct bpt_orphan*)
+					bpt_beps_realloc(b->orphan,
+					b->cap_orphan
+					* sizeof(struct bpt_orphan));
+			}
+			for(i = 0; i < buf->n; i++){
+				b->orphan[b->n_orphan].m = buf->m[i];
+				b->orphan[b->n_orphan++].h = h;
+			}
+			free(buf->m);
+			free(buf);
+		}
+	}
+	bpt_calloc_allocator.free(&bpt_calloc_allocator, n, type);
+}
+
+void
+bpt_beps_init(bpt_beps* b)
+{
+	b->base.alloc = bpt_beps_alloc;
+	b->base.free = bpt_beps_free;
+	b->base.destroy = NULL;
+	bpt_init_alloc(&b->t, &b->base);
+	b->buf_size = BPT_BEPS_BUF;
+	b->seq = 0;
+	b->index_smo = 0;
+	b->orphan = NULL;
+	b->n_orphan = 0;
+	b->cap_orphan = 0;
+	b->flushes = 0;
+	b->applied = 0;
+}
+
+/* Take the messages of the buffers under node n into the array *m of *n_m
+ * messages with room for *cap, and free the buffers.
+ */
+static void
+bpt_beps_drain(bpt_node* n, struct bpt_msg** m, long* n_m, long* cap)
+{
+	struct bpt_msgbuf* buf;
+	int i;
+
+	if(bpt_is_leaf(n))
+		return;
+	if((buf = bpt_beps_buf(n, 0)) != NULL){
+		if(buf->n > 0 && *n_m + buf->n > *cap){
+			*cap = 2 * (*n_m + buf->n);
+			*m = (struct bpt_msg*) bpt_beps_realloc(*m,
+					*cap * sizeof(struct bpt_msg));
+		}
+		if(buf->n > 0)
+			memcpy(*m + *n_m, buf->m,
+					buf->n * sizeof(struct bpt_msg));
+		*n_m += buf->n;
+		free(buf->m);
+		free(buf);
+		n->version = 0;
+	}
+	for(i = 0; i < n->num_of_rec; i++)
+		bpt_beps_drain(n->recs.i_rec.c_arr[i], m, n_m, cap);
+}
+
+void
+bpt_beps_destroy(bpt_beps* b)
+{
+	struct bpt_msg* m = NULL;
+	long n_m = 0, cap = 0;
+
+	if(! bpt_empty(&b->t))
+		bpt_beps_drain(b->t.root, &m, &n_m, &cap);
+	free(m);
+	free(b->orphan);
+	bpt_destroy(&b->t);
+}
+
+/* Get the lower bound of the keys in the subtree of path->node[lv], see
+ * bpt_path_high. Return 0 if there is no bound.
+ */
+static int
+bpt_beps_path_low(bpt_path* path, int lv, bpt_key_t* lo)
+{
+	int a;
+	for(a = lv - 1; a >= 0; a--)
+		if(path->slot[a + 1] > 0){
+			bpt_node* n = path->node[a];
+			*lo = n->recs.i_rec.key[path->slot[a + 1] - 1];
+			return 1;
+		}
+	return 0;
+}
+
+static void bpt_beps_apply (bpt_beps* b, struct bpt_msg* m);
+
+/* After the tree changed index nodes while a message was applied to key k:
+ * the splits, merges and borrows on the path of k moved keys between the
+ * nodes of the path and their neighbors, so move the messages of those keys
+ * the same way. Then put the orphans into the nodes of their keys at their
+ * heights, or the root if it is lower now.
+ */
+static void
+bpt_beps_settle(bpt_beps* b, bpt_key_t k)
+{
+	bptree* t = &b->t;
+	struct bpt_orphan* o = b->orphan;
+	long n_o = b->n_orphan, i;
+	bpt_path p, q;
+	int lv, d;
+
+	if(! bpt_is_leaf(t->root)){
+		bpt_query_path(t, k, &p);
+		for(lv = 1; lv < p.depth - 1; lv++)
+		for(d = -1; d <= 1; d += 2){
+			struct bpt_msgbuf* x = bpt_beps_buf(p.node[lv], 1);
+			struct bpt_msgbuf* y;
+			bpt_node* n1;
+			bpt_key_t bound;
+
+			q = p;
+			q.depth = lv + 1;
+			if((n1 = bpt_path_step_leaf(&q, d)) == NULL)
+				continue;
+			y = bpt_beps_buf(n1, 1);
+			if(d > 0){
+				bpt_path_high(&p, lv, &bound);
+				bpt_beps_move(x, bpt_beps_lower(x, bound),
+						x->n, n1);
+				bpt_beps_move(y, 0, bpt_beps_lower(y, bound),
+						p.node[lv]);
+			}else{
+				bpt_beps_path_low(&p, lv, &bound);
+				bpt_beps_move(x, 0, bpt_beps_lower(x, bound),
+						n1);
+				bpt_beps_move(y, bpt_beps_lower(y, bound),
+						y->n, p.node[lv]);
+			}
+		}
+	}
+
+	/* In the order of the messages, a message applied to a leaf may
+	 * free more nodes.
+	 */
+	b->orphan = NULL;
+	b->n_orphan = 0;
+	b->cap_orphan = 0;
+	if(n_o > 0)
+		qsort(o, n_o, sizeof(struct bpt_orphan), bpt_msg_cmp);
+	for(i = 0; i < n_o; i++){
+		bpt_node* n = t->root;
+		int h = bpt_beps_height(n);
+		if(h == 0){
+			bpt_beps_apply(b, &o[i].m);
+			continue;
+		}
+		for(; h > o[i].h; h--)
+			n = n->recs.i_rec.c_arr[
+				bpt_child_ind(t, n, o[i].m.k)];
+		bpt_beps_merge(bpt_beps_buf(n, 1), &o[i].m, 1);
+	}
+	free(o);
+}
+
+/* Apply message m to its leaf. The messages of its key in the buffers
+ * should be newer.
+ */
+static void
+bpt_beps_apply(bpt_beps* b, struct bpt_msg* m)
+{
+	bptree* t = &b->t;
+	long smo = b->index_smo + t->smo.merges;
+	int type = m->seq & 3, ind;
+	bpt_path path;
+	bpt_node* l;
+
+	b->applied++;
+	if(bpt_empty(t)){
+		if(type == BPT_MSG_DELETE)
+			return;
+		bpt_init_root(t);
+	}
+	l = bpt_query_path(t, m->k, &path);
+	ind = get_1st_ge_key(l->recs.l_rec.key, l->num_of_rec, m->k);
+	if(ind < l->num_of_rec && l->recs.l_rec.key[ind] == m->k){
+		if(type == BPT_MSG_UPSERT)
+			bpt_value_set(&l->recs.l_rec.r_arr[ind], m->v);
+		else if(type == BPT_MSG_DELETE){
+			bpt_path_count(&path, -1);
+			bpt_delete_entry(t, &path, path.depth - 1, ind);
+		}
+	}else if(type != BPT_MSG_DELETE){
+		bpt_path_count(&path, 1);
+		if(! bpt_is_full(l))
+			bpt_insert_in_leaf(l, m->k, m->v);
+		else bpt_split_leaf(t, &path, m->k, m->v);
+	}
+	/* Index nodes change only along with merges, or they are allocated
+	 * or freed.
+	 */
+	if(b->index_smo + t->smo.merges != smo)
+		bpt_beps_settle(b, m->k);
+}
+
+/* Make room in the buffer of the root: move its messages for the child with
+ * the most of them into the buffer of the child, if they fit; otherwise make
+ * room in the child the same way first. A batch for a leaf is applied.
+ */
+static void
+bpt_beps_flush(bpt_beps* b)
+{
+	bpt_node* n = b->t.root;
+	struct bpt_msgbuf* buf;
+	struct bpt_msg* run;
+	int i, a, e, prev, best;
+
+	for(;;){
+		struct bpt_msgbuf* cb;
+		bpt_node* c;
+
+		buf = bpt_beps_buf(n, 1);
+		bpt_beps_sort(buf);
+		a = e = prev = best = 0;
+		for(i = 0; i < n->num_of_rec; i++){
+			int end = i < bpt_num_of_key(n) ? bpt_beps_lower(buf,
+					n->recs.i_rec.key[i]) : buf->n;
+			if(end - prev > e - a){
+				a = prev;
+				e = end;
+				best = i;
+			}
+			prev = end;
+		}
+		c = n->recs.i_rec.c_arr[best];
+		if(bpt_is_leaf(c))
+			break;
+		cb = bpt_beps_buf(c, 1);
+		if(cb->n == 0 || cb->n + e - a <= b->buf_size){
+			bpt_beps_move(buf, a, e, c);
+			b->flushes++;
+			return;
+		}
+		n = c;
+	}
+
+	/* Out of the buffer first, applying may change the tree */
+	run = (struct bpt_msg*) my_calloc((e - a) * sizeof(struct bpt_msg) + 1);
+	memcpy(run, buf->m + a, (e - a) * sizeof(struct bpt_msg));
+	bpt_beps_remove(buf, a, e);
+	b->flushes++;
+	for(i = 0; i < e - a; i++)
+		bpt_beps_apply(b, &run[i]);
+	free(run);
+}
+
+static void
+bpt_beps_put(bpt_beps* b, bpt_key_t k, bpt_record_t* v, int type)
+{
+	struct bpt_msg m = {k, v, b->seq++ << 2 | type};
+	bptree* t = &b->t;
+	struct bpt_msgbuf* buf;
+
+	while(! bpt_empty(t) && ! bpt_is_leaf(t->root)){
+		buf = bpt_beps_buf(t->root, 1);
+		if(buf->n < b->buf_size){
+			if(buf->n == buf->cap){
+				buf->cap = buf->cap ? 2 * buf->cap : 16;
+				buf->m = (struct bpt_msg*) bpt_beps_realloc(
+						buf->m, buf->cap
+						* sizeof(struct bpt_msg));
+			}
+			buf->m[buf->n++] = m;
+			return;
+		}
+		bpt_beps_flush(b);
+	}
+	/* No buffers in a tree of one leaf */
+	bpt_beps_apply(b, &m);
+}
+
+void
+bpt_beps_insert(bpt_beps* b, bpt_key_t k, bpt_record_t* v)
+{
+	bpt_beps_put(b, k, v, BPT_MSG_INSERT);
+}
+
+void
+bpt_beps_upsert(bpt_beps* b, bpt_key_t k, bpt_record_t* v)
+{
+	bpt_beps_put(b, k, v, BPT_MSG_UPSERT);
+}
+
+void
+bpt_beps_delete(bpt_beps* b, bpt_key_t k)
+{
+	bpt_beps_put(b, k, NULL, BPT_MSG_DELETE);
+}
+
+/* Apply message m to the record *r of a key, which is there if *present */
+static void
+bpt_beps_resolve(struct bpt_msg* m, int* present, bpt_record_t** r)
+{
+	switch(m->seq & 3){
+	case BPT_MSG_INSERT:
+		if(! *present)
+			*r = m->v;
+		*present = 1;
+		break;
+	case BPT_MSG_UPSERT:
+		*r = m->v;
+		*present = 1;
+		break;
+	default:
+		*present = 0;
+	}
+}
+
+bpt_record_t*
+bpt_beps_get(bpt_beps* b, bpt_key_t k)
+{
+	struct bpt_msg* run[BPT_MAX_HEIGHT];
+	int len[BPT_MAX_HEIGHT], lv = 0, present = 0, ind;
+	bpt_node* n = b->t.root;
+	bpt_record_t* r = NULL;
+
+	if(n == NULL)
+		return NULL;
+	/* The messages of k on the way down, the upper ones are newer */
+	while(! bpt_is_leaf(n)){
+		struct bpt_msgbuf* buf = bpt_beps_buf(n, 0);
+		int a = bpt_beps_lower(buf, k), e = a;
+		while(buf && e < buf->n && buf->m[e].k == k)
+			e++;
+		if(e > a){
+			run[lv] = buf->m + a;
+			len[lv++] = e - a;
+		}
+		n = n->recs.i_rec.c_arr[bpt_child_ind(&b->t, n, k)];
+	}
+	ind = get_1st_ge_key(n->recs.l_rec.key, n->num_of_rec, k);
+	if(ind < n->num_of_rec && n->recs.l_rec.key[ind] == k){
+		r = bpt_value_rec(&n->recs.l_rec.r_arr[ind]);
+		present = 1;
+	}
+	while(lv-- > 0)
+		for(ind = 0; ind < len[lv]; ind++)
+			bpt_beps_resolve(&run[lv][ind], &present, &r);
+	return present ? r : NULL;
+}
+
+/* Add the messages with keys in [lo, hi) of the buffers under node n to the
+ * array *m, as bpt_beps_drain.
+ */
+static void
+bpt_beps_collect(bpt_node* n, bpt_key_t lo, bpt_key_t hi, struct bpt_msg** m,
+		long* n_m, long* cap)
+{
+	struct bpt_msgbuf* buf;
+	bpt_key_t* key = n->recs.i_rec.key;
+	int i, a, e;
+
+	if(bpt_is_leaf(n))
+		return;
+	if((buf = bpt_beps_buf(n, 0)) != NULL
+			&& (e = bpt_beps_lower(buf, hi))
+				> (a = bpt_beps_lower(buf, lo))){
+		if(*n_m + e - a > *cap){
+			*cap = 2 * (*n_m + e - a);
+			*m = (struct bpt_msg*) bpt_beps_realloc(*m,
+					*cap * sizeof(struct bpt_msg));
+		}
+		memcpy(*m + *n_m, buf->m + a, (e - a) * sizeof(struct bpt_msg));
+		*n_m += e - a;
+	}
+	/* Child i holds the keys in [key[i - 1], key[i]) */
+	for(i = 0; i < n->num_of_rec; i++)
+		if((i == 0 || key[i - 1] < hi)
+				&& (i == bpt_num_of_key(n) || key[i] > lo))
+			bpt_beps_collect(n->recs.i_rec.c_arr[i], lo, hi, m, n_m,
+					cap);
+}
+
+long
+bpt_beps_scan(bpt_beps* b, bpt_key_t lo, bpt_key_t hi, bpt_beps_scan_fn fn,
+		void* arg)
+{
+	struct bpt_msg* m = NULL;
+	long n_m = 0, cap = 0, i = 0, cnt = 0;
+	bpt_cursor c;
+
+	if(bpt_empty(&b->t) || hi <= lo)
+		return 0;
+	bpt_beps_collect(b->t.root, lo, hi, &m, &n_m, &cap);
+	if(n_m > 0)
+		qsort(m, n_m, sizeof(struct bpt_msg), bpt_msg_cmp);
+
+	/* Merge the records with the messages, key by key */
+	bpt_cursor_seek(&b->t, &c, lo);
+	bpt_cursor_set_end(&c, hi);
+	for(;;){
+		int leaf = bpt_cursor_valid(&c), present = 0;
+		bpt_record_t* r = NULL;
+		bpt_key_t k;
+
+		if(! leaf && i == n_m)
+			break;
+		k = i == n_m || (leaf && bpt_cursor_key(&c) < m[i].k)
+			? bpt_cursor_key(&c) : m[i].k;
+		if(leaf && bpt_cursor_key(&c) == k){
+			r = bpt_cursor_record(&c);
+			present = 1;
+			bpt_cursor_next(&c);
+		}
+		for(; i < n_m && m[i].k == k; i++)
+			bpt_beps_resolve(&m[i], &present, &r);
+		if(present){
+			fn(arg, k, r);
+			cnt++;
+		}
+	}
+	free(m);
+	return cnt;
+}
+
+void
+bpt_beps_sync(bpt_beps* b)
+{
+	struct bpt_msg* m = NULL;
+	long n_m = 0, cap = 0, i;
+
+	if(bpt_empty(&b->t))
+		return;
+	bpt_beps_drain(b->t.root, &m, &n_m, &cap);
+	/* In key order, the messages of a key oldest first */
+	if(n_m > 0)
+		qsort(m, n_m, sizeof(struct bpt_msg), bpt_msg_cmp);
+	for(i = 0; i < n_m; i++)
+		bpt_beps_apply(b, &m[i]);
+	free(m);
+}
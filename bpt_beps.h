@@ -0,0 +1,129 @@
+/* Copyright(c) Brayden Zhang
+ * Mail: pczhang2010@gmail.com
+ */
+
+#ifndef _BPT_BEPS_H
+#define _BPT_BEPS_H
+
+#include "bptree.h"
+
+/* Write-optimized B-Plus-Tree(a B-epsilon tree): each index node keeps a
+ * buffer of pending messages, inserts, upserts and deletes, for the keys of
+ * its subtree. A write only adds its message to the buffer of the root. When
+ * a buffer fills, the messages for the child which has the most of them move
+ * down into the buffer of the child together, and the messages reaching a
+ * leaf are applied to it in a batch. So a leaf is touched once per batch
+ * instead of once per write. Gets and scans apply the messages on their way
+ * to the records.
+ *
+ * The buffer of an index node is held by its version field. Messages carry a
+ * sequence number, and those of a key in upper nodes are always newer than
+ * those below. The leaf batches change the tree by the code of bptree.c;
+ * when that splits, merges or rebalances index nodes, the messages follow the
+ * keys to their new nodes at the same level.
+ *
+ * The keys are unique: an insert keeps the record of a key which is there
+ * already, an upsert replaces it. The records are kept by pointers until
+ * their messages reach the leaves, so with inline values(BPT_VALUE_BYTES)
+ * they should stay valid until then. Not thread-safe.
+ */
+
+/* Number of messages of a buffer which make it full, by default */
+#ifndef BPT_BEPS_BUF
+#define BPT_BEPS_BUF 256
+#endif
+
+/* Types of the messages, in the two low bits of their sequence numbers */
+enum
+{
+	BPT_MSG_INSERT,
+	BPT_MSG_UPSERT,
+	BPT_MSG_DELETE
+};
+
+struct bpt_msg
+{
+	bpt_key_t k;
+	bpt_record_t* v;
+	unsigned long seq;
+};
+
+/* Buffer of an index node, sorted by key, then sequence number; except the
+ * messages after the first 'sorted' ones, which writes append to the buffer
+ * of the root. They are sorted in when the buffer is read.
+ */
+struct bpt_msgbuf
+{
+	int n;
+	int sorted;
+	int cap;
+	struct bpt_msg* m;
+};
+
+/* A message of a freed index node, and the height of the node(1 for the
+ * parents of leaves)
+ */
+struct bpt_orphan
+{
+	struct bpt_msg m;
+	int h;
+};
+
+typedef struct __bpt_beps bpt_beps;
+struct __bpt_beps
+{
+	/* Allocator of the tree, it hands the buffers of the index nodes
+	 * freed by the tree to their neighbors. Must be the first member.
+	 */
+	bpt_allocator base;
+
+	bptree t;
+
+	/* Number of messages which make a buffer full, BPT_BEPS_BUF by
+	 * default. It may be changed at any time.
+	 */
+	int buf_size;
+
+	/* Sequence number of the next message */
+	unsigned long seq;
+
+	/* Index nodes allocated and freed, to tell when the tree changed
+	 * them.
+	 */
+	long index_smo;
+
+	/* Messages of the freed index nodes, until they are placed again */
+	struct bpt_orphan* orphan;
+	long n_orphan;
+	long cap_orphan;
+
+	/* Counters: batches moved down, and messages applied to leaves */
+	long flushes;
+	long applied;
+};
+
+/* Functions of the buffered tree, implemented in bpt_beps.c. b must not be
+ * moved after bpt_beps_init.
+ */
+void bpt_beps_init (bpt_beps* b);
+void bpt_beps_destroy (bpt_beps* b);
+void bpt_beps_insert (bpt_beps* b, bpt_key_t k, bpt_record_t* v);
+void bpt_beps_upsert (bpt_beps* b, bpt_key_t k, bpt_record_t* v);
+void bpt_beps_delete (bpt_beps* b, bpt_key_t k);
+
+/* Get the record of k, NULL if not found */
+bpt_record_t* bpt_beps_get (bpt_beps* b, bpt_key_t k);
+
+/* Call fn on the records with keys in [lo, hi) in key order, and return
+ * their number.
+ */
+typedef void (*bpt_beps_scan_fn) (void* arg, bpt_key_t k, bpt_record_t* v);
+long bpt_beps_scan (bpt_beps* b, bpt_key_t lo, bpt_key_t hi,
+		bpt_beps_scan_fn fn, void* arg);
+
+/* Apply all the messages to the leaves, then b->t is a plain tree of the
+ * records.
+ */
+void bpt_beps_sync (bpt_beps* b);
+
+#endif /* end of _BPT_BEPS_H */
@@ -0,0 +1,311 @@
+/* Copyright(c) Brayden Zhang
+ * Mail: pczhang2010@gmail.com
+ */
+#include <assert.h>
+
+#include "bpt_cow.h"
+
+/* If node n is used by the newest snapshot, so it must not be changed */
+static int
+bpt_cow_frozen(bpt_cow* c, bpt_node* n)
+{
+	return c->newest && n->version <= c->newest->gen;
+}
+
+/* Add node n to the garbage of snapshot s */
+static void
+bpt_snap_add_garbage(bpt_snap* s, bpt_node* n)
+{
+	if(s->n_garbage == s->cap_garbage){
+		s->cap_garbage = s->cap_garbage ? s->cap_garbage * 2 : 64;
+		s->garbage = (bpt_node**) realloc(s->garbage,
+				s->cap_garbage * sizeof(bpt_node*));
+		if(s->garbage == NULL){
+			fprintf(stderr, "Memory allocation failed\n");
+			exit(-1);
+		}
+	}
+	s->garbage[s->n_garbage++] = n;
+}
+
+static void*
+bpt_cow_alloc(bpt_allocator* a, int type)
+{
+	bpt_cow* c = (bpt_cow*) a;
+	bpt_node* n = (bpt_node*) bpt_calloc_allocator.alloc(
+			&bpt_calloc_allocator, type);
+	n->version = c->gen;
+	return n;
+}
+
+/* A frozen node is freed when no snapshot uses it */
+static void
+bpt_cow_free(bpt_allocator* a, void* n, int type)
+{
+	bpt_cow* c = (bpt_cow*) a;
+	if(bpt_cow_frozen(c, (bpt_node*) n))
+		bpt_snap_add_garbage(c->newest, (bpt_node*) n);
+	else bpt_calloc_allocator.free(&bpt_calloc_allocator, n, type);
+}
+
+void
+bpt_cow_init(bpt_cow* c)
+{
+	c->base.alloc = bpt_cow_alloc;
+	c->base.free = bpt_cow_free;
+	c->base.destroy = NULL;
+	bpt_init_alloc(&c->t, &c->base);
+	pthread_mutex_init(&c->lock, NULL);
+	c->gen = 1;
+	c->dirty = 0;
+	c->oldest = NULL;
+	c->newest = NULL;
+	c->copies = 0;
+	c->reclaimed = 0;
+}
+
+void
+bpt_cow_destroy(bpt_cow* c)
+{
+	assert(c->oldest == NULL);
+	bpt_destroy(&c->t);
+	pthread_mutex_destroy(&c->lock);
+}
+
+/* Return node n if it may be changed, or a copy of it which takes its place
+ * in the tree(and in the list of leaves), except in its parent, which the
+ * caller updates.
+ */
+static bpt_node*
+bpt_cow_own(bpt_cow* c, bpt_node* n)
+{
+	bpt_node* n1;
+
+	if(! bpt_cow_frozen(c, n))
+		return n;
+	n1 = (bpt_node*) c->base.alloc(&c->base, n->t);
+	if(bpt_is_leaf(n)){
+		memcpy(n1, n, BPT_LEAF_NODE_SIZE);
+		TAILQ_INSERT_AFTER(&c->t.rec_list_head, n, n1, recs.l_rec.n);
+		TAILQ_REMOVE(&c->t.rec_list_head, n, recs.l_rec.n);
+	}else memcpy(n1, n, BPT_INDEX_NODE_SIZE);
+	n1->version = c->gen;
+	bpt_snap_add_garbage(c->newest, n);
+	c->copies++;
+	return n1;
+}
+
+/* Make the nodes of the path changeable, from the root down */
+static void
+bpt_cow_own_path(bpt_cow* c, bpt_path* path)
+{
+	int lv;
+	for(lv = 0; lv < path->depth; lv++){
+		bpt_node* n = bpt_cow_own(c, path->node[lv]);
+		if(n == path->node[lv])
+			continue;
+		if(lv == 0)
+			c->t.root = n;
+		else path->node[lv - 1]->recs.i_rec.c_arr[path->slot[lv]] = n;
+		path->node[lv] = n;
+	}
+}
+
+void
+bpt_cow_insert(bpt_cow* c, bpt_key_t k, bpt_record_t* v)
+{
+	bpt_path path;
+
+	pthread_mutex_lock(&c->lock);
+	c->dirty = 1;
+	if(bpt_empty(&c->t))
+		bpt_init_root(&c->t);
+	bpt_query_path(&c->t, k, &path);
+	bpt_cow_own_path(c, &path);
+	bpt_path_count(&path, 1);
+	if(! bpt_is_full(path.node[path.depth - 1]))
+		bpt_insert_in_leaf(path.node[path.depth - 1], k, v);
+	else bpt_split_leaf(&c->t, &path, k, v);
+	pthread_mutex_unlock(&c->lock);
+}
+
+void
+bpt_cow_delete(bpt_cow* c, bpt_key_t k, bpt_record_t* v)
+{
+	bpt_path path;
+	int lv;
+
+	pthread_mutex_lock(&c->lock);
+	c->dirty = 1;
+	bpt_query_path(&c->t, k, &path);
+	int ind = bpt_locate_in_path(&path, k, v);
+	bpt_cow_own_path(c, &path);
+
+	/* Going up while the node would merge, its sibling changes too, as
+	 * the nodes locked by bpt_olc_delete_smo.
+	 */
+	for(lv = path.depth - 1; lv > 0; lv--){
+		bpt_node* n = path.node[lv];
+		bpt_node* p = path.node[lv - 1];
+		bpt_node* n1;
+		bpt_key_t split_key;
+
+		if(n->num_of_rec - 1 >= bpt_underflow_min(&c->t, n))
+			break;
+		int i = bpt_get_close_sibling(&path, lv, &n1, &split_key);
+		n1 = p->recs.i_rec.c_arr[i] = bpt_cow_own(c, n1);
+		if(n->num_of_rec - 1 + n1->num_of_rec > bpt_max_rec(n))
+			break;
+	}
+	bpt_path_count(&path, -1);
+	bpt_delete_entry(&c->t, &path, path.depth - 1, ind);
+	pthread_mutex_unlock(&c->lock);
+}
+
+bpt_snap*
+bpt_snapshot(bpt_cow* c)
+{
+	bpt_snap* s;
+
+	pthread_mutex_lock(&c->lock);
+	if(c->newest && ! c->dirty){
+		s = c->newest;
+		s->refs++;
+		pthread_mutex_unlock(&c->lock);
+		return s;
+	}
+	s = (bpt_snap*) my_calloc(sizeof(bpt_snap));
+	s->root = c->t.root;
+	s->gen = c->gen++;
+	s->refs = 1;
+	s->older = c->newest;
+	if(c->newest)
+		c->newest->newer = s;
+	else c->oldest = s;
+	c->newest = s;
+	c->dirty = 0;
+	pthread_mutex_unlock(&c->lock);
+	return s;
+}
+
+void
+bpt_snapshot_release(bpt_cow* c, bpt_snap* s)
+{
+	long i;
+
+	pthread_mutex_lock(&c->lock);
+	if(--s->refs > 0){
+		pthread_mutex_unlock(&c->lock);
+		return;
+	}
+
+	/* The garbage is used by the older versions only, if by any */
+	for(i = 0; i < s->n_garbage; i++){
+		bpt_node* n = s->garbage[i];
+		if(s->older && n->version <= s->older->gen)
+			bpt_snap_add_garbage(s->older, n);
+		else{
+			bpt_calloc_allocator.free(&bpt_calloc_allocator, n,
+					n->t);
+			c->reclaimed++;
+		}
+	}
+	free(s->garbage);
+
+	if(s->older)
+		s->older->newer = s->newer;
+	else c->oldest = s->newer;
+	if(s->newer)
+		s->newer->older = s->older;
+	else{
+		/* The nodes of the older version become frozen instead */
+		c->newest = s->older;
+		c->dirty = 1;
+	}
+	free(s);
+	pthread_mutex_unlock(&c->lock);
+}
+
+/* Go down from the root of s to the first record whose key >= k, as
+ * bpt_query_lower.
+ */
+void
+bpt_snap_cursor_seek(bpt_snap* s, bpt_snap_cursor* c, bpt_key_t k)
+{
+	bpt_path* path = &c->path;
+	bpt_node* n = s->root;
+
+	c->has_end = 0;
+	path->depth = 0;
+	if(n == NULL)
+		return;
+	path->node[path->depth++] = n;
+	while(! bpt_is_leaf(n)){
+		int ind = get_1st_ge_key(n->recs.i_rec.key,
+			bpt_num_of_key(n), k);
+		n = n->recs.i_rec.c_arr[ind];
+		path->slot[path->depth] = ind;
+		path->node[path->depth++] = n;
+	}
+	c->ind = get_1st_ge_key(n->recs.l_rec.key, n->num_of_rec, k) - 1;
+	bpt_snap_cursor_next(c);
+}
+
+void
+bpt_snap_cursor_set_end(bpt_snap_cursor* c, bpt_key_t end)
+{
+	c->has_end = 1;
+	c->end = end;
+}
+
+int
+bpt_snap_cursor_valid(bpt_snap_cursor* c)
+{
+	if(c->path.depth == 0)
+		return 0;
+	return ! c->has_end || bpt_snap_cursor_key(c) < c->end;
+}
+
+bpt_key_t
+bpt_snap_cursor_key(bpt_snap_cursor* c)
+{
+	assert(c->path.depth > 0);
+	return c->path.node[c->path.depth - 1]->recs.l_rec.key[c->ind];
+}
+
+bpt_record_t*
+bpt_snap_cursor_record(bpt_snap_cursor* c)
+{
+	assert(bpt_snap_cursor_valid(c));
+	return bpt_value_rec(
+		&c->path.node[c->path.depth - 1]->recs.l_rec.r_arr[c->ind]);
+}
+
+/* Move the cursor to the next record, by the path to the next leaf */
+void
+bpt_snap_cursor_next(bpt_snap_cursor* c)
+{
+	bpt_node* l = c->path.node[c->path.depth - 1];
+
+	assert(c->path.depth > 0);
+	c->ind++;
+	while(c->ind >= l->num_of_rec){
+		l = bpt_path_step_leaf(&c->path, 1);
+		c->ind = 0;
+		if(l == NULL){
+			c->path.depth = 0;
+			return;
+		}
+	}
+}
+
+bpt_record_t*
+bpt_snap_get(bpt_snap* s, bpt_key_t k)
+{
+	bpt_snap_cursor c;
+
+	bpt_snap_cursor_seek(s, &c, k);
+	if(bpt_snap_cursor_valid(&c) && bpt_snap_cursor_key(&c) == k)
+		return bpt_snap_cursor_record(&c);
+	return NULL;
+}
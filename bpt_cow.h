@@ -0,0 +1,132 @@
+/* Copyright(c) Brayden Zhang
+ * Mail: pczhang2010@gmail.com
+ */
+
+#ifndef _BPT_COW_H
+#define _BPT_COW_H
+
+#include <pthread.h>
+
+#include "bptree.h"
+
+/* Copy-on-write B-Plus-Tree with snapshots. Readers take a snapshot, a root
+ * which does not change, and query and scan it without locks while writers
+ * go on; writers are never blocked for the length of a scan.
+ *
+ * Each node keeps the generation in which it was created, in its version
+ * field. A snapshot freezes the current root and starts a new generation. A
+ * writer copies each frozen node it would change, from the root down to the
+ * leaf(and the siblings a delete merges with or borrows from), and links the
+ * copy in place of the node in the current tree; the nodes of the current
+ * generation are changed in place. So without snapshots, a write costs the
+ * same as in a plain tree, and with them each node is copied once per
+ * snapshot at most.
+ *
+ * A node which is replaced or freed while it is frozen goes to the garbage of
+ * the newest snapshot, which is the last version that uses it. When a
+ * snapshot is released, the nodes of its garbage that no older snapshot uses
+ * are freed, the others move to the garbage of the older snapshot.
+ *
+ * Writers, and the taking and releasing of snapshots, are serialized by a
+ * mutex. The leaf links of a snapshot are not kept, its cursor moves by the
+ * path from the root.
+ */
+
+/* A version of the tree, held by the readers of its snapshots */
+typedef struct __bpt_snap bpt_snap;
+struct __bpt_snap
+{
+	/* Root of the version, NULL for an empty tree */
+	bpt_node* root;
+
+	/* Generation of the version: its nodes have generations <= gen */
+	unsigned long gen;
+
+	/* Number of readers holding the version */
+	long refs;
+
+	/* Older and newer versions still held */
+	bpt_snap* older;
+	bpt_snap* newer;
+
+	/* Nodes replaced while this was the newest version */
+	bpt_node** garbage;
+	long n_garbage;
+	long cap_garbage;
+};
+
+typedef struct __bpt_cow bpt_cow;
+struct __bpt_cow
+{
+	/* Allocator of the tree, it stamps the nodes with their generation
+	 * and keeps the frozen nodes freed by the tree. Must be the first
+	 * member.
+	 */
+	bpt_allocator base;
+
+	/* The current tree. Only the writers may use it, under the lock. */
+	bptree t;
+
+	pthread_mutex_t lock;
+
+	/* Generation of the nodes created now */
+	unsigned long gen;
+
+	/* Set when the tree is changed after the newest snapshot */
+	int dirty;
+
+	/* The oldest and the newest versions held, NULL if none */
+	bpt_snap* oldest;
+	bpt_snap* newest;
+
+	/* Counters: nodes copied by writers, and frozen nodes freed */
+	long copies;
+	long reclaimed;
+};
+
+/* Cursor of a snapshot. It keeps the path from the root to its leaf. */
+typedef struct __bpt_snap_cursor bpt_snap_cursor;
+struct __bpt_snap_cursor
+{
+	/* Path to the current leaf; depth is 0 if the cursor is out of the
+	 * tree.
+	 */
+	bpt_path path;
+
+	/* Index of current record in the leaf node */
+	int ind;
+
+	/* If has_end is set, the cursor stops before the first key >= end */
+	int has_end;
+	bpt_key_t end;
+};
+
+/* Functions of the copy-on-write tree, implemented in bpt_cow.c. c must not
+ * be moved after bpt_cow_init. All the snapshots should be released before
+ * bpt_cow_destroy.
+ */
+void bpt_cow_init (bpt_cow* c);
+void bpt_cow_destroy (bpt_cow* c);
+void bpt_cow_insert (bpt_cow* c, bpt_key_t k, bpt_record_t* v);
+
+/* As bpt_delete, the pair should be in the tree */
+void bpt_cow_delete (bpt_cow* c, bpt_key_t k, bpt_record_t* v);
+
+/* Take a snapshot of the current tree, which stays as it is until released.
+ * Snapshots taken with no write between them share one version.
+ */
+bpt_snap* bpt_snapshot (bpt_cow* c);
+void bpt_snapshot_release (bpt_cow* c, bpt_snap* s);
+
+/* Functions of a snapshot, without locks. With inline values the records
+ * point into the nodes of the snapshot, they are valid until it is released.
+ */
+bpt_record_t* bpt_snap_get (bpt_snap* s, bpt_key_t k);
+void bpt_snap_cursor_seek (bpt_snap* s, bpt_snap_cursor* c, bpt_key_t k);
+void bpt_snap_cursor_set_end (bpt_snap_cursor* c, bpt_key_t end);
+int bpt_snap_cursor_valid (bpt_snap_cursor* c);
+bpt_key_t bpt_snap_cursor_key (bpt_snap_cursor* c);
+bpt_record_t* bpt_snap_cursor_record (bpt_snap_cursor* c);
+void bpt_snap_cursor_next (bpt_snap_cursor* c);
+
+#endif /* end of _BPT_COW_H */
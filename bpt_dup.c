@@ -0,0 +1,246 @@
+/* Copyright(c) Brayden Zhang
+ * Mail: pczhang2010@gmail.com
+ */
+#include <assert.h>
+#include <stdint.h>
+
+#include "bpt_dup.h"
+
+/* Capacity of a new posting list, it is not shrunk below that */
+#define BPT_POSTING_MIN 4
+
+/* The posting list in the value slot of a key, NULL if the slot holds the
+ * only value of the key.
+ */
+static struct bpt_posting*
+bpt_dup_list(bpt_value* s)
+{
+#ifdef BPT_VALUE_BYTES
+	return (struct bpt_posting*) s->w[0];
+#else
+	uintptr_t p = (uintptr_t) *s;
+	return p & 1 ? (struct bpt_posting*) (p - 1) : NULL;
+#endif
+}
+
+/* Store posting list p in a value slot, tagged with the low bit */
+static void
+bpt_dup_set_list(bpt_value* s, struct bpt_posting* p)
+{
+#ifdef BPT_VALUE_BYTES
+	s->w[0] = (long) p;
+#else
+	*s = (bpt_record_t*) ((uintptr_t) p + 1);
+#endif
+}
+
+/* Order of the values in a posting list: by address for pointer records, by
+ * bytes for inline values.
+ */
+static int
+bpt_dup_cmp(bpt_value* a, bpt_value* b)
+{
+#ifdef BPT_VALUE_BYTES
+	return memcmp(a, b, sizeof(bpt_value));
+#else
+	uintptr_t x = (uintptr_t) *a, y = (uintptr_t) *b;
+	return x < y ? -1 : x > y;
+#endif
+}
+
+/* Resize posting list p(NULL for a new one) to cap values */
+static struct bpt_posting*
+bpt_posting_resize(struct bpt_posting* p, long cap)
+{
+	p = (struct bpt_posting*) realloc(p, sizeof(struct bpt_posting)
+			+ cap * sizeof(bpt_value));
+	if(p == NULL){
+		fprintf(stderr, "Memory allocation failed\n");
+		exit(-1);
+	}
+	p->cap = cap;
+	return p;
+}
+
+/* Return the index of the first value >= x in posting list p */
+static long
+bpt_posting_find(struct bpt_posting* p, bpt_value* x)
+{
+	long lo = 0, hi = p->n;
+	while(lo < hi){
+		long mid = (lo + hi) / 2;
+		if(bpt_dup_cmp(&p->v[mid], x) < 0)
+			lo = mid + 1;
+		else hi = mid;
+	}
+	return lo;
+}
+
+/* Move the only value in slot s into a new posting list */
+static struct bpt_posting*
+bpt_dup_to_list(bpt_value* s)
+{
+	struct bpt_posting* p = bpt_posting_resize(NULL, BPT_POSTING_MIN);
+	p->n = 1;
+	p->v[0] = *s;
+	bpt_dup_set_list(s, p);
+	return p;
+}
+
+/* The value slot of key k in the tree, NULL if there is no such key */
+static bpt_value*
+bpt_dup_slot(bpt_dup* m, bpt_key_t k)
+{
+	if(bpt_empty(&m->t))
+		return NULL;
+	bpt_node* l = bpt_query(&m->t, k);
+	int ind = get_1st_ge_key(l->recs.l_rec.key, l->num_of_rec, k);
+	if(ind < l->num_of_rec && l->recs.l_rec.key[ind] == k)
+		return &l->recs.l_rec.r_arr[ind];
+	return NULL;
+}
+
+/* The values in slot s, see bpt_dup_get */
+static bpt_value*
+bpt_dup_slot_values(bpt_value* s, long* n)
+{
+	struct bpt_posting* p = bpt_dup_list(s);
+	if(p == NULL){
+		*n = 1;
+		return s;
+	}
+	*n = p->n;
+	return p->v;
+}
+
+void
+bpt_dup_init(bpt_dup* m)
+{
+	bpt_init(&m->t);
+	m->keys = 0;
+	m->values = 0;
+}
+
+void
+bpt_dup_destroy(bpt_dup* m)
+{
+	bpt_node* l;
+	int i;
+
+	TAILQ_FOREACH(l, &m->t.rec_list_head, recs.l_rec.n)
+		for(i = 0; i < l->num_of_rec; i++)
+			free(bpt_dup_list(&l->recs.l_rec.r_arr[i]));
+	bpt_destroy(&m->t);
+}
+
+int
+bpt_dup_insert(bpt_dup* m, bpt_key_t k, bpt_record_t* v)
+{
+	bpt_value* s = bpt_dup_slot(m, k);
+	struct bpt_posting* p;
+	bpt_value x;
+	long i;
+
+#ifndef BPT_VALUE_BYTES
+	assert(((uintptr_t) v & 1) == 0);
+#endif
+	if(s == NULL){
+		/* A new key */
+		bpt_insert(&m->t, k, v);
+		m->keys++;
+		m->values++;
+#ifdef BPT_VALUE_BYTES
+		bpt_dup_to_list(bpt_dup_slot(m, k));
+#endif
+		return 1;
+	}
+
+	bpt_value_set(&x, v);
+	p = bpt_dup_list(s);
+	if(p == NULL){
+		/* The second value of the key */
+		if(bpt_dup_cmp(s, &x) == 0)
+			return 0;
+		p = bpt_dup_to_list(s);
+	}
+	i = bpt_posting_find(p, &x);
+	if(i < p->n && bpt_dup_cmp(&p->v[i], &x) == 0)
+		return 0;
+	if(p->n == p->cap){
+		p = bpt_posting_resize(p, p->cap * 2);
+		bpt_dup_set_list(s, p);
+	}
+	memmove(p->v + i + 1, p->v + i, (p->n - i) * sizeof(bpt_value));
+	p->v[i] = x;
+	p->n++;
+	m->values++;
+	return 1;
+}
+
+int
+bpt_dup_delete(bpt_dup* m, bpt_key_t k, bpt_record_t* v)
+{
+	bpt_value* s = bpt_dup_slot(m, k);
+	struct bpt_posting* p;
+	bpt_value x;
+	long i;
+
+	if(s == NULL)
+		return 0;
+	bpt_value_set(&x, v);
+	p = bpt_dup_list(s);
+	if(p == NULL){
+		/* The only value of the key */
+		if(bpt_dup_cmp(s, &x) != 0)
+			return 0;
+		bpt_delete(&m->t, k, v);
+		m->keys--;
+		m->values--;
+		return 1;
+	}
+
+	i = bpt_posting_find(p, &x);
+	if(i == p->n || bpt_dup_cmp(&p->v[i], &x) != 0)
+		return 0;
+	memmove(p->v + i, p->v + i + 1, (p->n - i - 1) * sizeof(bpt_value));
+	p->n--;
+	m->values--;
+#ifdef BPT_VALUE_BYTES
+	if(p->n == 0){
+		/* The slot is compared by its bytes, the pointer to the list */
+		x = *s;
+		bpt_delete(&m->t, k, bpt_value_rec(&x));
+		free(p);
+		m->keys--;
+		return 1;
+	}
+#else
+	if(p->n == 1){
+		/* Back to the slot */
+		*s = p->v[0];
+		free(p);
+		return 1;
+	}
+#endif
+	if(p->cap > BPT_POSTING_MIN && p->n <= p->cap / 4)
+		bpt_dup_set_list(s, bpt_posting_resize(p, p->cap / 2));
+	return 1;
+}
+
+bpt_value*
+bpt_dup_get(bpt_dup* m, bpt_key_t k, long* n)
+{
+	bpt_value* s = bpt_dup_slot(m, k);
+	if(s == NULL){
+		*n = 0;
+		return NULL;
+	}
+	return bpt_dup_slot_values(s, n);
+}
+
+bpt_value*
+bpt_dup_values(bpt_cursor* c, long* n)
+{
+	assert(bpt_cursor_valid(c));
+	return bpt_dup_slot_values(&c->leaf->recs.l_rec.r_arr[c->ind], n);
+}
@@ -0,0 +1,63 @@
+/* Copyright(c) Brayden Zhang
+ * Mail: pczhang2010@gmail.com
+ */
+
+#ifndef _BPT_DUP_H
+#define _BPT_DUP_H
+
+#include "bptree.h"
+
+/* Multimap of keys to sets of values, for keys with many duplicates. The
+ * B-Plus-Tree holds each key once, and the values of a key are in a posting
+ * list: an array of the values sorted by their bytes, which grows and
+ * shrinks by halves. A key with one value holds it in its leaf slot, without
+ * a list(with pointer records; inline values are always in a list).
+ *
+ * A delete of a (key, value) pair is a binary search in the list of the key,
+ * and bpt_dup_get returns all the values of a key as one array. Values are
+ * unique per key: an insert of a pair which is in the multimap does nothing.
+ * Records must be aligned to 2 bytes at least, the low bit of the slot tells
+ * a list from a record.
+ */
+
+/* Posting list of the values of a key */
+struct bpt_posting
+{
+	long n;
+	long cap;
+	bpt_value v[];
+};
+
+typedef struct __bpt_dup bpt_dup;
+struct __bpt_dup
+{
+	/* The tree of the distinct keys. Gets and cursors of it return the
+	 * slots of the keys, use bpt_dup_values on them.
+	 */
+	bptree t;
+
+	/* Number of distinct keys, and of (key, value) pairs */
+	long keys;
+	long values;
+};
+
+/* Functions of the multimap, implemented in bpt_dup.c */
+void bpt_dup_init (bpt_dup* m);
+void bpt_dup_destroy (bpt_dup* m);
+
+/* Return 1 if the pair is added, 0 if it was in the multimap */
+int bpt_dup_insert (bpt_dup* m, bpt_key_t k, bpt_record_t* v);
+
+/* Return 1 if the pair is deleted, 0 if it is not in the multimap */
+int bpt_dup_delete (bpt_dup* m, bpt_key_t k, bpt_record_t* v);
+
+/* Return the values of key k and set *n to their number, NULL and 0 if there
+ * is no such key. Use bpt_value_rec on them; they are valid until the
+ * multimap is changed.
+ */
+bpt_value* bpt_dup_get (bpt_dup* m, bpt_key_t k, long* n);
+
+/* Values of the key at a cursor of m->t, as bpt_dup_get */
+bpt_value* bpt_dup_values (bpt_cursor* c, long* n);
+
+#endif /* end of _BPT_DUP_H */
@@ -0,0 +1,209 @@
+/* Copyright(c) Brayden Zhang
+ * Mail: pczhang2010@gmail.com
+ */
+#include <assert.h>
+
+#include "bpt_frozen.h"
+
+/* Memory aligned to a cache line, for arrays of any size */
+static void*
+bpt_frozen_alloc(long size)
+{
+	void* p;
+	if(posix_memalign(&p, BPT_CACHE_LINE, size > 0 ? size : 1) != 0){
+		fprintf(stderr, "Memory allocation failed\n");
+		exit(-1);
+	}
+	return p;
+}
+
+/* Build the index levels over the keys, see bpt_frozen.h. The widths are
+ * found bottom up. Key j of node i at level l is the first key of leaf
+ * c * span, the first one under child c = i * (F + 1) + j + 1, where span is
+ * the number of leaves under a full node of level l + 1.
+ */
+static void
+bpt_frozen_build(bpt_frozen* f)
+{
+	int F = BPT_FROZEN_FANOUT, h = 0, l, j;
+	long w[BPT_MAX_HEIGHT], i, span = 1;
+
+	w[0] = (f->n + F - 1) / F;
+	while(w[h] > 1){
+		assert(h + 1 < BPT_MAX_HEIGHT);
+		w[h + 1] = (w[h] + F) / (F + 1);
+		h++;
+	}
+	f->height = h;
+	for(l = 0; l <= h; l++)
+		f->width[l] = w[h - l];
+	f->off[0] = 0;
+	for(l = 0; l < h; l++)
+		f->off[l + 1] = f->off[l] + f->width[l];
+	f->index = (bpt_key_t*) bpt_frozen_alloc(f->off[h] * F
+			* sizeof(bpt_key_t));
+
+	for(l = h - 1; l >= 0; l--, span *= F + 1)
+		for(i = 0; i < f->width[l]; i++){
+			bpt_key_t* node = f->index + (f->off[l] + i) * F;
+			for(j = 0; j < F; j++){
+				long c = i * (F + 1) + j + 1;
+				/* Missing children are after all the keys */
+				node[j] = f->key[c < f->width[l + 1]
+					? c * span * F : f->n - 1];
+			}
+		}
+}
+
+/* Copy the records of cursor c into f */
+static void
+bpt_frozen_copy(bpt_frozen* f, bpt_cursor* c)
+{
+	bpt_cursor c1 = *c;
+	long i;
+
+	memset(f, 0, sizeof(bpt_frozen));
+	for(; bpt_cursor_valid(&c1); bpt_cursor_next(&c1))
+		f->n++;
+	f->key = (bpt_key_t*) bpt_frozen_alloc(f->n * sizeof(bpt_key_t));
+	f->val = (bpt_value*) bpt_frozen_alloc(f->n * sizeof(bpt_value));
+	for(i = 0; bpt_cursor_valid(c); bpt_cursor_next(c), i++){
+		f->key[i] = bpt_cursor_key(c);
+		bpt_value_set(&f->val[i], bpt_cursor_record(c));
+	}
+	bpt_frozen_build(f);
+}
+
+void
+bpt_freeze_range(bptree* t, bpt_frozen* f, bpt_key_t lo, bpt_key_t hi)
+{
+	bpt_cursor c;
+
+	assert(t->olc == NULL);
+	bpt_cursor_seek(t, &c, lo);
+	bpt_cursor_set_end(&c, hi);
+	if(hi <= lo)
+		c.leaf = NULL;
+	bpt_frozen_copy(f, &c);
+	bpt_delete_range(t, lo, hi);
+}
+
+void
+bpt_freeze(bptree* t, bpt_frozen* f)
+{
+	bpt_cursor c;
+
+	assert(t->olc == NULL);
+	c.has_end = 0;
+	c.ind = 0;
+	c.leaf = bpt_empty(t) ? NULL : TAILQ_FIRST(&t->rec_list_head);
+	/* The root leaf of an empty tree */
+	if(c.leaf && c.leaf->num_of_rec == 0)
+		c.leaf = NULL;
+	bpt_frozen_copy(f, &c);
+	bpt_destroy(t);
+}
+
+void
+bpt_frozen_destroy(bpt_frozen* f)
+{
+	free(f->key);
+	free(f->val);
+	free(f->index);
+	memset(f, 0, sizeof(bpt_frozen));
+}
+
+/* Index of the first key >= k, n if there is none. One node is searched at
+ * each level, then one leaf.
+ */
+static long
+bpt_frozen_lower(bpt_frozen* f, bpt_key_t k)
+{
+	int F = BPT_FROZEN_FANOUT, l;
+	long i = 0, a, e;
+
+	if(f->n == 0)
+		return 0;
+	for(l = 0; l < f->height; l++){
+		i = i * (F + 1) + get_1st_ge_key(f->index
+				+ (f->off[l] + i) * F, F, k);
+		/* k is after all the keys */
+		if(i >= f->width[l + 1])
+			i = f->width[l + 1] - 1;
+	}
+	a = i * F;
+	e = a + F < f->n ? a + F : f->n;
+	return a + get_1st_ge_key(f->key + a, e - a, k);
+}
+
+bpt_record_t*
+bpt_frozen_get(bpt_frozen* f, bpt_key_t k)
+{
+	long i = bpt_frozen_lower(f, k);
+	if(i < f->n && f->key[i] == k)
+		return bpt_value_rec(&f->val[i]);
+	return NULL;
+}
+
+long
+bpt_frozen_count_range(bpt_frozen* f, bpt_key_t lo, bpt_key_t hi)
+{
+	if(hi <= lo)
+		return 0;
+	return bpt_frozen_lower(f, hi) - bpt_frozen_lower(f, lo);
+}
+
+void
+bpt_frozen_cursor_seek(bpt_frozen* f, bpt_frozen_cursor* c, bpt_key_t k)
+{
+	c->f = f;
+	c->pos = bpt_frozen_lower(f, k);
+	c->has_end = 0;
+}
+
+void
+bpt_frozen_cursor_set_end(bpt_frozen_cursor* c, bpt_key_t end)
+{
+	c->has_end = 1;
+	c->end = end;
+}
+
+int
+bpt_frozen_cursor_valid(bpt_frozen_cursor* c)
+{
+	return c->pos >= 0 && c->pos < c->f->n
+		&& (! c->has_end || c->f->key[c->pos] < c->end);
+}
+
+bpt_key_t
+bpt_frozen_cursor_key(bpt_frozen_cursor* c)
+{
+	assert(bpt_frozen_cursor_valid(c));
+	return c->f->key[c->pos];
+}
+
+bpt_record_t*
+bpt_frozen_cursor_record(bpt_frozen_cursor* c)
+{
+	assert(bpt_frozen_cursor_valid(c));
+	return bpt_value_rec(&c->f->val[c->pos]);
+}
+
+void
+bpt_frozen_cursor_next(bpt_frozen_cursor* c)
+{
+	c->pos++;
+}
+
+void
+bpt_frozen_cursor_prev(bpt_frozen_cursor* c)
+{
+	c->pos--;
+}
+
+long
+bpt_frozen_bytes(bpt_frozen* f)
+{
+	return f->n * (sizeof(bpt_key_t) + sizeof(bpt_value))
+		+ f->off[f->height] * BPT_FROZEN_FANOUT * sizeof(bpt_key_t);
+}
@@ -0,0 +1,88 @@
+/* Copyright(c) Brayden Zhang
+ * Mail: pczhang2010@gmail.com
+ */
+
+#ifndef _BPT_FROZEN_H
+#define _BPT_FROZEN_H
+
+#include "bptree.h"
+
+/* Frozen tree: a read-only copy of the records of a B-Plus-Tree in a static
+ * layout without pointers, for cold data which is not changed any more. The
+ * keys are packed in one sorted array, cut into leaves of one cache line of
+ * keys, and the records are in a second array in the same order, so they are
+ * read only for the key found. Above the leaves is an implicit index of
+ * nodes of one cache line of keys(a CSS-tree): the nodes of each level are
+ * stored in order after the level above, and the children of node i are the
+ * nodes i * (F + 1) to i * (F + 1) + F of the next level, where F is the
+ * number of keys of a node. Key j of a node is the first key under its child
+ * j + 1. A lookup reads one cache line per level and needs no child pointers.
+ *
+ * The nodes are full but the last one of each level, so the frozen tree
+ * takes about the bytes of its keys and records, while the leaves of a tree
+ * built by inserts are 70% full and have link pointers. Duplicated keys are
+ * kept, in the order of the tree.
+ */
+
+/* Keys of a node and of a leaf: one cache line */
+#define BPT_FROZEN_FANOUT ((int) (BPT_CACHE_LINE / sizeof(bpt_key_t)))
+
+typedef struct __bpt_frozen bpt_frozen;
+struct __bpt_frozen
+{
+	/* Records, key[i] goes with val[i] */
+	long n;
+	bpt_key_t* key;
+	bpt_value* val;
+
+	/* Levels of the index above the leaves, 0 if there is only one leaf.
+	 * Level 0 is the root, level l has width[l] nodes from node off[l] of
+	 * the index; width[height] is the number of leaves.
+	 */
+	int height;
+	bpt_key_t* index;
+	long off[BPT_MAX_HEIGHT];
+	long width[BPT_MAX_HEIGHT];
+};
+
+/* Cursor of a frozen tree, as bpt_cursor */
+typedef struct __bpt_frozen_cursor bpt_frozen_cursor;
+struct __bpt_frozen_cursor
+{
+	bpt_frozen* f;
+
+	/* Index of the current record, out of [0, n) if the cursor is out of
+	 * the records.
+	 */
+	long pos;
+
+	/* If has_end is set, the cursor stops before the first key >= end */
+	int has_end;
+	bpt_key_t end;
+};
+
+/* Move the records of t with keys in [lo, hi) into the frozen tree f, and
+ * delete them from t by bpt_delete_range. bpt_freeze moves all the records,
+ * then t is empty as after bpt_destroy. Not in thread-safe mode.
+ */
+void bpt_freeze_range (bptree* t, bpt_frozen* f, bpt_key_t lo, bpt_key_t hi);
+void bpt_freeze (bptree* t, bpt_frozen* f);
+void bpt_frozen_destroy (bpt_frozen* f);
+
+/* Same as bpt_get and bpt_count_range on the frozen records */
+bpt_record_t* bpt_frozen_get (bpt_frozen* f, bpt_key_t k);
+long bpt_frozen_count_range (bpt_frozen* f, bpt_key_t lo, bpt_key_t hi);
+
+/* Cursor functions, as the ones of bptree.h */
+void bpt_frozen_cursor_seek (bpt_frozen* f, bpt_frozen_cursor* c, bpt_key_t k);
+void bpt_frozen_cursor_set_end (bpt_frozen_cursor* c, bpt_key_t end);
+int bpt_frozen_cursor_valid (bpt_frozen_cursor* c);
+bpt_key_t bpt_frozen_cursor_key (bpt_frozen_cursor* c);
+bpt_record_t* bpt_frozen_cursor_record (bpt_frozen_cursor* c);
+void bpt_frozen_cursor_next (bpt_frozen_cursor* c);
+void bpt_frozen_cursor_prev (bpt_frozen_cursor* c);
+
+/* Bytes of the frozen tree: the keys, the records and the index */
+long bpt_frozen_bytes (bpt_frozen* f);
+
+#endif /* end of _BPT_FROZEN_H */
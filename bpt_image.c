@@ -0,0 +1,400 @@
+/* Copyright(c) Brayden Zhang
+ * Mail: pczhang2010@gmail.com
+ */
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "bpt_image.h"
+
+/* "BPTIMG01" */
+#define BPT_IMAGE_MAGIC 0x3130474d49545042UL
+
+/* Writer of the blocks of an image */
+struct bpt_image_writer
+{
+	FILE* f;
+
+	/* Number of blocks written, including the header */
+	long nblocks;
+
+	/* Block being filled */
+	char* block;
+};
+
+/* Write the block, return its offset, and clear the block for the next one */
+static long
+bpt_image_put(struct bpt_image_writer* w)
+{
+	long off = w->nblocks * BPT_IMAGE_BLOCK_BYTES;
+	if(fwrite(w->block, BPT_IMAGE_BLOCK_BYTES, 1, w->f) != 1)
+		return -1;
+	memset(w->block, 0, BPT_IMAGE_BLOCK_BYTES);
+	w->nblocks++;
+	return off;
+}
+
+/* Append the key to the array of first keys of the nodes of a level */
+static bpt_key_t*
+bpt_image_push(bpt_key_t* a, long n, bpt_key_t k)
+{
+	/* Grow by doubling */
+	if((n & (n - 1)) == 0 && n >= 64){
+		a = realloc(a, 2 * n * sizeof(bpt_key_t));
+		if(a == NULL){
+			fprintf(stderr, "Memory allocation failed\n");
+			exit(-1);
+		}
+	}
+	a[n] = k;
+	return a;
+}
+
+/* Write the leaves of t, packed full, and return the number of them. first[i]
+ * is set to the first key of leaf i.
+ */
+static long
+bpt_image_put_leaves(struct bpt_image_writer* w, bptree* t, 
+		bpt_key_t** first, long* n)
+{
+	struct bpt_image_leaf* l = (struct bpt_image_leaf*) w->block;
+	long nleaves = 0;
+	bpt_node* leaf;
+	int i;
+
+	*n = 0;
+	TAILQ_FOREACH(leaf, &t->rec_list_head, recs.l_rec.n){
+		for(i = 0; i < leaf->num_of_rec; i++){
+			if(l->n == 0)
+				*first = bpt_image_push(*first, nleaves,
+					leaf->recs.l_rec.key[i]);
+			l->key[l->n] = leaf->recs.l_rec.key[i];
+			l->val[l->n++] = leaf->recs.l_rec.r_arr[i];
+			(*n)++;
+			if(l->n == BPT_IMAGE_LEAF_NO){
+				if(bpt_image_put(w) < 0)
+					return -1;
+				nleaves++;
+			}
+		}
+	}
+	if(l->n){
+		if(bpt_image_put(w) < 0)
+			return -1;
+		nleaves++;
+	}
+	return nleaves;
+}
+
+/* Write the index levels over count nodes from offset off, which are in
+ * consecutive blocks with first keys first[]. Set the offset of the root.
+ */
+static int
+bpt_image_put_index(struct bpt_image_writer* w, bpt_key_t* first, long count,
+		long off, long* root, long* height)
+{
+	struct bpt_image_index* x = (struct bpt_image_index*) w->block;
+	long i, j, next_off;
+
+	*height = 1;
+	while(count > 1){
+		next_off = w->nblocks * BPT_IMAGE_BLOCK_BYTES;
+		/* first[] of the new level overwrites the old one in place */
+		for(i = j = 0; i < count; j++){
+			first[j] = first[i];
+			x->n = 0;
+			while(i < count && x->n < BPT_IMAGE_INDEX_NO){
+				if(x->n)
+					x->key[x->n - 1] = first[i];
+				x->child[x->n++] = off
+					+ i * BPT_IMAGE_BLOCK_BYTES;
+				i++;
+			}
+			if(bpt_image_put(w) < 0)
+				return -1;
+		}
+		count = j;
+		off = next_off;
+		(*height)++;
+	}
+	*root = off;
+	return 0;
+}
+
+int
+bpt_image_save(bptree* t, const char* path)
+{
+	struct bpt_image_writer w;
+	struct bpt_image_hdr* h;
+	char tmp[4096];
+	bpt_key_t* first = my_calloc(64 * sizeof(bpt_key_t));
+	int ret = -1;
+
+	if(snprintf(tmp, sizeof(tmp), "%s.tmp", path) >= (int) sizeof(tmp)){
+		errno = ENAMETOOLONG;
+		free(first);
+		return -1;
+	}
+	w.f = fopen(tmp, "w");
+	if(w.f == NULL){
+		free(first);
+		return -1;
+	}
+	w.nblocks = 0;
+	w.block = my_aligned_calloc(BPT_IMAGE_BLOCK_BYTES,
+		BPT_IMAGE_BLOCK_BYTES);
+	h = (struct bpt_image_hdr*) my_calloc(BPT_IMAGE_BLOCK_BYTES);
+	h->magic = BPT_IMAGE_MAGIC;
+	h->block_bytes = BPT_IMAGE_BLOCK_BYTES;
+	h->first_leaf = BPT_IMAGE_BLOCK_BYTES;
+	h->key_bytes = sizeof(bpt_key_t);
+	h->value_bytes = sizeof(bpt_value);
+
+	/* The header is written again at the end */
+	if(bpt_image_put(&w) < 0)
+		goto out;
+	h->nleaves = bpt_image_put_leaves(&w, t, &first, &h->n);
+	if(h->nleaves < 0)
+		goto out;
+	if(h->nleaves && bpt_image_put_index(&w, first, h->nleaves,
+			h->first_leaf, &h->root, &h->height) < 0)
+		goto out;
+
+	if(fseek(w.f, 0, SEEK_SET) != 0
+			|| fwrite(h, BPT_IMAGE_BLOCK_BYTES, 1, w.f) != 1
+			|| fflush(w.f) != 0 || fsync(fileno(w.f)) != 0)
+		goto out;
+	ret = 0;
+out:
+	if(fclose(w.f) != 0)
+		ret = -1;
+	if(ret == 0 && rename(tmp, path) != 0)
+		ret = -1;
+	if(ret != 0)
+		unlink(tmp);
+	free(w.block);
+	free(h);
+	free(first);
+	return ret;
+}
+
+/* Whether off is a block in [lo, hi) */
+static int
+bpt_image_in(long off, long lo, long hi)
+{
+	return off % BPT_IMAGE_BLOCK_BYTES == 0 && off >= lo
+		&& off <= hi - BPT_IMAGE_BLOCK_BYTES;
+}
+
+/* Check the header and the offsets of the index blocks, so that a search of
+ * a truncated or corrupt image stays in the mapping. A level of index blocks
+ * is written after the levels below it, so the children of the blocks in
+ * [lo, hi] are leaves at the last level, and before lo at the others.
+ */
+static int
+bpt_image_check(bpt_image* im)
+{
+	struct bpt_image_hdr* h = im->hdr;
+	long size = im->size, leaves_end, lo, hi, next_lo, next_hi, off, d;
+	int i;
+
+	if(h->magic != BPT_IMAGE_MAGIC
+			|| h->block_bytes != BPT_IMAGE_BLOCK_BYTES
+			|| h->key_bytes != (long) sizeof(bpt_key_t)
+			|| h->value_bytes != (long) sizeof(bpt_value)
+			|| h->first_leaf != BPT_IMAGE_BLOCK_BYTES
+			|| h->nleaves < 0 || h->nleaves 
+				> size / BPT_IMAGE_BLOCK_BYTES - 1
+			|| h->n < 0 || h->n > h->nleaves * BPT_IMAGE_LEAF_NO)
+		return -1;
+	if(h->n == 0)
+		return h->nleaves == 0 && h->height == 0 ? 0 : -1;
+	leaves_end = h->first_leaf + h->nleaves * BPT_IMAGE_BLOCK_BYTES;
+	if(h->nleaves == 0 || h->height < 1 || ! (h->height == 1
+			? bpt_image_in(h->root, h->first_leaf, leaves_end)
+			: bpt_image_in(h->root, leaves_end, size)))
+		return -1;
+
+	lo = hi = h->root;
+	for(d = 1; d < h->height; d++){
+		next_lo = LONG_MAX;
+		next_hi = -1;
+		for(off = lo; off <= hi; off += BPT_IMAGE_BLOCK_BYTES){
+			struct bpt_image_index* x =
+				(struct bpt_image_index*) (im->base + off);
+			if(x->n < 1 || x->n > BPT_IMAGE_INDEX_NO)
+				return -1;
+			for(i = 0; i < x->n; i++){
+				long c = x->child[i];
+				if(! (d == h->height - 1
+						? bpt_image_in(c, h->first_leaf,
+							leaves_end)
+						: bpt_image_in(c, leaves_end,
+							lo)))
+					return -1;
+				if(c < next_lo)
+					next_lo = c;
+				if(c > next_hi)
+					next_hi = c;
+			}
+		}
+		lo = next_lo;
+		hi = next_hi;
+	}
+	return 0;
+}
+
+int
+bpt_image_open(bpt_image* im, const char* path)
+{
+	struct stat st;
+	int fd = open(path, O_RDONLY);
+
+	if(fd < 0)
+		return -1;
+	if(fstat(fd, &st) != 0){
+		close(fd);
+		return -1;
+	}
+	if(st.st_size < BPT_IMAGE_BLOCK_BYTES){
+		close(fd);
+		errno = EINVAL;
+		return -1;
+	}
+	/* Shared, so the processes mapping the file share the page cache */
+	im->base = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if(im->base == MAP_FAILED)
+		return -1;
+	im->size = st.st_size;
+	im->hdr = (struct bpt_image_hdr*) im->base;
+	if(bpt_image_check(im) != 0){
+		munmap(im->base, im->size);
+		errno = EINVAL;
+		return -1;
+	}
+	return 0;
+}
+
+void
+bpt_image_close(bpt_image* im)
+{
+	munmap(im->base, im->size);
+	im->base = NULL;
+}
+
+/* The leftmost leaf which may have key k */
+static struct bpt_image_leaf*
+bpt_image_query_lower(bpt_image* im, bpt_key_t k)
+{
+	char* n = im->base + im->hdr->root;
+	long h;
+
+	for(h = im->hdr->height; h > 1; h--){
+		struct bpt_image_index* x = (struct bpt_image_index*) n;
+		int ind = get_1st_ge_key(x->key, x->n - 1, k);
+		n = im->base + x->child[ind];
+	}
+	return (struct bpt_image_leaf*) n;
+}
+
+/* The leaf after l, NULL for the last leaf */
+static struct bpt_image_leaf*
+bpt_image_next_leaf(bpt_image* im, struct bpt_image_leaf* l)
+{
+	char* n = (char*) l + BPT_IMAGE_BLOCK_BYTES;
+	return n < im->base + im->hdr->first_leaf
+		+ im->hdr->nleaves * BPT_IMAGE_BLOCK_BYTES
+		? (struct bpt_image_leaf*) n : NULL;
+}
+
+/* The leaf before l, NULL for the first leaf */
+static struct bpt_image_leaf*
+bpt_image_prev_leaf(bpt_image* im, struct bpt_image_leaf* l)
+{
+	char* n = (char*) l - BPT_IMAGE_BLOCK_BYTES;
+	return n >= im->base + im->hdr->first_leaf
+		? (struct bpt_image_leaf*) n : NULL;
+}
+
+bpt_record_t*
+bpt_image_get(bpt_image* im, bpt_key_t k)
+{
+	bpt_image_cursor c;
+
+	bpt_image_cursor_seek(im, &c, k);
+	return c.leaf && c.leaf->key[c.ind] == k
+		? bpt_value_rec(&c.leaf->val[c.ind]) : NULL;
+}
+
+void
+bpt_image_cursor_seek(bpt_image* im, bpt_image_cursor* c, bpt_key_t k)
+{
+	c->im = im;
+	c->has_end = 0;
+	if(im->hdr->n == 0){
+		c->leaf = NULL;
+		return;
+	}
+
+	c->leaf = bpt_image_query_lower(im, k);
+	c->ind = get_1st_ge_key(c->leaf->key, c->leaf->n, k);
+	/* Leaves are not empty, so the next leaf has a key >= k */
+	if(c->ind == c->leaf->n){
+		c->leaf = bpt_image_next_leaf(im, c->leaf);
+		c->ind = 0;
+	}
+}
+
+void
+bpt_image_cursor_set_end(bpt_image_cursor* c, bpt_key_t end)
+{
+	c->has_end = 1;
+	c->end = end;
+}
+
+int
+bpt_image_cursor_valid(bpt_image_cursor* c)
+{
+	if(c->leaf == NULL)
+		return 0;
+	return ! c->has_end || c->leaf->key[c->ind] < c->end;
+}
+
+bpt_key_t
+bpt_image_cursor_key(bpt_image_cursor* c)
+{
+	assert(bpt_image_cursor_valid(c));
+	return c->leaf->key[c->ind];
+}
+
+bpt_record_t*
+bpt_image_cursor_record(bpt_image_cursor* c)
+{
+	assert(bpt_image_cursor_valid(c));
+	return bpt_value_rec(&c->leaf->val[c->ind]);
+}
+
+void
+bpt_image_cursor_next(bpt_image_cursor* c)
+{
+	assert(c->leaf);
+	if(++c->ind == c->leaf->n){
+		c->leaf = bpt_image_next_leaf(c->im, c->leaf);
+		c->ind = 0;
+	}
+}
+
+void
+bpt_image_cursor_prev(bpt_image_cursor* c)
+{
+	assert(c->leaf);
+	if(--c->ind < 0){
+		c->leaf = bpt_image_prev_leaf(c->im, c->leaf);
+		c->ind = c->leaf ? c->leaf->n - 1 : 0;
+	}
+}
@@ -0,0 +1,127 @@
+/* Copyright(c) Brayden Zhang
+ * Mail: pczhang2010@gmail.com
+ */
+
+#ifndef _BPT_IMAGE_H
+#define _BPT_IMAGE_H
+
+#include "bptree.h"
+
+/* Read only image of a B-Plus-Tree in a file, which is searched in place by
+ * mmap: opening it reads nothing but the header and the index blocks, a small
+ * part of the file, and processes mapping the same file share its pages in
+ * the page cache.
+ *
+ * The file is a sequence of blocks of BPT_IMAGE_BLOCK_BYTES:
+ *   block 0:           header(struct bpt_image_hdr);
+ *   blocks 1..nleaves: the leaves in key order, all full but the last one;
+ *   the rest:          the index nodes, level by level from the bottom, the
+ *                      root is the last block.
+ * Children are referenced by their offsets in the file. The records are
+ * stored as they are, like in a persistent tree(see bpt_pool.h): they should
+ * be values, or point into storage which outlives the process. Inline values
+ * (see BPT_VALUE_BYTES) are stored in the leaves.
+ */
+
+#ifndef BPT_IMAGE_BLOCK_BYTES
+#define BPT_IMAGE_BLOCK_BYTES 4096
+#endif
+
+/* Max keys of a leaf block and max children of an index block */
+#define BPT_IMAGE_LEAF_NO ((int) ((BPT_IMAGE_BLOCK_BYTES - sizeof(long)) \
+		/ (sizeof(bpt_key_t) + sizeof(bpt_value))))
+#define BPT_IMAGE_INDEX_NO ((int) ((BPT_IMAGE_BLOCK_BYTES - sizeof(long)) \
+		/ (sizeof(bpt_key_t) + sizeof(long))))
+
+struct bpt_image_hdr
+{
+	unsigned long magic;
+	long block_bytes;
+
+	/* Number of keys and of leaves */
+	long n;
+	long nleaves;
+
+	/* Levels of the tree, 0 for an empty tree */
+	long height;
+
+	/* Offsets of the first leaf and of the root */
+	long first_leaf;
+	long root;
+
+	/* Bytes of a key, and of a record: of a pointer, or BPT_VALUE_BYTES
+	 * for inline values
+	 */
+	long key_bytes;
+	long value_bytes;
+};
+
+struct bpt_image_leaf
+{
+	long n;
+	bpt_key_t key[BPT_IMAGE_LEAF_NO];
+	bpt_value val[BPT_IMAGE_LEAF_NO];
+};
+
+/* Index block of n children and n - 1 keys, the same as bpt_index_recs */
+struct bpt_image_index
+{
+	long n;
+	bpt_key_t key[BPT_IMAGE_INDEX_NO];
+	long child[BPT_IMAGE_INDEX_NO];
+};
+
+_Static_assert(sizeof(struct bpt_image_leaf) <= BPT_IMAGE_BLOCK_BYTES
+		&& sizeof(struct bpt_image_index) <= BPT_IMAGE_BLOCK_BYTES,
+		"image block too small");
+
+/* An opened image */
+typedef struct __bpt_image bpt_image;
+struct __bpt_image
+{
+	/* The mapped file */
+	char* base;
+	size_t size;
+	struct bpt_image_hdr* hdr;
+};
+
+/* Cursor on an image, the same as bpt_cursor */
+typedef struct __bpt_image_cursor bpt_image_cursor;
+struct __bpt_image_cursor
+{
+	bpt_image* im;
+
+	/* Current leaf, NULL if the cursor is out of the image */
+	struct bpt_image_leaf* leaf;
+	int ind;
+
+	int has_end;
+	bpt_key_t end;
+};
+
+/* Write the keys and records of tree t to an image at path. The image is
+ * written to path.tmp and renamed, so an open image of path is not changed.
+ * Return 0, or -1 with errno set.
+ */
+int bpt_image_save (bptree* t, const char* path);
+
+/* Map the image at path. Return 0, or -1 with errno set: EINVAL if the
+ * header or a child offset of an index block is not valid, as in a truncated
+ * or corrupt image.
+ */
+int bpt_image_open (bpt_image* im, const char* path);
+void bpt_image_close (bpt_image* im);
+
+/* Record of key k, NULL if not found */
+bpt_record_t* bpt_image_get (bpt_image* im, bpt_key_t k);
+
+/* Ordered scan, see the cursor functions of bptree.h */
+void bpt_image_cursor_seek (bpt_image* im, bpt_image_cursor* c, bpt_key_t k);
+void bpt_image_cursor_set_end (bpt_image_cursor* c, bpt_key_t end);
+int bpt_image_cursor_valid (bpt_image_cursor* c);
+bpt_key_t bpt_image_cursor_key (bpt_image_cursor* c);
+bpt_record_t* bpt_image_cursor_record (bpt_image_cursor* c);
+void bpt_image_cursor_next (bpt_image_cursor* c);
+void bpt_image_cursor_prev (bpt_image_cursor* c);
+
+#endif /* end of _BPT_IMAGE_H */
@@ -0,0 +1,409 @@
+/* Copyright(c) Brayden Zhang
+ * Mail: pczhang2010@gmail.com
+ */
+#include <assert.h>
+
+#include "bpt_learn.h"
+
+static void*
+bpt_learn_realloc(void* p, long size)
+{
+	p = realloc(p, size);
+	if(p == NULL){
+		fprintf(stderr, "Memory allocation failed\n");
+		exit(-1);
+	}
+	return p;
+}
+
+/* Append leaf l with first key k to the array */
+static void
+bpt_learn_add_leaf(bpt_learn* m, bpt_node* l, bpt_key_t k)
+{
+	if(m->n_leaf == m->cap_leaf){
+		m->cap_leaf = m->cap_leaf ? 2 * m->cap_leaf : 64;
+		m->leaf = (bpt_node**) bpt_learn_realloc(m->leaf,
+				m->cap_leaf * sizeof(bpt_node*));
+		m->lo = (bpt_key_t*) bpt_learn_realloc(m->lo,
+				m->cap_leaf * sizeof(bpt_key_t));
+	}
+	m->leaf[m->n_leaf] = l;
+	m->lo[m->n_leaf++] = k;
+}
+
+/* Append segment g with first key k */
+static void
+bpt_learn_add_seg(bpt_learn* m, bpt_key_t k, struct bpt_seg* g)
+{
+	if(m->n_seg == m->cap_seg){
+		m->cap_seg = m->cap_seg ? 2 * m->cap_seg : 16;
+		m->seg_k = (bpt_key_t*) bpt_learn_realloc(m->seg_k,
+				m->cap_seg * sizeof(bpt_key_t));
+		m->seg = (struct bpt_seg*) bpt_learn_realloc(m->seg,
+				m->cap_seg * sizeof(struct bpt_seg));
+	}
+	m->seg_k[m->n_seg] = k;
+	m->seg[m->n_seg++] = *g;
+}
+
+/* k - k0 as a double. Keys far from 0 are not exact as doubles, so the
+ * difference is taken in the key type unless it overflows.
+ */
+static inline double
+bpt_learn_dx(bpt_key_t k, bpt_key_t k0)
+{
+	bpt_key_t d;
+	if(__builtin_sub_overflow(k, k0, &d))
+		return (double) k - (double) k0;
+	return (double) d;
+}
+
+/* Index of the leaf after the last one of segment s */
+static long
+bpt_learn_seg_end(bpt_learn* m, long s)
+{
+	return s + 1 < m->n_seg ? m->seg[s + 1].first : m->n_leaf;
+}
+
+/* Fit segments to the leaves [a, e) of the array, and append them. A
+ * segment starts at the first of its leaves, and is extended while a slope
+ * is left which predicts each of its first keys within eps: the slopes for
+ * each key are an interval, and the segment keeps their intersection. Leaves
+ * of the same first key are one point, at the last of them.
+ */
+static void
+bpt_learn_fit(bpt_learn* m, long a, long e)
+{
+	bpt_key_t* lo = m->lo;
+	long i = a, r;
+
+	while(i < e){
+		struct bpt_seg g;
+		double y0, dx, s0 = 0, s1 = HUGE_VAL;
+
+		g.first = i;
+		g.stale = 0;
+		for(r = i; r + 1 < e && lo[r + 1] == lo[i]; r++)
+			;
+		y0 = r;
+		for(i = r + 1; i < e && i - g.first < BPT_LEARN_SEG; i = r + 1){
+			for(r = i; r + 1 < e && lo[r + 1] == lo[i]; r++)
+				;
+			/* Distinct keys may be the same double */
+			if((dx = bpt_learn_dx(lo[i], lo[g.first])) <= 0)
+				break;
+			if((r - m->eps - y0) / dx > s1
+					|| (r + m->eps - y0) / dx < s0)
+				break;
+			if((r - m->eps - y0) / dx > s0)
+				s0 = (r - m->eps - y0) / dx;
+			if((r + m->eps - y0) / dx < s1)
+				s1 = (r + m->eps - y0) / dx;
+		}
+		g.slope = s1 == HUGE_VAL ? 0 : (s0 + s1) / 2;
+		g.y = y0;
+		bpt_learn_add_seg(m, lo[g.first], &g);
+	}
+}
+
+/* Mark segments [s0, s1] stale */
+static void
+bpt_learn_mark(bpt_learn* m, long s0, long s1)
+{
+	long s;
+	if(s0 < 0)
+		s0 = 0;
+	for(s = s0; s <= s1 && s < m->n_seg; s++)
+		if(! m->seg[s].stale){
+			m->seg[s].stale = 1;
+			m->stale_leaves += bpt_learn_seg_end(m, s)
+				- m->seg[s].first;
+		}
+}
+
+/* Mark the whole model stale if the tree changed its structure by other than
+ * the functions here.
+ */
+static void
+bpt_learn_follow(bpt_learn* m)
+{
+	struct bpt_smo* smo = &m->t->smo;
+	if(smo->splits != m->smo.splits || smo->merges != m->smo.merges
+			|| smo->borrows != m->smo.borrows){
+		bpt_learn_mark(m, 0, m->n_seg - 1);
+		m->smo = *smo;
+	}
+}
+
+void
+bpt_learn_init(bpt_learn* m, bptree* t)
+{
+	memset(m, 0, sizeof(bpt_learn));
+	m->t = t;
+	m->eps = BPT_LEARN_EPS;
+	m->smo = t->smo;
+	bpt_learn_refresh(m);
+	m->refreshes = 0;
+}
+
+void
+bpt_learn_destroy(bpt_learn* m)
+{
+	free(m->leaf);
+	free(m->lo);
+	free(m->seg_k);
+	free(m->seg);
+	memset(m, 0, sizeof(bpt_learn));
+}
+
+/* The array is rebuilt: the leaves of the fresh segments are copied, and the
+ * leaves between them are taken from the link list, starting after the last
+ * leaf of the fresh segment before and stopping at the first leaf of the
+ * fresh segment after. The leaves of stale segments may be freed, so they
+ * are not read.
+ */
+void
+bpt_learn_refresh(bpt_learn* m)
+{
+	bptree* t = m->t;
+	bpt_learn old = *m;
+	bpt_node *l, *stop;
+	long s, e, a, f;
+
+	m->leaf = NULL;
+	m->lo = NULL;
+	m->n_leaf = m->cap_leaf = 0;
+	m->seg_k = NULL;
+	m->seg = NULL;
+	m->n_seg = m->cap_seg = 0;
+
+	for(s = 0; s < old.n_seg || (s == 0 && ! bpt_empty(t)); s = e){
+		f = s < old.n_seg ? old.seg[s].first : 0;
+		if(s < old.n_seg && ! old.seg[s].stale){
+			struct bpt_seg g = old.seg[s];
+			long end = bpt_learn_seg_end(&old, s);
+
+			g.y += m->n_leaf - f;
+			g.first = m->n_leaf;
+			bpt_learn_add_seg(m, old.seg_k[s], &g);
+			for(; f < end; f++)
+				bpt_learn_add_leaf(m, old.leaf[f], old.lo[f]);
+			e = s + 1;
+			continue;
+		}
+		for(e = s; e < old.n_seg && old.seg[e].stale; e++)
+			;
+		l = s == 0 ? TAILQ_FIRST(&t->rec_list_head)
+			: TAILQ_NEXT(old.leaf[f - 1], recs.l_rec.n);
+		stop = e < old.n_seg ? old.leaf[old.seg[e].first] : NULL;
+		a = m->n_leaf;
+		for(; l != stop; l = TAILQ_NEXT(l, recs.l_rec.n))
+			/* Only the leaf of an empty tree has no records */
+			if(l->num_of_rec > 0)
+				bpt_learn_add_leaf(m, l, l->recs.l_rec.key[0]);
+		bpt_learn_fit(m, a, m->n_leaf);
+		if(e == 0)
+			break;
+	}
+
+	free(old.leaf);
+	free(old.lo);
+	free(old.seg_k);
+	free(old.seg);
+	m->stale_leaves = 0;
+	m->stale_lookups = 0;
+	m->refreshes++;
+}
+
+/* Index of the last leaf of segment s whose first key <= k(< k if lower is
+ * set), or the first leaf of s if there is none. The first keys are searched
+ * within the error around the prediction; if the answer is not inside, the
+ * window moves on, doubling its size.
+ */
+static long
+bpt_learn_pos(bpt_learn* m, long s, bpt_key_t k, int lower)
+{
+	struct bpt_seg* g = &m->seg[s];
+	long first = g->first, end = bpt_learn_seg_end(m, s);
+	long w = m->eps + 2, a, b, c, p;
+	double y = g->y + g->slope * bpt_learn_dx(k, m->seg_k[s]);
+
+	p = y < first ? first : y >= end ? end - 1 : (long) y;
+	/* Mostly the leaf found, load it while the keys are searched */
+	__builtin_prefetch(m->leaf + p);
+	a = p - w < first ? first : p - w;
+	b = p + w + 1 > end ? end : p + w + 1;
+	for(;;){
+		/* lo[a, c) are before k */
+		c = a + get_1st_ge_key(m->lo + a, b - a, k);
+		if(! lower)
+			while(c < b && m->lo[c] == k)
+				c++;
+		if(c == a && a > first){
+			b = a + 1;
+			a = a - w < first ? first : a - w;
+		}else if(c == b && b < end){
+			a = b - 1;
+			b = b + w > end ? end : b + w;
+		}else break;
+		w *= 2;
+	}
+	return c > first ? c - 1 : first;
+}
+
+/* From leaf l, follow the link list to the last leaf whose first key <= k(<
+ * k if lower is set), or the first leaf if there is none. The next leaf is
+ * only read if k is after the keys of l, so a leaf of duplicates of k may be
+ * followed by more.
+ */
+static bpt_node*
+bpt_learn_walk(bpt_node* l, bpt_key_t k, int lower)
+{
+	bpt_key_t* key = l->recs.l_rec.key;
+	bpt_node* n;
+
+	while(l->num_of_rec > 0 && key[l->num_of_rec - 1] < k
+			&& (n = TAILQ_NEXT(l, recs.l_rec.n)) != NULL
+			&& (n->recs.l_rec.key[0] < k
+				|| (! lower && n->recs.l_rec.key[0] == k))){
+		l = n;
+		key = l->recs.l_rec.key;
+	}
+	while(l->num_of_rec > 0 && (l->recs.l_rec.key[0] > k
+				|| (lower && l->recs.l_rec.key[0] == k))
+			&& (n = TAILQ_PREV(l, rec_list, recs.l_rec.n)) != NULL)
+		l = n;
+	return l;
+}
+
+/* Leaf found by the model, see bpt_learn_walk. NULL if the tree is empty or
+ * the segment is stale, then the caller descends the tree.
+ */
+static bpt_node*
+bpt_learn_leaf(bpt_learn* m, bpt_key_t k, int lower)
+{
+	long s;
+
+	bpt_learn_follow(m);
+	if(m->n_seg == 0){
+		if(bpt_empty(m->t))
+			return NULL;
+		bpt_learn_refresh(m);
+		if(m->n_seg == 0)
+			return NULL;
+	}
+	m->lookups++;
+
+	/* The last segment whose first key <= k(< k if lower) */
+	s = get_1st_ge_key(m->seg_k, m->n_seg, k);
+	if(! lower)
+		while(s < m->n_seg && m->seg_k[s] == k)
+			s++;
+	if(--s < 0)
+		s = 0;
+
+	if(m->seg[s].stale){
+		m->fallbacks++;
+		if(4 * ++m->stale_lookups >= m->stale_leaves)
+			bpt_learn_refresh(m);
+		return NULL;
+	}
+	return bpt_learn_walk(m->leaf[bpt_learn_pos(m, s, k, lower)], k,
+			lower);
+}
+
+bpt_node*
+bpt_learn_query(bpt_learn* m, bpt_key_t k)
+{
+	bpt_node* l = bpt_learn_leaf(m, k, 0);
+	if(l == NULL && ! bpt_empty(m->t))
+		l = bpt_query(m->t, k);
+	return l;
+}
+
+/* From the first leaf which may have k, as bpt_get */
+bpt_record_t*
+bpt_learn_get(bpt_learn* m, bpt_key_t k)
+{
+	bpt_node* l = bpt_learn_leaf(m, k, 1);
+	int ind;
+
+	if(l == NULL)
+		return bpt_get(m->t, k);
+	ind = bpt_leaf_seek(&l, k);
+	if(l && l->recs.l_rec.key[ind] == k)
+		return bpt_value_rec(&l->recs.l_rec.r_arr[ind]);
+	return NULL;
+}
+
+void
+bpt_learn_cursor_seek(bpt_learn* m, bpt_cursor* c, bpt_key_t k)
+{
+	bpt_node* l = bpt_learn_leaf(m, k, 1);
+
+	if(l == NULL){
+		bpt_cursor_seek(m->t, c, k);
+		return;
+	}
+	c->has_end = 0;
+	c->leaf = l;
+	c->ind = bpt_leaf_seek(&c->leaf, k);
+}
+
+/* Index of the segment of key k, for marking */
+static long
+bpt_learn_seg_of(bpt_learn* m, bpt_key_t k)
+{
+	long s = get_1st_ge_key(m->seg_k, m->n_seg, k);
+	while(s < m->n_seg && m->seg_k[s] == k)
+		s++;
+	return s > 0 ? s - 1 : 0;
+}
+
+/* A split adds a leaf after the leaf of k, in the same segment. The new leaf
+ * is found by following the link list until the segment is refit.
+ */
+void
+bpt_learn_insert(bpt_learn* m, bpt_key_t k, bpt_record_t* v)
+{
+	long splits;
+
+	bpt_learn_follow(m);
+	splits = m->t->smo.splits;
+	bpt_insert(m->t, k, v);
+	if(m->t->smo.splits != splits)
+		bpt_learn_mark(m, bpt_learn_seg_of(m, k),
+				bpt_learn_seg_of(m, k));
+	m->smo = m->t->smo;
+}
+
+/* A borrow moves keys between the leaf of k and a sibling, in the segment of
+ * k or a neighbor one. A merge frees the leaf of k or a sibling, but with
+ * the leaves added by splits and the keys moved by borrows, its segment is
+ * not known for sure; the whole model is marked stale, so that no freed leaf
+ * is read from the array.
+ */
+void
+bpt_learn_delete(bpt_learn* m, bpt_key_t k, bpt_record_t* v)
+{
+	struct bpt_smo smo;
+	long s;
+
+	bpt_learn_follow(m);
+	smo = m->t->smo;
+	bpt_delete(m->t, k, v);
+	if(m->t->smo.merges != smo.merges)
+		bpt_learn_mark(m, 0, m->n_seg - 1);
+	else if(m->t->smo.borrows != smo.borrows){
+		s = bpt_learn_seg_of(m, k);
+		bpt_learn_mark(m, s - 1, s + 1);
+	}
+	m->smo = m->t->smo;
+}
+
+long
+bpt_learn_bytes(bpt_learn* m)
+{
+	return m->n_leaf * (sizeof(bpt_node*) + sizeof(bpt_key_t))
+		+ m->n_seg * (sizeof(bpt_key_t) + sizeof(struct bpt_seg));
+}
@@ -0,0 +1,121 @@
+/* Copyright(c) Brayden Zhang
+ * Mail: pczhang2010@gmail.com
+ */
+
+#ifndef _BPT_LEARN_H
+#define _BPT_LEARN_H
+
+#include "bptree.h"
+
+/* Learned index over the leaves of a B-Plus-Tree, for reads which skip the
+ * index levels. The leaves are kept in an array with their first keys, and a
+ * piecewise linear model maps a key to its position in the array: each
+ * segment covers a run of leaves, and predicts the position of any first key
+ * of them with an error of at most eps leaves. A lookup finds the segment by
+ * a binary search of their first keys, searches the first keys around the
+ * prediction, and then follows the link list of the leaves if the tree has
+ * changed the leaves since. So the lookups are always right, the model only
+ * tells where to start.
+ *
+ * The tree should be changed by bpt_learn_insert and bpt_learn_delete: a
+ * split or a rebalance marks the segment of the key stale, and a merge, which
+ * frees a leaf, the whole model. Lookups in stale segments descend the index
+ * levels instead, and once they add up to a quarter of the stale leaves,
+ * bpt_learn_refresh refits the stale segments only, from the link list of
+ * the leaves. If the tree is changed directly, the change of its counters
+ * marks the whole model stale; bpt_delete_range, bpt_bulk_load and the like
+ * free leaves without counting, so fit a new model after them. Not in
+ * thread-safe mode.
+ */
+
+/* Max error of the predicted positions, in leaves, by default */
+#ifndef BPT_LEARN_EPS
+#define BPT_LEARN_EPS 8
+#endif
+
+/* Max number of leaves of a segment, so that a split makes a bounded number
+ * of leaves stale.
+ */
+#ifndef BPT_LEARN_SEG
+#define BPT_LEARN_SEG 256
+#endif
+
+/* A segment predicts the position y + slope * (k - first key of the segment)
+ * for key k.
+ */
+struct bpt_seg
+{
+	double slope;
+	double y;
+
+	/* Index of the first leaf of the segment in the array */
+	long first;
+	int stale;
+};
+
+typedef struct __bpt_learn bpt_learn;
+struct __bpt_learn
+{
+	bptree* t;
+
+	/* Max error of the segments fit from now on, BPT_LEARN_EPS by
+	 * default.
+	 */
+	int eps;
+
+	/* The leaves in the order of the link list, and their first keys when
+	 * the segment was fit.
+	 */
+	bpt_node** leaf;
+	bpt_key_t* lo;
+	long n_leaf;
+	long cap_leaf;
+
+	/* First keys of the segments, in increasing order, and the segments */
+	bpt_key_t* seg_k;
+	struct bpt_seg* seg;
+	long n_seg;
+	long cap_seg;
+
+	/* Leaves of the stale segments, and the lookups in them since the last
+	 * refresh.
+	 */
+	long stale_leaves;
+	long stale_lookups;
+
+	/* Counters of the tree when the model last followed it */
+	struct bpt_smo smo;
+
+	/* Counters: lookups, lookups which descended the tree instead, and
+	 * refreshes.
+	 */
+	long lookups;
+	long fallbacks;
+	long refreshes;
+};
+
+/* Functions of the learned index, implemented in bpt_learn.c. init fits the
+ * model to the leaves of t.
+ */
+void bpt_learn_init (bpt_learn* m, bptree* t);
+void bpt_learn_destroy (bpt_learn* m);
+
+/* Refit the stale segments, or all the segments if there are none */
+void bpt_learn_refresh (bpt_learn* m);
+
+/* Same as bpt_get and bpt_cursor_seek on the tree. bpt_learn_query returns
+ * the leaf of k as bpt_query if k is in the tree, otherwise the last leaf
+ * whose first key is before k, or the first leaf.
+ */
+bpt_node* bpt_learn_query (bpt_learn* m, bpt_key_t k);
+bpt_record_t* bpt_learn_get (bpt_learn* m, bpt_key_t k);
+void bpt_learn_cursor_seek (bpt_learn* m, bpt_cursor* c, bpt_key_t k);
+
+/* bpt_insert and bpt_delete on the tree, which mark the model stale */
+void bpt_learn_insert (bpt_learn* m, bpt_key_t k, bpt_record_t* v);
+void bpt_learn_delete (bpt_learn* m, bpt_key_t k, bpt_record_t* v);
+
+/* Bytes of the model: the array of the leaves and the segments */
+long bpt_learn_bytes (bpt_learn* m);
+
+#endif /* end of _BPT_LEARN_H */
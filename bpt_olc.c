@@ -0,0 +1,555 @@
+/* Copyright(c) Brayden Zhang
+ * Mail: pczhang2010@gmail.com
+ */
+#include <assert.h>
+#include <sched.h>
+
+#include "bpt_olc.h"
+
+/* Max number of nodes locked by one split or merge: the path from the leaf
+ * to the root, and a sibling at each level.
+ */
+#define BPT_OLC_MAX_LOCKED 256
+
+/* Slots of the thread epochs are shared by all trees. A thread gets its slot
+ * on its first access to a thread-safe tree, and gives it back when it exits.
+ */
+static char bpt_olc_slot_used[BPT_OLC_MAX_THREADS];
+static pthread_key_t bpt_olc_slot_key;
+static pthread_once_t bpt_olc_slot_once = PTHREAD_ONCE_INIT;
+static __thread int bpt_olc_tid = -1;
+
+static void
+bpt_olc_slot_release(void* arg)
+{
+	int tid = (int) (long) arg - 1;
+	__atomic_store_n(&bpt_olc_slot_used[tid], 0, __ATOMIC_RELEASE);
+}
+
+static void
+bpt_olc_slot_init()
+{
+	pthread_key_create(&bpt_olc_slot_key, bpt_olc_slot_release);
+}
+
+static int
+bpt_olc_thread_id()
+{
+	int i;
+	if(bpt_olc_tid >= 0)
+		return bpt_olc_tid;
+
+	pthread_once(&bpt_olc_slot_once, bpt_olc_slot_init);
+	for(i = 0; i < BPT_OLC_MAX_THREADS; i++){
+		char unused = 0;
+		if(__atomic_compare_exchange_n(&bpt_olc_slot_used[i], &unused,
+				1, 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+			break;
+	}
+	if(i == BPT_OLC_MAX_THREADS){
+		fprintf(stderr, "Too many threads in thread-safe trees\n");
+		exit(-1);
+	}
+	/* Store tid + 1, since NULL value does not call the destructor */
+	pthread_setspecific(bpt_olc_slot_key, (void*) (long) (i + 1));
+	bpt_olc_tid = i;
+	return i;
+}
+
+/* Wait for a lock holder */
+static inline void
+bpt_olc_pause(int* spins)
+{
+	if(++*spins % 1024 == 0)
+		sched_yield();
+#if defined(__x86_64__) || defined(__i386__)
+	else __builtin_ia32_pause();
+#endif
+}
+
+/* Wait until node n is not locked, and remember its version in v. Return 0
+ * if the node is obsolete, the caller should restart.
+ */
+static inline int
+bpt_olc_read_lock(bpt_node* n, unsigned long* v)
+{
+	int spins = 0;
+	unsigned long x = __atomic_load_n(&n->version, __ATOMIC_ACQUIRE);
+	while(x & BPT_OLC_LOCKED){
+		bpt_olc_pause(&spins);
+		x = __atomic_load_n(&n->version, __ATOMIC_ACQUIRE);
+	}
+	*v = x;
+	return ! (x & BPT_OLC_OBSOLETE);
+}
+
+/* Return 1 if node n is not changed since its version was v */
+static inline int
+bpt_olc_check(bpt_node* n, unsigned long v)
+{
+	/* The reads of the node should be done before reading the version */
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	return __atomic_load_n(&n->version, __ATOMIC_RELAXED) == v;
+}
+
+/* Lock node n if it is not changed since version v */
+static inline int
+bpt_olc_upgrade(bpt_node* n, unsigned long v)
+{
+	return __atomic_compare_exchange_n(&n->version, &v,
+			v + BPT_OLC_LOCKED, 0, __ATOMIC_ACQUIRE,
+			__ATOMIC_RELAXED);
+}
+
+/* Lock node n, wait if it is locked by others */
+static void
+bpt_olc_write_lock(bpt_node* n)
+{
+	int spins = 0;
+	for(;;){
+		unsigned long v = __atomic_load_n(&n->version, 
+				__ATOMIC_RELAXED);
+		if(! (v & BPT_OLC_LOCKED) && bpt_olc_upgrade(n, v))
+			return;
+		bpt_olc_pause(&spins);
+	}
+}
+
+/* Unlock node n and increase its version */
+static inline void
+bpt_olc_write_unlock(bpt_node* n)
+{
+	__atomic_fetch_add(&n->version, BPT_OLC_LOCKED, __ATOMIC_RELEASE);
+}
+
+/* Enter the tree: readers of this thread may hold nodes from now on */
+static inline void
+bpt_olc_enter(struct bpt_olc* o)
+{
+	uint64_t e = __atomic_load_n(&o->epoch, __ATOMIC_ACQUIRE);
+	/* A full barrier: the epoch should be visible before reading nodes */
+	__atomic_store_n(&o->slots[bpt_olc_thread_id()].epoch, e,
+			__ATOMIC_SEQ_CST);
+}
+
+static inline void
+bpt_olc_exit(struct bpt_olc* o)
+{
+	__atomic_store_n(&o->slots[bpt_olc_tid].epoch, 0, __ATOMIC_RELEASE);
+}
+
+int
+bpt_olc_enable(bptree* t)
+{
+	assert(t->olc == NULL);
+#ifdef BPT_COUNTS
+	/* Writers lock only the leaf, the counts are in all the levels */
+	(void) t;
+	return -1;
+#else
+	struct bpt_olc* o = (struct bpt_olc*) my_aligned_calloc(BPT_CACHE_LINE,
+			sizeof(struct bpt_olc));
+	pthread_mutex_init(&o->smo_lock, NULL);
+	o->epoch = 1;
+	t->olc = o;
+	return 0;
+#endif
+}
+
+void
+bpt_olc_disable(bptree* t)
+{
+	struct bpt_olc* o = t->olc;
+	int i;
+
+	for(i = 0; i < o->num_retired; i++)
+		t->alloc->free(t->alloc, o->retired[i].n, o->retired[i].n->t);
+	free(o->retired);
+	pthread_mutex_destroy(&o->smo_lock);
+	free(o);
+	t->olc = NULL;
+}
+
+/* Called with smo_lock held, and node n locked */
+void
+bpt_olc_retire(bptree* t, bpt_node* n)
+{
+	struct bpt_olc* o = t->olc;
+
+	if(o->num_retired == o->max_retired){
+		o->max_retired = o->max_retired ? o->max_retired * 2
+			: BPT_OLC_RECLAIM_BATCH;
+		o->retired = realloc(o->retired,
+			o->max_retired * sizeof(struct bpt_retired));
+		if(o->retired == NULL){
+			fprintf(stderr, "Memory allocation failed\n");
+			exit(-1);
+		}
+	}
+	__atomic_fetch_or(&n->version, BPT_OLC_OBSOLETE, __ATOMIC_RELEASE);
+
+	/* Threads entering from now on have a bigger epoch and can not see n */
+	o->retired[o->num_retired].n = n;
+	o->retired[o->num_retired].epoch =
+		__atomic_fetch_add(&o->epoch, 1, __ATOMIC_ACQ_REL);
+	o->num_retired++;
+}
+
+/* Free the retired nodes that no thread can hold. Called with smo_lock held */
+static void
+bpt_olc_reclaim(bptree* t)
+{
+	struct bpt_olc* o = t->olc;
+	uint64_t min = UINT64_MAX;
+	int i, j;
+
+	for(i = 0; i < BPT_OLC_MAX_THREADS; i++){
+		uint64_t e = __atomic_load_n(&o->slots[i].epoch,
+				__ATOMIC_ACQUIRE);
+		if(e && e < min)
+			min = e;
+	}
+	for(i = j = 0; i < o->num_retired; i++){
+		bpt_node* n = o->retired[i].n;
+		if(o->retired[i].epoch < min)
+			t->alloc->free(t->alloc, n, n->t);
+		else o->retired[j++] = o->retired[i];
+	}
+	o->num_retired = j;
+}
+
+/* Go down from the root to the leaf for key k, without locking. Return 0 if
+ * a node changed on the way and the caller should restart. Otherwise the leaf
+ * and its version are returned in l and v; l is NULL for an empty tree.
+ */
+static int
+bpt_olc_find_leaf(bptree* t, bpt_key_t k, bpt_node** l, unsigned long* v)
+{
+	bpt_node* n = __atomic_load_n(&t->root, __ATOMIC_ACQUIRE);
+	*l = NULL;
+	if(n == NULL)
+		return 1;
+	if(! bpt_olc_read_lock(n, v))
+		return 0;
+	/* The root may have been replaced before its version was read */
+	if(n != __atomic_load_n(&t->root, __ATOMIC_ACQUIRE))
+		return 0;
+
+	while(! bpt_is_leaf(n)){
+		int num = n->num_of_rec;
+		/* num may be read while the node changes */
+		if(num < 1 || num > BPT_MAX_INDEX_REC_NO)
+			return 0;
+
+		/* Same as bpt_query_lower: go left if k equals the split 
+		 * key, the records of k may be there(see bpt_child_ind).
+		 */
+		int ind = get_1st_ge_key(n->recs.i_rec.key, num - 1, k);
+		bpt_node* c = n->recs.i_rec.c_arr[ind];
+
+		/* c may be garbage if n changed while reading it. Check n
+		 * again after reading the version of c: if c splits or merges
+		 * in between, n changes too.
+		 */
+		unsigned long cv;
+		if(! bpt_olc_check(n, *v) || ! bpt_olc_read_lock(c, &cv)
+				|| ! bpt_olc_check(n, *v))
+			return 0;
+		n = c;
+		*v = cv;
+	}
+	*l = n;
+	return 1;
+}
+
+/* Move l to the leaf after it, and v to its version, as a step down in
+ * bpt_olc_find_leaf. l is NULL after the last leaf. Return 0 if the caller
+ * should restart.
+ */
+static int
+bpt_olc_next_leaf(bpt_node** l, unsigned long* v)
+{
+	bpt_node* n = TAILQ_NEXT(*l, recs.l_rec.n);
+	unsigned long nv = 0;
+
+	if(! bpt_olc_check(*l, *v) || (n != NULL 
+			&& (! bpt_olc_read_lock(n, &nv) 
+				|| ! bpt_olc_check(*l, *v))))
+		return 0;
+	*l = n;
+	*v = nv;
+	return 1;
+}
+
+/* Same as bpt_olc_find_leaf, and go on along the leaves to the first key >= 
+ * k: its leaf is returned in l, NULL if there is none, and its index in ind.
+ */
+static int
+bpt_olc_find_ge(bptree* t, bpt_key_t k, bpt_node** l, unsigned long* v, 
+		int* ind)
+{
+	if(! bpt_olc_find_leaf(t, k, l, v))
+		return 0;
+	while(*l != NULL){
+		int num = (*l)->num_of_rec;
+		if(num < 0 || num > BPT_MAX_LEAF_REC_NO)
+			return 0;
+		*ind = get_1st_ge_key((*l)->recs.l_rec.key, num, k);
+		if(*ind < num)
+			return 1;
+		if(! bpt_olc_next_leaf(l, v))
+			return 0;
+	}
+	return 1;
+}
+
+/* Same as bpt_olc_find_ge, and go on along the leaves to record v of key k:
+ * its leaf is returned in l, NULL if there is none, and its index in ind.
+ */
+static int
+bpt_olc_find_rec(bptree* t, bpt_key_t k, bpt_record_t* v, bpt_node** l,
+		unsigned long* ver, int* ind)
+{
+	if(! bpt_olc_find_ge(t, k, l, ver, ind))
+		return 0;
+	while(*l != NULL && (*ind = bpt_find_in_leaf(*l, k, v)) < 0){
+		int num = (*l)->num_of_rec;
+		if(num < 0 || num > BPT_MAX_LEAF_REC_NO)
+			return 0;
+		/* The leaf has a key > k, the records of k end here */
+		if(num > 0 && (*l)->recs.l_rec.key[num - 1] > k){
+			if(! bpt_olc_check(*l, *ver))
+				return 0;
+			*l = NULL;
+			break;
+		}
+		if(! bpt_olc_next_leaf(l, ver))
+			return 0;
+	}
+	return 1;
+}
+
+bpt_record_t*
+bpt_olc_get(bptree* t, bpt_key_t k)
+{
+	struct bpt_olc* o = t->olc;
+	bpt_node* l;
+	unsigned long v;
+	bpt_record_t* r;
+	int ind;
+
+	bpt_olc_enter(o);
+	for(;;){
+		if(! bpt_olc_find_ge(t, k, &l, &v, &ind))
+			continue;
+		if(l == NULL){
+			r = NULL;
+			break;
+		}
+		r = l->recs.l_rec.key[ind] == k
+			? bpt_value_rec(&l->recs.l_rec.r_arr[ind]) : NULL;
+		if(bpt_olc_check(l, v))
+			break;
+	}
+	bpt_olc_exit(o);
+	return r;
+}
+
+#ifdef BPT_VALUE_BYTES
+int
+bpt_olc_get_value(bptree* t, bpt_key_t k, bpt_record_t* out)
+{
+	struct bpt_olc* o = t->olc;
+	bpt_node* l;
+	unsigned long v;
+	int found, ind;
+
+	bpt_olc_enter(o);
+	for(;;){
+		if(! bpt_olc_find_ge(t, k, &l, &v, &ind))
+			continue;
+		if(l == NULL){
+			found = 0;
+			break;
+		}
+		found = l->recs.l_rec.key[ind] == k;
+		/* The copy may be torn by a writer, then the check fails */
+		if(found)
+			memcpy(out, &l->recs.l_rec.r_arr[ind], BPT_VALUE_BYTES);
+		if(bpt_olc_check(l, v))
+			break;
+	}
+	bpt_olc_exit(o);
+	return found;
+}
+#endif
+
+/* Unlock the locked nodes of a split or merge, and leave the structure
+ * modification lock.
+ */
+static void
+bpt_olc_smo_done(bptree* t, bpt_node** locked, int num)
+{
+	struct bpt_olc* o = t->olc;
+	while(num > 0)
+		bpt_olc_write_unlock(locked[--num]);
+	if(o->num_retired >= BPT_OLC_RECLAIM_BATCH)
+		bpt_olc_reclaim(t);
+	pthread_mutex_unlock(&o->smo_lock);
+}
+
+/* Insert with the structure modification lock held. The index nodes can only
+ * be changed by the holder of the lock, leaf nodes can still be changed by
+ * the inserts and deletes which do not split or merge.
+ */
+static void
+bpt_olc_insert_smo(bptree* t, bpt_key_t k, bpt_record_t* v)
+{
+	bpt_node* locked[BPT_OLC_MAX_LOCKED];
+	int num = 0;
+	bpt_path path;
+
+	pthread_mutex_lock(&t->olc->smo_lock);
+	if(bpt_empty(t))
+		bpt_init_root(t);
+	bpt_node* l = bpt_query_path(t, k, &path);
+	bpt_olc_write_lock(l);
+	locked[num++] = l;
+
+	if(! bpt_is_full(l))
+		bpt_insert_in_leaf(l, k, v);
+	else{
+		/* Lock the full ancestors which will split, and the first
+		 * one which is not full, since it gets a new child.
+		 */
+		int lv;
+		for(lv = path.depth - 2; lv >= 0; lv--){
+			bpt_node* n = path.node[lv];
+			assert(num < BPT_OLC_MAX_LOCKED);
+			bpt_olc_write_lock(n);
+			locked[num++] = n;
+			if(! bpt_is_full(n))
+				break;
+		}
+		bpt_split_leaf(t, &path, k, v);
+	}
+	bpt_olc_smo_done(t, locked, num);
+}
+
+void
+bpt_olc_insert(bptree* t, bpt_key_t k, bpt_record_t* v)
+{
+	struct bpt_olc* o = t->olc;
+	bpt_node* l;
+	unsigned long ver;
+
+	bpt_olc_enter(o);
+	for(;;){
+		if(! bpt_olc_find_leaf(t, k, &l, &ver))
+			continue;
+		if(l == NULL || l->num_of_rec >= BPT_MAX_LEAF_REC_NO){
+			/* Need to create the root or split the leaf */
+			if(l && ! bpt_olc_check(l, ver))
+				continue;
+			bpt_olc_insert_smo(t, k, v);
+			break;
+		}
+		/* The leaf has room, only lock it */
+		if(! bpt_olc_upgrade(l, ver))
+			continue;
+		bpt_insert_in_leaf(l, k, v);
+		bpt_olc_write_unlock(l);
+		break;
+	}
+	bpt_olc_exit(o);
+}
+
+/* Delete with the structure modification lock held, see bpt_olc_insert_smo */
+static void
+bpt_olc_delete_smo(bptree* t, bpt_key_t k, bpt_record_t* v)
+{
+	bpt_node* locked[BPT_OLC_MAX_LOCKED];
+	int num = 0;
+	bpt_path path;
+
+	pthread_mutex_lock(&t->olc->smo_lock);
+	if(bpt_empty(t)){
+		bpt_olc_smo_done(t, locked, num);
+		return;
+	}
+	bpt_node* l = bpt_query_path_lower(t, k, &path);
+	bpt_olc_write_lock(l);
+	locked[num++] = l;
+
+	/* As bpt_locate_in_path, from the first leaf which may have k. The
+	 * index nodes do not change without the lock, the leaves are read
+	 * locked.
+	 */
+	int ind;
+	while((ind = bpt_find_in_leaf(l, k, v)) < 0 && (l->num_of_rec == 0
+			|| l->recs.l_rec.key[l->num_of_rec - 1] <= k)
+			&& bpt_path_step_leaf(&path, 1) != NULL){
+		bpt_olc_write_unlock(l);
+		l = locked[0] = path.node[path.depth - 1];
+		bpt_olc_write_lock(l);
+	}
+	if(ind >= 0){
+		/* Lock the nodes which will change, going up while the node
+		 * would merge with its sibling: the node, its sibling and
+		 * their parent.
+		 */
+		int lv = path.depth - 1;
+		for(; lv > 0; lv--){
+			bpt_node* n = path.node[lv];
+			bpt_node* n1;
+			bpt_key_t split_key;
+
+			if(n->num_of_rec - 1 >= bpt_underflow_min(t, n))
+				break;
+			assert(num + 2 <= BPT_OLC_MAX_LOCKED);
+			bpt_olc_write_lock(path.node[lv - 1]);
+			locked[num++] = path.node[lv - 1];
+			bpt_get_close_sibling(&path, lv, &n1, &split_key);
+			bpt_olc_write_lock(n1);
+			locked[num++] = n1;
+
+			if(n->num_of_rec - 1 + n1->num_of_rec > bpt_max_rec(n))
+				break; // Borrow from n1
+		}
+		bpt_delete_entry(t, &path, path.depth - 1, ind);
+	}
+	bpt_olc_smo_done(t, locked, num);
+}
+
+void
+bpt_olc_delete(bptree* t, bpt_key_t k, bpt_record_t* v)
+{
+	struct bpt_olc* o = t->olc;
+	bpt_node* l;
+	unsigned long ver;
+	int ind;
+
+	bpt_olc_enter(o);
+	for(;;){
+		if(! bpt_olc_find_rec(t, k, v, &l, &ver, &ind))
+			continue;
+		if(l == NULL)
+			break;
+		int enough = l == __atomic_load_n(&t->root, __ATOMIC_ACQUIRE)
+			|| l->num_of_rec - 1 >= bpt_underflow_min(t, l);
+		if(! bpt_olc_check(l, ver))
+			continue;
+		if(! enough){
+			/* The leaf will merge or borrow */
+			bpt_olc_delete_smo(t, k, v);
+			break;
+		}
+		/* Only the leaf changes */
+		if(! bpt_olc_upgrade(l, ver))
+			continue;
+		bpt_delete_in_leaf_at(l, ind);
+		bpt_olc_write_unlock(l);
+		break;
+	}
+	bpt_olc_exit(o);
+}
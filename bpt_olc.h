@@ -0,0 +1,98 @@
+/* Copyright(c) Brayden Zhang
+ * Mail: pczhang2010@gmail.com
+ */
+
+#ifndef _BPT_OLC_H
+#define _BPT_OLC_H
+
+#include <stdint.h>
+#include <pthread.h>
+
+#include "bptree.h"
+
+/* Thread-safe mode of the B-Plus-Tree, by optimistic lock coupling.
+ *
+ * Each node has a version lock(bpt_node.version):
+ *   bit 0: the node is obsolete(removed from the tree);
+ *   bit 1: the node is locked by a writer;
+ *   other bits: version number, increased when the node is unlocked.
+ * Readers do not lock: they remember the version of a node, read it, and
+ * restart from the root if the version changed meanwhile.
+ *
+ * Writers go down the tree like readers. If the leaf does not split or
+ * underflow, the writer only locks the leaf. Otherwise the writer takes the
+ * structure modification lock(only one split or merge at a time), and locks
+ * only the nodes that the split or merge will change.
+ *
+ * Removed nodes are not freed at once, since readers may still read them.
+ * They are retired with the current epoch, and freed when all threads in the
+ * tree entered after that epoch.
+ *
+ * Only bpt_insert, bpt_delete and bpt_get are thread-safe; cursors, bulk
+ * loading and printing need the tree not changed by other threads.
+ */
+
+/* Max number of threads using thread-safe trees */
+#define BPT_OLC_MAX_THREADS 256
+
+/* Freed nodes are reclaimed when so many are retired */
+#define BPT_OLC_RECLAIM_BATCH 64
+
+/* A removed node waiting for the readers to leave */
+struct bpt_retired
+{
+	bpt_node* n;
+	uint64_t epoch;
+};
+
+/* Epoch of a thread, on its own cache line */
+struct bpt_olc_slot
+{
+	/* Global epoch when the thread entered the tree, 0 if outside */
+	uint64_t epoch;
+	char pad[BPT_CACHE_LINE - sizeof(uint64_t)];
+};
+
+struct bpt_olc
+{
+	/* Structure modification lock, taken by splits and merges */
+	pthread_mutex_t smo_lock;
+
+	/* Global epoch, increased when a node is retired */
+	uint64_t epoch;
+
+	/* Retired nodes, protected by smo_lock */
+	struct bpt_retired* retired;
+	int num_retired;
+	int max_retired;
+
+	struct bpt_olc_slot slots[BPT_OLC_MAX_THREADS];
+};
+
+/* Version lock bits */
+#define BPT_OLC_OBSOLETE 0x1UL
+#define BPT_OLC_LOCKED 0x2UL
+
+/* Switch the tree to thread-safe mode, before it is used by threads. Return
+ * -1 if built with BPT_COUNTS, whose counts writers locking only the leaf can
+ * not keep, then the tree stays as it is.
+ */
+int bpt_olc_enable (bptree* t);
+
+/* Leave thread-safe mode, free all retired nodes. No thread should be using
+ * the tree.
+ */
+void bpt_olc_disable (bptree* t);
+
+/* Thread-safe versions of bpt_get/bpt_insert/bpt_delete, called by them */
+bpt_record_t* bpt_olc_get (bptree* t, bpt_key_t k);
+void bpt_olc_insert (bptree* t, bpt_key_t k, bpt_record_t* v);
+void bpt_olc_delete (bptree* t, bpt_key_t k, bpt_record_t* v);
+#ifdef BPT_VALUE_BYTES
+int bpt_olc_get_value (bptree* t, bpt_key_t k, bpt_record_t* out);
+#endif
+
+/* Retire a node removed from the tree, called by bpt_delete_node */
+void bpt_olc_retire (bptree* t, bpt_node* n);
+
+#endif /* end of _BPT_OLC_H */
@@ -0,0 +1,652 @@
+/* Copyright(c) Brayden Zhang
+ * Mail: pczhang2010@gmail.com
+ */
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "bpt_pool.h"
+
+/* "BPTREE01" */
+#define BPT_POOL_MAGIC 0x3130454552545042UL
+
+/* Links of a page in the file are page IDs, or one of these. Page 0 is the
+ * meta page, so it is never linked.
+ */
+#define BPT_LINK_NULL 0
+#define BPT_LINK_HEAD (-1L)
+
+/* Type of a free page, after LEAF and INDEX */
+#define BPT_PAGE_FREE 2
+
+/* Protection of a page in the pool */
+enum { BPT_PROT_NONE, BPT_PROT_READ, BPT_PROT_RW };
+
+/* Content of page 0 of the file */
+struct bpt_pool_meta
+{
+	unsigned long magic;
+	long page_bytes;
+	int leaf_rec_no;
+	int index_rec_no;
+	long key_bytes;
+	long value_bytes;
+	long count_bytes;
+
+	/* Pages of the tree, including the meta page */
+	long npages;
+
+	/* First page of the free page list, 0 if none */
+	long free_head;
+
+	/* Root, first and last leaf, 0 for an empty tree */
+	long root;
+	long first_leaf;
+	long last_leaf;
+
+	int ragged_right;
+	int underfull;
+};
+
+/* A free page, linked to the next free page */
+struct bpt_free_page
+{
+	int t;
+	long next;
+};
+
+/* A page in the pool */
+struct bpt_frame
+{
+	long pid;
+
+	/* Number of pins, a pinned page is not evicted */
+	int pins;
+
+	/* Reference bit of CLOCK */
+	char ref;
+
+	/* The page was written since it was read or written back */
+	char dirty;
+
+	/* Protection of the page, BPT_PROT_NONE after the clock hand cleared
+	 * the reference bit.
+	 */
+	char prot;
+};
+
+struct bpt_pool
+{
+	/* Must be the first member, the pool is passed as bpt_allocator */
+	bpt_allocator base;
+
+	/* The tree in the file, for the head of the leaf list */
+	bptree* t;
+
+	int fd;
+
+	/* Reserved virtual memory, page i is at mem + i * BPT_PAGE_BYTES */
+	char* mem;
+
+	/* Pages of the tree including the meta page, and pages of the file */
+	long npages;
+	long file_pages;
+
+	/* First page of the free page list, 0 if none */
+	long free_head;
+
+	/* frame_of[i] is 1 + the index of the frame of page i, 0 if page i is
+	 * not in the pool.
+	 */
+	int* frame_of;
+
+	/* The frames, used_frames of them are in use. hand is the clock. */
+	struct bpt_frame* frames;
+	long nframes;
+	long used_frames;
+	long hand;
+
+	/* Number of dirty pages; if no_steal is set, they are not evicted */
+	long ndirty;
+	int no_steal;
+
+	struct bpt_pool_stats stats;
+
+	/* A page is copied here to be written, with the links as page IDs */
+	char* buf;
+
+	/* Next open pool */
+	struct bpt_pool* next;
+};
+
+/* Open pools, searched by the trap handler */
+static struct bpt_pool* bpt_pools;
+
+/* Action of SIGSEGV before the trap handler was installed */
+static struct sigaction bpt_pool_old_act;
+static int bpt_pool_trap_installed;
+
+/* Called from the trap handler too, so only write(2) is used */
+static void
+bpt_pool_fatal(const char* msg)
+{
+	ssize_t r = write(2, msg, strlen(msg));
+	(void) r;
+	abort();
+}
+
+static char*
+bpt_pool_page(struct bpt_pool* p, long pid)
+{
+	return p->mem + pid * BPT_PAGE_BYTES;
+}
+
+static long
+bpt_pool_pid(struct bpt_pool* p, void* a)
+{
+	return ((char*) a - p->mem) / BPT_PAGE_BYTES;
+}
+
+static void
+bpt_pool_protect(struct bpt_pool* p, struct bpt_frame* f, int prot)
+{
+	static const int flags[] = {
+		PROT_NONE, PROT_READ, PROT_READ | PROT_WRITE
+	};
+	if(mprotect(bpt_pool_page(p, f->pid), BPT_PAGE_BYTES,
+			flags[prot]) != 0)
+		bpt_pool_fatal("bpt_pool: mprotect failed, is the pool larger "
+			"than vm.max_map_count?\n");
+	f->prot = prot;
+}
+
+/* Link in the file of a pointer to a node, or to the leaf link of a node */
+static long
+bpt_pool_link(struct bpt_pool* p, void* a)
+{
+	if(a == NULL)
+		return BPT_LINK_NULL;
+	/* The first leaf links back to the head of the list in the bptree */
+	if((char*) a < p->mem
+			|| (char*) a >= p->mem + p->npages * BPT_PAGE_BYTES)
+		return BPT_LINK_HEAD;
+	return bpt_pool_pid(p, a);
+}
+
+/* Pointer of a link in the file. off is the offset of the pointed field in
+ * the node.
+ */
+static void*
+bpt_pool_unlink(struct bpt_pool* p, long link, size_t off)
+{
+	if(link == BPT_LINK_NULL)
+		return NULL;
+	if(link == BPT_LINK_HEAD)
+		return &p->t->rec_list_head.tqh_first;
+	return bpt_pool_page(p, link) + off;
+}
+
+/* Copy page pid to p->buf, with the links as page IDs */
+static void
+bpt_pool_encode(struct bpt_pool* p, long pid)
+{
+	bpt_node* n = (bpt_node*) p->buf;
+	int i;
+
+	memcpy(p->buf, bpt_pool_page(p, pid), BPT_PAGE_BYTES);
+	if(n->t == INDEX){
+		for(i = 0; i < BPT_MAX_INDEX_REC_NO; i++)
+			n->recs.i_rec.c_arr[i] = i < n->num_of_rec
+				? (bpt_node*) bpt_pool_link(p,
+					n->recs.i_rec.c_arr[i]) : NULL;
+	}else if(n->t == LEAF){
+		n->recs.l_rec.n.tqe_next = (bpt_node*) bpt_pool_link(p,
+			n->recs.l_rec.n.tqe_next);
+		n->recs.l_rec.n.tqe_prev = (bpt_node**) bpt_pool_link(p,
+			n->recs.l_rec.n.tqe_prev);
+	}
+}
+
+/* Turn the page IDs of node n, just read from the file, into pointers */
+static void
+bpt_pool_decode(struct bpt_pool* p, bpt_node* n)
+{
+	int i;
+
+	if(n->t == INDEX){
+		for(i = 0; i < n->num_of_rec; i++)
+			n->recs.i_rec.c_arr[i] = bpt_pool_unlink(p,
+				(long) n->recs.i_rec.c_arr[i], 0);
+	}else if(n->t == LEAF){
+		n->recs.l_rec.n.tqe_next = bpt_pool_unlink(p,
+			(long) n->recs.l_rec.n.tqe_next, 0);
+		n->recs.l_rec.n.tqe_prev = bpt_pool_unlink(p,
+			(long) n->recs.l_rec.n.tqe_prev,
+			offsetof(bpt_node, recs.l_rec.n.tqe_next));
+	}
+}
+
+static void
+bpt_pool_write_back(struct bpt_pool* p, struct bpt_frame* f)
+{
+	int prot = f->prot;
+
+	if(prot == BPT_PROT_NONE)
+		bpt_pool_protect(p, f, BPT_PROT_READ);
+	bpt_pool_encode(p, f->pid);
+	if(pwrite(p->fd, p->buf, BPT_PAGE_BYTES, f->pid * BPT_PAGE_BYTES)
+			!= BPT_PAGE_BYTES)
+		bpt_pool_fatal("bpt_pool: write failed\n");
+	if(f->pid >= p->file_pages)
+		p->file_pages = f->pid + 1;
+	p->stats.writes++;
+
+	/* The next write to the page traps again to set the dirty bit */
+	f->dirty = 0;
+	p->ndirty--;
+	bpt_pool_protect(p, f, prot == BPT_PROT_NONE
+		? BPT_PROT_NONE : BPT_PROT_READ);
+}
+
+/* Get a frame for a new page, evicting a page by CLOCK if the pool is full */
+static struct bpt_frame*
+bpt_pool_victim(struct bpt_pool* p)
+{
+	long i;
+
+	if(p->used_frames < p->nframes)
+		return &p->frames[p->used_frames++];
+
+	/* Two rounds clear all reference bits, unless the pages are pinned */
+	for(i = 0; i < 2 * p->nframes + 1; i++){
+		struct bpt_frame* f = &p->frames[p->hand];
+		p->hand = (p->hand + 1) % p->nframes;
+		if(f->pins || (f->dirty && p->no_steal))
+			continue;
+		if(f->ref){
+			/* The page traps on the next access, which sets the
+			 * reference bit again.
+			 */
+			f->ref = 0;
+			bpt_pool_protect(p, f, BPT_PROT_NONE);
+			continue;
+		}
+
+		if(f->dirty)
+			bpt_pool_write_back(p, f);
+		madvise(bpt_pool_page(p, f->pid), BPT_PAGE_BYTES,
+			MADV_DONTNEED);
+		p->frame_of[f->pid] = 0;
+		p->stats.evictions++;
+		return f;
+	}
+	bpt_pool_fatal("bpt_pool: all pages of the pool are pinned or "
+		"dirty\n");
+	return NULL;
+}
+
+/* Read page pid into the pool, it is read only after that */
+static void
+bpt_pool_load(struct bpt_pool* p, long pid)
+{
+	struct bpt_frame* f = bpt_pool_victim(p);
+	char* page = bpt_pool_page(p, pid);
+
+	f->pid = pid;
+	f->pins = 0;
+	f->ref = 1;
+	f->dirty = 0;
+	bpt_pool_protect(p, f, BPT_PROT_RW);
+	/* A new page, which was never written, is still zeroed */
+	if(pid < p->file_pages){
+		if(pread(p->fd, page, BPT_PAGE_BYTES, pid * BPT_PAGE_BYTES)
+				!= BPT_PAGE_BYTES)
+			bpt_pool_fatal("bpt_pool: read failed\n");
+		p->stats.reads++;
+		bpt_pool_decode(p, (bpt_node*) page);
+	}
+	bpt_pool_protect(p, f, BPT_PROT_READ);
+	p->frame_of[pid] = f - p->frames + 1;
+}
+
+/* Handler of SIGSEGV: an access to a page which is not in the pool, to a
+ * page whose reference bit was cleared, or the first write to a clean page.
+ */
+static void
+bpt_pool_trap(int sig, siginfo_t* si, void* ctx)
+{
+	char* a = (char*) si->si_addr;
+	struct bpt_pool* p;
+	struct bpt_frame* f;
+	long pid;
+
+	(void) sig;
+	(void) ctx;
+	for(p = bpt_pools; p; p = p->next)
+		if(a >= p->mem + BPT_PAGE_BYTES
+				&& a < p->mem + p->npages * BPT_PAGE_BYTES)
+			break;
+	if(p == NULL){
+		/* Not a page of the pools. The access traps again, and is
+		 * handled by the old action.
+		 */
+		sigaction(SIGSEGV, &bpt_pool_old_act, NULL);
+		return;
+	}
+
+	p->stats.traps++;
+	pid = bpt_pool_pid(p, a);
+	if(p->frame_of[pid] == 0){
+		bpt_pool_load(p, pid);
+		return;
+	}
+	f = &p->frames[p->frame_of[pid] - 1];
+	if(f->prot == BPT_PROT_NONE){
+		f->ref = 1;
+		bpt_pool_protect(p, f, f->dirty ? BPT_PROT_RW : BPT_PROT_READ);
+	}else if(f->prot == BPT_PROT_READ){
+		f->ref = 1;
+		f->dirty = 1;
+		p->ndirty++;
+		bpt_pool_protect(p, f, BPT_PROT_RW);
+	}else sigaction(SIGSEGV, &bpt_pool_old_act, NULL);
+}
+
+static void*
+bpt_pool_alloc(bpt_allocator* a, int type)
+{
+	struct bpt_pool* p = (struct bpt_pool*) a;
+	char* page;
+	long pid;
+
+	(void) type;
+	if(p->free_head){
+		pid = p->free_head;
+		p->free_head = ((struct bpt_free_page*)
+			bpt_pool_page(p, pid))->next;
+	}else{
+		if(p->npages == BPT_POOL_MAX_PAGES){
+			fprintf(stderr, "Page file is full\n");
+			exit(-1);
+		}
+		pid = p->npages++;
+	}
+	page = bpt_pool_page(p, pid);
+	/* Traps the page into the pool, and marks it dirty */
+	memset(page, 0, BPT_PAGE_BYTES);
+	return page;
+}
+
+static void
+bpt_pool_free(bpt_allocator* a, void* n, int type)
+{
+	struct bpt_pool* p = (struct bpt_pool*) a;
+	struct bpt_free_page* fp = (struct bpt_free_page*) n;
+
+	(void) type;
+	fp->t = BPT_PAGE_FREE;
+	fp->next = p->free_head;
+	p->free_head = bpt_pool_pid(p, n);
+}
+
+/* Content of the meta page for the tree as it is now */
+static void
+bpt_pool_get_meta(struct bpt_pool* p, struct bpt_pool_meta* meta)
+{
+	bptree* t = p->t;
+	struct bpt_pool_meta m;
+
+	memset(&m, 0, sizeof(m));
+	m.magic = BPT_POOL_MAGIC;
+	m.page_bytes = BPT_PAGE_BYTES;
+	m.leaf_rec_no = BPT_MAX_LEAF_REC_NO;
+	m.index_rec_no = BPT_MAX_INDEX_REC_NO;
+	m.key_bytes = sizeof(bpt_key_t);
+	m.value_bytes = sizeof(bpt_value);
+	m.count_bytes = BPT_COUNT_BYTES;
+	m.npages = p->npages;
+	m.free_head = p->free_head;
+	if(! bpt_empty(t)){
+		m.root = bpt_pool_pid(p, t->root);
+		m.first_leaf = bpt_pool_pid(p, TAILQ_FIRST(&t->rec_list_head));
+		/* tqh_last points into the last leaf */
+		m.last_leaf = bpt_pool_pid(p, t->rec_list_head.tqh_last);
+	}
+	m.ragged_right = t->ragged_right;
+	m.underfull = t->underfull;
+	*meta = m;
+}
+
+static void
+bpt_pool_write_meta(struct bpt_pool* p)
+{
+	struct bpt_pool_meta m;
+
+	bpt_pool_get_meta(p, &m);
+	if(pwrite(p->fd, &m, sizeof(m), 0) != sizeof(m))
+		bpt_pool_fatal("bpt_pool: write failed\n");
+	if(p->file_pages == 0)
+		p->file_pages = 1;
+}
+
+static struct bpt_pool*
+bpt_pool_of(bptree* t)
+{
+	assert(t->alloc->alloc == bpt_pool_alloc);
+	return (struct bpt_pool*) t->alloc;
+}
+
+void
+bpt_flush(bptree* t)
+{
+	struct bpt_pool* p = bpt_pool_of(t);
+	long i;
+
+	for(i = 0; i < p->used_frames; i++)
+		if(p->frames[i].dirty)
+			bpt_pool_write_back(p, &p->frames[i]);
+	bpt_pool_write_meta(p);
+	fdatasync(p->fd);
+}
+
+/* Destroy of the allocator: flush, close the file and release the pool. The
+ * tree stays in the file.
+ */
+static void
+bpt_pool_destroy(bpt_allocator* a)
+{
+	struct bpt_pool* p = (struct bpt_pool*) a;
+	struct bpt_pool** pp;
+
+	bpt_flush(p->t);
+	for(pp = &bpt_pools; *pp != p; pp = &(*pp)->next)
+		;
+	*pp = p->next;
+	munmap(p->mem, BPT_POOL_MAX_PAGES * BPT_PAGE_BYTES);
+	munmap(p->frame_of, BPT_POOL_MAX_PAGES * sizeof(int));
+	close(p->fd);
+	free(p->frames);
+	free(p->buf);
+	free(p);
+}
+
+void
+bpt_close(bptree* t)
+{
+	bpt_pool_of(t);
+	bpt_destroy(t);
+}
+
+/* Read the meta page of a file which is not empty into m. Return 0, or -1
+ * if the file was not written by a tree of this page size and fanouts.
+ */
+static int
+bpt_pool_read_meta(int fd, struct bpt_pool_meta* m)
+{
+	errno = EINVAL;
+	if(pread(fd, m, sizeof(*m), 0) != sizeof(*m))
+		return -1;
+	if(m->magic != BPT_POOL_MAGIC || m->page_bytes != BPT_PAGE_BYTES
+			|| m->leaf_rec_no != BPT_MAX_LEAF_REC_NO
+			|| m->index_rec_no != BPT_MAX_INDEX_REC_NO
+			|| m->key_bytes != sizeof(bpt_key_t)
+			|| m->value_bytes != sizeof(bpt_value)
+			|| m->count_bytes != BPT_COUNT_BYTES
+			|| m->npages < 1 || m->npages > BPT_POOL_MAX_PAGES)
+		return -1;
+	return 0;
+}
+
+int
+bpt_open(bptree* t, const char* path, long pool_pages)
+{
+	struct bpt_pool_meta m;
+	struct bpt_pool* p;
+	struct stat st;
+	int fd;
+
+	/* Pages are protected one by one */
+	if(BPT_PAGE_BYTES % sysconf(_SC_PAGESIZE) != 0){
+		errno = EINVAL;
+		return -1;
+	}
+	fd = open(path, O_RDWR | O_CREAT, 0644);
+	if(fd < 0)
+		return -1;
+	memset(&m, 0, sizeof(m));
+	m.npages = 1;
+	if(fstat(fd, &st) != 0
+			|| (st.st_size > 0 && bpt_pool_read_meta(fd, &m) != 0)){
+		close(fd);
+		return -1;
+	}
+
+	p = my_calloc(sizeof(struct bpt_pool));
+	p->base.alloc = bpt_pool_alloc;
+	p->base.free = bpt_pool_free;
+	p->base.destroy = bpt_pool_destroy;
+	p->t = t;
+	p->fd = fd;
+	p->npages = m.npages;
+	p->file_pages = (st.st_size + BPT_PAGE_BYTES - 1) / BPT_PAGE_BYTES;
+	p->free_head = m.free_head;
+	p->nframes = pool_pages < BPT_POOL_MIN_PAGES
+		? BPT_POOL_MIN_PAGES : pool_pages;
+	p->frames = my_calloc(p->nframes * sizeof(struct bpt_frame));
+	p->buf = my_aligned_calloc(4096, BPT_PAGE_BYTES);
+
+	/* Only the pages in the pool take memory */
+	p->mem = mmap(NULL, BPT_POOL_MAX_PAGES * BPT_PAGE_BYTES, PROT_NONE,
+		MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	p->frame_of = mmap(NULL, BPT_POOL_MAX_PAGES * sizeof(int),
+		PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if(p->mem == MAP_FAILED || p->frame_of == MAP_FAILED){
+		fprintf(stderr, "Memory allocation failed\n");
+		exit(-1);
+	}
+
+	if(! bpt_pool_trap_installed){
+		struct sigaction act;
+		memset(&act, 0, sizeof(act));
+		act.sa_sigaction = bpt_pool_trap;
+		act.sa_flags = SA_SIGINFO;
+		sigemptyset(&act.sa_mask);
+		sigaction(SIGSEGV, &act, &bpt_pool_old_act);
+		bpt_pool_trap_installed = 1;
+	}
+	p->next = bpt_pools;
+	bpt_pools = p;
+
+	bpt_init_alloc(t, &p->base);
+	t->ragged_right = m.ragged_right;
+	t->underfull = m.underfull;
+	if(m.root){
+		/* Only addresses are computed, the pages are read when used */
+		t->root = (bpt_node*) bpt_pool_page(p, m.root);
+		t->rec_list_head.tqh_first =
+			(bpt_node*) bpt_pool_page(p, m.first_leaf);
+		t->rec_list_head.tqh_last = &((bpt_node*) bpt_pool_page(p,
+			m.last_leaf))->recs.l_rec.n.tqe_next;
+	}
+	return 0;
+}
+
+void
+bpt_pool_pin(bptree* t, bpt_node* n)
+{
+	struct bpt_pool* p = bpt_pool_of(t);
+
+	/* Trap the page into the pool, and set its reference bit */
+	*(volatile char*) n;
+	p->frames[p->frame_of[bpt_pool_pid(p, n)] - 1].pins++;
+}
+
+void
+bpt_pool_unpin(bptree* t, bpt_node* n)
+{
+	struct bpt_pool* p = bpt_pool_of(t);
+	struct bpt_frame* f = &p->frames[p->frame_of[bpt_pool_pid(p, n)] - 1];
+
+	assert(f->pins > 0);
+	f->pins--;
+}
+
+long
+bpt_page_id(bptree* t, bpt_node* n)
+{
+	return bpt_pool_pid(bpt_pool_of(t), n);
+}
+
+bpt_node*
+bpt_page_node(bptree* t, long pid)
+{
+	struct bpt_pool* p = bpt_pool_of(t);
+
+	assert(pid > 0 && pid < p->npages);
+	return (bpt_node*) bpt_pool_page(p, pid);
+}
+
+void
+bpt_pool_get_stats(bptree* t, struct bpt_pool_stats* s)
+{
+	*s = bpt_pool_of(t)->stats;
+}
+
+void
+bpt_pool_set_no_steal(bptree* t, int on)
+{
+	bpt_pool_of(t)->no_steal = on;
+}
+
+long
+bpt_pool_dirty_pages(bptree* t)
+{
+	return bpt_pool_of(t)->ndirty;
+}
+
+void
+bpt_pool_dirty_images(bptree* t, bpt_pool_image_fn fn, void* arg)
+{
+	struct bpt_pool* p = bpt_pool_of(t);
+	struct bpt_pool_meta m;
+	long i;
+
+	for(i = 0; i < p->used_frames; i++){
+		struct bpt_frame* f = &p->frames[i];
+		if(! f->dirty)
+			continue;
+		if(f->prot == BPT_PROT_NONE){
+			bpt_pool_protect(p, f, BPT_PROT_READ);
+			bpt_pool_encode(p, f->pid);
+			bpt_pool_protect(p, f, BPT_PROT_NONE);
+		}else bpt_pool_encode(p, f->pid);
+		fn(arg, f->pid, p->buf, BPT_PAGE_BYTES);
+	}
+	bpt_pool_get_meta(p, &m);
+	fn(arg, 0, &m, sizeof(m));
+}
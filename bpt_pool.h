@@ -0,0 +1,107 @@
+/* Copyright(c) Brayden Zhang
+ * Mail: pczhang2010@gmail.com
+ */
+
+#ifndef _BPT_POOL_H
+#define _BPT_POOL_H
+
+#include "bptree.h"
+
+/* Persistent mode of the B-Plus-Tree, by a page file and a buffer pool.
+ *
+ * Each node is a fixed size page of the file, addressed by its page ID; the
+ * links between nodes(children, leaf list) are stored as page IDs. Page 0 is
+ * the meta page, which holds the root, the ends of the leaf list and the
+ * free page list.
+ *
+ * The buffer pool holds at most pool_pages pages in memory. Page i is kept
+ * at base + i * BPT_PAGE_BYTES of a range of reserved virtual memory, so a
+ * page ID and a bpt_node* convert to each other, and bptree.c runs unchanged
+ * on the pages. The pages which are not in the pool are not accessible: the
+ * first access traps(SIGSEGV), and the trap handler reads the page in,
+ * evicting another page. The eviction policy is CLOCK. Its reference bits
+ * are kept by the traps too: the clock hand clears the bit of a page by
+ * making it inaccessible, and the next access traps and sets the bit again.
+ * Clean pages are read only; the first write traps and marks the page dirty.
+ * Dirty pages are written back when evicted, and by bpt_flush.
+ *
+ * Limitations:
+ * 1. Only one thread may use a persistent tree, and not in thread-safe mode;
+ * 2. Record pointers are stored as they are: a tree which is opened again
+ *    should use them as values(eg. row IDs), or point into storage which
+ *    outlives the process;
+ * 3. Each page in the pool may take a memory mapping of the process, so
+ *    pool_pages should be well below vm.max_map_count(65530 by default).
+ */
+
+/* Size of a page: the node size rounded up to 4 KiB, the unit of memory
+ * protection. Compile with -DBPT_NODE_BYTES=4096 so that a node fills its
+ * page.
+ */
+#define BPT_PAGE_BYTES (((BPT_LEAF_NODE_SIZE > BPT_INDEX_NODE_SIZE \
+		? BPT_LEAF_NODE_SIZE : BPT_INDEX_NODE_SIZE) + 4095) / 4096 * 4096)
+
+/* Max pages of a file, ie. the size of the virtual memory reserved for it */
+#ifndef BPT_POOL_MAX_PAGES
+#define BPT_POOL_MAX_PAGES (1L << 24)
+#endif
+
+/* Min pages of the pool. A copy between two nodes needs both in memory. */
+#define BPT_POOL_MIN_PAGES 8
+
+/* Counters of the buffer pool */
+struct bpt_pool_stats
+{
+	/* Pages read from and written to the file */
+	long reads;
+	long writes;
+
+	/* Pages evicted from the pool */
+	long evictions;
+
+	/* All traps, including those to set reference and dirty bits */
+	long traps;
+};
+
+/* Open the tree in the file at path, or create an empty one if the file does
+ * not exist or is empty, with a buffer pool of pool_pages pages. Return 0,
+ * or -1 with errno set if the file can not be opened or was written with
+ * another page size or fanout. t must not be moved while it is open.
+ */
+int bpt_open (bptree* t, const char* path, long pool_pages);
+
+/* Write back the dirty pages and the meta page, and sync the file */
+void bpt_flush (bptree* t);
+
+/* Flush and close the file, and release the pool; t is an empty in-memory
+ * tree after that. bpt_destroy does the same for a persistent tree.
+ */
+void bpt_close (bptree* t);
+
+/* Keep the page of node n in the pool until it is unpinned. Pins nest. */
+void bpt_pool_pin (bptree* t, bpt_node* n);
+void bpt_pool_unpin (bptree* t, bpt_node* n);
+
+/* Page ID of node n, and node of page ID pid */
+long bpt_page_id (bptree* t, bpt_node* n);
+bpt_node* bpt_page_node (bptree* t, long pid);
+
+/* Copy the counters of the pool into s */
+void bpt_pool_get_stats (bptree* t, struct bpt_pool_stats* s);
+
+/* For a write-ahead log(see bpt_wal.h): if no_steal is on, dirty pages are
+ * not evicted, so the file only changes by bpt_flush.
+ */
+void bpt_pool_set_no_steal (bptree* t, int on);
+long bpt_pool_dirty_pages (bptree* t);
+
+/* Call fn with the image of each dirty page as it is written to the file, 
+ * then with the image of the meta page(pid 0, shorter than a page). Writing
+ * len bytes of the images at pid * BPT_PAGE_BYTES of the file has the same 
+ * effect as bpt_flush.
+ */
+typedef void (*bpt_pool_image_fn) (void* arg, long pid, const void* image,
+		size_t len);
+void bpt_pool_dirty_images (bptree* t, bpt_pool_image_fn fn, void* arg);
+
+#endif /* end of _BPT_POOL_H */
@@ -0,0 +1,610 @@
+/* Copyright(c) Brayden Zhang
+ * Mail: pczhang2010@gmail.com
+ */
+#include <assert.h>
+#include <sched.h>
+#include <time.h>
+
+#include "bpt_shard.h"
+
+/* A shard with fewer records is not split */
+#ifndef BPT_SHARD_MIN_SPLIT
+#define BPT_SHARD_MIN_SPLIT 1024
+#endif
+
+/* Polls of an empty queue before the worker sleeps */
+#define BPT_SHARD_SPINS 64
+
+/* Types of the operations */
+enum
+{
+	BPT_SHARD_INSERT,
+	BPT_SHARD_DELETE,
+	BPT_SHARD_GET,
+	BPT_SHARD_SCAN,
+	BPT_SHARD_SYNC,
+	BPT_SHARD_STOP
+};
+
+/* Index of the shard of key k: the last one whose lower bound <= k. The
+ * first shard has no lower bound.
+ */
+static int
+bpt_shard_route(struct bpt_shard_map* m, bpt_key_t k)
+{
+	int a = 0, b = m->n;
+	while(b - a > 1){
+		int mid = (a + b) / 2;
+		if(m->lo[mid] <= k)
+			a = mid;
+		else b = mid;
+	}
+	return a;
+}
+
+/* Put op into the queue of sh, return 0 if the queue is full. A producer
+ * takes a slot by moving the tail, then fills it and marks it filled.
+ */
+static int
+bpt_shard_enqueue(struct bpt_shard* sh, struct bpt_shard_op* op)
+{
+	unsigned long pos = __atomic_load_n(&sh->tail, __ATOMIC_RELAXED);
+	struct bpt_shard_cell* c;
+
+	for(;;){
+		c = &sh->cells[pos & (BPT_SHARD_QUEUE - 1)];
+		long d = (long) (__atomic_load_n(&c->seq, __ATOMIC_ACQUIRE)
+				- pos);
+		if(d == 0){
+			if(__atomic_compare_exchange_n(&sh->tail, &pos, pos + 1,
+					1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+				break;
+		}else if(d < 0)
+			return 0;
+		else pos = __atomic_load_n(&sh->tail, __ATOMIC_RELAXED);
+	}
+	c->op = *op;
+	__atomic_store_n(&c->seq, pos + 1, __ATOMIC_RELEASE);
+	return 1;
+}
+
+/* If the slot at the head of the queue is filled */
+static int
+bpt_shard_ready(struct bpt_shard* sh)
+{
+	struct bpt_shard_cell* c = &sh->cells[sh->head & (BPT_SHARD_QUEUE - 1)];
+	return __atomic_load_n(&c->seq, __ATOMIC_SEQ_CST) == sh->head + 1;
+}
+
+/* Take the operation at the head of the queue, return 0 if it is empty */
+static int
+bpt_shard_dequeue(struct bpt_shard* sh, struct bpt_shard_op* op)
+{
+	struct bpt_shard_cell* c = &sh->cells[sh->head & (BPT_SHARD_QUEUE - 1)];
+
+	if(__atomic_load_n(&c->seq, __ATOMIC_ACQUIRE) != sh->head + 1)
+		return 0;
+	*op = c->op;
+	/* Free for the next round of the queue */
+	__atomic_store_n(&c->seq, sh->head + BPT_SHARD_QUEUE, __ATOMIC_RELEASE);
+	sh->head++;
+	return 1;
+}
+
+/* Wake the worker of sh if it sleeps, after an operation is queued */
+static void
+bpt_shard_wake(struct bpt_shard* sh)
+{
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if(__atomic_load_n(&sh->sleeping, __ATOMIC_SEQ_CST)){
+		pthread_mutex_lock(&sh->lock);
+		pthread_cond_signal(&sh->wake);
+		pthread_mutex_unlock(&sh->lock);
+	}
+}
+
+/* Sleep until an operation is queued, or 1 ms passed. The producer sees
+ * sleeping set, or the worker sees the operation.
+ */
+static void
+bpt_shard_sleep(struct bpt_shard* sh)
+{
+	struct timespec ts;
+
+	pthread_mutex_lock(&sh->lock);
+	__atomic_store_n(&sh->sleeping, 1, __ATOMIC_SEQ_CST);
+	if(! bpt_shard_ready(sh)){
+		clock_gettime(CLOCK_REALTIME, &ts);
+		ts.tv_nsec += 1000000;
+		if(ts.tv_nsec >= 1000000000){
+			ts.tv_sec++;
+			ts.tv_nsec -= 1000000000;
+		}
+		pthread_cond_timedwait(&sh->wake, &sh->lock, &ts);
+	}
+	__atomic_store_n(&sh->sleeping, 0, __ATOMIC_RELAXED);
+	pthread_mutex_unlock(&sh->lock);
+}
+
+/* Apply op to the tree of sh, return 1 for a stop */
+static int
+bpt_shard_apply(struct bpt_shard* sh, struct bpt_shard_op* op)
+{
+	struct bpt_shard_wait* w = op->wait;
+	bpt_cursor c;
+
+	switch(op->type){
+	case BPT_SHARD_INSERT:
+		bpt_insert(&sh->t, op->k, op->v);
+		__atomic_store_n(&sh->records, sh->records + 1,
+				__ATOMIC_RELAXED);
+		break;
+	case BPT_SHARD_DELETE:
+		bpt_delete(&sh->t, op->k, op->v);
+		__atomic_store_n(&sh->records, sh->records - 1,
+				__ATOMIC_RELAXED);
+		break;
+	case BPT_SHARD_GET:
+		w->r = bpt_get(&sh->t, op->k);
+		break;
+	case BPT_SHARD_SCAN:
+		/* Up to the end of the scan or of the shard */
+		w->has_next = sh->has_hi && sh->hi < w->end;
+		w->next = sh->hi;
+		bpt_cursor_seek(&sh->t, &c, op->k);
+		bpt_cursor_set_end(&c, w->has_next ? sh->hi : w->end);
+		for(; bpt_cursor_valid(&c); bpt_cursor_next(&c), w->n++)
+			w->fn(w->arg, bpt_cursor_key(&c),
+				bpt_cursor_record(&c));
+		break;
+	case BPT_SHARD_STOP:
+		return 1;
+	}
+	return 0;
+}
+
+static void*
+bpt_shard_worker(void* p)
+{
+	struct bpt_shard* sh = (struct bpt_shard*) p;
+	struct bpt_shard_op op;
+	int idle = 0, stop;
+
+	for(;;){
+		if(! bpt_shard_dequeue(sh, &op)){
+			if(++idle < BPT_SHARD_SPINS)
+				sched_yield();
+			else{
+				bpt_shard_sleep(sh);
+				idle = 0;
+			}
+			continue;
+		}
+		idle = 0;
+		stop = bpt_shard_apply(sh, &op);
+		__atomic_store_n(&sh->applied, sh->applied + 1,
+				__ATOMIC_RELEASE);
+		/* The waiting caller may free op.wait after that */
+		if(op.wait)
+			__atomic_store_n(&op.wait->done, 1, __ATOMIC_RELEASE);
+		if(stop)
+			return NULL;
+	}
+}
+
+static struct bpt_shard*
+bpt_shard_create()
+{
+	struct bpt_shard* sh = (struct bpt_shard*) my_aligned_calloc(
+			BPT_CACHE_LINE, sizeof(struct bpt_shard));
+	long i;
+
+	bpt_init_alloc(&sh->t, bpt_slab_allocator_create(0));
+	sh->cells = (struct bpt_shard_cell*) my_calloc(
+			BPT_SHARD_QUEUE * sizeof(struct bpt_shard_cell));
+	for(i = 0; i < BPT_SHARD_QUEUE; i++)
+		sh->cells[i].seq = i;
+	pthread_mutex_init(&sh->lock, NULL);
+	pthread_cond_init(&sh->wake, NULL);
+	return sh;
+}
+
+/* Stop the worker of sh after it applies its queue, and free its tree */
+static void
+bpt_shard_stop(struct bpt_shard* sh)
+{
+	struct bpt_shard_op op;
+
+	memset(&op, 0, sizeof(op));
+	op.type = BPT_SHARD_STOP;
+	while(! bpt_shard_enqueue(sh, &op))
+		sched_yield();
+	bpt_shard_wake(sh);
+	pthread_join(sh->worker, NULL);
+	bpt_destroy(&sh->t);
+	free(sh->cells);
+	sh->cells = NULL;
+	pthread_mutex_destroy(&sh->lock);
+	pthread_cond_destroy(&sh->wake);
+}
+
+void
+bpt_shards_init(bpt_shards* s, int n, bpt_key_t lo, bpt_key_t hi)
+{
+	struct bpt_shard_map* m = (struct bpt_shard_map*) my_calloc(
+			sizeof(struct bpt_shard_map));
+	int i;
+
+	assert(n >= 1 && n <= BPT_SHARD_MAX && lo < hi);
+	m->n = n;
+	for(i = 0; i < n; i++){
+		struct bpt_shard* sh = bpt_shard_create();
+		m->lo[i] = lo + (hi - lo) / n * i;
+		sh->lo = m->lo[i];
+		sh->has_lo = i > 0;
+		m->shard[i] = sh;
+		if(i > 0){
+			m->shard[i - 1]->hi = m->lo[i];
+			m->shard[i - 1]->has_hi = 1;
+		}
+	}
+	for(i = 0; i < n; i++)
+		pthread_create(&m->shard[i]->worker, NULL, bpt_shard_worker,
+				m->shard[i]);
+	s->map = m;
+	pthread_mutex_init(&s->lock, NULL);
+	s->retired = NULL;
+	s->splits = 0;
+	s->merges = 0;
+}
+
+void
+bpt_shards_destroy(bpt_shards* s)
+{
+	struct bpt_shard_map* m = s->map;
+	struct bpt_shard* sh;
+	int i;
+
+	for(i = 0; i < m->n; i++){
+		bpt_shard_stop(m->shard[i]);
+		free(m->shard[i]);
+	}
+	while((sh = s->retired) != NULL){
+		s->retired = sh->next;
+		free(sh);
+	}
+	while(m){
+		struct bpt_shard_map* old = m->old;
+		free(m);
+		m = old;
+	}
+	pthread_mutex_destroy(&s->lock);
+}
+
+/* Route op by its key and queue it. A caller of a frozen shard, or which
+ * routed by an old map, waits and routes again. inflight tells a rebalance
+ * that callers are between routing and waking the worker.
+ */
+static void
+bpt_shards_push(bpt_shards* s, struct bpt_shard_op* op)
+{
+	for(;;){
+		struct bpt_shard_map* m = __atomic_load_n(&s->map,
+				__ATOMIC_ACQUIRE);
+		struct bpt_shard* sh = m->shard[bpt_shard_route(m, op->k)];
+		int ok = 0;
+
+		__atomic_fetch_add(&sh->inflight, 1, __ATOMIC_SEQ_CST);
+		if(! __atomic_load_n(&sh->frozen, __ATOMIC_SEQ_CST)
+				&& __atomic_load_n(&s->map, __ATOMIC_SEQ_CST)
+					== m)
+			ok = bpt_shard_enqueue(sh, op);
+		/* Wake while still in flight: a merge waits for that before
+		 * it stops the worker and destroys the lock of sh.
+		 */
+		if(ok)
+			bpt_shard_wake(sh);
+		__atomic_fetch_sub(&sh->inflight, 1, __ATOMIC_SEQ_CST);
+		if(ok)
+			return;
+		sched_yield();
+	}
+}
+
+/* Queue op and wait for its result */
+static void
+bpt_shards_call(bpt_shards* s, struct bpt_shard_op* op)
+{
+	op->wait->done = 0;
+	bpt_shards_push(s, op);
+	while(! __atomic_load_n(&op->wait->done, __ATOMIC_ACQUIRE))
+		sched_yield();
+}
+
+void
+bpt_shards_insert(bpt_shards* s, bpt_key_t k, bpt_record_t* v)
+{
+	struct bpt_shard_op op = {BPT_SHARD_INSERT, k, v, NULL};
+	bpt_shards_push(s, &op);
+}
+
+void
+bpt_shards_delete(bpt_shards* s, bpt_key_t k, bpt_record_t* v)
+{
+	struct bpt_shard_op op = {BPT_SHARD_DELETE, k, v, NULL};
+	bpt_shards_push(s, &op);
+}
+
+bpt_record_t*
+bpt_shards_get(bpt_shards* s, bpt_key_t k)
+{
+	struct bpt_shard_wait w;
+	struct bpt_shard_op op = {BPT_SHARD_GET, k, NULL, &w};
+
+	bpt_shards_call(s, &op);
+	return w.r;
+}
+
+long
+bpt_shards_scan(bpt_shards* s, bpt_key_t lo, bpt_key_t hi,
+		bpt_shard_scan_fn fn, void* arg)
+{
+	struct bpt_shard_wait w;
+	struct bpt_shard_op op = {BPT_SHARD_SCAN, lo, NULL, &w};
+
+	memset(&w, 0, sizeof(w));
+	w.end = hi;
+	w.fn = fn;
+	w.arg = arg;
+	/* The shard scans up to its upper bound, then the next one goes on
+	 * from there, by the map of that time.
+	 */
+	while(op.k < hi){
+		bpt_shards_call(s, &op);
+		if(! w.has_next)
+			break;
+		op.k = w.next;
+	}
+	return w.n;
+}
+
+/* A shard which was rebalanced after the map was read has applied all the
+ * operations queued to it before.
+ */
+void
+bpt_shards_flush(bpt_shards* s)
+{
+	struct bpt_shard_map* m = __atomic_load_n(&s->map, __ATOMIC_ACQUIRE);
+	struct bpt_shard_wait w;
+	struct bpt_shard_op op = {BPT_SHARD_SYNC, 0, NULL, &w};
+	int i;
+
+	for(i = 0; i < m->n; i++){
+		op.k = m->lo[i];
+		bpt_shards_call(s, &op);
+	}
+}
+
+/* Stop the callers of sh and wait until it applied its queue. Then only the
+ * caller changes sh and its tree, until bpt_shard_thaw.
+ */
+static void
+bpt_shard_freeze(struct bpt_shard* sh)
+{
+	__atomic_store_n(&sh->frozen, 1, __ATOMIC_SEQ_CST);
+	while(__atomic_load_n(&sh->inflight, __ATOMIC_SEQ_CST) > 0)
+		sched_yield();
+	while(__atomic_load_n(&sh->applied, __ATOMIC_ACQUIRE)
+			!= __atomic_load_n(&sh->tail, __ATOMIC_SEQ_CST))
+		sched_yield();
+}
+
+static void
+bpt_shard_thaw(struct bpt_shard* sh)
+{
+	__atomic_store_n(&sh->frozen, 0, __ATOMIC_SEQ_CST);
+}
+
+/* Copy the records of the tree of sh with keys >= k, from the first one if
+ * all is set, into keys and recs. Return their number.
+ */
+static long
+bpt_shard_collect(struct bpt_shard* sh, bpt_key_t k, int all,
+		bpt_key_t* keys, bpt_record_t** recs)
+{
+	bpt_cursor c;
+	long n = 0;
+
+	if(all){
+		bpt_node* l = TAILQ_FIRST(&sh->t.rec_list_head);
+		if(l == NULL || l->num_of_rec == 0)
+			return 0;
+		k = l->recs.l_rec.key[0];
+	}
+	for(bpt_cursor_seek(&sh->t, &c, k); bpt_cursor_valid(&c);
+			bpt_cursor_next(&c), n++){
+		keys[n] = bpt_cursor_key(&c);
+		recs[n] = bpt_cursor_record(&c);
+	}
+	return n;
+}
+
+/* Publish map m1, which replaces s->map */
+static void
+bpt_shards_publish(bpt_shards* s, struct bpt_shard_map* m1)
+{
+	m1->old = s->map;
+	__atomic_store_n(&s->map, m1, __ATOMIC_SEQ_CST);
+}
+
+/* Split shard i at the median of its keys, the upper half goes to a new
+ * shard. Return 0 if all its records have one key.
+ */
+static int
+bpt_shards_split(bpt_shards* s, int i)
+{
+	struct bpt_shard_map* m = s->map;
+	struct bpt_shard_map* m1;
+	struct bpt_shard* sh = m->shard[i];
+	struct bpt_shard* sh1;
+	bpt_key_t* keys;
+	bpt_record_t** recs;
+	bpt_key_t mid;
+	long n, j;
+
+	bpt_shard_freeze(sh);
+	keys = (bpt_key_t*) my_calloc(sh->records * sizeof(bpt_key_t) + 1);
+	recs = (bpt_record_t**) my_calloc(sh->records * sizeof(void*) + 1);
+	n = bpt_shard_collect(sh, 0, 1, keys, recs);
+	assert(n == sh->records);
+
+	/* The records of the median key all go to the new shard */
+	for(j = n / 2; j > 0 && keys[j - 1] == keys[j]; j--)
+		;
+	if(j == 0)
+		for(j = n / 2; j < n && keys[j] == keys[0]; j++)
+			;
+	if(j == n){
+		bpt_shard_thaw(sh);
+		free(keys);
+		free(recs);
+		return 0;
+	}
+	mid = keys[j];
+
+	sh1 = bpt_shard_create();
+	bpt_bulk_load(&sh1->t, keys + j, recs + j, n - j, 0.7);
+	sh1->records = n - j;
+	if(sh->has_hi)
+		bpt_delete_range(&sh->t, mid, sh->hi);
+	else{
+		/* No key above the last one to end the range at */
+		bpt_delete_range(&sh->t, mid, keys[n - 1]);
+		for(; j < n; j++)
+			if(keys[j] == keys[n - 1]){
+				bpt_node* l = TAILQ_LAST(&sh->t.rec_list_head,
+						rec_list);
+				bpt_value x = l->recs.l_rec.r_arr[
+						l->num_of_rec - 1];
+				bpt_delete(&sh->t, keys[j], bpt_value_rec(&x));
+			}
+	}
+	sh->records = n - sh1->records;
+
+	sh1->lo = mid;
+	sh1->has_lo = 1;
+	sh1->hi = sh->hi;
+	sh1->has_hi = sh->has_hi;
+	sh->hi = mid;
+	sh->has_hi = 1;
+
+	m1 = (struct bpt_shard_map*) my_calloc(sizeof(struct bpt_shard_map));
+	*m1 = *m;
+	memmove(m1->lo + i + 2, m1->lo + i + 1,
+			(m->n - i - 1) * sizeof(bpt_key_t));
+	memmove(m1->shard + i + 2, m1->shard + i + 1,
+			(m->n - i - 1) * sizeof(struct bpt_shard*));
+	m1->lo[i + 1] = mid;
+	m1->shard[i + 1] = sh1;
+	m1->n++;
+	pthread_create(&sh1->worker, NULL, bpt_shard_worker, sh1);
+	bpt_shards_publish(s, m1);
+	bpt_shard_thaw(sh);
+	s->splits++;
+	free(keys);
+	free(recs);
+	return 1;
+}
+
+/* Merge shard i + 1 into shard i. The merged shard stays frozen, callers
+ * which routed by the old map route again.
+ */
+static void
+bpt_shards_merge(bpt_shards* s, int i)
+{
+	struct bpt_shard_map* m = s->map;
+	struct bpt_shard_map* m1;
+	struct bpt_shard* sh = m->shard[i];
+	struct bpt_shard* sh1 = m->shard[i + 1];
+	bpt_key_t* keys;
+	bpt_record_t** recs;
+	long n;
+
+	bpt_shard_freeze(sh);
+	bpt_shard_freeze(sh1);
+	keys = (bpt_key_t*) my_calloc(sh1->records * sizeof(bpt_key_t) + 1);
+	recs = (bpt_record_t**) my_calloc(sh1->records * sizeof(void*) + 1);
+	n = bpt_shard_collect(sh1, 0, 1, keys, recs);
+	/* The keys are above the ones of sh, so they are appended */
+	bpt_insert_batch(&sh->t, keys, recs, n, 1);
+	sh->records += n;
+	sh->hi = sh1->hi;
+	sh->has_hi = sh1->has_hi;
+
+	m1 = (struct bpt_shard_map*) my_calloc(sizeof(struct bpt_shard_map));
+	*m1 = *m;
+	memmove(m1->lo + i + 1, m1->lo + i + 2,
+			(m->n - i - 2) * sizeof(bpt_key_t));
+	memmove(m1->shard + i + 1, m1->shard + i + 2,
+			(m->n - i - 2) * sizeof(struct bpt_shard*));
+	m1->n--;
+	bpt_shards_publish(s, m1);
+	bpt_shard_thaw(sh);
+
+	bpt_shard_stop(sh1);
+	sh1->next = s->retired;
+	s->retired = sh1;
+	s->merges++;
+	free(keys);
+	free(recs);
+}
+
+/* Operations queued to the shards since the last rebalance tell how hot
+ * they are, if there were enough of them. Split the hottest shard if it got
+ * more than 1.5 times the average, or else the largest one if it holds more
+ * than 1.5 times the average.
+ * Otherwise merge the two neighbors with the fewest records, if they hold
+ * and got less than half the average together.
+ */
+int
+bpt_shards_rebalance(bpt_shards* s)
+{
+	struct bpt_shard_map* m;
+	long r[BPT_SHARD_MAX], d[BPT_SHARD_MAX], sum_r = 0, sum_d = 0;
+	int i, hot = 0, big = 0, low = -1, done = 0;
+
+	pthread_mutex_lock(&s->lock);
+	m = s->map;
+	for(i = 0; i < m->n; i++){
+		struct bpt_shard* sh = m->shard[i];
+		unsigned long a = __atomic_load_n(&sh->tail,
+				__ATOMIC_RELAXED);
+		r[i] = __atomic_load_n(&sh->records, __ATOMIC_RELAXED);
+		d[i] = a - sh->tail_last;
+		sh->tail_last = a;
+		sum_r += r[i];
+		sum_d += d[i];
+		if(d[i] > d[hot])
+			hot = i;
+		if(r[i] > r[big])
+			big = i;
+		if(i > 0 && (low < 0 || r[i - 1] + r[i] < r[low] + r[low + 1]))
+			low = i - 1;
+	}
+
+	if(m->n < BPT_SHARD_MAX){
+		if(sum_d >= BPT_SHARD_MIN_SPLIT && 2 * d[hot] * m->n > 3 * sum_d
+				&& r[hot] >= BPT_SHARD_MIN_SPLIT)
+			done = bpt_shards_split(s, hot);
+		if(! done && 2 * r[big] * m->n > 3 * sum_r
+				&& r[big] >= BPT_SHARD_MIN_SPLIT)
+			done = bpt_shards_split(s, big);
+	}
+	if(! done && low >= 0 && (r[low] + r[low + 1]) * m->n * 2 < sum_r
+			&& (d[low] + d[low + 1]) * m->n * 2 <= sum_d){
+		bpt_shards_merge(s, low);
+		done = 1;
+	}
+	pthread_mutex_unlock(&s->lock);
+	return done;
+}
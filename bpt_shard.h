@@ -0,0 +1,177 @@
+/* Copyright(c) Brayden Zhang
+ * Mail: pczhang2010@gmail.com
+ */
+
+#ifndef _BPT_SHARD_H
+#define _BPT_SHARD_H
+
+#include <pthread.h>
+
+#include "bptree.h"
+
+/* Front-end of independent B-Plus-Trees split by key range, for writes that
+ * scale with the cores. Each shard holds the keys of one range in its own
+ * tree and slab allocator, and only its worker thread changes the tree, so
+ * the trees need no locks and no hot upper levels are shared. Callers route
+ * an operation to the shard of its key and push it into the queue of the
+ * shard: a bounded lock-free queue of many producers and one consumer.
+ * Inserts and deletes return when queued; gets and scans wait for their
+ * results.
+ *
+ * bpt_shards_rebalance splits a shard which holds or gets much more than
+ * the average(at the median of its keys, into a new shard and worker), or
+ * merges two neighbor shards which hold and get little. It runs while the
+ * callers go on: the shards being changed are frozen, callers of them wait
+ * until the shards have applied their queues and the new ranges are
+ * published, so the operations on each key stay in order.
+ */
+
+/* Max number of shards */
+#ifndef BPT_SHARD_MAX
+#define BPT_SHARD_MAX 64
+#endif
+
+/* Number of operations a queue holds, a power of two */
+#ifndef BPT_SHARD_QUEUE
+#define BPT_SHARD_QUEUE 4096
+#endif
+
+/* Callback of bpt_shards_scan, called in the worker thread of a shard */
+typedef void (*bpt_shard_scan_fn) (void* arg, bpt_key_t k, bpt_record_t* v);
+
+/* A caller waiting for the result of an operation */
+struct bpt_shard_wait
+{
+	int done;
+
+	/* Result of a get */
+	bpt_record_t* r;
+
+	/* A scan from the key of the operation up to end(exclusive), and the
+	 * key the next shard starts at, if it is before end.
+	 */
+	bpt_key_t end;
+	bpt_key_t next;
+	int has_next;
+	bpt_shard_scan_fn fn;
+	void* arg;
+	long n;
+};
+
+/* Operation in the queue of a shard */
+struct bpt_shard_op
+{
+	int type;
+	bpt_key_t k;
+	bpt_record_t* v;
+	struct bpt_shard_wait* wait;
+};
+
+/* Slot of a queue. seq tells whether the slot is free or filled for the
+ * current round of the queue.
+ */
+struct bpt_shard_cell
+{
+	unsigned long seq;
+	struct bpt_shard_op op;
+};
+
+struct bpt_shard
+{
+	/* Range of the keys, [lo, hi). No bound on a side if has_lo or
+	 * has_hi is 0. Changed only while the shard is frozen.
+	 */
+	bpt_key_t lo;
+	bpt_key_t hi;
+	int has_lo;
+	int has_hi;
+
+	bptree t;
+	pthread_t worker;
+	struct bpt_shard_cell* cells;
+
+	/* Shared by the producers: the next slot, the producers between
+	 * routing and waking the worker, and the freeze of a rebalance.
+	 */
+	unsigned long tail __attribute__ ((aligned (BPT_CACHE_LINE)));
+	long inflight;
+	int frozen;
+	int sleeping;
+
+	/* The worker's: next slot to take, the operations applied, and the
+	 * number of records in the tree. tail_last is the tail at the last
+	 * rebalance.
+	 */
+	unsigned long head __attribute__ ((aligned (BPT_CACHE_LINE)));
+	unsigned long applied;
+	long records;
+	unsigned long tail_last;
+
+	/* The worker sleeps on them when its queue is empty */
+	pthread_mutex_t lock;
+	pthread_cond_t wake;
+
+	/* Next one in the list of retired shards */
+	struct bpt_shard* next;
+} __attribute__ ((aligned (BPT_CACHE_LINE)));
+
+/* Ranges of the shards: shard[i] holds the keys in [lo[i], lo[i + 1]). A
+ * rebalance publishes a new map, the old ones are freed by destroy since
+ * callers may still route by them.
+ */
+struct bpt_shard_map
+{
+	int n;
+	bpt_key_t lo[BPT_SHARD_MAX];
+	struct bpt_shard* shard[BPT_SHARD_MAX];
+	struct bpt_shard_map* old;
+};
+
+typedef struct __bpt_shards bpt_shards;
+struct __bpt_shards
+{
+	struct bpt_shard_map* map;
+
+	/* Serializes the rebalances */
+	pthread_mutex_t lock;
+
+	/* Shards merged into their neighbors */
+	struct bpt_shard* retired;
+
+	/* Counters of the rebalances */
+	long splits;
+	long merges;
+};
+
+/* Functions of the sharded tree, implemented in bpt_shard.c. init starts n
+ * shards, splitting [lo, hi) evenly; the first and the last shards also
+ * hold the keys out of it.
+ */
+void bpt_shards_init (bpt_shards* s, int n, bpt_key_t lo, bpt_key_t hi);
+void bpt_shards_destroy (bpt_shards* s);
+
+/* Queue an insert or a delete. As bpt_delete, the pair should be in the
+ * tree when the delete is applied.
+ */
+void bpt_shards_insert (bpt_shards* s, bpt_key_t k, bpt_record_t* v);
+void bpt_shards_delete (bpt_shards* s, bpt_key_t k, bpt_record_t* v);
+
+/* Get the record of k, after the operations queued before by this thread */
+bpt_record_t* bpt_shards_get (bpt_shards* s, bpt_key_t k);
+
+/* Call fn on the records with keys in [lo, hi) in key order, shard after
+ * shard, and return their number. Each shard is scanned at once, but the
+ * shards at different times.
+ */
+long bpt_shards_scan (bpt_shards* s, bpt_key_t lo, bpt_key_t hi,
+		bpt_shard_scan_fn fn, void* arg);
+
+/* Wait until the operations queued before by this thread are applied */
+void bpt_shards_flush (bpt_shards* s);
+
+/* Split a shard or merge two, see above. Return 1 if a shard was split or
+ * merged, 0 if the shards are balanced.
+ */
+int bpt_shards_rebalance (bpt_shards* s);
+
+#endif /* end of _BPT_SHARD_H */
@@ -0,0 +1,881 @@
+/* Copyright(c) Brayden Zhang
+ * Mail: pczhang2010@gmail.com
+ */
+#include <assert.h>
+#include <errno.h>
+
+#include "bpt_str.h"
+
+#define BPT_STR_HDR_BYTES ((int) offsetof(bpt_str_node, slot))
+
+/* Bytes of an entry besides its key: the slot and the pointer */
+#define BPT_STR_ENT_BYTES ((int) (sizeof(struct bpt_str_slot) \
+		+ sizeof(void*)))
+
+/* Max number of entries of a node being rebuilt: a full node, the entry
+ * inserted and the separator of a merge.
+ */
+#define BPT_STR_MAX_ENTS ((BPT_STR_NODE_BYTES - BPT_STR_HDR_BYTES) \
+		/ BPT_STR_ENT_BYTES + 2)
+
+/* A key in two parts, eg. the prefix of a node and the rest of the key */
+struct bpt_str_key
+{
+	const unsigned char* a;
+	int alen;
+	const unsigned char* b;
+	int blen;
+};
+
+/* An entry to rebuild a node with: the key and the pointer */
+struct bpt_str_ent
+{
+	struct bpt_str_key k;
+	void* p;
+};
+
+/* The root-to-leaf path of a descent, as bpt_path */
+struct bpt_str_path
+{
+	int depth;
+	bpt_str_node* node[BPT_STR_MAX_HEIGHT];
+	int slot[BPT_STR_MAX_HEIGHT];
+};
+
+static const struct bpt_str_key bpt_str_empty = {NULL, 0, NULL, 0};
+
+static bpt_str_node*
+bpt_str_new_node(bpt_str* t, int leaf)
+{
+	bpt_str_node* n = (bpt_str_node*) my_aligned_calloc(BPT_CACHE_LINE,
+		BPT_STR_NODE_BYTES);
+	n->leaf = leaf;
+	n->heap = BPT_STR_NODE_BYTES;
+	t->nodes++;
+	return n;
+}
+
+static void
+bpt_str_free_node(bpt_str* t, bpt_str_node* n)
+{
+	free(n);
+	t->nodes--;
+}
+
+void
+bpt_str_init(bpt_str* t)
+{
+	memset(t, 0, sizeof(*t));
+	t->tmp[0] = (bpt_str_node*) my_aligned_calloc(BPT_CACHE_LINE,
+		BPT_STR_NODE_BYTES);
+	t->tmp[1] = (bpt_str_node*) my_aligned_calloc(BPT_CACHE_LINE,
+		BPT_STR_NODE_BYTES);
+	t->ents = (struct bpt_str_ent*) my_calloc(BPT_STR_MAX_ENTS
+		* sizeof(struct bpt_str_ent));
+}
+
+static void
+bpt_str_free_subtree(bpt_str* t, bpt_str_node* n)
+{
+	int i;
+	if(! n->leaf){
+		for(i = 0; i < n->n; i++){
+			bpt_str_node* c;
+			memcpy(&c, (char*) n + n->slot[i].off, sizeof(c));
+			bpt_str_free_subtree(t, c);
+		}
+		bpt_str_free_subtree(t, n->last);
+	}
+	bpt_str_free_node(t, n);
+}
+
+void
+bpt_str_destroy(bpt_str* t)
+{
+	if(t->root)
+		bpt_str_free_subtree(t, t->root);
+	free(t->tmp[0]);
+	free(t->tmp[1]);
+	free(t->ents);
+	memset(t, 0, sizeof(*t));
+}
+
+/* Key head of k */
+static inline unsigned int
+bpt_str_head(const unsigned char* k, int len)
+{
+	unsigned int h = 0;
+	int i;
+	for(i = 0; i < 4; i++)
+		h = h << 8 | (i < len ? k[i] : 0);
+	return h;
+}
+
+/* The bytes of the key of slot i, after the prefix */
+static inline unsigned char*
+bpt_str_rem(bpt_str_node* n, int i)
+{
+	return (unsigned char*) n + n->slot[i].off + sizeof(void*);
+}
+
+/* The pointer of slot i, which is not aligned */
+static inline void*
+bpt_str_ptr(bpt_str_node* n, int i)
+{
+	void* p;
+	memcpy(&p, (char*) n + n->slot[i].off, sizeof(p));
+	return p;
+}
+
+static inline void
+bpt_str_set_ptr(bpt_str_node* n, int i, void* p)
+{
+	memcpy((char*) n + n->slot[i].off, &p, sizeof(p));
+}
+
+/* Child i of an index node */
+static inline bpt_str_node*
+bpt_str_child(bpt_str_node* n, int i)
+{
+	return i < n->n ? (bpt_str_node*) bpt_str_ptr(n, i) : n->last;
+}
+
+/* Compare the key of slot i with k, both after the prefix of the node. h is
+ * the head of k.
+ */
+static inline int
+bpt_str_cmp(bpt_str_node* n, int i, unsigned int h, const unsigned char* k,
+		int len)
+{
+	struct bpt_str_slot* s = &n->slot[i];
+	int c;
+
+	if(s->head != h)
+		return s->head < h ? -1 : 1;
+	/* The heads are equal, so is the first 4 bytes. If one key is
+	 * shorter, it is padded with zeros, which are the bytes of the other.
+	 */
+	if(s->len <= 4 || len <= 4)
+		return s->len - len;
+	c = memcmp(bpt_str_rem(n, i) + 4, k + 4,
+		(s->len < len ? s->len : len) - 4);
+	return c ? c : s->len - len;
+}
+
+/* The first slot whose key is >= k, or > k if upper is 1. k has the prefix
+ * of the node.
+ */
+static inline int
+bpt_str_search(bpt_str_node* n, const unsigned char* k, int len, int upper)
+{
+	unsigned int h;
+	int lo = 0, hi = n->n;
+
+	k += n->prefix_len;
+	len -= n->prefix_len;
+	h = bpt_str_head(k, len);
+	while(lo < hi){
+		int mid = (lo + hi) / 2;
+		if(bpt_str_cmp(n, mid, h, k, len) < upper)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+/* The child of an index node to descend to for key k */
+static inline bpt_str_node*
+bpt_str_child_of(bpt_str_node* n, const unsigned char* k, int len)
+{
+	return bpt_str_child(n, bpt_str_search(n, k, len, 1));
+}
+
+/* If slot i of node n holds key k */
+static inline int
+bpt_str_is(bpt_str_node* n, int i, const unsigned char* k, int len)
+{
+	k += n->prefix_len;
+	len -= n->prefix_len;
+	return i < n->n && bpt_str_cmp(n, i, bpt_str_head(k, len), k, len)
+		== 0;
+}
+
+static bpt_str_node*
+bpt_str_descend(bpt_str* t, const unsigned char* k, int len,
+		struct bpt_str_path* path)
+{
+	bpt_str_node* n = t->root;
+	int i;
+
+	path->depth = 0;
+	while(! n->leaf){
+		i = bpt_str_search(n, k, len, 1);
+		path->node[path->depth++] = n;
+		path->slot[path->depth] = i;
+		n = bpt_str_child(n, i);
+	}
+	path->node[path->depth++] = n;
+	return n;
+}
+
+bpt_record_t*
+bpt_str_get(bpt_str* t, const void* key, int len)
+{
+	bpt_str_node* n = t->root;
+	int i;
+
+	if(n == NULL)
+		return NULL;
+	while(! n->leaf)
+		n = bpt_str_child_of(n, key, len);
+	i = bpt_str_search(n, key, len, 0);
+	return bpt_str_is(n, i, key, len)
+		? (bpt_record_t*) bpt_str_ptr(n, i) : NULL;
+}
+
+/* Free bytes between the slots and the entries */
+static inline int
+bpt_str_free(bpt_str_node* n)
+{
+	return n->heap - BPT_STR_HDR_BYTES
+		- n->n * (int) sizeof(struct bpt_str_slot);
+}
+
+/* Bytes of the node in use, ie. after a compaction */
+static inline int
+bpt_str_live(bpt_str_node* n)
+{
+	return BPT_STR_NODE_BYTES - bpt_str_free(n) - n->dead;
+}
+
+static inline int
+bpt_str_key_len(const struct bpt_str_key* k)
+{
+	return k->alen + k->blen;
+}
+
+static inline unsigned char
+bpt_str_key_at(const struct bpt_str_key* k, int i)
+{
+	return i < k->alen ? k->a[i] : k->b[i - k->alen];
+}
+
+/* Copy len bytes of key k from byte from */
+static void
+bpt_str_key_copy(unsigned char* dst, const struct bpt_str_key* k, int from,
+		int len)
+{
+	int n;
+	if(from < k->alen && len > 0){
+		n = k->alen - from < len ? k->alen - from : len;
+		memcpy(dst, k->a + from, n);
+		dst += n;
+		from += n;
+		len -= n;
+	}
+	if(len > 0)
+		memcpy(dst, k->b + from - k->alen, len);
+}
+
+/* Length of the common prefix of two keys */
+static int
+bpt_str_common(const struct bpt_str_key* x, const struct bpt_str_key* y)
+{
+	int i, n = bpt_str_key_len(x);
+	if(bpt_str_key_len(y) < n)
+		n = bpt_str_key_len(y);
+	for(i = 0; i < n && bpt_str_key_at(x, i) == bpt_str_key_at(y, i); i++)
+		;
+	return i;
+}
+
+/* Fences of node n */
+static void
+bpt_str_fences(bpt_str_node* n, struct bpt_str_key* lower,
+		struct bpt_str_key* upper)
+{
+	*lower = (struct bpt_str_key) {(unsigned char*) n + n->lower_off,
+		n->lower_len, NULL, 0};
+	*upper = (struct bpt_str_key) {(unsigned char*) n + n->upper_off,
+		n->upper_len, NULL, 0};
+}
+
+/* Entries of node n into e, return the number of them. The keys point into
+ * n, which should be a copy kept until the entries are used.
+ */
+static int
+bpt_str_get_ents(bpt_str_node* n, struct bpt_str_ent* e)
+{
+	int i;
+	for(i = 0; i < n->n; i++){
+		e[i].k = (struct bpt_str_key) {(unsigned char*) n
+			+ n->lower_off, n->prefix_len, bpt_str_rem(n, i),
+			n->slot[i].len};
+		e[i].p = bpt_str_ptr(n, i);
+	}
+	return n->n;
+}
+
+/* Store len bytes of key k from byte from at the bottom of the entries */
+static int
+bpt_str_put_key(bpt_str_node* n, const struct bpt_str_key* k, int from,
+		int len)
+{
+	n->heap -= len;
+	bpt_str_key_copy((unsigned char*) n + n->heap, k, from, len);
+	return n->heap;
+}
+
+/* Rebuild node n with the entries e[0..cnt), the fences(upper is NULL for
+ * none), and the last child of an index node. The other fields of n are
+ * kept. The keys of the entries should not point into n.
+ */
+static void
+bpt_str_build(bpt_str_node* n, struct bpt_str_ent* e, int cnt,
+		const struct bpt_str_key* lower,
+		const struct bpt_str_key* upper, bpt_str_node* last)
+{
+	int i, len;
+
+	n->heap = BPT_STR_NODE_BYTES;
+	n->dead = 0;
+	n->n = cnt;
+	n->last = last;
+	n->lower_len = bpt_str_key_len(lower);
+	n->lower_off = bpt_str_put_key(n, lower, 0, n->lower_len);
+	n->has_upper = upper != NULL;
+	n->upper_len = upper ? bpt_str_key_len(upper) : 0;
+	n->upper_off = upper ? bpt_str_put_key(n, upper, 0, n->upper_len)
+		: n->heap;
+	n->prefix_len = upper ? bpt_str_common(lower, upper) : 0;
+
+	for(i = 0; i < cnt; i++){
+		len = bpt_str_key_len(&e[i].k) - n->prefix_len;
+		n->slot[i].off = bpt_str_put_key(n, &e[i].k, n->prefix_len, len)
+			- sizeof(void*);
+		n->slot[i].len = len;
+		n->slot[i].head = bpt_str_head(bpt_str_rem(n, i), len);
+		n->heap -= sizeof(void*);
+		bpt_str_set_ptr(n, i, e[i].p);
+	}
+	assert(bpt_str_free(n) >= 0);
+}
+
+/* Rebuild node n without the dead bytes */
+static void
+bpt_str_compact(bpt_str* t, bpt_str_node* n)
+{
+	bpt_str_node* tmp = t->tmp[0];
+	struct bpt_str_key lower, upper;
+	int cnt;
+
+	memcpy(tmp, n, BPT_STR_NODE_BYTES);
+	cnt = bpt_str_get_ents(tmp, t->ents);
+	bpt_str_fences(tmp, &lower, &upper);
+	bpt_str_build(n, t->ents, cnt, &lower, tmp->has_upper ? &upper : NULL,
+		tmp->last);
+}
+
+/* Insert the entry of key k(after the prefix) and pointer p at slot i, the
+ * node has the space.
+ */
+static void
+bpt_str_insert_at(bpt_str_node* n, int i, const unsigned char* k, int len,
+		void* p)
+{
+	n->heap -= sizeof(void*) + len;
+	memcpy((char*) n + n->heap, &p, sizeof(p));
+	memcpy((char*) n + n->heap + sizeof(p), k, len);
+	memmove(&n->slot[i + 1], &n->slot[i],
+		(n->n - i) * sizeof(struct bpt_str_slot));
+	n->slot[i].head = bpt_str_head(k, len);
+	n->slot[i].off = n->heap;
+	n->slot[i].len = len;
+	n->n++;
+}
+
+static void
+bpt_str_delete_at(bpt_str_node* n, int i)
+{
+	n->dead += sizeof(void*) + n->slot[i].len;
+	memmove(&n->slot[i], &n->slot[i + 1],
+		(n->n - i - 1) * sizeof(struct bpt_str_slot));
+	n->n--;
+}
+
+/* Choose where to split the entries e[0..cnt) of node n. Return m: the
+ * right node starts with entry m, or for an index node entry m moves up.
+ * Set *slen to the length of the separator. Among the split points near the
+ * middle of the bytes where both nodes fit, the shortest separator is taken.
+ * Return -1 if there is none.
+ */
+static int
+bpt_str_split_point(bpt_str_node* n, struct bpt_str_ent* e, int cnt,
+		int* slen)
+{
+	int idx = ! n->leaf, lo = 1, hi = cnt - 1 - idx;
+	int j, m, mid = lo, len, best = -1, best_len = 0;
+	long total = 0, left = 0, right, d, best_d = -1;
+	long size[BPT_STR_MAX_ENTS];
+
+	for(j = 0; j < cnt; j++){
+		size[j] = BPT_STR_ENT_BYTES + bpt_str_key_len(&e[j].k)
+			- n->prefix_len;
+		total += size[j];
+	}
+	/* The middle: the bytes of the two nodes closest to each other */
+	for(m = lo, left = size[0]; m <= hi; left += size[m++]){
+		d = labs(2 * left + idx * size[m] - total);
+		if(best_d < 0 || d < best_d){
+			best_d = d;
+			mid = m;
+		}
+	}
+	for(m = 0, left = 0; m < mid - cnt / 16; m++)
+		left += size[m];
+	for(; m <= hi && m <= mid + cnt / 16; left += size[m++]){
+		if(m < lo)
+			continue;
+		len = idx ? bpt_str_key_len(&e[m].k)
+			: bpt_str_common(&e[m - 1].k, &e[m].k) + 1;
+		right = total - left - idx * size[m];
+		if(BPT_STR_HDR_BYTES + n->lower_len + len + left
+				> BPT_STR_NODE_BYTES || BPT_STR_HDR_BYTES
+				+ len + n->upper_len + right
+				> BPT_STR_NODE_BYTES)
+			continue;
+		if(best < 0 || len < best_len || (len == best_len
+				&& abs(m - mid) < abs(best - mid))){
+			best = m;
+			best_len = len;
+		}
+	}
+	*slen = best_len;
+	return best;
+}
+
+static void bpt_str_insert_in (bpt_str* t, struct bpt_str_path* path, int lv,
+		int i, const unsigned char* k, int len, void* p);
+
+/* Split path->node[lv] on the insert of the entry(k after the prefix, p) at
+ * slot i, and insert the separator into the parent. The left half moves to
+ * a new node, so the slot of the node in its parent stays.
+ */
+static void
+bpt_str_split(bpt_str* t, struct bpt_str_path* path, int lv, int i,
+		const unsigned char* k, int len, void* p)
+{
+	bpt_str_node* n = path->node[lv];
+	bpt_str_node* tmp = t->tmp[0];
+	bpt_str_node* l, *r;
+	struct bpt_str_ent* e = t->ents;
+	struct bpt_str_key lower, upper, sep;
+	/* The separator, out of tmp, which the split of the parent reuses */
+	unsigned char sbuf[BPT_STR_MAX_KEY];
+	int cnt, m, slen;
+
+	memcpy(tmp, n, BPT_STR_NODE_BYTES);
+	cnt = bpt_str_get_ents(tmp, e);
+	memmove(e + i + 1, e + i, (cnt - i) * sizeof(*e));
+	e[i].k = (struct bpt_str_key) {(unsigned char*) tmp + tmp->lower_off,
+		tmp->prefix_len, k, len};
+	e[i].p = p;
+	cnt++;
+	bpt_str_fences(tmp, &lower, &upper);
+
+	m = bpt_str_split_point(tmp, e, cnt, &slen);
+	assert(m >= 0);
+	bpt_str_key_copy(sbuf, &e[m].k, 0, slen);
+	sep = (struct bpt_str_key) {sbuf, slen, NULL, 0};
+
+	l = bpt_str_new_node(t, n->leaf);
+	if(n->leaf){
+		bpt_str_build(l, e, m, &lower, &sep, NULL);
+		bpt_str_build(n, e + m, cnt - m, &sep,
+			tmp->has_upper ? &upper : NULL, NULL);
+		l->next = n;
+		l->prev = n->prev;
+		if(n->prev)
+			n->prev->next = l;
+		else
+			t->first = l;
+		n->prev = l;
+	}else{
+		bpt_str_build(l, e, m, &lower, &sep, (bpt_str_node*) e[m].p);
+		bpt_str_build(n, e + m + 1, cnt - m - 1, &sep,
+			tmp->has_upper ? &upper : NULL, tmp->last);
+	}
+
+	if(lv == 0){
+		r = bpt_str_new_node(t, 0);
+		e[0].k = sep;
+		e[0].p = l;
+		bpt_str_build(r, e, 1, &bpt_str_empty, NULL, n);
+		t->root = r;
+		t->height++;
+		return;
+	}
+	r = path->node[lv - 1];
+	bpt_str_insert_in(t, path, lv - 1, path->slot[lv],
+		sbuf + r->prefix_len, slen - r->prefix_len, l);
+}
+
+/* Insert the entry of key k(after the prefix) and pointer p at slot i of
+ * path->node[lv], compact or split the node if it has no space.
+ */
+static void
+bpt_str_insert_in(bpt_str* t, struct bpt_str_path* path, int lv, int i,
+		const unsigned char* k, int len, void* p)
+{
+	bpt_str_node* n = path->node[lv];
+	int need = BPT_STR_ENT_BYTES + len;
+
+	if(bpt_str_free(n) < need && bpt_str_live(n) + need
+			<= BPT_STR_NODE_BYTES)
+		bpt_str_compact(t, n);
+	if(bpt_str_free(n) >= need)
+		bpt_str_insert_at(n, i, k, len, p);
+	else
+		bpt_str_split(t, path, lv, i, k, len, p);
+}
+
+int
+bpt_str_insert(bpt_str* t, const void* key, int len, bpt_record_t* v)
+{
+	const unsigned char* k = key;
+	struct bpt_str_path path;
+	bpt_str_node* l;
+	int i;
+
+	if(len < 0 || len > BPT_STR_MAX_KEY){
+		errno = EINVAL;
+		return -1;
+	}
+	if(t->root == NULL){
+		t->root = t->first = bpt_str_new_node(t, 1);
+		t->height = 1;
+	}
+	l = bpt_str_descend(t, k, len, &path);
+	i = bpt_str_search(l, k, len, 0);
+	if(bpt_str_is(l, i, k, len)){
+		bpt_str_set_ptr(l, i, v);
+		return 0;
+	}
+	t->n++;
+	bpt_str_insert_in(t, &path, path.depth - 1, i, k + l->prefix_len,
+		len - l->prefix_len, v);
+	return 0;
+}
+
+/* Merge l and r, the children j and j + 1 of index node p, into r if they
+ * fit in one node. Return 1 if merged, then slot j of p should be deleted.
+ */
+static int
+bpt_str_merge(bpt_str* t, bpt_str_node* p, int j, bpt_str_node* l,
+		bpt_str_node* r)
+{
+	bpt_str_node* tl = t->tmp[0], *tr = t->tmp[1];
+	struct bpt_str_ent* e = t->ents;
+	struct bpt_str_key lower, upper, x;
+	int cnt, prefix, bytes;
+
+	bpt_str_fences(l, &lower, &x);
+	bpt_str_fences(r, &x, &upper);
+	prefix = r->has_upper ? bpt_str_common(&lower, &upper) : 0;
+	/* The keys of l and r get their prefixes back beyond the new one */
+	bytes = BPT_STR_HDR_BYTES + lower.alen + upper.alen
+		+ bpt_str_live(l) - BPT_STR_HDR_BYTES - l->lower_len
+		- l->upper_len + l->n * (l->prefix_len - prefix)
+		+ bpt_str_live(r) - BPT_STR_HDR_BYTES - r->lower_len
+		- r->upper_len + r->n * (r->prefix_len - prefix);
+	if(! r->leaf)
+		bytes += BPT_STR_ENT_BYTES + p->prefix_len + p->slot[j].len
+			- prefix;
+	if(bytes > BPT_STR_NODE_BYTES)
+		return 0;
+
+	memcpy(tl, l, BPT_STR_NODE_BYTES);
+	memcpy(tr, r, BPT_STR_NODE_BYTES);
+	cnt = bpt_str_get_ents(tl, e);
+	if(! r->leaf){
+		/* The separator comes down, before the last child of l */
+		e[cnt].k = (struct bpt_str_key) {(unsigned char*) p
+			+ p->lower_off, p->prefix_len, bpt_str_rem(p, j),
+			p->slot[j].len};
+		e[cnt++].p = tl->last;
+	}
+	cnt += bpt_str_get_ents(tr, e + cnt);
+	bpt_str_fences(tl, &lower, &x);
+	bpt_str_fences(tr, &x, &upper);
+	bpt_str_build(r, e, cnt, &lower, tr->has_upper ? &upper : NULL,
+		tr->last);
+
+	if(r->leaf){
+		r->prev = l->prev;
+		if(l->prev)
+			l->prev->next = r;
+		else
+			t->first = r;
+	}
+	bpt_str_free_node(t, l);
+	return 1;
+}
+
+/* Choose where to split the entries e[0..cnt) of two siblings between the
+ * fences lower and upper(NULL for none), as bpt_str_split_point. The
+ * prefix of each half is the common prefix of its own fences: a half next
+ * to a far fence takes back the bytes of its keys, so the split point
+ * may be far from the middle. Of the points where both halves fit, the
+ * one with the closest bytes is taken. Return -1 if there is none.
+ */
+static int
+bpt_str_borrow_point(struct bpt_str_ent* e, int cnt, int leaf,
+		const struct bpt_str_key* lower,
+		const struct bpt_str_key* upper, int* slen)
+{
+	int idx = ! leaf, j, m, len, lp, rp, best = -1, best_len = 0;
+	long left, right, d, best_d = -1;
+	long sum[BPT_STR_MAX_ENTS + 1];
+
+	/* sum[j]: the bytes of entries e[0..j) with their whole keys */
+	for(j = 0, sum[0] = 0; j < cnt; j++)
+		sum[j + 1] = sum[j] + BPT_STR_ENT_BYTES
+			+ bpt_str_key_len(&e[j].k);
+	for(m = 1; m <= cnt - 1 - idx; m++){
+		len = idx ? bpt_str_key_len(&e[m].k)
+			: bpt_str_common(&e[m - 1].k, &e[m].k) + 1;
+		lp = bpt_str_common(lower, &e[m].k);
+		lp = lp < len ? lp : len;
+		rp = upper ? bpt_str_common(&e[m].k, upper) : 0;
+		rp = rp < len ? rp : len;
+		left = BPT_STR_HDR_BYTES + bpt_str_key_len(lower) + len + sum[m]
+			- (long) m * lp;
+		right = BPT_STR_HDR_BYTES + len + (upper ? bpt_str_key_len(upper)
+			: 0) + sum[cnt] - sum[m + idx]
+			- (long) (cnt - m - idx) * rp;
+		if(left > BPT_STR_NODE_BYTES || right > BPT_STR_NODE_BYTES)
+			continue;
+		d = labs(left - right);
+		if(best < 0 || d < best_d){
+			best = m;
+			best_len = len;
+			best_d = d;
+		}
+	}
+	*slen = best_len;
+	return best;
+}
+
+/* Move entries between l and r, the children j and j + 1 of index node
+ * path->node[lv - 1], which do not fit in one node, so that the two have
+ * about the same bytes, and put the new separator into the parent. Return 0
+ * if no split point fits.
+ */
+static int
+bpt_str_borrow(bpt_str* t, struct bpt_str_path* path, int lv, int j,
+		bpt_str_node* l, bpt_str_node* r)
+{
+	bpt_str_node* p = path->node[lv - 1];
+	bpt_str_node* tl = t->tmp[0], *tr = t->tmp[1];
+	struct bpt_str_ent* e = t->ents;
+	struct bpt_str_key lower, upper, sep, x;
+	unsigned char sbuf[BPT_STR_MAX_KEY];
+	int cnt, m, slen;
+
+	memcpy(tl, l, BPT_STR_NODE_BYTES);
+	memcpy(tr, r, BPT_STR_NODE_BYTES);
+	cnt = bpt_str_get_ents(tl, e);
+	if(! r->leaf){
+		e[cnt].k = (struct bpt_str_key) {(unsigned char*) p
+			+ p->lower_off, p->prefix_len, bpt_str_rem(p, j),
+			p->slot[j].len};
+		e[cnt++].p = tl->last;
+	}
+	cnt += bpt_str_get_ents(tr, e + cnt);
+	if(cnt < 2 + ! r->leaf)
+		return 0;
+	bpt_str_fences(tl, &lower, &x);
+	bpt_str_fences(tr, &x, &upper);
+	m = bpt_str_borrow_point(e, cnt, r->leaf, &lower,
+		tr->has_upper ? &upper : NULL, &slen);
+	if(m < 0)
+		return 0;
+	bpt_str_key_copy(sbuf, &e[m].k, 0, slen);
+	sep = (struct bpt_str_key) {sbuf, slen, NULL, 0};
+	if(r->leaf){
+		bpt_str_build(l, e, m, &lower, &sep, NULL);
+		bpt_str_build(r, e + m, cnt - m, &sep,
+			tr->has_upper ? &upper : NULL, NULL);
+	}else{
+		bpt_str_build(l, e, m, &lower, &sep, (bpt_str_node*) e[m].p);
+		bpt_str_build(r, e + m + 1, cnt - m - 1, &sep,
+			tr->has_upper ? &upper : NULL, tr->last);
+	}
+
+	/* The parent may split for a longer separator */
+	bpt_str_delete_at(p, j);
+	bpt_str_insert_in(t, path, lv - 1, j, sbuf + p->prefix_len,
+		slen - p->prefix_len, l);
+	return 1;
+}
+
+/* After a delete from path->node[lv], merge it with a sibling if it is less
+ * than a quarter full, and go up. If it fits in no sibling, it takes entries
+ * from one instead, so an emptied leaf or an index node left with one child
+ * is freed or refilled at once.
+ */
+static void
+bpt_str_rebalance(bpt_str* t, struct bpt_str_path* path, int lv)
+{
+	bpt_str_node* n = path->node[lv];
+	bpt_str_node* p;
+	int j;
+
+	if(lv == 0){
+		/* Drop an empty root leaf, or a root with one child */
+		while(n && n->n == 0){
+			t->root = n->leaf ? NULL : n->last;
+			if(n->leaf)
+				t->first = NULL;
+			bpt_str_free_node(t, n);
+			t->height--;
+			n = t->root;
+		}
+		return;
+	}
+	/* Long fences may fill a quarter of an empty node */
+	if(n->n > 0 && bpt_str_live(n) >= BPT_STR_NODE_BYTES / 4)
+		return;
+	p = path->node[lv - 1];
+	j = path->slot[lv];
+	/* With the next sibling, or the previous one */
+	if(j < p->n && bpt_str_merge(t, p, j, n, bpt_str_child(p, j + 1)))
+		bpt_str_delete_at(p, j);
+	else if(j > 0 && bpt_str_merge(t, p, j - 1, bpt_str_child(p, j - 1),
+			n))
+		bpt_str_delete_at(p, j - 1);
+	else{
+		if(j < p->n)
+			bpt_str_borrow(t, path, lv, j, n, bpt_str_child(p, j + 1));
+		else if(j > 0)
+			bpt_str_borrow(t, path, lv, j - 1,
+				bpt_str_child(p, j - 1), n);
+		return;
+	}
+	bpt_str_rebalance(t, path, lv - 1);
+}
+
+int
+bpt_str_delete(bpt_str* t, const void* key, int len)
+{
+	struct bpt_str_path path;
+	bpt_str_node* l;
+	int i;
+
+	if(t->root == NULL)
+		return 0;
+	l = bpt_str_descend(t, key, len, &path);
+	i = bpt_str_search(l, key, len, 0);
+	if(! bpt_str_is(l, i, key, len))
+		return 0;
+	bpt_str_delete_at(l, i);
+	t->n--;
+	if(t->n == 0){
+		/* Nodes kept by the fits of the merges go with the last key */
+		bpt_str_free_subtree(t, t->root);
+		t->root = t->first = NULL;
+		t->height = 0;
+		return 1;
+	}
+	bpt_str_rebalance(t, &path, path.depth - 1);
+	return 1;
+}
+
+/* Move the cursor forward out of the end of a leaf, and of empty leaves */
+static void
+bpt_str_cursor_fix(bpt_str_cursor* c)
+{
+	while(c->leaf && c->ind >= c->leaf->n){
+		c->leaf = c->leaf->next;
+		c->ind = 0;
+	}
+}
+
+void
+bpt_str_cursor_seek(bpt_str* t, bpt_str_cursor* c, const void* key, int len)
+{
+	bpt_str_node* n = t->root;
+
+	c->has_end = 0;
+	c->leaf = n;
+	if(n == NULL)
+		return;
+	while(! n->leaf)
+		n = bpt_str_child_of(n, key, len);
+	c->leaf = n;
+	c->ind = bpt_str_search(n, key, len, 0);
+	bpt_str_cursor_fix(c);
+}
+
+void
+bpt_str_cursor_set_end(bpt_str_cursor* c, const void* end, int len)
+{
+	assert(len >= 0 && len <= BPT_STR_MAX_KEY);
+	c->has_end = 1;
+	c->end_len = len;
+	memcpy(c->end, end, len);
+}
+
+int
+bpt_str_cursor_valid(bpt_str_cursor* c)
+{
+	const unsigned char* k;
+	int len, cmp;
+
+	if(c->leaf == NULL)
+		return 0;
+	if(! c->has_end)
+		return 1;
+	k = bpt_str_cursor_key(c, &len);
+	cmp = memcmp(k, c->end, len < c->end_len ? len : c->end_len);
+	return cmp < 0 || (cmp == 0 && len < c->end_len);
+}
+
+const unsigned char*
+bpt_str_cursor_key(bpt_str_cursor* c, int* len)
+{
+	bpt_str_node* n = c->leaf;
+	assert(n);
+	memcpy(c->key, (char*) n + n->lower_off, n->prefix_len);
+	memcpy(c->key + n->prefix_len, bpt_str_rem(n, c->ind),
+		n->slot[c->ind].len);
+	*len = n->prefix_len + n->slot[c->ind].len;
+	return c->key;
+}
+
+bpt_record_t*
+bpt_str_cursor_record(bpt_str_cursor* c)
+{
+	assert(c->leaf);
+	return (bpt_record_t*) bpt_str_ptr(c->leaf, c->ind);
+}
+
+void
+bpt_str_cursor_next(bpt_str_cursor* c)
+{
+	assert(c->leaf);
+	c->ind++;
+	bpt_str_cursor_fix(c);
+}
+
+void
+bpt_str_cursor_prev(bpt_str_cursor* c)
+{
+	assert(c->leaf);
+	c->ind--;
+	while(c->leaf && c->ind < 0){
+		c->leaf = c->leaf->prev;
+		c->ind = c->leaf ? c->leaf->n - 1 : 0;
+	}
+}
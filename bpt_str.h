@@ -0,0 +1,174 @@
+/* Copyright(c) Brayden Zhang
+ * Mail: pczhang2010@gmail.com
+ */
+
+#ifndef _BPT_STR_H
+#define _BPT_STR_H
+
+#include "bptree.h"
+
+/* B-Plus-Tree of variable length keys, eg. URLs or composite keys. A key is
+ * any string of bytes of up to BPT_STR_MAX_KEY bytes, ordered as by memcmp,
+ * a shorter key first when it is a prefix of the other. Keys are unique: an
+ * insert of a key in the tree replaces its record.
+ *
+ * Nodes are slotted pages of BPT_STR_NODE_BYTES bytes. The array of slots
+ * grows up after the header, and the entries(the child or record pointer
+ * and the bytes of the key) fill the node from the end down, so the fanout
+ * depends on the lengths of the keys.
+ *
+ * Each node has two fence keys, the separators around it in its parent: its
+ * keys are >= the lower fence and < the upper fence, so they all start with
+ * the common prefix of the fences. The prefix is stored once, as the head of
+ * the lower fence, and cut from the keys of the node. A slot holds the first
+ * 4 bytes after the prefix as an integer(the key head), so a search compares
+ * integers in the slot array, and reads the bytes of a key only when the
+ * heads are equal.
+ *
+ * A leaf split moves up the shortest prefix of the first key of the right
+ * node which is greater than the last key of the left node, taken among the
+ * split points near the middle, so the separators in the index nodes are
+ * short. A delete merges a node less than a quarter full with its sibling,
+ * when the two fit in one node, or else moves entries from the sibling into
+ * it, so an emptied leaf does not stay in the tree.
+ */
+
+/* Bytes of a node */
+#ifndef BPT_STR_NODE_BYTES
+#define BPT_STR_NODE_BYTES 4096
+#endif
+
+#if BPT_STR_NODE_BYTES < 512 || BPT_STR_NODE_BYTES > 32768
+#error "BPT_STR_NODE_BYTES should be in [512, 32768]"
+#endif
+
+/* Max length of a key, so that a split node fits in two nodes with their
+ * fences.
+ */
+#define BPT_STR_MAX_KEY (BPT_STR_NODE_BYTES / 8 - 16)
+
+/* Max levels of the tree */
+#define BPT_STR_MAX_HEIGHT 32
+
+struct bpt_str_slot
+{
+	/* The first 4 bytes of the key after the prefix, the first one as
+	 * the most significant byte, padded with zeros.
+	 */
+	unsigned int head;
+
+	/* Offset of the entry in the node */
+	unsigned short off;
+
+	/* Length of the key after the prefix */
+	unsigned short len;
+};
+
+typedef struct __bpt_str_node bpt_str_node;
+struct __bpt_str_node
+{
+	/* 1 for a leaf node, 0 for an index node */
+	unsigned short leaf;
+
+	/* Number of slots. A leaf has a record for each key, an index node has
+	 * a child for each key(the child before the key), and the last child.
+	 */
+	unsigned short n;
+
+	/* Length of the prefix of the keys, the first bytes of lower fence */
+	unsigned short prefix_len;
+
+	/* Offset of the lowest entry. The space between the slots and it is
+	 * free, and dead bytes of deleted entries are among the entries.
+	 */
+	unsigned short heap;
+	unsigned short dead;
+
+	/* Fence keys, stored among the entries. No upper fence if has_upper is
+	 * 0, the lower fence is empty for the first node of a level.
+	 */
+	unsigned short lower_off;
+	unsigned short lower_len;
+	unsigned short upper_off;
+	unsigned short upper_len;
+	unsigned short has_upper;
+
+	/* The last child of an index node */
+	bpt_str_node* last;
+
+	/* Next/previous leaf node, ordered by the keys */
+	bpt_str_node* next;
+	bpt_str_node* prev;
+
+	struct bpt_str_slot slot[];
+} __attribute__ ((aligned (BPT_CACHE_LINE)));
+
+typedef struct __bpt_str bpt_str;
+struct __bpt_str
+{
+	/* Root node, NULL for an empty tree */
+	bpt_str_node* root;
+
+	/* The first leaf node */
+	bpt_str_node* first;
+
+	/* Number of keys, nodes and levels */
+	long n;
+	long nodes;
+	int height;
+
+	/* Scratch space of splits and merges: copies of two nodes, and the
+	 * entries of a node being rebuilt.
+	 */
+	bpt_str_node* tmp[2];
+	struct bpt_str_ent* ents;
+};
+
+/* Cursor for the ordered scan of records. The tree should not be changed
+ * while the cursor is used.
+ */
+typedef struct __bpt_str_cursor bpt_str_cursor;
+struct __bpt_str_cursor
+{
+	/* Current leaf node, NULL if the cursor is out of the tree */
+	bpt_str_node* leaf;
+
+	/* Index of current record in the leaf node */
+	int ind;
+
+	/* If has_end is set, the cursor stops before the first key >= end */
+	int has_end;
+	int end_len;
+	unsigned char end[BPT_STR_MAX_KEY];
+
+	/* The current key, filled by bpt_str_cursor_key */
+	unsigned char key[BPT_STR_MAX_KEY];
+};
+
+/* Functions of the tree of variable length keys, implemented in bpt_str.c */
+void bpt_str_init (bpt_str* t);
+void bpt_str_destroy (bpt_str* t);
+bpt_record_t* bpt_str_get (bpt_str* t, const void* k, int len);
+
+/* Return 0, or -1 with errno EINVAL if the key is longer than
+ * BPT_STR_MAX_KEY.
+ */
+int bpt_str_insert (bpt_str* t, const void* k, int len, bpt_record_t* v);
+
+/* Return 1 if the key was deleted, 0 if it is not in the tree */
+int bpt_str_delete (bpt_str* t, const void* k, int len);
+
+/* Cursor functions. The end key has at most BPT_STR_MAX_KEY bytes.
+ * bpt_str_cursor_key returns the key in the cursor, valid until the cursor
+ * moves, and sets *len to its length.
+ */
+void bpt_str_cursor_seek (bpt_str* t, bpt_str_cursor* c, const void* k,
+		int len);
+void bpt_str_cursor_set_end (bpt_str_cursor* c, const void* end, int len);
+int bpt_str_cursor_valid (bpt_str_cursor* c);
+const unsigned char* bpt_str_cursor_key (bpt_str_cursor* c, int* len);
+bpt_record_t* bpt_str_cursor_record (bpt_str_cursor* c);
+void bpt_str_cursor_next (bpt_str_cursor* c);
+void bpt_str_cursor_prev (bpt_str_cursor* c);
+
+#endif /* end of _BPT_STR_H */
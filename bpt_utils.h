@@ -8,7 +8,14 @@
 
 static inline void swap_pointer (void** a, void** b);
 static inline void* my_calloc (int size);
+static inline void* my_aligned_calloc (int align, int size);
 static inline int get_1st_ge (long a[], int len, long k);
+static inline int get_1st_ge_scalar (long a[], int len, long k);
+static inline int get_1st_ge_bsearch (long a[], int len, long k);
+#if defined(__x86_64__) && defined(__GNUC__)
+static inline int get_1st_ge_sse42 (long a[], int len, long k);
+static inline int get_1st_ge_avx2 (long a[], int len, long k);
+#endif
 
 void
 swap_pointer(void** a, void** b)
@@ -29,14 +36,33 @@ my_calloc(int size)
 	return p;
 }
 
+/* Same as my_calloc, but the returned memory is aligned to align, which 
+ * should be a power of two.
+ */
+void*
+my_aligned_calloc(int align, int size)
+{
+	void* p;
+	if (posix_memalign(&p, align, size) != 0) {
+		fprintf(stderr, "Memory allocation failed\n");
+		exit(-1);
+	}
+	memset(p, 0, size);
+	return p;
+}
+
 /* Give an integer k, return the least-bigger index i in integer array, which 
  * makes a[i-1] < k <= a[i].
  * Note: if i == len, then k is bigger than all array elements.
+ *
+ * This is the plain linear search. get_1st_ge() dispatches to the fastest 
+ * implementation for the CPU, which requires the array to be sorted(the key
+ * arrays of the nodes are always sorted); all implementations return the same
+ * index for a sorted array.
  */
 int
-get_1st_ge(long a[], int len, long k)
+get_1st_ge_scalar(long a[], int len, long k)
 {
-	/* TODO: replaced with binary search */
 	int i;
 	for (i = 0; i < len; i++)
 		if (a[i] >= k)
@@ -44,4 +70,112 @@ get_1st_ge(long a[], int len, long k)
 	return len;
 }
 
+/* Size of the windows that the vectorized searches scan linearly, two 
+ * vectors wide. Larger arrays are first narrowed down by binary search.
+ */
+#define BPT_SEARCH_WINDOW_SSE42 4
+#define BPT_SEARCH_WINDOW_AVX2 8
+
+/* Branchless binary search, narrow [0, len] down to a window [base, base+n]
+ * of at most w elements which contains the answer.
+ */
+static inline long*
+get_1st_ge_narrow(long a[], int* len, long k, int w)
+{
+	long* base = a;
+	int n = *len;
+	while (n > w) {
+		int half = n / 2;
+		base = (base[half - 1] < k) ? base + half : base;
+		n -= half;
+	}
+	*len = n;
+	return base;
+}
+
+/* Portable fallback: branchless binary search */
+int
+get_1st_ge_bsearch(long a[], int len, long k)
+{
+	if (len == 0)
+		return 0;
+	long* base = get_1st_ge_narrow(a, &len, k, 1);
+	return (base - a) + (*base < k);
+}
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+
+#define BPT_HAVE_SIMD_SEARCH
+
+/* SSE4.2: compare 2 keys at a time, count the keys less than k */
+__attribute__ ((target ("sse4.2,popcnt")))
+int
+get_1st_ge_sse42(long a[], int len, long k)
+{
+	long* base = get_1st_ge_narrow(a, &len, k, BPT_SEARCH_WINDOW_SSE42);
+	__m128i kv = _mm_set1_epi64x(k);
+	int i, cnt = 0;
+	for (i = 0; i + 2 <= len; i += 2) {
+		__m128i v = _mm_loadu_si128((__m128i*) (base + i));
+		__m128i lt = _mm_cmpgt_epi64(kv, v);
+		cnt += __builtin_popcount(_mm_movemask_pd(_mm_castsi128_pd(lt)));
+	}
+	for (; i < len; i++)
+		cnt += base[i] < k;
+	return (base - a) + cnt;
+}
+
+/* AVX2: compare 4 keys at a time, count the keys less than k */
+__attribute__ ((target ("avx2,popcnt")))
+int
+get_1st_ge_avx2(long a[], int len, long k)
+{
+	long* base = get_1st_ge_narrow(a, &len, k, BPT_SEARCH_WINDOW_AVX2);
+	__m256i kv = _mm256_set1_epi64x(k);
+	int i, cnt = 0;
+	for (i = 0; i + 4 <= len; i += 4) {
+		__m256i v = _mm256_loadu_si256((__m256i*) (base + i));
+		__m256i lt = _mm256_cmpgt_epi64(kv, v);
+		cnt += __builtin_popcount(
+			_mm256_movemask_pd(_mm256_castsi256_pd(lt)));
+	}
+	for (; i < len; i++)
+		cnt += base[i] < k;
+	return (base - a) + cnt;
+}
+#endif /* __x86_64__ && __GNUC__ */
+
+/* Pick the search implementation by CPU features on the first call */
+static int get_1st_ge_resolve (long a[], int len, long k);
+
+static int (*get_1st_ge_impl) (long a[], int len, long k) = 
+	get_1st_ge_resolve;
+
+int
+get_1st_ge_resolve(long a[], int len, long k)
+{
+	int (*impl) (long a[], int len, long k) = get_1st_ge_bsearch;
+#ifdef BPT_HAVE_SIMD_SEARCH
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		impl = get_1st_ge_avx2;
+	else if (__builtin_cpu_supports("sse4.2"))
+		impl = get_1st_ge_sse42;
+#endif
+	/* Threads may resolve at the same time, they store the same value */
+	__atomic_store_n(&get_1st_ge_impl, impl, __ATOMIC_RELAXED);
+	return impl(a, len, k);
+}
+
+/* Give an integer k, return the least-bigger index i in sorted integer array,
+ * which makes a[i-1] < k <= a[i].
+ * Note: if i == len, then k is bigger than all array elements.
+ */
+int
+get_1st_ge(long a[], int len, long k)
+{
+	return __atomic_load_n(&get_1st_ge_impl, __ATOMIC_RELAXED)(a, len, k);
+}
+
 #endif /* End of _BPT_UTILS_H */
@@ -0,0 +1,428 @@
+/* Copyright(c) Brayden Zhang
+ * Mail: pczhang2010@gmail.com
+ */
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "bpt_wal.h"
+
+/* Types of log records */
+enum {
+	BPT_WAL_START = 1,      /* First record of the log, val: pool pages */
+	BPT_WAL_INSERT,
+	BPT_WAL_DELETE,
+	BPT_WAL_PAGE,           /* Page image of a checkpoint, val: page ID */
+	BPT_WAL_END             /* End of a checkpoint */
+};
+
+/* Header of a log record. A page image of len bytes follows it, or the value
+ * of an insert or delete with inline values(see BPT_VALUE_BYTES). Packed, so
+ * that a key wider than 8 bytes is read right after a record of any length.
+ */
+struct bpt_wal_rec
+{
+	int type;
+	int len;
+
+	/* Key and record(0 for inline values), or page ID of the image */
+	bpt_key_t key;
+	long val;
+
+	/* Checksum of the header(with sum = 0) and the image */
+	unsigned long sum;
+} __attribute__ ((packed, aligned (8)));
+
+/* The buffer is written before the checkpoint images grow it larger */
+#define BPT_WAL_BUF_BYTES (1024 * 1024)
+
+/* FNV-1a hash */
+static unsigned long
+bpt_wal_hash(const void* a, size_t n, unsigned long h)
+{
+	const unsigned char* c = a;
+	size_t i;
+
+	for(i = 0; i < n; i++){
+		h ^= c[i];
+		h *= 0x100000001b3UL;
+	}
+	return h;
+}
+
+static unsigned long
+bpt_wal_sum(struct bpt_wal_rec* r, const void* image)
+{
+	unsigned long sum = r->sum, h;
+
+	r->sum = 0;
+	h = bpt_wal_hash(r, sizeof(*r), 0xcbf29ce484222325UL);
+	if(r->len)
+		h = bpt_wal_hash(image, r->len, h);
+	r->sum = sum;
+	return h;
+}
+
+/* Append a record to buf[cur] */
+static void
+bpt_wal_append(bpt_wal* w, int type, bpt_key_t key, long val, 
+		const void* image, int len)
+{
+	struct bpt_wal_rec r;
+	int b = w->cur;
+	long need = w->len[b] + (long) sizeof(r) + len;
+
+	if(need > w->cap[b]){
+		while(need > w->cap[b])
+			w->cap[b] *= 2;
+		w->buf[b] = realloc(w->buf[b], w->cap[b]);
+		if(w->buf[b] == NULL){
+			fprintf(stderr, "Memory allocation failed\n");
+			exit(-1);
+		}
+	}
+	/* Padding after a narrow key is in the checksum */
+	memset(&r, 0, sizeof(r));
+	r.type = type;
+	r.len = len;
+	r.key = key;
+	r.val = val;
+	r.sum = 0;
+	r.sum = bpt_wal_sum(&r, image);
+	memcpy(w->buf[b] + w->len[b], &r, sizeof(r));
+	if(len)
+		memcpy(w->buf[b] + w->len[b] + sizeof(r), image, len);
+	w->len[b] += sizeof(r) + len;
+}
+
+/* Append an insert or delete record */
+static void
+bpt_wal_append_op(bpt_wal* w, int type, bpt_key_t k, bpt_record_t* v)
+{
+#ifdef BPT_VALUE_BYTES
+	bpt_wal_append(w, type, k, 0, v, BPT_VALUE_BYTES);
+#else
+	bpt_wal_append(w, type, k, (long) v, NULL, 0);
+#endif
+}
+
+/* The record logged by an insert or delete */
+static bpt_record_t*
+bpt_wal_rec_value(struct bpt_wal_rec* r)
+{
+#ifdef BPT_VALUE_BYTES
+	return (bpt_record_t*) (r + 1);
+#else
+	return (bpt_record_t*) r->val;
+#endif
+}
+
+static void
+bpt_wal_fatal(const char* msg)
+{
+	perror(msg);
+	exit(-1);
+}
+
+/* Write buffer b at the end of the log */
+static void
+bpt_wal_write(bpt_wal* w, int b)
+{
+	if(w->len[b] == 0)
+		return;
+	if(pwrite(w->fd, w->buf[b], w->len[b], w->size) != w->len[b])
+		bpt_wal_fatal("bpt_wal: write");
+	w->size += w->len[b];
+	w->len[b] = 0;
+}
+
+/* Append a page image of the checkpoint */
+static void
+bpt_wal_put_image(void* arg, long pid, const void* image, size_t len)
+{
+	bpt_wal* w = (bpt_wal*) arg;
+
+	bpt_wal_append(w, BPT_WAL_PAGE, 0, pid, image, len);
+	if(w->len[w->cur] >= BPT_WAL_BUF_BYTES)
+		bpt_wal_write(w, w->cur);
+}
+
+/* Checkpoint, with the lock held */
+static void
+bpt_wal_checkpoint_locked(bpt_wal* w)
+{
+	/* Wait for the leader, the log is written by one thread at a time */
+	while(w->syncing)
+		pthread_cond_wait(&w->synced, &w->lock);
+
+	bpt_pool_dirty_images(&w->t, bpt_wal_put_image, w);
+	bpt_wal_append(w, BPT_WAL_END, 0, 0, NULL, 0);
+	bpt_wal_write(w, w->cur);
+	if(fdatasync(w->fd) != 0)
+		bpt_wal_fatal("bpt_wal: fdatasync");
+
+	/* The checkpoint is on disk, now the tree file may change */
+	bpt_flush(&w->t);
+	if(ftruncate(w->fd, 0) != 0 || fdatasync(w->fd) != 0)
+		bpt_wal_fatal("bpt_wal: truncate");
+	w->size = 0;
+	w->synced_lsn = w->lsn;
+	w->checkpoints++;
+	bpt_wal_append(w, BPT_WAL_START, 0, w->pool_pages, NULL, 0);
+	pthread_cond_broadcast(&w->synced);
+}
+
+void
+bpt_wal_checkpoint(bpt_wal* w)
+{
+	pthread_mutex_lock(&w->lock);
+	bpt_wal_checkpoint_locked(w);
+	pthread_mutex_unlock(&w->lock);
+}
+
+/* Levels of the tree, a leaf root has height 1 */
+static int
+bpt_wal_height(bptree* t)
+{
+	bpt_node* n = t->root;
+	int h = 1;
+
+	if(n == NULL)
+		return 0;
+	while(! bpt_is_leaf(n)){
+		n = n->recs.i_rec.c_arr[0];
+		h++;
+	}
+	return h;
+}
+
+/* Take a checkpoint before the pool is full of dirty pages. An insert or
+ * delete dirties at most two pages per level and one for a new root, and 
+ * reads about as many clean pages.
+ */
+static void
+bpt_wal_maybe_checkpoint(bpt_wal* w)
+{
+	long dirty = bpt_pool_dirty_pages(&w->t);
+
+	if(dirty >= w->pool_pages / 2
+			|| dirty + 4 * (bpt_wal_height(&w->t) + 1) 
+				>= w->pool_pages
+			|| w->size + w->len[w->cur] >= BPT_WAL_CKPT_BYTES)
+		bpt_wal_checkpoint_locked(w);
+}
+
+long
+bpt_wal_insert(bpt_wal* w, bpt_key_t k, bpt_record_t* v)
+{
+	long lsn;
+
+	pthread_mutex_lock(&w->lock);
+	bpt_wal_maybe_checkpoint(w);
+	bpt_insert(&w->t, k, v);
+	bpt_wal_append_op(w, BPT_WAL_INSERT, k, v);
+	lsn = ++w->lsn;
+	pthread_mutex_unlock(&w->lock);
+	return lsn;
+}
+
+long
+bpt_wal_delete(bpt_wal* w, bpt_key_t k, bpt_record_t* v)
+{
+	long lsn;
+
+	pthread_mutex_lock(&w->lock);
+	bpt_wal_maybe_checkpoint(w);
+	bpt_delete(&w->t, k, v);
+	bpt_wal_append_op(w, BPT_WAL_DELETE, k, v);
+	lsn = ++w->lsn;
+	pthread_mutex_unlock(&w->lock);
+	return lsn;
+}
+
+bpt_record_t*
+bpt_wal_get(bpt_wal* w, bpt_key_t k)
+{
+	bpt_record_t* v;
+
+	pthread_mutex_lock(&w->lock);
+	v = bpt_get(&w->t, k);
+	pthread_mutex_unlock(&w->lock);
+	return v;
+}
+
+void
+bpt_wal_commit(bpt_wal* w, long lsn)
+{
+	pthread_mutex_lock(&w->lock);
+	while(w->synced_lsn < lsn){
+		if(w->syncing){
+			/* Wait for the group being synced, the record may be
+			 * in the next group.
+			 */
+			pthread_cond_wait(&w->synced, &w->lock);
+			continue;
+		}
+
+		/* Be the leader: take the buffer, and sync it without the
+		 * lock, while the other threads fill the other buffer.
+		 */
+		int b = w->cur;
+		long end = w->lsn, off = w->size, len = w->len[b];
+		w->syncing = 1;
+		w->cur = ! b;
+		w->size += len;
+		pthread_mutex_unlock(&w->lock);
+		if(pwrite(w->fd, w->buf[b], len, off) != len)
+			bpt_wal_fatal("bpt_wal: write");
+		if(fdatasync(w->fd) != 0)
+			bpt_wal_fatal("bpt_wal: fdatasync");
+		pthread_mutex_lock(&w->lock);
+		w->len[b] = 0;
+		w->syncing = 0;
+		w->syncs++;
+		if(end > w->synced_lsn)
+			w->synced_lsn = end;
+		pthread_cond_broadcast(&w->synced);
+	}
+	pthread_mutex_unlock(&w->lock);
+}
+
+/* Read the log into memory, return the length of its valid part */
+static long
+bpt_wal_read(int fd, char** log)
+{
+	struct stat st;
+	off_t off = 0, rec = sizeof(struct bpt_wal_rec);
+
+	if(fstat(fd, &st) != 0)
+		return -1;
+	*log = my_calloc(st.st_size + 1);
+	if(pread(fd, *log, st.st_size, 0) != st.st_size)
+		return -1;
+
+	/* Stop at the first torn record */
+	while(off + rec <= st.st_size){
+		struct bpt_wal_rec* r = (struct bpt_wal_rec*) (*log + off);
+		if(r->len < 0 || off + rec + r->len > st.st_size
+				|| r->sum != bpt_wal_sum(r, r + 1))
+			break;
+		off += rec + r->len;
+	}
+	return off;
+}
+
+/* Replay the logical records in log[from, to) */
+static void
+bpt_wal_replay(bpt_wal* w, char* log, long from, long to)
+{
+	while(from < to){
+		struct bpt_wal_rec* r = (struct bpt_wal_rec*) (log + from);
+		if(r->type == BPT_WAL_INSERT)
+			bpt_insert(&w->t, r->key, bpt_wal_rec_value(r));
+		else if(r->type == BPT_WAL_DELETE)
+			bpt_delete(&w->t, r->key, bpt_wal_rec_value(r));
+		else if(r->type != BPT_WAL_START)
+			break;
+		from += sizeof(*r) + r->len;
+	}
+}
+
+int
+bpt_wal_open(bpt_wal* w, const char* path, long pool_pages)
+{
+	char wal_path[4096];
+	char* log = NULL;
+	long len, off, start = 0, end = -1;
+	struct bpt_wal_rec* first;
+
+	if(snprintf(wal_path, sizeof(wal_path), "%s.wal", path)
+			>= (int) sizeof(wal_path)){
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+	w->fd = open(wal_path, O_RDWR | O_CREAT, 0644);
+	if(w->fd < 0)
+		return -1;
+	len = bpt_wal_read(w->fd, &log);
+	if(len < 0)
+		goto fail;
+
+	/* Find the end of a complete checkpoint */
+	for(off = 0; off < len; ){
+		struct bpt_wal_rec* r = (struct bpt_wal_rec*) (log + off);
+		if(r->type == BPT_WAL_PAGE && start == 0 && end < 0)
+			start = off;
+		off += sizeof(*r) + r->len;
+		if(r->type == BPT_WAL_END)
+			end = off;
+	}
+
+	if(end >= 0){
+		/* Redo the checkpoint in the tree file */
+		int fd = open(path, O_RDWR | O_CREAT, 0644);
+		if(fd < 0)
+			goto fail;
+		for(off = start; off < end; ){
+			struct bpt_wal_rec* r = (struct bpt_wal_rec*) (log + off);
+			if(r->type == BPT_WAL_PAGE && pwrite(fd, r + 1, r->len,
+					r->val * BPT_PAGE_BYTES) != r->len){
+				close(fd);
+				goto fail;
+			}
+			off += sizeof(*r) + r->len;
+		}
+		if(fsync(fd) != 0 || close(fd) != 0)
+			goto fail;
+	}
+
+	/* The replay needs a pool as large as when the log was written */
+	first = (struct bpt_wal_rec*) log;
+	if(len > 0 && first->type == BPT_WAL_START && first->val > pool_pages)
+		pool_pages = first->val;
+	if(pool_pages < BPT_POOL_MIN_PAGES)
+		pool_pages = BPT_POOL_MIN_PAGES;
+	if(bpt_open(&w->t, path, pool_pages) != 0)
+		goto fail;
+	bpt_pool_set_no_steal(&w->t, 1);
+	w->pool_pages = pool_pages;
+	pthread_mutex_init(&w->lock, NULL);
+	pthread_cond_init(&w->synced, NULL);
+	w->syncing = 0;
+	w->cur = 0;
+	w->cap[0] = w->cap[1] = 64 * 1024;
+	w->buf[0] = my_calloc(w->cap[0]);
+	w->buf[1] = my_calloc(w->cap[1]);
+	w->len[0] = w->len[1] = 0;
+	w->size = len;
+	w->lsn = w->synced_lsn = 0;
+	w->syncs = w->checkpoints = 0;
+
+	/* Replay the records after the checkpoint, or before the checkpoint
+	 * which did not complete.
+	 */
+	bpt_wal_replay(w, log, end >= 0 ? end : 0, len);
+	free(log);
+
+	/* Start a new log, without the torn end of the old one */
+	bpt_wal_checkpoint(w);
+	return 0;
+fail:
+	free(log);
+	close(w->fd);
+	return -1;
+}
+
+void
+bpt_wal_close(bpt_wal* w)
+{
+	bpt_wal_checkpoint(w);
+	bpt_close(&w->t);
+	close(w->fd);
+	free(w->buf[0]);
+	free(w->buf[1]);
+	pthread_mutex_destroy(&w->lock);
+	pthread_cond_destroy(&w->synced);
+}
@@ -0,0 +1,112 @@
+/* Copyright(c) Brayden Zhang
+ * Mail: pczhang2010@gmail.com
+ */
+
+#ifndef _BPT_WAL_H
+#define _BPT_WAL_H
+
+#include <pthread.h>
+
+#include "bptree.h"
+#include "bpt_pool.h"
+
+/* Write-ahead log of a persistent tree(see bpt_pool.h), in the file path.wal
+ * next to the tree file path.
+ *
+ * bpt_wal_insert and bpt_wal_delete change the tree and append a logical
+ * record(operation, key, record) to the log buffer, and return its log
+ * sequence number(LSN). bpt_wal_commit(lsn) returns when the record is on
+ * disk. Commits are grouped: one thread(the leader) writes and syncs all the
+ * buffered records, while the others add records and wait for the next
+ * group, so many commits share one fsync.
+ *
+ * The tree file only changes at checkpoints: the pool does not evict dirty
+ * pages(no steal), and a checkpoint is taken when half of the pool is dirty
+ * or the log is larger than BPT_WAL_CKPT_BYTES, so the pool should be much
+ * larger than the pages one insert or delete changes(2 per level). A 
+ * checkpoint appends the images of the dirty pages and of the meta page to 
+ * the log, then an end record, and syncs the log; then it writes the pages
+ * into the tree file, syncs it, and truncates the log.
+ *
+ * Recovery, in bpt_wal_open: if the log has a complete checkpoint, its page
+ * images are written into the tree file, and the records after it are
+ * replayed; otherwise the tree file is as of the last checkpoint, and the
+ * records before the incomplete checkpoint are replayed. Records are
+ * checksummed, the log ends at the first torn record. The replay changes the
+ * same pages as the logged operations did, so it fits in the pool without a 
+ * checkpoint; the pool is at least as large as when the log was written.
+ *
+ * The functions may be called by several threads. They are serialized by a
+ * mutex, but fsync is done without it.
+ */
+
+/* Checkpoint when the log is larger than this */
+#ifndef BPT_WAL_CKPT_BYTES
+#define BPT_WAL_CKPT_BYTES (64L * 1024 * 1024)
+#endif
+
+typedef struct __bpt_wal bpt_wal;
+struct __bpt_wal
+{
+	/* The tree. Other functions of the tree may be used on it, when no
+	 * thread uses the log.
+	 */
+	bptree t;
+
+	/* The log file, and its size */
+	int fd;
+	long size;
+
+	/* Pages of the pool */
+	long pool_pages;
+
+	pthread_mutex_t lock;
+
+	/* Signaled when a group of records is synced */
+	pthread_cond_t synced;
+
+	/* Set while the leader writes and syncs a group */
+	int syncing;
+
+	/* Two log buffers: records are appended to buf[cur], while the leader
+	 * writes the other one.
+	 */
+	char* buf[2];
+	long len[2];
+	long cap[2];
+	int cur;
+
+	/* LSN of the last record appended, and of the last record synced */
+	long lsn;
+	long synced_lsn;
+
+	/* Counters: fsyncs of groups, and checkpoints */
+	long syncs;
+	long checkpoints;
+};
+
+/* Open the tree at path with a pool of pool_pages pages, and recover it from
+ * path.wal. Return 0, or -1 with errno set. w must not be moved while it is
+ * open.
+ */
+int bpt_wal_open (bpt_wal* w, const char* path, long pool_pages);
+
+/* Checkpoint and close */
+void bpt_wal_close (bpt_wal* w);
+
+/* Change the tree and log the change, return the LSN of the log record */
+long bpt_wal_insert (bpt_wal* w, bpt_key_t k, bpt_record_t* v);
+long bpt_wal_delete (bpt_wal* w, bpt_key_t k, bpt_record_t* v);
+
+/* Return when the log records up to lsn are on disk */
+void bpt_wal_commit (bpt_wal* w, long lsn);
+
+/* With inline values(see BPT_VALUE_BYTES), the record points into a leaf,
+ * which other threads may change.
+ */
+bpt_record_t* bpt_wal_get (bpt_wal* w, bpt_key_t k);
+
+/* Take a checkpoint now */
+void bpt_wal_checkpoint (bpt_wal* w);
+
+#endif /* end of _BPT_WAL_H */
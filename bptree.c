@@ -4,13 +4,15 @@
 #include <assert.h>
 
 #include "bptree.h"
+#include "bpt_olc.h"
 
 int
-bpt_empty(bpt_node* root)
+bpt_empty(bptree* t)
 {
-	return root == NULL;
+	return t->root == NULL;
 }
 
+int
 bpt_num_of_key(bpt_node* n)
 {
 	if(bpt_is_leaf(n))
@@ -19,27 +21,69 @@ bpt_num_of_key(bpt_node* n)
 }
 
 bpt_node* 
-bpt_create_leaf_node()
+bpt_create_leaf_node(bptree* t)
 {
-	bpt_node* n = (bpt_node*) my_calloc(sizeof(bpt_node));
+	bpt_node* n = (bpt_node*) t->alloc->alloc(t->alloc, LEAF);
 	n->t = LEAF;
 	n->num_of_rec = 0;
-	n->p = NULL;
 	return n;
 }
 
 bpt_node*
-bpt_create_index_node()
+bpt_create_index_node(bptree* t)
 {
-	bpt_node* n = bpt_create_leaf_node();
+	bpt_node* n = (bpt_node*) t->alloc->alloc(t->alloc, INDEX);
 	n->t = INDEX;
+	n->num_of_rec = 0;
 	return n;
 }
 
+/* Init an empty B-Plus-Tree, whose nodes are allocated from allocator a */
+void
+bpt_init_alloc(bptree* t, bpt_allocator* a)
+{
+	t->root = NULL;
+	TAILQ_INIT(&t->rec_list_head);
+	t->alloc = a;
+	t->olc = NULL;
+	t->append = 0;
+	t->ragged_right = 0;
+	t->underflow = BPT_UNDERFLOW_HALF;
+	t->underfull = 0;
+	memset(&t->smo, 0, sizeof(t->smo));
+}
+
+/* Init an empty B-Plus-Tree, whose nodes are allocated by calloc */
 void 
-bpt_init(bpt_node** root)
+bpt_init(bptree* t)
+{
+	bpt_init_alloc(t, &bpt_calloc_allocator);
+}
+
+void
+bpt_set_append(bptree* t, int on)
+{
+	t->append = on;
+}
+
+void
+bpt_set_underflow(bptree* t, bpt_underflow_t policy)
 {
-	*root = bpt_create_leaf_node();
+	t->underflow = policy;
+	if(policy != BPT_UNDERFLOW_HALF)
+		t->underfull = 1;
+}
+
+/* The first insert into an empty tree creates the root, which is also the 
+ * only leaf node.
+ */
+void
+bpt_init_root(bptree* t)
+{
+	bpt_node* r = bpt_create_leaf_node(t);
+	TAILQ_INSERT_HEAD(&t->rec_list_head, r, recs.l_rec.n);
+	/* Readers of thread-safe mode should see the node initialized */
+	__atomic_store_n(&t->root, r, __ATOMIC_RELEASE);
 }
 
 int
@@ -50,105 +94,509 @@ bpt_is_leaf(bpt_node* p)
 }
 
 int 
-bpt_is_root(bpt_node* l)
+bpt_is_root(bptree* t, bpt_node* n)
+{
+	return n == t->root;
+}
+
+/* Max number of records(leaf) or children(index) in the node */
+int
+bpt_max_rec(bpt_node* n)
 {
-	return l->p == NULL;
+	return bpt_is_leaf(n) ? BPT_MAX_LEAF_REC_NO : BPT_MAX_INDEX_REC_NO;
+}
+
+/* Min number of records(leaf) or children(index) in the non-root node */
+int
+bpt_min_rec(bpt_node* n)
+{
+	return bpt_is_leaf(n) ? BPT_MIN_LEAF_REC_NO : BPT_MIN_INDEX_REC_NO;
+}
+
+/* Min number of records(leaf) or children(index) a delete leaves in the 
+ * non-root node without merging or borrowing, under the underflow policy of
+ * the tree. An index node keeps 2 children, so that each child has a sibling.
+ */
+int
+bpt_underflow_min(bptree* t, bpt_node* n)
+{
+	int m;
+	switch(t->underflow){
+	case BPT_UNDERFLOW_QUARTER:
+		m = (bpt_max_rec(n) + 3) / 4;
+		break;
+	case BPT_UNDERFLOW_EMPTY:
+		m = 1;
+		break;
+	default:
+		return bpt_min_rec(n);
+	}
+	return bpt_is_leaf(n) || m >= 2 ? m : 2;
 }
 
 int
 bpt_is_full(bpt_node* l)
 {
-	assert(l->num_of_rec <= BPT_MAX_REC_NO);
-	return l->num_of_rec == BPT_MAX_REC_NO;
+	assert(l->num_of_rec <= bpt_max_rec(l));
+	return l->num_of_rec == bpt_max_rec(l);
 }
 
 void
-bpt_delete_node(bpt_node** n)
+bpt_delete_node(bptree* t, bpt_node** n)
 {
-	free(*n);
+	/* In thread-safe mode, readers may still be reading the node */
+	if(t->olc)
+		bpt_olc_retire(t, *n);
+	else t->alloc->free(t->alloc, *n, (*n)->t);
 	*n = NULL;
 }
 
-/* Get the record index from node's parent, eg, if record is the first record of
- * its parent, then return 0.
+/* Free node n and all nodes under it */
+void
+bpt_delete_subtree(bptree* t, bpt_node* n)
+{
+	int i;
+	if(! bpt_is_leaf(n))
+		for(i = 0; i < n->num_of_rec; i++)
+			bpt_delete_subtree(t, n->recs.i_rec.c_arr[i]);
+	bpt_delete_node(t, &n);
+}
+
+/* Free all the nodes of the tree, the records are owned by client code. If
+ * the allocator can release all its memory at once, the nodes are not
+ * visited. The tree is empty after that, and can be used again.
  */
-int 
-bpt_locate_in_parent(bpt_node* l)
+void
+bpt_destroy(bptree* t)
 {
-	int ind;
-	bpt_node* p = l->p;
-	for(ind = 0; ind < p->num_of_rec; ind++)
-		if(p->recs.c_arr[ind] == l)
-			return ind;
-	assert(0); // Should never reach here
+	bpt_allocator* a = t->alloc;
+	if(t->olc)
+		bpt_olc_disable(t);
+	if(a->destroy){
+		a->destroy(a);
+		/* The allocator is gone with its memory */
+		a = &bpt_calloc_allocator;
+	}else if(! bpt_empty(t))
+		bpt_delete_subtree(t, t->root);
+	bpt_init_alloc(t, a);
 }
 
 /* 1. If node is root and is not leaf, it must have num_of_rec >=2;
  * 2. If node is root and is leaf, it can have num_of_rec == 0 or == 1 ;
- * 3. If node is not root, it must have num_of_rec >= ceil(BPT_MAX_REC_NO / 2).
+ * 3. If node is not root, it must have num_of_rec >= ceil(M / 2), M is 
+ *    BPT_MAX_LEAF_REC_NO or BPT_MAX_INDEX_REC_NO; or the min number of the
+ *    underflow policy, see bpt_underflow_min.
  */
 int
-bpt_is_enough(bpt_node* n)
+bpt_is_enough(bptree* t, bpt_node* n)
 {
-	return bpt_is_root(n) 
+	return bpt_is_root(t, n) 
 			? bpt_is_leaf(n)
 				? 1 
 				: n->num_of_rec >= 2 
-			: n->num_of_rec >= ceil(BPT_MAX_REC_NO / 2);
+			: n->num_of_rec >= bpt_underflow_min(t, n);
+}
+
+/* For the searching key k, return the index of the child of index node n to
+ * go down. The descent goes right when k equals a split key. With duplicated
+ * keys, several split keys may equal k, and the records of k may be in the
+ * leaves before and after the one reached: bpt_query_lower finds the first of
+ * them, bpt_locate_in_path walks them. bpt_dup keeps the keys unique and the
+ * duplicates in posting lists instead, see bpt_dup.h.
+ */
+int
+bpt_child_ind(bptree* t, bpt_node* n, bpt_key_t k)
+{
+	if(bpt_is_root(t, n) || t->ragged_right || t->underfull)
+		assert(n->num_of_rec >=2);
+	else assert(n->num_of_rec >= BPT_MIN_INDEX_REC_NO);
+
+	bpt_key_t* key = n->recs.i_rec.key;
+	int ind = get_1st_ge_key(key, bpt_num_of_key(n), k);
+
+	if(ind == bpt_num_of_key(n)) 
+		/* k is the biggest, search the last child */
+		return bpt_num_of_key(n);
+
+	/* Now k <= key[ind] */
+	else if(k == key[ind])
+		return ind + 1;
+	else return ind;
 }
 
-/** For the searching key K, return the leaf node N 
- * TODO: verify if duplicated keys exists, is current behavior correct?
- */ 
+/* For the searching key k, return the leaf node */
 bpt_node*
-bpt_query(bpt_node* root, long k)
+bpt_query(bptree* t, bpt_key_t k)
 {
-	bpt_node* n = root;
+	bpt_node* n = t->root;
+	while(! bpt_is_leaf(n))
+		n = n->recs.i_rec.c_arr[bpt_child_ind(t, n, k)];
+
+	/* We are in the leaf node now */
+	return n;
+}
+
+/* Go down from the last node of the path to the leaf of key k, and record the
+ * nodes on the way. If lower is not 0, go down as bpt_query_lower instead.
+ */
+bpt_node*
+bpt_path_descend(bptree* t, bpt_key_t k, bpt_path* path, int lower)
+{
+	bpt_node* n = path->node[path->depth - 1];
 	while(! bpt_is_leaf(n)){
-		if(bpt_is_root(n))
-			assert(n->num_of_rec >=2);
-		else assert(n->num_of_rec >= (BPT_MAX_REC_NO + 1) / 2);
+		int ind = lower ? get_1st_ge_key(n->recs.i_rec.key, 
+				bpt_num_of_key(n), k) : bpt_child_ind(t, n, k);
+		n = n->recs.i_rec.c_arr[ind];
+		assert(path->depth < BPT_MAX_HEIGHT);
+		path->node[path->depth] = n;
+		path->slot[path->depth] = ind;
+		path->depth++;
+	}
+	return n;
+}
 
-		int ind = get_1st_ge(n->key, bpt_num_of_key(n), k);
+/* Same as bpt_query, and record the path from the root to the leaf */
+bpt_node*
+bpt_query_path(bptree* t, bpt_key_t k, bpt_path* path)
+{
+	path->depth = 1;
+	path->node[0] = t->root;
+	path->slot[0] = 0;
+	return bpt_path_descend(t, k, path, 0);
+}
 
-		if(ind == bpt_num_of_key(n)) 
-			/* k is the biggest, search the last child */
-			n = n->recs.c_arr[bpt_num_of_key(n)];
+/* Same as bpt_query_lower, and record the path from the root to the leaf */
+bpt_node*
+bpt_query_path_lower(bptree* t, bpt_key_t k, bpt_path* path)
+{
+	path->depth = 1;
+	path->node[0] = t->root;
+	path->slot[0] = 0;
+	return bpt_path_descend(t, k, path, 1);
+}
 
-		/* Now k <= n->key[ind] */
-		else if(k == n->key[ind])
-			n = n->recs.c_arr[ind + 1];
-		else n = n->recs.c_arr[ind];
+/* Get the upper bound(exclusive) of the keys in the subtree of 
+ * path->node[lv]. Return 0 if there is no bound, ie. the node is at the right
+ * edge.
+ */
+int
+bpt_path_high(bpt_path* path, int lv, bpt_key_t* hi)
+{
+	int a;
+	for(a = lv - 1; a >= 0; a--){
+		bpt_node* n = path->node[a];
+		if(path->slot[a + 1] < bpt_num_of_key(n)){
+			*hi = n->recs.i_rec.key[path->slot[a + 1]];
+			return 1;
+		}
 	}
+	return 0;
+}
 
-	/* We are in the leaf node now */
+/* Move the path to the leaf of key k, which is not less than the keys in the 
+ * subtree of the path's leaf(eg. the next key of a sorted batch). Go up only 
+ * to the lowest node which covers k, then go down from there. lower is as in
+ * bpt_path_descend: then k equal to the split key after the subtree is 
+ * covered too.
+ */
+bpt_node*
+bpt_path_seek(bptree* t, bpt_key_t k, bpt_path* path, int lower)
+{
+	int a, lv = path->depth - 1;
+	for(a = path->depth - 2; a >= 0; a--){
+		bpt_node* n = path->node[a];
+		int s = path->slot[a + 1];
+		if(s < bpt_num_of_key(n)){
+			if(k < n->recs.i_rec.key[s] 
+					|| (lower && k == n->recs.i_rec.key[s]))
+				break;
+			/* k is right of node[a + 1], maybe in node[a] */
+			lv = a;
+		}
+	}
+	path->depth = lv + 1;
+	return bpt_path_descend(t, k, path, lower);
+}
+
+/* Move the path to the leaf after(d = 1) or before(d = -1) its leaf, and 
+ * return it. Return NULL if there is no such leaf, the path is not changed 
+ * then.
+ */
+bpt_node*
+bpt_path_step_leaf(bpt_path* path, int d)
+{
+	int a = path->depth - 1;
+	bpt_node* n;
+
+	while(a > 0 && path->slot[a] + d 
+			== (d > 0 ? path->node[a - 1]->num_of_rec : -1))
+		a--;
+	if(a == 0)
+		return NULL;
+	path->slot[a] += d;
+	n = path->node[a] = path->node[a - 1]->recs.i_rec.c_arr[path->slot[a]];
+	/* Go down along the first or the last children */
+	for(a++; a < path->depth; a++){
+		path->slot[a] = d > 0 ? 0 : n->num_of_rec - 1;
+		n = path->node[a] = n->recs.i_rec.c_arr[path->slot[a]];
+	}
 	return n;
 }
 
+/* Add d to the counts of the subtrees on the path, when its leaf gets d more
+ * records, or -d less. Splits and merges keep the counts after that, so the
+ * path is counted before the leaf is changed. See BPT_COUNTS.
+ */
+void
+bpt_path_count(bpt_path* path, long d)
+{
+#ifdef BPT_COUNTS
+	int i;
+	for(i = 1; i < path->depth; i++)
+		path->node[i - 1]->recs.i_rec.cnt[path->slot[i]] += d;
+#else
+	(void) path;
+	(void) d;
+#endif
+}
+
+/* Count d records of child from of index node p in child to instead */
+void
+bpt_count_move(bpt_node* p, int from, int to, long d)
+{
+#ifdef BPT_COUNTS
+	p->recs.i_rec.cnt[from] -= d;
+	p->recs.i_rec.cnt[to] += d;
+#else
+	(void) p;
+	(void) from;
+	(void) to;
+	(void) d;
+#endif
+}
+
+/* Child i + 1 of index node p was split from child i, with its records */
+void
+bpt_count_split(bpt_node* p, int i)
+{
+#ifdef BPT_COUNTS
+	p->recs.i_rec.cnt[i] -= p->recs.i_rec.cnt[i + 1];
+#else
+	(void) p;
+	(void) i;
+#endif
+}
+
+/* Child i + 1 of index node p was merged into child i */
+void
+bpt_count_merge(bpt_node* p, int i)
+{
+#ifdef BPT_COUNTS
+	p->recs.i_rec.cnt[i] += p->recs.i_rec.cnt[i + 1];
+#else
+	(void) p;
+	(void) i;
+#endif
+}
+
+#ifdef BPT_COUNTS
+/* Number of records in the subtree of node n */
+long
+bpt_subtree_count(bpt_node* n)
+{
+	long c = 0;
+	int i;
+	if(bpt_is_leaf(n))
+		return n->num_of_rec;
+	for(i = 0; i < n->num_of_rec; i++)
+		c += n->recs.i_rec.cnt[i];
+	return c;
+}
+
+/* Set the counts of all the index nodes under n, return the count of n */
+long
+bpt_count_all(bpt_node* n)
+{
+	long c = 0;
+	int i;
+	if(bpt_is_leaf(n))
+		return n->num_of_rec;
+	for(i = 0; i < n->num_of_rec; i++)
+		c += n->recs.i_rec.cnt[i] = bpt_count_all(
+			n->recs.i_rec.c_arr[i]);
+	return c;
+}
+
+/* Add d to the counts on the right edge, for an append to the last leaf */
+void
+bpt_count_right_edge(bptree* t, long d)
+{
+	bpt_node* n = t->root;
+	while(! bpt_is_leaf(n)){
+		n->recs.i_rec.cnt[n->num_of_rec - 1] += d;
+		n = n->recs.i_rec.c_arr[n->num_of_rec - 1];
+	}
+}
+#endif
+
+/* Set the counts of the children of node n, if it is an index node */
+void
+bpt_count_children(bpt_node* n)
+{
+#ifdef BPT_COUNTS
+	int i;
+	for(i = 0; ! bpt_is_leaf(n) && i < n->num_of_rec; i++)
+		n->recs.i_rec.cnt[i] = bpt_subtree_count(
+			n->recs.i_rec.c_arr[i]);
+#else
+	(void) n;
+#endif
+}
+
+/* Return the index of the first key >= k in leaf *l or the leaves after it,
+ * and move *l to its leaf. *l is NULL if there is no such key.
+ */
+int
+bpt_leaf_seek(bpt_node** l, bpt_key_t k)
+{
+	int ind = get_1st_ge_key((*l)->recs.l_rec.key, (*l)->num_of_rec, k);
+
+	/* k is bigger than all the keys of the leaf, go to the next leaf */
+	while(ind == (*l)->num_of_rec){
+		if((*l = TAILQ_NEXT(*l, recs.l_rec.n)) == NULL)
+			return 0;
+		ind = get_1st_ge_key((*l)->recs.l_rec.key, (*l)->num_of_rec,
+				k);
+	}
+	return ind;
+}
+
+/* Return the record of key k, NULL if there is no such key. If there are
+ * duplicated keys, the first one of their records is returned. The lookup
+ * goes down as bpt_query_lower, since after deletes the records of k may be
+ * only in the leaf before an equal split key(see bpt_child_ind).
+ */
+bpt_record_t*
+bpt_get(bptree* t, bpt_key_t k)
+{
+	if(t->olc)
+		return bpt_olc_get(t, k);
+	if(bpt_empty(t))
+		return NULL;
+
+	bpt_node* l = bpt_query_lower(t, k);
+	int ind = bpt_leaf_seek(&l, k);
+	if(l && l->recs.l_rec.key[ind] == k)
+		return bpt_value_rec(&l->recs.l_rec.r_arr[ind]);
+	return NULL;
+}
+
+#ifdef BPT_VALUE_BYTES
+int
+bpt_get_value(bptree* t, bpt_key_t k, bpt_record_t* out)
+{
+	if(t->olc)
+		return bpt_olc_get_value(t, k, out);
+	bpt_record_t* r = bpt_get(t, k);
+	if(r == NULL)
+		return 0;
+	memcpy(out, r, BPT_VALUE_BYTES);
+	return 1;
+}
+#endif
+
+/* Prefetch the head of node n, where the search in it starts */
+void
+bpt_prefetch_node(bpt_node* n)
+{
+	int off;
+	for(off = 0; off < (int) BPT_PREFETCH_BYTES; off += BPT_CACHE_LINE)
+		__builtin_prefetch((char*) n + off, 0, 3);
+}
+
+/* bpt_multi_get with lookups of the given group size, at most 
+ * BPT_MULTIGET_MAX_GROUP.
+ */
+void
+bpt_multi_get_group(bptree* t, bpt_key_t* keys, bpt_record_t** recs, long n, 
+		int group)
+{
+	bpt_node* cur[BPT_MULTIGET_MAX_GROUP];
+	long i;
+	int j;
+
+	assert(group > 0 && group <= BPT_MULTIGET_MAX_GROUP);
+	if(t->olc || bpt_empty(t)){
+		for(i = 0; i < n; i++)
+			recs[i] = bpt_get(t, keys[i]);
+		return;
+	}
+
+	for(i = 0; i < n; i += group){
+		int g = n - i < group ? n - i : group;
+		for(j = 0; j < g; j++)
+			cur[j] = t->root;
+
+		/* All leaves are at the same depth, so the lookups of the 
+		 * group go down level by level together. Each one prefetches 
+		 * its next node and switches to the next lookup, so the cache
+		 * misses of the group overlap. They go down as bpt_get.
+		 */
+		while(! bpt_is_leaf(cur[0])){
+			for(j = 0; j < g; j++){
+				bpt_node* c = cur[j];
+				cur[j] = c->recs.i_rec.c_arr[get_1st_ge_key(
+					c->recs.i_rec.key, bpt_num_of_key(c),
+					keys[i + j])];
+				bpt_prefetch_node(cur[j]);
+			}
+		}
+
+		for(j = 0; j < g; j++){
+			bpt_node* l = cur[j];
+			bpt_key_t k = keys[i + j];
+			int ind = bpt_leaf_seek(&l, k);
+			recs[i + j] = l && l->recs.l_rec.key[ind] == k
+				? bpt_value_rec(&l->recs.l_rec.r_arr[ind])
+				: NULL;
+		}
+	}
+}
+
+/* Get the records of n keys into recs[i], NULL if not found. The lookups run
+ * in groups of BPT_MULTIGET_GROUP, with their memory accesses interleaved.
+ */
+void
+bpt_multi_get(bptree* t, bpt_key_t* keys, bpt_record_t** recs, long n)
+{
+	bpt_multi_get_group(t, keys, recs, n, BPT_MULTIGET_GROUP);
+}
+
 /* In leaf node, insert key in l[key_ind]; 
  * insert record in l[rec_ind] 
  */
 void
 bpt_insert_in_leaf_at(bpt_node* l, int key_ind, int rec_ind, 
-		long k, bpt_record_t *v)
+		bpt_key_t k, bpt_record_t *v)
 {
 	assert(key_ind >= 0 && rec_ind >= 0 && ! bpt_is_full(l));
 
-	int i;
-	for(i = l->num_of_rec; i > key_ind; i--)//make room for the new key
-		l->key[i] = l->key[i - 1];
-	l->key[key_ind] = k;
+	/* make room for the new key and record */
+	memmove(l->recs.l_rec.key + key_ind + 1, l->recs.l_rec.key + key_ind,
+			(l->num_of_rec - key_ind) * sizeof(bpt_key_t));
+	l->recs.l_rec.key[key_ind] = k;
 
-	for(i = l->num_of_rec; i > rec_ind; i--)//make room for the new record
-		l->recs.l_rec.r_arr[i] = l->recs.l_rec.r_arr[i - 1];
-	l->recs.l_rec.r_arr[rec_ind] = v;
+	memmove(l->recs.l_rec.r_arr + rec_ind + 1, 
+			l->recs.l_rec.r_arr + rec_ind,
+			(l->num_of_rec - rec_ind) * sizeof(bpt_value));
+	bpt_value_set(&l->recs.l_rec.r_arr[rec_ind], v);
 
 	l->num_of_rec++;
 }
 
 /* Insert (k, v) into leaf node */ 
 void
-bpt_insert_in_leaf(bpt_node* l, long k, bpt_record_t* v)
+bpt_insert_in_leaf(bpt_node* l, bpt_key_t k, bpt_record_t* v)
 {
 	assert(!bpt_is_full(l));
 	
@@ -156,7 +604,7 @@ bpt_insert_in_leaf(bpt_node* l, long k, bpt_record_t* v)
 	 * greater or equal to k; if k is greater than all the keys, (k, v) will
 	 * be insert after the last key 
 	 * */
-	int ind = get_1st_ge(l->key, l->num_of_rec, k);
+	int ind = get_1st_ge_key(l->recs.l_rec.key, l->num_of_rec, k);
 	bpt_insert_in_leaf_at(l, ind, ind, k, v);  
 }
 
@@ -165,21 +613,26 @@ bpt_insert_in_leaf(bpt_node* l, long k, bpt_record_t* v)
  */
 void
 bpt_insert_in_index_at(bpt_node* n, int key_ind, int rec_ind, 
-		long k, bpt_node* l)
+		bpt_key_t k, bpt_node* l)
 {
 	assert(key_ind >= 0 && rec_ind >= 0 && ! bpt_is_full(n));
-	int i;
 
-	for(i = bpt_num_of_key(n); i > key_ind; i--)//make room for the new key
-		n->key[i] = n->key[i - 1];
-	n->key[key_ind] = k;
-
-	for(i = n->num_of_rec; i > rec_ind; i--) //make room for the new child
-		n->recs.c_arr[i] = n->recs.c_arr[i - 1];
-	n->recs.c_arr[rec_ind] = l;
+	/* make room for the new key and child */
+	memmove(n->recs.i_rec.key + key_ind + 1, n->recs.i_rec.key + key_ind,
+			(bpt_num_of_key(n) - key_ind) * sizeof(bpt_key_t));
+	n->recs.i_rec.key[key_ind] = k;
+
+	memmove(n->recs.i_rec.c_arr + rec_ind + 1, 
+			n->recs.i_rec.c_arr + rec_ind,
+			(n->num_of_rec - rec_ind) * sizeof(bpt_node*));
+	n->recs.i_rec.c_arr[rec_ind] = l;
+#ifdef BPT_COUNTS
+	memmove(n->recs.i_rec.cnt + rec_ind + 1, n->recs.i_rec.cnt + rec_ind,
+			(n->num_of_rec - rec_ind) * sizeof(long));
+	n->recs.i_rec.cnt[rec_ind] = bpt_subtree_count(l);
+#endif
 
 	n->num_of_rec++; 
-	l->p = n;
 }
 
 /* New pair (split_key, l1) need to be added into root, but root node is full, 
@@ -187,272 +640,345 @@ bpt_insert_in_index_at(bpt_node* n, int key_ind, int rec_ind,
  * root node and the new node, separated by the split_key. 
  */
 void
-bpt_split_root(bpt_node** root, long split_key, bpt_node* l1)
+bpt_split_root(bptree* t, bpt_key_t split_key, bpt_node* l1)
 {
-	bpt_node* l = *root;
-	assert(bpt_is_root(l));
+	bpt_node* l = t->root;
 
 	/* Split the old root node, r is the new root node */
-	bpt_node* r = bpt_create_index_node();
+	bpt_node* r = bpt_create_index_node(t);
 	r->num_of_rec = 2;
-	r->key[0] = split_key;
-	r->recs.c_arr[0] = l;
-	r->recs.c_arr[1] = l1;
-
-	*root = r;
-
-	l->p = r;
-	l1->p = r;
+	r->recs.i_rec.key[0] = split_key;
+	r->recs.i_rec.c_arr[0] = l;
+	r->recs.i_rec.c_arr[1] = l1;
+#ifdef BPT_COUNTS
+	r->recs.i_rec.cnt[0] = bpt_subtree_count(l);
+	r->recs.i_rec.cnt[1] = bpt_subtree_count(l1);
+#endif
+
+	/* Publish the new root after it is filled, for thread-safe mode */
+	__atomic_store_n(&t->root, r, __ATOMIC_RELEASE);
 }
 
 void 
-bpt_split_parent(bpt_node** root, bpt_node* p, int key_ind, int child_ind, 
-		long k, bpt_node* l);
-
-/* The new pair (split_key, l1) need to be insert into node l's parent, right 
- * after node l. Please note if parent node is full, we need to split the parent
- * node.
+bpt_split_parent(bptree* t, bpt_path* path, int lv, int key_ind, 
+		int child_ind, bpt_key_t k, bpt_node* l, int follow);
+
+/* The new pair (split_key, l1) need to be insert into the parent of node l, 
+ * right after node l. l is path->node[lv]. Please note if parent node is full,
+ * we need to split the parent node.
+ * Then the path leads to l1 if follow is 1, or still to l if follow is 0, so
+ * that the caller can go on using the path.
  */
 void
-bpt_insert_in_parent(bpt_node** root, bpt_node* l, 
-		long split_key, bpt_node* l1) 
+bpt_insert_in_parent(bptree* t, bpt_path* path, int lv,
+		bpt_key_t split_key, bpt_node* l1, int follow) 
 {
-	if(bpt_is_root(l)){
-		bpt_split_root(root, split_key, l1);
+	if(lv == 0){
+		bpt_split_root(t, split_key, l1);
+
+		/* The new root is on top of the path */
+		assert(path->depth < BPT_MAX_HEIGHT);
+		memmove(path->node + 1, path->node, 
+				path->depth * sizeof(bpt_node*));
+		memmove(path->slot + 1, path->slot, path->depth * sizeof(int));
+		path->depth++;
+		path->node[0] = t->root;
+		path->node[1] = t->root->recs.i_rec.c_arr[follow];
+		path->slot[1] = follow;
 		return;
 	} 
 
-	bpt_node* p = l->p;
-	int ind = bpt_locate_in_parent(l);
-	if(! bpt_is_full(p))
+	bpt_node* p = path->node[lv - 1];
+	int ind = path->slot[lv];
+	if(! bpt_is_full(p)){
 		bpt_insert_in_index_at(p, ind, ind + 1, split_key, l1);
-	else{
-		bpt_split_parent(root, p, ind, ind + 1, split_key, l1);
+		bpt_count_split(p, ind);
+		path->node[lv] = p->recs.i_rec.c_arr[ind + follow];
+		path->slot[lv] = ind + follow;
+	}else{
+		bpt_split_parent(t, path, lv - 1, ind, ind + 1, split_key, l1,
+				ind + follow);
 	}
 }
 
-/* New pair (k, l) need to be added into parent node, key_ind and child_ind is 
- * the location to insert the new key and new child into the key array and child
- * array. but parent node is full,so need to split the parent node. 
+/* Return 1 if path->node[lv] is the right most node of its level */
+int
+bpt_path_at_right_edge(bpt_path* path, int lv)
+{
+	int i;
+	for(i = 1; i <= lv; i++)
+		if(path->slot[i] != path->node[i - 1]->num_of_rec - 1)
+			return 0;
+	return 1;
+}
+
+/* New pair (k, l) need to be added into parent node path->node[lv], key_ind 
+ * and child_ind is the location to insert the new key and new child into the
+ * key array and child array. but parent node is full,so need to split the 
+ * parent node. Then the path leads to the child at index follow, counted with 
+ * the new child.
  */
 void
-bpt_split_parent(bpt_node** root, bpt_node* p, int key_ind, int child_ind, 
-		long k, bpt_node* l)
+bpt_split_parent(bptree* t, bpt_path* path, int lv, int key_ind, 
+		int child_ind, bpt_key_t k, bpt_node* l, int follow)
 {
+	bpt_node* p = path->node[lv];
 	assert(bpt_is_full(p));
 
 	/* Temporary storage */
-	long ind_arr[p->num_of_rec];
+	bpt_key_t ind_arr[p->num_of_rec];
 	bpt_node* rec_arr[p->num_of_rec + 1];
 
-	/* Copy from the old node to temporary storage */
-	memcpy(ind_arr, p->key, bpt_num_of_key(p) * sizeof(long));
-	memcpy(rec_arr, p->recs.c_arr, p->num_of_rec * sizeof(bpt_node*));
-
-	/* Add the new (k, l) to temporary storage */
-	int i;
-	for(i = bpt_num_of_key(p); i > key_ind; i--) //make room for new key
-		ind_arr[i] = ind_arr[i - 1];
-	for(i = p->num_of_rec; i > child_ind; i--) //make room for new child
-		rec_arr[i] = rec_arr[i - 1];
+	/* Copy from the old node to temporary storage, leaving room for the
+	 * new (k, l)
+	 */
+	memcpy(ind_arr, p->recs.i_rec.key, key_ind * sizeof(bpt_key_t));
+	memcpy(ind_arr + key_ind + 1, p->recs.i_rec.key + key_ind, 
+			(bpt_num_of_key(p) - key_ind) * sizeof(bpt_key_t));
+	memcpy(rec_arr, p->recs.i_rec.c_arr, child_ind * sizeof(bpt_node*));
+	memcpy(rec_arr + child_ind + 1, p->recs.i_rec.c_arr + child_ind, 
+			(p->num_of_rec - child_ind) * sizeof(bpt_node*));
 	ind_arr[key_ind] = k;
 	rec_arr[child_ind] = l;
+#ifdef BPT_COUNTS
+	long cnt_arr[p->num_of_rec + 1];
+	memcpy(cnt_arr, p->recs.i_rec.cnt, child_ind * sizeof(long));
+	memcpy(cnt_arr + child_ind + 1, p->recs.i_rec.cnt + child_ind, 
+			(p->num_of_rec - child_ind) * sizeof(long));
+	/* l was split from the child before it */
+	cnt_arr[child_ind] = bpt_subtree_count(l);
+	cnt_arr[child_ind - 1] -= cnt_arr[child_ind];
+#endif
 
 	int num = (p->num_of_rec + 1) / 2; // Num to move to original node
+	if(t->append && child_ind == p->num_of_rec 
+			&& bpt_path_at_right_edge(path, lv)){
+		/* Appending at the right edge: keep the original node full,
+		 * the new node starts with the last two children.
+		 */
+		num = p->num_of_rec - 1;
+		t->ragged_right = 1;
+	}
 	int num1 = p->num_of_rec + 1 - num; // Num to move to new node 
 
 	/* Move from temporary to orginal node */
-	memcpy(p->key, ind_arr, (num - 1) * sizeof(long));
-	memcpy(p->recs.c_arr, rec_arr, num * sizeof(bpt_node*));
+	memcpy(p->recs.i_rec.key, ind_arr, (num - 1) * sizeof(bpt_key_t));
+	memcpy(p->recs.i_rec.c_arr, rec_arr, num * sizeof(bpt_node*));
+#ifdef BPT_COUNTS
+	memcpy(p->recs.i_rec.cnt, cnt_arr, num * sizeof(long));
+#endif
 	p->num_of_rec = num;
 
 	/* Create new index node */
-	bpt_node* p1 = bpt_create_index_node();
+	bpt_node* p1 = bpt_create_index_node(t);
+	t->smo.splits++;
 
 	/* Move from temporary to new node */
-	memcpy(p1->key, ind_arr + num,  num1 * sizeof(long));
-	memcpy(p1->recs.c_arr,rec_arr + num, num1 * sizeof(bpt_node*));
+	memcpy(p1->recs.i_rec.key, ind_arr + num,
+		(num1 - 1) * sizeof(bpt_key_t));
+	memcpy(p1->recs.i_rec.c_arr,rec_arr + num, num1 * sizeof(bpt_node*));
+#ifdef BPT_COUNTS
+	memcpy(p1->recs.i_rec.cnt, cnt_arr + num, num1 * sizeof(long));
+#endif
        	p1->num_of_rec = num1;      
 
-	/* Split key for original node(p) and new node(p1) in p->p */
-	long split_key = ind_arr[num - 1]; 
-
-	/* Insert the new splitted node into parent */
-	if(k < split_key)
-		l->p = p;
+	/* Split key for original node(p) and new node(p1) in the parent of p */
+	bpt_key_t split_key = ind_arr[num - 1]; 
 
-	/* The new node's children should change their parents now */
-	for(i = 0; i < p1->num_of_rec; i++)
-		p1->recs.c_arr[i]->p = p1;
+	/* Keep the path to the followed child, in p or p1 */
+	path->node[lv + 1] = rec_arr[follow];
+	path->slot[lv + 1] = follow < num ? follow : follow - num;
 
 	/* The new node should be adopted by its parent now */
-	bpt_insert_in_parent(root, p, split_key, p1);
+	bpt_insert_in_parent(t, path, lv, split_key, p1, follow >= num);
 }
 
-void bpt_split_leaf(bpt_node** root, bpt_node* l, long k, bpt_record_t* v);
-
 /* Insert pair (k, v) into the B-Plus-Tree */
 void 
-bpt_insert(bpt_node** root, long k, bpt_record_t* v)
+bpt_insert(bptree* t, bpt_key_t k, bpt_record_t* v)
 {
-	bpt_node* l;
-	if(bpt_empty(*root)){
-		bpt_init(root);
-		l = *root;
-	}else l = bpt_query(*root, k);
+	bpt_path path;
+	if(t->olc){
+		bpt_olc_insert(t, k, v);
+		return;
+	}
+
+	if(bpt_empty(t))
+		bpt_init_root(t);
+	else if(t->append){
+		/* Append a key >= the max key to the right most leaf */
+		bpt_node* r = TAILQ_LAST(&t->rec_list_head, rec_list);
+		int num = r->num_of_rec;
+		if(num > 0 && k >= r->recs.l_rec.key[num - 1] 
+				&& ! bpt_is_full(r)){
+			r->recs.l_rec.key[num] = k;
+			bpt_value_set(&r->recs.l_rec.r_arr[num], v);
+			r->num_of_rec++;
+#ifdef BPT_COUNTS
+			bpt_count_right_edge(t, 1);
+#endif
+			return;
+		}
+	}
+	bpt_node* l = bpt_query_path(t, k, &path);
+	bpt_path_count(&path, 1);
 	
 	/* Now l is the leaf node */
 	if(! bpt_is_full(l))
 		bpt_insert_in_leaf(l, k, v);
-	else bpt_split_leaf(root, l, k, v);
+	else bpt_split_leaf(t, &path, k, v);
 }
 
-/* New pair (k, l) need to be added into leaf node, but this leaf node is full,
- * so need to split it. 
+/* New pair (k, v) need to be added into the leaf node at the end of path, but
+ * this leaf node is full, so need to split it. 
  */
 void
-bpt_split_leaf(bpt_node** root, bpt_node* l, long k, bpt_record_t* v)
+bpt_split_leaf(bptree* t, bpt_path* path, bpt_key_t k, bpt_record_t* v)
 {
+	bpt_node* l = path->node[path->depth - 1];
 	assert(bpt_is_full(l));
 
 	/* Temporary storage */
-	long ind_arr[l->num_of_rec + 1];
-	bpt_record_t* rec_arr[l->num_of_rec + 1];
+	bpt_key_t ind_arr[l->num_of_rec + 1];
+	bpt_value rec_arr[l->num_of_rec + 1];
 
-	/* Move all items of orginal node to temporary */
-	memcpy(ind_arr, l->key, l->num_of_rec * sizeof(long));
-	memcpy(rec_arr, l->recs.l_rec.r_arr, 
-			l->num_of_rec * sizeof(bpt_record_t*));
-
-	/* Insert the new (k, v) to temporary */
-	int ind = get_1st_ge(l->key, l->num_of_rec, k);
-	int i;
-	for(i = l->num_of_rec; i > ind; i--){
-		/* make room for the new key and record */
-		ind_arr[i] = ind_arr[i - 1];
-		rec_arr[i] = rec_arr[i - 1];
-	}
+	/* Move all items of orginal node to temporary, leaving room for the 
+	 * new (k, v)
+	 */
+	int ind = get_1st_ge_key(l->recs.l_rec.key, l->num_of_rec, k);
+	memcpy(ind_arr, l->recs.l_rec.key, ind * sizeof(bpt_key_t));
+	memcpy(ind_arr + ind + 1, l->recs.l_rec.key + ind, 
+			(l->num_of_rec - ind) * sizeof(bpt_key_t));
+	memcpy(rec_arr, l->recs.l_rec.r_arr, ind * sizeof(bpt_value));
+	memcpy(rec_arr + ind + 1, l->recs.l_rec.r_arr + ind, 
+			(l->num_of_rec - ind) * sizeof(bpt_value));
 	ind_arr[ind] = k;
-	rec_arr[ind] = v;
+	bpt_value_set(&rec_arr[ind], v);
 	
 	/* Num to move to original node */
 	int num = (l->num_of_rec + 1) / 2;
+	if(t->append && ind == l->num_of_rec 
+			&& TAILQ_NEXT(l, recs.l_rec.n) == NULL){
+		/* Appending to the right most leaf: keep it full, the new 
+		 * leaf starts with the new record only.
+		 */
+		num = l->num_of_rec;
+		t->ragged_right = 1;
+	}
 	/* Num to move to new node */
 	int num1 = l->num_of_rec + 1 - num; 
 
 	/* Move from temporary to original node */
-	memcpy(l->key, ind_arr, num * sizeof(long));
-	memcpy(l->recs.l_rec.r_arr, rec_arr, num * sizeof(bpt_record_t*));
+	memcpy(l->recs.l_rec.key, ind_arr, num * sizeof(bpt_key_t));
+	memcpy(l->recs.l_rec.r_arr, rec_arr, num * sizeof(bpt_value));
 	l->num_of_rec = num;
 
 	/* Create the new leaf node */
-	bpt_node* l1 = bpt_create_leaf_node();
+	bpt_node* l1 = bpt_create_leaf_node(t);
+	t->smo.splits++;
 	
-	/* TODO: maintain the link list of the leaf node */
-	//TAILQ_INSERT_AFTER(&rec_list_head, l, l1, recs.l_rec.n);
+	/* Maintain the link list of the leaf node */
+	TAILQ_INSERT_AFTER(&t->rec_list_head, l, l1, recs.l_rec.n);
 
 	/* Move from temporary to new node */
-	memcpy(l1->key, ind_arr + num,  num1 * sizeof(long));
+	memcpy(l1->recs.l_rec.key, ind_arr + num,  num1 * sizeof(bpt_key_t));
 	memcpy(l1->recs.l_rec.r_arr, rec_arr + num, 
-			num1 * sizeof(bpt_record_t*));
+			num1 * sizeof(bpt_value));
        	l1->num_of_rec = num1;      
 
 	/* Add the new splitted node into parent;
 	 * use the first key of the new node as the split key
 	 */
-	bpt_insert_in_parent(root, l, l1->key[0], l1);
+	bpt_insert_in_parent(t, path, path->depth - 1, 
+			l1->recs.l_rec.key[0], l1, 0);
 }
 
 void
-bpt_replace_root_with_child(bpt_node** root)
+bpt_replace_root_with_child(bptree* t)
 {
-	bpt_node* r = (*root)->recs.c_arr[0];
-	r->p = NULL;
-	free(*root);
-	*root = r;
+	bpt_node* r = t->root->recs.i_rec.c_arr[0];
+	bpt_node* old = t->root;
+	__atomic_store_n(&t->root, r, __ATOMIC_RELEASE);
+	bpt_delete_node(t, &old);
 }
 
-/* Given a node n, return the close sibling of n. The returned sibling node is 
- * hold by parameter n1, the returned split key between the two node is hold by
- * parameter k. The order of n and it's sibling makes no differences here.
+/* Given the non-root node path->node[lv], return its close sibling. The 
+ * returned sibling node is hold by parameter n1, the returned split key between
+ * the two node is hold by parameter k. The order of n and it's sibling makes 
+ * no differences here. Return the index of the sibling in their parent.
  */
-void 
-bpt_get_close_sibling(bpt_node* n, bpt_node** n1, long* k)
+int
+bpt_get_close_sibling(bpt_path* path, int lv, bpt_node** n1, bpt_key_t* k)
 {
-	bpt_node* p = n->p;
-	assert(p && p->num_of_rec > 1);
+	assert(lv > 0);
+	bpt_node* p = path->node[lv - 1];
+	assert(p->num_of_rec > 1);
 
-	int ind = bpt_locate_in_parent(n);
-	int direction = (ind == 0) ? 1 : -1; // indicats index +1 or -1
+	int ind = path->slot[lv];
 	if(ind == 0){
-		*n1 = p->recs.c_arr[ind + 1];
-		*k = p->key[ind];
+		*n1 = p->recs.i_rec.c_arr[ind + 1];
+		*k = p->recs.i_rec.key[ind];
+		return ind + 1;
 	}else{
-		*n1 = p->recs.c_arr[ind - 1];
-		*k = p->key[ind - 1];
+		*n1 = p->recs.i_rec.c_arr[ind - 1];
+		*k = p->recs.i_rec.key[ind - 1];
+		return ind - 1;
 	}
 }	
 
-
-void bpt_delete_entry(bpt_node** root, bpt_node* n, void* v);
-
 /* Merge the second index node into the first index node. split_key is the 
- * split key between the two node. The second index node will be freed.
+ * split key between the two node. The second index node will be freed, the 
+ * caller removes it from the parent.
  */
 void
-bpt_merge_index(bpt_node** root, bpt_node* n, long split_key, bpt_node** n1)
+bpt_merge_index(bptree* t, bpt_node* n, bpt_key_t split_key, bpt_node** n1)
 {
 	bpt_node *n11 = *n1;
 
 	/* add the split key into node */
-	n->key[bpt_num_of_key(n)] = split_key;
+	n->recs.i_rec.key[bpt_num_of_key(n)] = split_key;
 
 	/* Copy keys of the second index node into the first index node */
-	memcpy(n->key + n->num_of_rec, n11->key, 
-			n11->num_of_rec * sizeof(long));
+	memcpy(n->recs.i_rec.key + n->num_of_rec, n11->recs.i_rec.key, 
+			n11->num_of_rec * sizeof(bpt_key_t));
 
 	/* Copy children of the second index node into the first index node */
-	memcpy(n->recs.c_arr + n->num_of_rec, n11->recs.c_arr, 
+	memcpy(n->recs.i_rec.c_arr + n->num_of_rec, n11->recs.i_rec.c_arr, 
 			n11->num_of_rec * sizeof(bpt_node*));
+#ifdef BPT_COUNTS
+	memcpy(n->recs.i_rec.cnt + n->num_of_rec, n11->recs.i_rec.cnt, 
+			n11->num_of_rec * sizeof(long));
+#endif
 
 	n->num_of_rec += n11->num_of_rec;
 
-	/* NOTE!! For the children of to-be-removed index node, 
-	 * they should change their parent. */
-	int i;
-	for(i = 0; i < n11->num_of_rec; i++)
-		n11->recs.c_arr[i]->p = n;
-
-	/* Need to remove it from its parent. */
-	bpt_delete_entry(root, n->p, *n1);
-
 	/* Free the node memory */
-	bpt_delete_node(n1);
+	bpt_delete_node(t, n1);
 }
 
 /* Merge the second leaf node into the first leaf node. The second leaf node 
- * will be freed. 
+ * will be freed, the caller removes it from the parent.
  */
 void
-bpt_merge_leaf(bpt_node** root, bpt_node* n, bpt_node** n1)
+bpt_merge_leaf(bptree* t, bpt_node* n, bpt_node** n1)
 {
 	bpt_node *n11 = *n1;
 	
 	/* Copy keys of the second leaf node into the first leaf node */
-	memcpy(n->key + n->num_of_rec, n11->key, 
-			n11->num_of_rec * sizeof(long));
+	memcpy(n->recs.l_rec.key + n->num_of_rec, n11->recs.l_rec.key, 
+			n11->num_of_rec * sizeof(bpt_key_t));
 
 	/* Copy records of the second leaf node into the first leaf node */
 	memcpy(n->recs.l_rec.r_arr + n->num_of_rec, n11->recs.l_rec.r_arr, 
-			n11->num_of_rec * sizeof(bpt_record_t*));
+			n11->num_of_rec * sizeof(bpt_value));
 
 	n->num_of_rec += n11->num_of_rec;
 
-	/* Need to remove the second node from its parent */
-	bpt_delete_entry(root, n->p, *n1);
+	/* The second node is the next leaf of the first node, unlink it */
+	TAILQ_REMOVE(&t->rec_list_head, n11, recs.l_rec.n);
 
 	/* Free the node memory */
-	bpt_delete_node(n1);
+	bpt_delete_node(t, n1);
 }
 
 /* In the index node, delete key from the key array at key_ind; delete child 
@@ -467,11 +993,15 @@ bpt_delete_in_index_at(bpt_node* n, int key_ind, int rec_ind)
 	/* Key is the split key of the child */
 	assert(key_ind == rec_ind || key_ind == rec_ind - 1);
 
-	int i;
-	for(i = key_ind; i < bpt_num_of_key(n) - 1; i++)
-		n->key[i] = n->key[i + 1];
-	for(i = rec_ind; i < n->num_of_rec - 1; i++)
-		n->recs.c_arr[i] = n->recs.c_arr[i + 1];
+	memmove(n->recs.i_rec.key + key_ind, n->recs.i_rec.key + key_ind + 1,
+			(bpt_num_of_key(n) - key_ind - 1) * sizeof(bpt_key_t));
+	memmove(n->recs.i_rec.c_arr + rec_ind, 
+			n->recs.i_rec.c_arr + rec_ind + 1,
+			(n->num_of_rec - rec_ind - 1) * sizeof(bpt_node*));
+#ifdef BPT_COUNTS
+	memmove(n->recs.i_rec.cnt + rec_ind, n->recs.i_rec.cnt + rec_ind + 1,
+			(n->num_of_rec - rec_ind - 1) * sizeof(long));
+#endif
 
 	n->num_of_rec--;
 }
@@ -484,171 +1014,1110 @@ bpt_delete_in_leaf_at(bpt_node* n, int ind)
 {
 	assert(ind >= 0 && ind < n->num_of_rec);
 
-	int i;
-	for(i = ind; i < n->num_of_rec - 1; i++){
-		n->key[i] = n->key[i + 1];
-		n->recs.l_rec.r_arr[i] = n->recs.l_rec.r_arr[i + 1];
-	}
+	memmove(n->recs.l_rec.key + ind, n->recs.l_rec.key + ind + 1,
+			(n->num_of_rec - ind - 1) * sizeof(bpt_key_t));
+	memmove(n->recs.l_rec.r_arr + ind, n->recs.l_rec.r_arr + ind + 1,
+			(n->num_of_rec - ind - 1) * sizeof(bpt_value));
 
 	n->num_of_rec--;
 }
 
 /* Replace key of the node's key array at specific index */
 void
-bpt_replace_key_in_parent(bpt_node* p, int ind, long k)
+bpt_replace_key_in_parent(bpt_node* p, int ind, bpt_key_t k)
 {
-	p->key[ind] = k;
+	p->recs.i_rec.key[ind] = k;
 }
 
 /* Borrow on record from the second leaf node to the first leaf node. The second
- * node is the previous node of the first node.
+ * node is the previous node of the first node. Their split key is at ind of 
+ * the parent p.
  */
 void
-bpt_borrow_from_pre_leaf(bpt_node* n, bpt_node* n1)
+bpt_borrow_from_pre_leaf(bpt_node* n, bpt_node* n1, bpt_node* p, int ind)
 {
-	long k = n1->key[bpt_num_of_key(n1) - 1];
-	bpt_record_t* v = n1->recs.l_rec.r_arr[n1->num_of_rec - 1];
+	bpt_key_t k = n1->recs.l_rec.key[bpt_num_of_key(n1) - 1];
+	bpt_record_t* v = bpt_value_rec(
+			&n1->recs.l_rec.r_arr[n1->num_of_rec - 1]);
 	bpt_insert_in_leaf_at(n, 0, 0, k, v);
 	bpt_delete_in_leaf_at(n1, n1->num_of_rec - 1);
-
-	/* Get the split key index of n and n1 */
-	int ind = bpt_locate_in_parent(n1);
-	bpt_replace_key_in_parent(n1->p, ind, n->key[0]);
+	bpt_replace_key_in_parent(p, ind, n->recs.l_rec.key[0]);
+	bpt_count_move(p, ind, ind + 1, 1);
 }
 
 /* Borrow on record from the second leaf node to the first leaf node. The second
- * node is the next node of the first node.
+ * node is the next node of the first node. Their split key is at ind of the 
+ * parent p.
  */
 void
-bpt_borrow_from_post_leaf(bpt_node* n, bpt_node* n1)
+bpt_borrow_from_post_leaf(bpt_node* n, bpt_node* n1, bpt_node* p, int ind)
 {
 	int num = n->num_of_rec;
-	bpt_insert_in_leaf_at(n, num, num, n1->key[0], n1->recs.l_rec.r_arr[0]);
+	bpt_insert_in_leaf_at(n, num, num, n1->recs.l_rec.key[0], 
+			bpt_value_rec(&n1->recs.l_rec.r_arr[0]));
 	bpt_delete_in_leaf_at(n1, 0);
-
-	/* Get the split key index of n and n1 */
-	int ind = bpt_locate_in_parent(n);
-	bpt_replace_key_in_parent(n->p, ind, n1->key[0]);
+	bpt_replace_key_in_parent(p, ind, n1->recs.l_rec.key[0]);
+	bpt_count_move(p, ind + 1, ind, 1);
 }
 
 /* Borrow on record from the second index node to the first index node. The 
- * second node is the previous node of the first node.
+ * second node is the previous node of the first node. Their split key k is at 
+ * ind of the parent p.
  */
 void
-bpt_borrow_from_pre_index(bpt_node* n, long k, bpt_node* n1)
+bpt_borrow_from_pre_index(bpt_node* n, bpt_key_t k, bpt_node* n1, bpt_node* p, 
+		int ind)
 {
-	long new_key = n1->key[bpt_num_of_key(n1) - 1];
+	bpt_key_t new_key = n1->recs.i_rec.key[bpt_num_of_key(n1) - 1];
 	bpt_insert_in_index_at(n, 0, 0, 
-			k, n1->recs.c_arr[n1->num_of_rec - 1]);
+			k, n1->recs.i_rec.c_arr[n1->num_of_rec - 1]);
 	bpt_delete_in_index_at(n1, bpt_num_of_key(n1) - 1, n1->num_of_rec - 1);
-
-	/* Get the split key index of n and n1 */
-	int ind = bpt_locate_in_parent(n1);
-	bpt_replace_key_in_parent(n1->p, ind, new_key);
+	bpt_replace_key_in_parent(p, ind, new_key);
+#ifdef BPT_COUNTS
+	bpt_count_move(p, ind, ind + 1, n->recs.i_rec.cnt[0]);
+#endif
 }
 
 /* Borrow on record from the second index node to the first index node. The 
- * second node is the next node of the first node.
+ * second node is the next node of the first node. Their split key k is at ind
+ * of the parent p.
  */
 void
-bpt_borrow_from_post_index(bpt_node* n, long k, bpt_node* n1)
+bpt_borrow_from_post_index(bpt_node* n, bpt_key_t k, bpt_node* n1, bpt_node* p, 
+		int ind)
 {
-	long new_key = n1->key[0];
+	bpt_key_t new_key = n1->recs.i_rec.key[0];
 	bpt_insert_in_index_at(n, bpt_num_of_key(n), n->num_of_rec, 
-			k, n1->recs.c_arr[0]);
+			k, n1->recs.i_rec.c_arr[0]);
 	bpt_delete_in_index_at(n1, 0, 0);
-
-	/* Get the split key index of n and n1 */
-	int ind = bpt_locate_in_parent(n);
-	bpt_replace_key_in_parent(n->p, ind, new_key);
+	bpt_replace_key_in_parent(p, ind, new_key);
+#ifdef BPT_COUNTS
+	bpt_count_move(p, ind + 1, ind, 
+			n->recs.i_rec.cnt[n->num_of_rec - 1]);
+#endif
 }
 
-/* Return the index of record in a leaf node */
+/* Return the index of key k with record v in the leaf of the path, and move
+ * the path to the leaf of the record if it is not there: with duplicated 
+ * keys, the records of k may be in the leaves before and after it(see 
+ * bpt_child_ind).
+ */
 int
-bpt_locate_in_leaf(bpt_node* n, bpt_record_t* v)
+bpt_locate_in_path(bpt_path* path, bpt_key_t k, bpt_record_t* v)
 {
-	/* TODO: replace with binary search */
+	bpt_node* n = path->node[path->depth - 1];
+	bpt_node* n1;
 	int ind;
-	for(ind = 0; ind < n->num_of_rec; ind++)
-		if(n->recs.l_rec.r_arr[ind] == v)
-			return ind;
-	assert(0); // Should never reach here
-}	
 
-void
-bpt_delete_in_leaf(bpt_node* n, bpt_record_t* v)
-{
-	int ind = bpt_locate_in_leaf(n, v);
-	bpt_delete_in_leaf_at(n, ind);
-}
+	if((ind = bpt_find_in_leaf(n, k, v)) >= 0)
+		return ind;
+	/* Back to the first leaf which may hold k, then forward */
+	while(n->num_of_rec > 0 && n->recs.l_rec.key[0] >= k
+			&& (n1 = bpt_path_step_leaf(path, -1)) != NULL)
+		n = n1;
+	while((ind = bpt_find_in_leaf(n, k, v)) < 0){
+		n = bpt_path_step_leaf(path, 1);
+		/* Should be found */
+		assert(n != NULL && n->recs.l_rec.key[0] <= k);
+	}
+	return ind;
+}	
 
-void
-bpt_delete_in_index(bpt_node* n, bpt_node* v)
+/* Return the index of key k with record v in a leaf node, -1 if not found. 
+ * The key is needed since inline values need not be unique.
+ */
+int
+bpt_find_in_leaf(bpt_node* n, bpt_key_t k, bpt_record_t* v)
 {
-	int ind = bpt_locate_in_parent(v);
-	bpt_delete_in_index_at(n, ind - 1, ind);
+	int ind = get_1st_ge_key(n->recs.l_rec.key, n->num_of_rec, k);
+	for(; ind < n->num_of_rec && n->recs.l_rec.key[ind] == k; ind++)
+		if(bpt_value_is(&n->recs.l_rec.r_arr[ind], v))
+			return ind;
+	return -1;
 }
 
-/* Only for delete the entry in node. Not ajust the tree yet */
+/* Only for delete the entry at ind in node: record ind of leaf node, or child
+ * ind(with the key before it) of index node. Not ajust the tree yet.
+ */
 void
-bpt_delete_in_node(bpt_node* n, void* v)
+bpt_delete_in_node(bpt_node* n, int ind)
 {
 	if(bpt_is_leaf(n))
-		bpt_delete_in_leaf(n, v);
-	else bpt_delete_in_index(n, v);
+		bpt_delete_in_leaf_at(n, ind);
+	else bpt_delete_in_index_at(n, ind - 1, ind);
 }
 
 void
-bpt_delete(bpt_node** root, long k, bpt_record_t* v)
+bpt_delete(bptree* t, bpt_key_t k, bpt_record_t* v)
 {
-	bpt_node* n = bpt_query(*root, k);
-	/* n is the leaf node now. Delete record(v) from n */
-	bpt_delete_entry(root, n, v);
+	bpt_path path;
+	if(t->olc){
+		bpt_olc_delete(t, k, v);
+		return;
+	}
+
+	bpt_query_path(t, k, &path);
+	/* Delete record(v) from the leaf node */
+	int ind = bpt_locate_in_path(&path, k, v);
+	bpt_path_count(&path, -1);
+	bpt_delete_entry(t, &path, path.depth - 1, ind);
 }
 
-/* Delete one entry from leaf node or index node; 
- * make ajustment to maintain bptree
+/* Delete entry ind(see bpt_delete_in_node) from node path->node[lv], which is
+ * leaf node or index node; make ajustment to maintain bptree
  */
 void
-bpt_delete_entry(bpt_node** root, bpt_node* n, void* v)
+bpt_delete_entry(bptree* t, bpt_path* path, int lv, int ind)
 {
+	bpt_node* n = path->node[lv];
+
 	/* Only delete from node, no ajust yet. */
-	bpt_delete_in_node(n, v);
+	bpt_delete_in_node(n, ind);
 
-	if(bpt_is_root(n)){
-	       if(! bpt_is_enough(n) && !bpt_is_leaf(n)) 
+	if(lv == 0){
+	       if(! bpt_is_enough(t, n) && !bpt_is_leaf(n)) 
 			/* So root is not leaf node and only has one child */
-			bpt_replace_root_with_child(root);
-	}else if(! bpt_is_enough(n)){
+			bpt_replace_root_with_child(t);
+	}else if(! bpt_is_enough(t, n)){
 	        /* Not enough record in the node now, so need ajustment. */	
-		long k;
+		bpt_key_t k;
 		bpt_node* n1;
+		bpt_node* p = path->node[lv - 1];
+		int n_ind = path->slot[lv];
+		int n1_ind = bpt_get_close_sibling(path, lv, &n1, &k);
 
-		bpt_get_close_sibling(n, &n1, &k);
-
-		if((n->num_of_rec + n1->num_of_rec) <= BPT_MAX_REC_NO){
+		if((n->num_of_rec + n1->num_of_rec) <= bpt_max_rec(n)){
 			/* merge node and its close sibling */
-			if(n->key[0] > n1->key[0])
+			if(n1_ind < n_ind){
 				swap_pointer((void**)&n, (void**)&n1);
+				n1_ind = n_ind;
+			}
 
 			if(bpt_is_leaf(n))
-				bpt_merge_leaf(root, n, &n1);
-			else bpt_merge_index(root, n, k, &n1);
+				bpt_merge_leaf(t, n, &n1);
+			else bpt_merge_index(t, n, k, &n1);
+			bpt_count_merge(p, n1_ind - 1);
+			t->smo.merges++;
+
+			/* Need to remove the second node from its parent */
+			bpt_delete_entry(t, path, lv - 1, n1_ind);
 		}else{
 			/* borrow one entry from its close sibling */
-			if(n->key[0] > n1->key[0]){
+			t->smo.borrows++;
+			if(n1_ind < n_ind){
 				if(bpt_is_leaf(n))
-					bpt_borrow_from_pre_leaf(n,n1);
-				else bpt_borrow_from_pre_index(n, k, n1);
+					bpt_borrow_from_pre_leaf(n, n1, p,
+							n1_ind);
+				else bpt_borrow_from_pre_index(n, k, n1, p, 
+						n1_ind);
 			}else{
 				if(bpt_is_leaf(n))
-					bpt_borrow_from_post_leaf(n, n1);
-				else bpt_borrow_from_post_index(n, k, n1);
+					bpt_borrow_from_post_leaf(n, n1, p,
+							n_ind);
+				else bpt_borrow_from_post_index(n, k, n1, p, 
+						n_ind);
 			}
 		}
 	}
 }
 
+/* State of bulk loading. The tree is built level by level from left to right,
+ * so for each level only the right most node is open for appending; 'prev' is 
+ * the node closed before it, kept for fixing up the last node of the level.
+ */
+struct bpt_bulk
+{
+	/* Number of records(leaf) and children(index) to fill in each node */
+	int leaf_target;
+	int index_target;
+
+	struct
+	{
+		bpt_node* open;
+		bpt_node* prev;
+		/* The first key in the subtree of the open node */
+		bpt_key_t low;
+	} lv[BPT_MAX_HEIGHT];
+};
+
+/* Number of entries to fill in a node with max entries, for the fill factor.
+ * The result is at least the min number of non-root node.
+ */
+int
+bpt_bulk_target(double fill, int max, int min)
+{
+	int n = (int) (fill * max + 0.5);
+	return n < min ? min : n > max ? max : n;
+}
+
+/* Append child(its subtree starts from key low) to the open index node of 
+ * level; if the open node is filled, close it and append it to upper level.
+ */
+void
+bpt_bulk_add_child(bptree* t, struct bpt_bulk* b, int level, bpt_key_t low, 
+		bpt_node* child)
+{
+	assert(level < BPT_MAX_HEIGHT);
+	bpt_node* n = b->lv[level].open;
+	if(n && n->num_of_rec == b->index_target){
+		bpt_bulk_add_child(t, b, level + 1, b->lv[level].low, n);
+		b->lv[level].prev = n;
+		n = NULL;
+	}
+	if(n == NULL){
+		n = b->lv[level].open = bpt_create_index_node(t);
+		b->lv[level].low = low;
+	}else n->recs.i_rec.key[bpt_num_of_key(n)] = low;
+
+	n->recs.i_rec.c_arr[n->num_of_rec++] = child;
+}
+
+/* Append (k, v) to the open leaf node */
+void
+bpt_bulk_add_rec(bptree* t, struct bpt_bulk* b, bpt_key_t k, bpt_record_t* v)
+{
+	bpt_node* l = b->lv[0].open;
+	if(l && l->num_of_rec == b->leaf_target){
+		bpt_bulk_add_child(t, b, 1, l->recs.l_rec.key[0], l);
+		b->lv[0].prev = l;
+		l = NULL;
+	}
+	if(l == NULL){
+		l = b->lv[0].open = bpt_create_leaf_node(t);
+		TAILQ_INSERT_TAIL(&t->rec_list_head, l, recs.l_rec.n);
+	}
+	assert(l->num_of_rec == 0 || l->recs.l_rec.key[l->num_of_rec - 1] <= k);
+	l->recs.l_rec.key[l->num_of_rec] = k;
+	bpt_value_set(&l->recs.l_rec.r_arr[l->num_of_rec], v);
+	l->num_of_rec++;
+}
+
+/* The last node of a level may have less than the min number of entries. Merge
+ * it into the previous node of the level if they fit in one node, otherwise 
+ * move entries from the previous node to make both have enough.
+ */
+void
+bpt_bulk_fix_last(bptree* t, struct bpt_bulk* b, int level)
+{
+	bpt_node* n = b->lv[level].open;
+	bpt_node* p = b->lv[level].prev;
+
+	if(p == NULL || n->num_of_rec >= bpt_min_rec(n))
+		return;
+
+	if(p->num_of_rec + n->num_of_rec <= bpt_max_rec(n)){
+		/* Merge n into p. n is not in its parent yet */
+		if(bpt_is_leaf(n)){
+			memcpy(p->recs.l_rec.key + p->num_of_rec, 
+				n->recs.l_rec.key,
+				n->num_of_rec * sizeof(bpt_key_t));
+			memcpy(p->recs.l_rec.r_arr + p->num_of_rec, 
+				n->recs.l_rec.r_arr, 
+				n->num_of_rec * sizeof(bpt_value));
+			TAILQ_REMOVE(&t->rec_list_head, n, recs.l_rec.n);
+		}else{
+			p->recs.i_rec.key[bpt_num_of_key(p)] = b->lv[level].low;
+			memcpy(p->recs.i_rec.key + p->num_of_rec, 
+				n->recs.i_rec.key, 
+				bpt_num_of_key(n) * sizeof(bpt_key_t));
+			memcpy(p->recs.i_rec.c_arr + p->num_of_rec, 
+				n->recs.i_rec.c_arr, 
+				n->num_of_rec * sizeof(bpt_node*));
+		}
+		p->num_of_rec += n->num_of_rec;
+		bpt_delete_node(t, &b->lv[level].open);
+		return;
+	}
+
+	/* Move m entries from the tail of p to the head of n */
+	int m = (p->num_of_rec + n->num_of_rec) / 2 - n->num_of_rec;
+	int pn = p->num_of_rec - m;
+	if(bpt_is_leaf(n)){
+		memmove(n->recs.l_rec.key + m, n->recs.l_rec.key, 
+				n->num_of_rec * sizeof(bpt_key_t));
+		memmove(n->recs.l_rec.r_arr + m, n->recs.l_rec.r_arr, 
+				n->num_of_rec * sizeof(bpt_value));
+		memcpy(n->recs.l_rec.key, p->recs.l_rec.key + pn, 
+				m * sizeof(bpt_key_t));
+		memcpy(n->recs.l_rec.r_arr, p->recs.l_rec.r_arr + pn, 
+				m * sizeof(bpt_value));
+		b->lv[level].low = n->recs.l_rec.key[0];
+	}else{
+		/* Keys of n become: keys of p after its new last child, the old
+		 * first key of n's subtree, then the old keys of n.
+		 */
+		memmove(n->recs.i_rec.key + m, n->recs.i_rec.key, 
+				bpt_num_of_key(n) * sizeof(bpt_key_t));
+		n->recs.i_rec.key[m - 1] = b->lv[level].low;
+		memcpy(n->recs.i_rec.key, p->recs.i_rec.key + pn, 
+				(m - 1) * sizeof(bpt_key_t));
+		b->lv[level].low = p->recs.i_rec.key[pn - 1];
+
+		memmove(n->recs.i_rec.c_arr + m, n->recs.i_rec.c_arr, 
+				n->num_of_rec * sizeof(bpt_node*));
+		memcpy(n->recs.i_rec.c_arr, p->recs.i_rec.c_arr + pn, 
+				m * sizeof(bpt_node*));
+	}
+	p->num_of_rec = pn;
+	n->num_of_rec += m;
+}
+
+/* Build the tree bottom-up from (key, record) pairs in key order, returned by
+ * next() one by one until it returns 0. Each node is filled with 
+ * fill * 'max entries'(but at least the min entries of non-root node), so 
+ * fill == 1 gives the densest tree. The tree should be empty.
+ */
+void
+bpt_bulk_load_stream(bptree* t, bpt_bulk_next next, void* arg, double fill)
+{
+	struct bpt_bulk b;
+	bpt_key_t k;
+	bpt_record_t* v;
+	int level;
+
+	assert(bpt_empty(t));
+	memset(&b, 0, sizeof(b));
+	b.leaf_target = bpt_bulk_target(fill, BPT_MAX_LEAF_REC_NO, 
+			BPT_MIN_LEAF_REC_NO);
+	b.index_target = bpt_bulk_target(fill, BPT_MAX_INDEX_REC_NO, 
+			BPT_MIN_INDEX_REC_NO);
+
+	while(next(arg, &k, &v))
+		bpt_bulk_add_rec(t, &b, k, v);
+	if(b.lv[0].open == NULL)
+		return;
+
+	/* Close the open nodes from bottom up; the open node of the top level
+	 * is the root.
+	 */
+	b.lv[0].low = b.lv[0].open->recs.l_rec.key[0];
+	for(level = 0; b.lv[level + 1].open; level++){
+		bpt_bulk_fix_last(t, &b, level);
+		if(b.lv[level].open)
+			bpt_bulk_add_child(t, &b, level + 1, b.lv[level].low, 
+					b.lv[level].open);
+	}
+	t->root = b.lv[level].open;
+#ifdef BPT_COUNTS
+	/* Nodes move entries after they are in their parents, count at last */
+	bpt_count_all(t->root);
+#endif
+
+	/* A merge of the last node may leave the root only one child */
+	while(! bpt_is_leaf(t->root) && t->root->num_of_rec == 1)
+		bpt_replace_root_with_child(t);
+}
+
+/* Reader of the sorted arrays for bpt_bulk_load */
+struct bpt_bulk_arr
+{
+	bpt_key_t* keys;
+	bpt_record_t** recs;
+	long n;
+	long i;
+};
+
+int
+bpt_bulk_arr_next(void* arg, bpt_key_t* k, bpt_record_t** v)
+{
+	struct bpt_bulk_arr* a = (struct bpt_bulk_arr*) arg;
+	if(a->i == a->n)
+		return 0;
+	*k = a->keys[a->i];
+	*v = a->recs[a->i];
+	a->i++;
+	return 1;
+}
+
+/* Build the tree from n sorted keys and their records, see 
+ * bpt_bulk_load_stream.
+ */
+void
+bpt_bulk_load(bptree* t, bpt_key_t* keys, bpt_record_t** recs, long n,
+		double fill)
+{
+	struct bpt_bulk_arr a = {keys, recs, n, 0};
+	bpt_bulk_load_stream(t, bpt_bulk_arr_next, &a, fill);
+}
+
+/* Max number of new records put into one leaf at a time by batch insert */
+#define BPT_BATCH_LEAF_MAX (4 * BPT_MAX_LEAF_REC_NO)
+
+/* Insert the sorted pairs (keys[i], recs[i]), 0 <= i < n, into the leaf at the
+ * end of path; all of them belong to the leaf. If the leaf overflows, it is 
+ * split once, into as many leaves as needed. The path leads to the last of 
+ * them after that.
+ */
+void
+bpt_insert_in_leaf_batch(bptree* t, bpt_path* path, bpt_key_t* keys, 
+		bpt_record_t** recs, int n)
+{
+	bpt_node* l = path->node[path->depth - 1];
+	int num = l->num_of_rec;
+	int total = num + n;
+	int i = num - 1, j = n - 1, d;
+
+	assert(n <= BPT_BATCH_LEAF_MAX);
+	if(total <= BPT_MAX_LEAF_REC_NO){
+		/* Merge from the back, in place */
+		for(d = total - 1; j >= 0; d--){
+			if(i >= 0 && l->recs.l_rec.key[i] > keys[j]){
+				l->recs.l_rec.key[d] = l->recs.l_rec.key[i];
+				l->recs.l_rec.r_arr[d] = l->recs.l_rec.r_arr[i--];
+			}else{
+				l->recs.l_rec.key[d] = keys[j];
+				bpt_value_set(&l->recs.l_rec.r_arr[d], 
+						recs[j--]);
+			}
+		}
+		l->num_of_rec = total;
+		bpt_path_count(path, n);
+		return;
+	}
+
+	/* Temporary storage of the merged records */
+	bpt_key_t ind_arr[total];
+	bpt_value rec_arr[total];
+	int append = t->append && TAILQ_NEXT(l, recs.l_rec.n) == NULL
+		&& (num == 0 || keys[0] >= l->recs.l_rec.key[num - 1]);
+
+	for(d = total - 1; d >= 0; d--){
+		if(j < 0 || (i >= 0 && l->recs.l_rec.key[i] > keys[j])){
+			ind_arr[d] = l->recs.l_rec.key[i];
+			rec_arr[d] = l->recs.l_rec.r_arr[i--];
+		}else{
+			ind_arr[d] = keys[j];
+			bpt_value_set(&rec_arr[d], recs[j--]);
+		}
+	}
+
+	/* Split into q leaves of even sizes, all of them have enough records
+	 * since total > M * (q - 1). In append mode at the right edge, fill 
+	 * all but the last leaf.
+	 */
+	int q = (total + BPT_MAX_LEAF_REC_NO - 1) / BPT_MAX_LEAF_REC_NO;
+	int from = 0, piece;
+	if(append && total - BPT_MAX_LEAF_REC_NO * (q - 1) 
+			< BPT_MIN_LEAF_REC_NO)
+		t->ragged_right = 1;
+	for(piece = 0; piece < q; piece++){
+		int size = append ? BPT_MAX_LEAF_REC_NO
+			: total / q + (piece < total % q);
+		if(size > total - from)
+			size = total - from;
+
+		bpt_node* l1 = l;
+		if(piece > 0){
+			l1 = bpt_create_leaf_node(t);
+			TAILQ_INSERT_AFTER(&t->rec_list_head, l, l1, 
+					recs.l_rec.n);
+			t->smo.splits++;
+		}
+		memcpy(l1->recs.l_rec.key, ind_arr + from,
+			size * sizeof(bpt_key_t));
+		memcpy(l1->recs.l_rec.r_arr, rec_arr + from, 
+				size * sizeof(bpt_value));
+		l1->num_of_rec = size;
+		from += size;
+
+		/* Add the new leaf right after the previous one. Its records
+		 * are counted on the path first, as in a leaf split.
+		 */
+		bpt_path_count(path, piece > 0 ? size : size - num);
+		if(piece > 0)
+			bpt_insert_in_parent(t, path, path->depth - 1, 
+					l1->recs.l_rec.key[0], l1, 1);
+		l = l1;
+	}
+}
+
+/* Batch insert of sorted keys. Keys that fall into the same leaf are inserted
+ * together, and the descent for the next leaf starts from their lowest 
+ * common ancestor.
+ */
+void
+bpt_insert_sorted(bptree* t, bpt_key_t* keys, bpt_record_t** recs, long n)
+{
+	bpt_path path;
+	long i = 0, j;
+	/* Set by bpt_path_high, and read only when that returns 1 */
+	bpt_key_t hi = 0;
+
+	if(n == 0)
+		return;
+	if(bpt_empty(t))
+		bpt_init_root(t);
+	bpt_query_path(t, keys[0], &path);
+	while(i < n){
+		int has_hi = bpt_path_high(&path, path.depth - 1, &hi);
+		for(j = i + 1; j < n && j - i < BPT_BATCH_LEAF_MAX 
+				&& (! has_hi || keys[j] < hi); j++)
+			assert(keys[j - 1] <= keys[j]);
+		bpt_insert_in_leaf_batch(t, &path, keys + i, recs + i, j - i);
+		i = j;
+
+		/* The path leads to the last leaf of the split, whose keys may
+		 * be bigger than keys[i] if the leaf got only part of its keys.
+		 */
+		if(i < n && has_hi && keys[i] < hi)
+			bpt_query_path(t, keys[i], &path);
+		else if(i < n)
+			bpt_path_seek(t, keys[i], &path, 0);
+	}
+}
+
+/* Batch delete of sorted keys, see bpt_insert_sorted. A delete which makes 
+ * the leaf merge or borrow restarts the descent from the root.
+ */
+void
+bpt_delete_sorted(bptree* t, bpt_key_t* keys, bpt_record_t** recs, long n)
+{
+	bpt_path path;
+	long i;
+
+	if(n == 0)
+		return;
+	bpt_query_path(t, keys[0], &path);
+	for(i = 0; i < n; i++){
+		if(i > 0){
+			assert(keys[i - 1] <= keys[i]);
+			bpt_path_seek(t, keys[i], &path, 0);
+		}
+		int ind = bpt_locate_in_path(&path, keys[i], recs[i]);
+		bpt_node* l = path.node[path.depth - 1];
+		bpt_path_count(&path, -1);
+		if(path.depth == 1 
+				|| l->num_of_rec - 1 >= bpt_underflow_min(t, l))
+			bpt_delete_in_leaf_at(l, ind);
+		else{
+			bpt_delete_entry(t, &path, path.depth - 1, ind);
+			if(i + 1 < n)
+				bpt_query_path(t, keys[i + 1], &path);
+		}
+	}
+}
+
+/* Batch get of sorted keys, see bpt_insert_sorted. The path goes down as 
+ * bpt_get, then on along the leaves to the first key >= keys[i].
+ */
+void
+bpt_get_sorted(bptree* t, bpt_key_t* keys, bpt_record_t** recs, long n)
+{
+	bpt_path path;
+	bpt_node* l;
+	long i;
+	int ind;
+
+	if(n == 0)
+		return;
+	if(bpt_empty(t)){
+		memset(recs, 0, n * sizeof(bpt_record_t*));
+		return;
+	}
+	l = bpt_query_path_lower(t, keys[0], &path);
+	for(i = 0; i < n; i++){
+		if(i > 0){
+			assert(keys[i - 1] <= keys[i]);
+			l = bpt_path_seek(t, keys[i], &path, 1);
+		}
+		ind = get_1st_ge_key(l->recs.l_rec.key, l->num_of_rec, 
+				keys[i]);
+		while(ind == l->num_of_rec 
+				&& bpt_path_step_leaf(&path, 1) != NULL){
+			l = path.node[path.depth - 1];
+			ind = get_1st_ge_key(l->recs.l_rec.key, 
+					l->num_of_rec, keys[i]);
+		}
+		recs[i] = ind < l->num_of_rec && l->recs.l_rec.key[ind] == keys[i]
+			? bpt_value_rec(&l->recs.l_rec.r_arr[ind]) : NULL;
+	}
+}
+
+/* Key and its index in a batch, for sorting */
+struct bpt_batch_ent
+{
+	bpt_key_t k;
+	long i;
+};
+
+int
+bpt_batch_cmp(const void* a, const void* b)
+{
+	const struct bpt_batch_ent* x = a;
+	const struct bpt_batch_ent* y = b;
+	if(x->k != y->k)
+		return x->k < y->k ? -1 : 1;
+	return x->i < y->i ? -1 : x->i > y->i;
+}
+
+/* Sort a batch: return the order of the keys, keys[perm[0]] <= keys[perm[1]] 
+ * <= ..., and the sorted copies of keys and recs(if recs is not NULL). The 
+ * caller frees the three arrays.
+ */
+long*
+bpt_batch_sort(bpt_key_t* keys, bpt_record_t** recs, long n, bpt_key_t** skeys, 
+		bpt_record_t*** srecs)
+{
+	struct bpt_batch_ent* e = my_calloc(n * sizeof(struct bpt_batch_ent));
+	long* perm = my_calloc(n * sizeof(long));
+	long i;
+
+	for(i = 0; i < n; i++){
+		e[i].k = keys[i];
+		e[i].i = i;
+	}
+	qsort(e, n, sizeof(struct bpt_batch_ent), bpt_batch_cmp);
+
+	*skeys = my_calloc(n * sizeof(bpt_key_t));
+	*srecs = my_calloc(n * sizeof(bpt_record_t*));
+	for(i = 0; i < n; i++){
+		perm[i] = e[i].i;
+		(*skeys)[i] = e[i].k;
+		if(recs)
+			(*srecs)[i] = recs[e[i].i];
+	}
+	free(e);
+	return perm;
+}
+
+/* Insert n pairs (keys[i], recs[i]). If sorted is not 0, the keys should be in
+ * increasing order, otherwise they are sorted first.
+ */
+void
+bpt_insert_batch(bptree* t, bpt_key_t* keys, bpt_record_t** recs, long n, 
+		int sorted)
+{
+	long i;
+	bpt_key_t* skeys;
+	bpt_record_t** srecs;
+
+	if(t->olc){
+		for(i = 0; i < n; i++)
+			bpt_olc_insert(t, keys[i], recs[i]);
+	}else if(sorted)
+		bpt_insert_sorted(t, keys, recs, n);
+	else if(n > 0){
+		free(bpt_batch_sort(keys, recs, n, &skeys, &srecs));
+		bpt_insert_sorted(t, skeys, srecs, n);
+		free(skeys);
+		free(srecs);
+	}
+}
+
+/* Delete n pairs (keys[i], recs[i]), see bpt_insert_batch */
+void
+bpt_delete_batch(bptree* t, bpt_key_t* keys, bpt_record_t** recs, long n, 
+		int sorted)
+{
+	long i;
+	bpt_key_t* skeys;
+	bpt_record_t** srecs;
+
+	if(t->olc){
+		for(i = 0; i < n; i++)
+			bpt_olc_delete(t, keys[i], recs[i]);
+	}else if(sorted)
+		bpt_delete_sorted(t, keys, recs, n);
+	else if(n > 0){
+		free(bpt_batch_sort(keys, recs, n, &skeys, &srecs));
+		bpt_delete_sorted(t, skeys, srecs, n);
+		free(skeys);
+		free(srecs);
+	}
+}
+
+/* Free the subtree of node n, and unlink its leaves from the leaf list. 
+ * Return the number of records in it.
+ */
+long
+bpt_range_free(bptree* t, bpt_node* n)
+{
+	long d = 0;
+	int i;
+
+	if(bpt_is_leaf(n)){
+		d = n->num_of_rec;
+		TAILQ_REMOVE(&t->rec_list_head, n, recs.l_rec.n);
+	}else for(i = 0; i < n->num_of_rec; i++)
+		d += bpt_range_free(t, n->recs.i_rec.c_arr[i]);
+	bpt_delete_node(t, &n);
+	return d;
+}
+
+/* Rebalance children i and i + 1 of index node p, when a range delete left
+ * either of them with too few entries: merge them if they fit in one node,
+ * otherwise share their entries evenly.
+ */
+void
+bpt_range_fix_pair(bptree* t, bpt_node* p, int i)
+{
+	bpt_node* n = p->recs.i_rec.c_arr[i];
+	bpt_node* n1 = p->recs.i_rec.c_arr[i + 1];
+	int m = n->num_of_rec, m1 = n1->num_of_rec;
+	int total = m + m1, h = total / 2;
+
+	if(total <= bpt_max_rec(n)){
+		if(bpt_is_leaf(n))
+			bpt_merge_leaf(t, n, &n1);
+		else bpt_merge_index(t, n, p->recs.i_rec.key[i], &n1);
+		bpt_delete_in_index_at(p, i, i + 1);
+		t->smo.merges++;
+		return;
+	}
+
+	t->smo.borrows++;
+
+	if(bpt_is_leaf(n)){
+		bpt_key_t key[total];
+		bpt_value rec[total];
+		memcpy(key, n->recs.l_rec.key, m * sizeof(bpt_key_t));
+		memcpy(key + m, n1->recs.l_rec.key, m1 * sizeof(bpt_key_t));
+		memcpy(rec, n->recs.l_rec.r_arr, m * sizeof(bpt_value));
+		memcpy(rec + m, n1->recs.l_rec.r_arr, m1 * sizeof(bpt_value));
+
+		memcpy(n->recs.l_rec.key, key, h * sizeof(bpt_key_t));
+		memcpy(n->recs.l_rec.r_arr, rec, h * sizeof(bpt_value));
+		memcpy(n1->recs.l_rec.key, key + h, 
+				(total - h) * sizeof(bpt_key_t));
+		memcpy(n1->recs.l_rec.r_arr, rec + h, 
+				(total - h) * sizeof(bpt_value));
+		p->recs.i_rec.key[i] = key[h];
+	}else{
+		/* The split key in p goes down between the keys of the two */
+		bpt_key_t key[total];
+		bpt_node* child[total];
+		memcpy(key, n->recs.i_rec.key, (m - 1) * sizeof(bpt_key_t));
+		key[m - 1] = p->recs.i_rec.key[i];
+		memcpy(key + m, n1->recs.i_rec.key, 
+				(m1 - 1) * sizeof(bpt_key_t));
+		memcpy(child, n->recs.i_rec.c_arr, m * sizeof(bpt_node*));
+		memcpy(child + m, n1->recs.i_rec.c_arr, 
+				m1 * sizeof(bpt_node*));
+
+		memcpy(n->recs.i_rec.key, key, (h - 1) * sizeof(bpt_key_t));
+		memcpy(n->recs.i_rec.c_arr, child, h * sizeof(bpt_node*));
+		memcpy(n1->recs.i_rec.key, key + h, 
+				(total - h - 1) * sizeof(bpt_key_t));
+		memcpy(n1->recs.i_rec.c_arr, child + h, 
+				(total - h) * sizeof(bpt_node*));
+		p->recs.i_rec.key[i] = key[h - 1];
+	}
+	n->num_of_rec = h;
+	n1->num_of_rec = total - h;
+	bpt_count_children(n);
+	bpt_count_children(n1);
+}
+
+/* Rebalance the children of node n which have too few entries, each one 
+ * with its next or previous sibling. The nodes merged or shared may have such
+ * children too(eg. the child of a node of one child), they are rebalanced in
+ * turn.
+ */
+void
+bpt_range_fix_children(bptree* t, bpt_node* n)
+{
+	int i = 0, j;
+
+	if(bpt_is_leaf(n))
+		return;
+	while(n->num_of_rec >= 2){
+		/* The children before child i have enough entries */
+		for(; i < n->num_of_rec; i++)
+			if(n->recs.i_rec.c_arr[i]->num_of_rec 
+					< bpt_min_rec(n->recs.i_rec.c_arr[i]))
+				break;
+		if(i == n->num_of_rec)
+			break;
+		i = j = i + 1 < n->num_of_rec ? i : i - 1;
+		bpt_range_fix_pair(t, n, j);
+		bpt_range_fix_children(t, n->recs.i_rec.c_arr[j]);
+		if(j + 1 < n->num_of_rec)
+			bpt_range_fix_children(t, n->recs.i_rec.c_arr[j + 1]);
+	}
+	bpt_count_children(n);
+}
+
+/* Delete the records with keys in [lo, hi) under node n, return their number.
+ * The children of n which are covered by the range are freed, the ones at
+ * the two ends of the range are cut by recursion and then rebalanced, so n is
+ * correct below, but may be left with too few entries, or none.
+ */
+long
+bpt_range_delete_node(bptree* t, bpt_node* n, bpt_key_t lo, bpt_key_t hi)
+{
+	long d = 0;
+	int a, b, i;
+
+	if(bpt_is_leaf(n)){
+		a = get_1st_ge_key(n->recs.l_rec.key, n->num_of_rec, lo);
+		b = get_1st_ge_key(n->recs.l_rec.key, n->num_of_rec, hi);
+		memmove(n->recs.l_rec.key + a, n->recs.l_rec.key + b,
+				(n->num_of_rec - b) * sizeof(bpt_key_t));
+		memmove(n->recs.l_rec.r_arr + a, n->recs.l_rec.r_arr + b,
+				(n->num_of_rec - b) * sizeof(bpt_value));
+		n->num_of_rec -= b - a;
+		return b - a;
+	}
+
+	/* Child i holds keys in [key[i - 1], key[i]], the upper bound is 
+	 * included for duplicated keys. So children a + 1 .. b - 1 hold only 
+	 * keys in the range.
+	 */
+	a = get_1st_ge_key(n->recs.i_rec.key, bpt_num_of_key(n), lo);
+	b = get_1st_ge_key(n->recs.i_rec.key, bpt_num_of_key(n), hi);
+	if(b > a + 1){
+		for(i = a + 1; i < b; i++)
+			d += bpt_range_free(t, n->recs.i_rec.c_arr[i]);
+		/* key[b - 1] is the split key between children a and b now */
+		memmove(n->recs.i_rec.key + a, n->recs.i_rec.key + b - 1,
+			(bpt_num_of_key(n) - b + 1) * sizeof(bpt_key_t));
+		memmove(n->recs.i_rec.c_arr + a + 1, n->recs.i_rec.c_arr + b,
+				(n->num_of_rec - b) * sizeof(bpt_node*));
+		n->num_of_rec -= b - a - 1;
+		b = a + 1;
+	}
+	d += bpt_range_delete_node(t, n->recs.i_rec.c_arr[a], lo, hi);
+	if(b > a)
+		d += bpt_range_delete_node(t, n->recs.i_rec.c_arr[b], lo, hi);
+
+	/* Remove the children left empty */
+	for(i = b; i >= a; i--){
+		bpt_node* c = n->recs.i_rec.c_arr[i];
+		if(c->num_of_rec > 0)
+			continue;
+		bpt_range_free(t, c);
+		if(n->num_of_rec == 1)
+			n->num_of_rec = 0;
+		else bpt_delete_in_index_at(n, i > 0 ? i - 1 : 0, i);
+	}
+
+	bpt_range_fix_children(t, n);
+	return d;
+}
+
+/* The root may be left with one child, or none. Below a root of one child, 
+ * the new root may have children to rebalance.
+ */
+void
+bpt_range_fix_root(bptree* t)
+{
+	while(! bpt_is_leaf(t->root) && t->root->num_of_rec < 2){
+		if(t->root->num_of_rec == 0){
+			bpt_delete_node(t, &t->root);
+			bpt_init_root(t);
+			break;
+		}
+		bpt_replace_root_with_child(t);
+		bpt_range_fix_children(t, t->root);
+	}
+}
+
+/* Delete all the records with keys in [lo, hi), return their number */
+long
+bpt_delete_range(bptree* t, bpt_key_t lo, bpt_key_t hi)
+{
+	long d;
+
+	assert(t->olc == NULL);
+	if(bpt_empty(t) || hi <= lo)
+		return 0;
+	d = bpt_range_delete_node(t, t->root, lo, hi);
+	bpt_range_fix_root(t);
+	return d;
+}
+
+/* Rebalance the subtree of node n bottom up: the children of each index node
+ * are fixed after their own subtrees.
+ */
+void
+bpt_compact_node(bptree* t, bpt_node* n)
+{
+	int i;
+
+	if(bpt_is_leaf(n))
+		return;
+	for(i = 0; i < n->num_of_rec; i++)
+		bpt_compact_node(t, n->recs.i_rec.c_arr[i]);
+	bpt_range_fix_children(t, n);
+}
+
+void
+bpt_compact(bptree* t)
+{
+	assert(t->olc == NULL);
+	if(bpt_empty(t))
+		return;
+	bpt_compact_node(t, t->root);
+	bpt_range_fix_root(t);
+
+	/* Only the nodes the policy lets shrink may be underfull again */
+	t->ragged_right = 0;
+	t->underfull = t->underflow != BPT_UNDERFLOW_HALF;
+}
+
+/* Get the records of n keys into recs[i](NULL if no such key), see 
+ * bpt_insert_batch.
+ */
+void
+bpt_get_batch(bptree* t, bpt_key_t* keys, bpt_record_t** recs, long n,
+		int sorted)
+{
+	long i;
+	bpt_key_t* skeys;
+	bpt_record_t** srecs;
+
+	if(t->olc){
+		for(i = 0; i < n; i++)
+			recs[i] = bpt_olc_get(t, keys[i]);
+	}else if(sorted)
+		bpt_get_sorted(t, keys, recs, n);
+	else if(n > 0){
+		long* perm = bpt_batch_sort(keys, NULL, n, &skeys, &srecs);
+		bpt_get_sorted(t, skeys, srecs, n);
+		for(i = 0; i < n; i++)
+			recs[perm[i]] = srecs[i];
+		free(perm);
+		free(skeys);
+		free(srecs);
+	}
+}
+
+/* For the searching key k, return the left most leaf node which may contain 
+ * keys >= k. Different from bpt_query, the descent goes left when k equals the
+ * split key, so that duplicated keys in the left node are not missed.
+ */
+bpt_node*
+bpt_query_lower(bptree* t, bpt_key_t k)
+{
+	bpt_node* n = t->root;
+	while(! bpt_is_leaf(n)){
+		int ind = get_1st_ge_key(n->recs.i_rec.key,
+			bpt_num_of_key(n), k);
+		n = n->recs.i_rec.c_arr[ind];
+	}
+	return n;
+}
+
+/* Position the cursor at the first record whose key >= k. The end bound of the
+ * cursor is cleared.
+ */
+void
+bpt_cursor_seek(bptree* t, bpt_cursor* c, bpt_key_t k)
+{
+	c->has_end = 0;
+	if(bpt_empty(t)){
+		c->leaf = NULL;
+		return;
+	}
+
+	c->leaf = bpt_query_lower(t, k);
+	c->ind = bpt_leaf_seek(&c->leaf, k);
+}
+
+/* Stop the cursor before the first key >= end */
+void
+bpt_cursor_set_end(bpt_cursor* c, bpt_key_t end)
+{
+	c->has_end = 1;
+	c->end = end;
+}
+
+/* Return 1 if the cursor points to a record */
+int
+bpt_cursor_valid(bpt_cursor* c)
+{
+	if(c->leaf == NULL)
+		return 0;
+	return ! c->has_end || c->leaf->recs.l_rec.key[c->ind] < c->end;
+}
+
+bpt_key_t
+bpt_cursor_key(bpt_cursor* c)
+{
+	assert(bpt_cursor_valid(c));
+	return c->leaf->recs.l_rec.key[c->ind];
+}
+
+bpt_record_t*
+bpt_cursor_record(bpt_cursor* c)
+{
+	assert(bpt_cursor_valid(c));
+	return bpt_value_rec(&c->leaf->recs.l_rec.r_arr[c->ind]);
+}
+
+/* Move the cursor to the next record */
+void
+bpt_cursor_next(bpt_cursor* c)
+{
+	assert(c->leaf);
+	c->ind++;
+	/* Skip to the next leaf, the loop also skips an empty root leaf */
+	while(c->leaf && c->ind >= c->leaf->num_of_rec){
+		c->leaf = TAILQ_NEXT(c->leaf, recs.l_rec.n);
+		c->ind = 0;
+	}
+}
+
+/* Move the cursor to the previous record */
+void
+bpt_cursor_prev(bpt_cursor* c)
+{
+	assert(c->leaf);
+	c->ind--;
+	while(c->leaf && c->ind < 0){
+		c->leaf = TAILQ_PREV(c->leaf, rec_list, recs.l_rec.n);
+		c->ind = c->leaf ? c->leaf->num_of_rec - 1 : 0;
+	}
+}
+
+#ifdef BPT_COUNTS
+long
+bpt_rank(bptree* t, bpt_key_t k)
+{
+	bpt_node* n = t->root;
+	long r = 0;
+	int i, ind;
+
+	if(bpt_empty(t))
+		return 0;
+	/* Go down as bpt_query_lower, the children before the path have only
+	 * keys < k.
+	 */
+	while(! bpt_is_leaf(n)){
+		ind = get_1st_ge_key(n->recs.i_rec.key, bpt_num_of_key(n), k);
+		for(i = 0; i < ind; i++)
+			r += n->recs.i_rec.cnt[i];
+		n = n->recs.i_rec.c_arr[ind];
+	}
+	return r + get_1st_ge_key(n->recs.l_rec.key, n->num_of_rec, k);
+}
+
+bpt_record_t*
+bpt_select(bptree* t, long i, bpt_key_t* k)
+{
+	bpt_node* n = t->root;
+	int j;
+
+	if(bpt_empty(t) || i < 0)
+		return NULL;
+	while(! bpt_is_leaf(n)){
+		for(j = 0; j < n->num_of_rec - 1 && i >= n->recs.i_rec.cnt[j]; 
+				j++)
+			i -= n->recs.i_rec.cnt[j];
+		n = n->recs.i_rec.c_arr[j];
+	}
+	if(i >= n->num_of_rec)
+		return NULL;
+	*k = n->recs.l_rec.key[i];
+	return bpt_value_rec(&n->recs.l_rec.r_arr[i]);
+}
+
+long
+bpt_count_range(bptree* t, bpt_key_t lo, bpt_key_t hi)
+{
+	return hi > lo ? bpt_rank(t, hi) - bpt_rank(t, lo) : 0;
+}
+#endif
 
 void 
 print_level(int level)
@@ -670,7 +2139,8 @@ bpt_print_leaf_node(bpt_node* node, int level)
 		 * node data will be printed. Currently print the pointer.
 		 */
 		printf("key:%ld, record:%ld\n", 
-			node->key[i], node->recs.l_rec.r_arr[i]);
+			(long) node->recs.l_rec.key[i], 
+			(long) bpt_value_rec(&node->recs.l_rec.r_arr[i]));
 	}
 	print_level(level);
 	printf("##END LEAF NODE\n");
@@ -686,13 +2156,13 @@ bpt_print_node(bpt_node* root, int level)
 		printf("##BEGIN INDEX NODE##\n");
 		int i, j;
 		/** print the first child **/
-		bpt_print_node(root->recs.c_arr[0], level + 1);
+		bpt_print_node(root->recs.i_rec.c_arr[0], level + 1);
 
 		for(i = 0; i < bpt_num_of_key(root); i++){
 			/** print the key and next child **/
 			print_level(level);
-			printf("key:%ld\n", root->key[i]);
-			bpt_print_node(root->recs.c_arr[i+1], level + 1);
+			printf("key:%ld\n", (long) root->recs.i_rec.key[i]);
+			bpt_print_node(root->recs.i_rec.c_arr[i+1], level + 1);
 		}
 		print_level(level);
 		printf("##END INDEX NODE##\n");
@@ -700,9 +2170,9 @@ bpt_print_node(bpt_node* root, int level)
 }
 
 void
-bpt_print_tree(bpt_node* root)
+bpt_print_tree(bptree* t)
 {
 	printf("###########BEGIN PRINT TREE##########\n");
-	bpt_print_node(root, 0);
+	bpt_print_node(t->root, 0);
 	printf("#############END PRINT TREE##########\n\n");
 }
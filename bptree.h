@@ -8,16 +8,22 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stddef.h>
 #include <math.h>
 #include <sys/queue.h>
 
 #include "bpt_utils.h"
+#include "bpt_alloc.h"
 
 /* Definition of a B_Plus_Tree(referenced from Database System Concept):
  * 0. Assume M > 2;
  * 1. Non-leaf root node has [2, M] children; leaf root node can have only
  *    one child or zero child;
- * 2. Non-root nodes can have [roof(M/2), M] children;
+ * 2. Non-root nodes can have [roof(M/2), M] children; M may differ for leaf
+ *    nodes(BPT_MAX_LEAF_REC_NO) and index nodes(BPT_MAX_INDEX_REC_NO);
+ *    In append mode the right most node of each level may have fewer, but 
+ *    at least 1 record(leaf) or 2 children(index); so may any node under a
+ *    relaxed underflow policy(see bpt_set_underflow);
  * 3. Leaf nodes are in the same level. They store keys(as K[i]) of the 
  *    file records and the pointers(as P[i]) to the file records. 
  *    For i < j, K[i] <= K[j]. 
@@ -31,78 +37,527 @@
  *    < K[i].
  */
 
-/* The max number of children in index node;
- * Also the max number of records in leaf node. 
- * TODO: separate the two numbers for index node and leaf node.
- */ 
-#define BPT_MAX_REC_NO 4 
+/* Type of the keys, long by default. It should be a signed integer type: 
+ * keys are compared by the built-in operators, so the comparisons are inlined
+ * in every function, and the nodes are laid out for the key width, eg. a 
+ * 32-bit key(-DBPT_KEY_TYPE=int) takes half the space of a long. Use 
+ * -DBPT_KEY_TYPE=__int128 for UUIDs, or for strings of up to 16 bytes(see 
+ * bpt_key_from_str).
+ */
+#ifndef BPT_KEY_TYPE
+#define BPT_KEY_TYPE long
+#endif
+typedef BPT_KEY_TYPE bpt_key_t;
+
+/* Branchless binary search down to a window of 8 keys, then count the keys
+ * less than k in it. Same result as get_1st_ge, for any key type.
+ */
+static inline int
+get_1st_ge_any(bpt_key_t a[], int len, bpt_key_t k)
+{
+	bpt_key_t* base = a;
+	int i, n = len, cnt = 0;
+	while(n > 8){
+		int half = n / 2;
+		base = (base[half - 1] < k) ? base + half : base;
+		n -= half;
+	}
+	for(i = 0; i < n; i++)
+		cnt += base[i] < k;
+	return (base - a) + cnt;
+}
+
+/* get_1st_ge on the key array of a node: long keys use the vectorized search
+ * of get_1st_ge, the other key types get_1st_ge_any. Chosen at compile time.
+ */
+static inline int
+get_1st_ge_key(bpt_key_t a[], int len, bpt_key_t k)
+{
+	return _Generic(k, long: get_1st_ge, default: get_1st_ge_any)
+		(a, len, k);
+}
+
+/* Key of a string of at most sizeof(bpt_key_t) bytes: the bytes of the 
+ * string from the most significant one, padded with zeros, so that the keys
+ * are in the order of the strings(as strcmp). The first byte should be less
+ * than 0x80(eg. ASCII), the sign bit of the key.
+ */
+static inline bpt_key_t
+bpt_key_from_str(const char* s)
+{
+	bpt_key_t k = 0;
+	size_t i;
+	for(i = 0; i < sizeof(bpt_key_t); i++){
+		k <<= 8;
+		if(*s)
+			k |= (unsigned char) *s++;
+	}
+	return k;
+}
+
+/* The string of a key made by bpt_key_from_str. buf should have 
+ * sizeof(bpt_key_t) + 1 bytes.
+ */
+static inline char*
+bpt_key_to_str(bpt_key_t k, char* buf)
+{
+	int i;
+	for(i = sizeof(bpt_key_t) - 1; i >= 0; i--){
+		buf[i] = (char) (k & 0xff);
+		k >>= 8;
+	}
+	buf[sizeof(bpt_key_t)] = '\0';
+	return buf;
+}
+
+/* If BPT_COUNTS is defined, each index node keeps the number of records in 
+ * the subtree of each child, so bpt_rank, bpt_select and bpt_count_range 
+ * take O(log n) time instead of a scan of the range. Inserts and deletes
+ * update the counts on the path from the root, and with BPT_NODE_BYTES the
+ * index nodes hold fewer children. Thread-safe mode does not keep the counts,
+ * since its writers lock only the leaf.
+ */
+#ifdef BPT_COUNTS
+#define BPT_COUNT_BYTES sizeof(long)
+#else
+#define BPT_COUNT_BYTES 0
+#endif
+
+/* Size in bytes of a cache line. Nodes are aligned to it. */
+#ifndef BPT_CACHE_LINE
+#define BPT_CACHE_LINE 64
+#endif
+
+/* If BPT_NODE_BYTES is defined(eg. -DBPT_NODE_BYTES=256 for 4 cache lines, or
+ * -DBPT_NODE_BYTES=4096 for a page), the fanouts of leaf and index node are
+ * derived from it, so that each node fills exactly that many bytes. 
+ * Otherwise, the fanouts are given by BPT_MAX_LEAF_REC_NO and 
+ * BPT_MAX_INDEX_REC_NO.
+ */
+#ifdef BPT_NODE_BYTES
+
+#if BPT_NODE_BYTES % BPT_CACHE_LINE != 0
+#error "BPT_NODE_BYTES should be a multiple of BPT_CACHE_LINE"
+#endif
+
+/* Bytes of the node header, ie. the fields before the record arrays */
+#define BPT_NODE_HDR_BYTES (2 * sizeof(int) + sizeof(unsigned long))
+
+#define BPT_MAX_LEAF_REC_NO ((int) ((BPT_NODE_BYTES - BPT_NODE_HDR_BYTES \
+		- 2 * sizeof(void*)) / (sizeof(bpt_key_t) + sizeof(bpt_value))))
+#define BPT_MAX_INDEX_REC_NO ((int) ((BPT_NODE_BYTES - BPT_NODE_HDR_BYTES) \
+		/ (sizeof(bpt_key_t) + sizeof(void*) + BPT_COUNT_BYTES)))
+
+#if BPT_NODE_BYTES >= 4096
+#define BPT_NODE_ALIGN 4096
+#endif
+
+#endif /* BPT_NODE_BYTES */
+
+/* The max number of records in leaf node. */
+#ifndef BPT_MAX_LEAF_REC_NO
+#define BPT_MAX_LEAF_REC_NO 4
+#endif
+
+/* The max number of children in index node. */
+#ifndef BPT_MAX_INDEX_REC_NO
+#define BPT_MAX_INDEX_REC_NO 4
+#endif
+
+/* The min number of records in non-root leaf node, ie. ceil(M/2) */
+#define BPT_MIN_LEAF_REC_NO ((BPT_MAX_LEAF_REC_NO + 1) / 2)
+
+/* The min number of children in non-root index node, ie. ceil(M/2) */
+#define BPT_MIN_INDEX_REC_NO ((BPT_MAX_INDEX_REC_NO + 1) / 2)
+
+/* Alignment of the node memory */
+#ifndef BPT_NODE_ALIGN
+#define BPT_NODE_ALIGN BPT_CACHE_LINE
+#endif
 
 typedef enum { LEAF, INDEX } bpt_node_t;
 
+/* Underflow policies of deletes, see bpt_set_underflow */
+typedef enum
+{
+	/* Merge or borrow below ceil(M/2) entries, the default */
+	BPT_UNDERFLOW_HALF,
+
+	/* Merge or borrow below ceil(M/4) entries */
+	BPT_UNDERFLOW_QUARTER,
+
+	/* Merge a leaf only when it is empty, an index node below 2 children */
+	BPT_UNDERFLOW_EMPTY
+} bpt_underflow_t;
+
+/* Counters of structure modifications: node splits, merges of two nodes, and
+ * borrows(entries moved from a node to its sibling).
+ */
+struct bpt_smo
+{
+	long splits;
+	long merges;
+	long borrows;
+};
+
 /* The record struct stored in the leaf node */
 typedef struct bpt_record_t bpt_record_t;
 /* The record struct should be defined in client code. */
 struct bpt_record_t;
 
+/* If BPT_VALUE_BYTES is defined(eg. -DBPT_VALUE_BYTES=8 or 16), the leaves
+ * store the records inline, as values of BPT_VALUE_BYTES bytes in an array
+ * next to the keys, instead of pointers to the records of the client. Then 
+ * the record struct should be BPT_VALUE_BYTES bytes: the record passed to an
+ * insert is copied into the leaf, the record passed to a delete is compared 
+ * by its bytes, and the records returned by gets and cursors point into the 
+ * leaf, they are valid until the tree is changed(use bpt_get_value to copy 
+ * them). A lookup does not dereference a pointer to reach the record, and 
+ * the client does not allocate each record.
+ */
+#ifdef BPT_VALUE_BYTES
+
+#if BPT_VALUE_BYTES <= 0 || BPT_VALUE_BYTES % 8 != 0
+#error "BPT_VALUE_BYTES should be a positive multiple of 8"
+#endif
+
+/* An inline value, aligned as a long */
+typedef struct { long w[BPT_VALUE_BYTES / 8]; } bpt_value;
+
+#else
+
+typedef bpt_record_t* bpt_value;
+
+#endif /* BPT_VALUE_BYTES */
+
+/* The record stored in a value slot */
+static inline bpt_record_t*
+bpt_value_rec(bpt_value* s)
+{
+#ifdef BPT_VALUE_BYTES
+	return (bpt_record_t*) s;
+#else
+	return *s;
+#endif
+}
+
+/* Store record v in a value slot */
+static inline void
+bpt_value_set(bpt_value* s, bpt_record_t* v)
+{
+#ifdef BPT_VALUE_BYTES
+	memcpy(s, v, BPT_VALUE_BYTES);
+#else
+	*s = v;
+#endif
+}
+
+/* If the value slot holds record v */
+static inline int
+bpt_value_is(bpt_value* s, bpt_record_t* v)
+{
+#ifdef BPT_VALUE_BYTES
+	return memcmp(s, v, BPT_VALUE_BYTES) == 0;
+#else
+	return *s == v;
+#endif
+}
+
 typedef struct __bpt_node bpt_node;
 
+/* Records of the index node */
+struct bpt_index_recs
+{
+	/* Array for the keys. Only 'children number' - 1 keys are used, the 
+	 * last slot is a scratch slot for merging.
+	 */
+	bpt_key_t key[BPT_MAX_INDEX_REC_NO];
+
+	/* Array for the children of index node */
+	bpt_node* c_arr[BPT_MAX_INDEX_REC_NO];
+
+#ifdef BPT_COUNTS
+	/* Number of records in the subtree of each child */
+	long cnt[BPT_MAX_INDEX_REC_NO];
+#endif
+};
+
+/* Records of the leaf node */
+struct bpt_leaf_recs
+{
+	/* Array for the keys. */
+	bpt_key_t key[BPT_MAX_LEAF_REC_NO];
+
+	/* Array for the records of leaf node, pointers or inline values(see
+	 * BPT_VALUE_BYTES). Use bpt_value_rec and bpt_value_set on it.
+	 */
+	bpt_value r_arr[BPT_MAX_LEAF_REC_NO];
+
+	/* Pointer to next/previous leaf node */
+	TAILQ_ENTRY (__bpt_node) n;
+};
+
 struct __bpt_node
 {
 	/* Type of this node, should always be LEAF or INDEX */
 	bpt_node_t t;
 
-	/* Parent node of this node. For root node, parent is NULL */
-	bpt_node* p;
-	
 	/* Current record number in this node.
-	 * For index node, num_of_rec == 'key number' -1 == 'children number';
+	 * For index node, num_of_rec == 'key number' + 1 == 'children number';
 	 * for leaf node, num_of_rec == 'key number' == 'record number'
 	 */
 	int num_of_rec;
 
-	/* Array for the keys. */
-	long key[BPT_MAX_REC_NO];
+	/* Version lock of the node, only used in thread-safe mode. 
+	 * See bpt_olc.h. In a copy-on-write tree, the generation of the
+	 * node instead, see bpt_cow.h; in a buffered tree, the message
+	 * buffer of an index node, see bpt_beps.h.
+	 */
+	unsigned long version;
 
+	/* The key array is the first member of both record structs, so 
+	 * key array of any node can be accessed by recs.l_rec.key.
+	 */
 	union
 	{
-		/* Array for the children of index node */
-		bpt_node* c_arr[BPT_MAX_REC_NO + 1];
+		struct bpt_index_recs i_rec;
+		struct bpt_leaf_recs l_rec;
+	} recs;
+} __attribute__ ((aligned (BPT_NODE_ALIGN)));
 
-		struct
-		{
-			/* Array for the records of leaf node */
-			bpt_record_t* r_arr[BPT_MAX_REC_NO];
+/* Round up size to the multiple of BPT_NODE_ALIGN */
+#define BPT_NODE_ROUND_UP(size) \
+	(((size) + BPT_NODE_ALIGN - 1) / BPT_NODE_ALIGN * BPT_NODE_ALIGN)
 
-			/* Pointer to next/previous leaf node */
-			TAILQ_ENTRY (bpt_node) n;
-		} l_rec;
-	} recs;
-};
+/* Memory size of leaf node and index node. The two may differ when the 
+ * fanouts differ, then only the needed part of bpt_node is allocated.
+ */
+#define BPT_LEAF_NODE_SIZE BPT_NODE_ROUND_UP(offsetof(bpt_node, recs) \
+		+ sizeof(struct bpt_leaf_recs))
+#define BPT_INDEX_NODE_SIZE BPT_NODE_ROUND_UP(offsetof(bpt_node, recs) \
+		+ sizeof(struct bpt_index_recs))
+
+_Static_assert(BPT_MAX_LEAF_REC_NO > 2 && BPT_MAX_INDEX_REC_NO > 2, 
+		"B-Plus-Tree needs M > 2");
+#ifdef BPT_NODE_BYTES
+_Static_assert(sizeof(bpt_node) == BPT_NODE_BYTES, 
+		"node layout does not match BPT_NODE_BYTES");
+#endif
 
-/* bptree struct is not used yet. Currently we access bptree using root node.
- * TODO: use bptree struct to access the B-Plus-Tree.
+/* Number of lookups interleaved by bpt_multi_get, and the max of it */
+#ifndef BPT_MULTIGET_GROUP
+#define BPT_MULTIGET_GROUP 16
+#endif
+#define BPT_MULTIGET_MAX_GROUP 64
+
+/* Bytes prefetched from the head of a node by bpt_multi_get: the whole node
+ * up to 4 cache lines.
  */
+#ifndef BPT_PREFETCH_BYTES
+#define BPT_PREFETCH_BYTES (BPT_INDEX_NODE_SIZE < 4 * BPT_CACHE_LINE \
+		? BPT_INDEX_NODE_SIZE : 4 * BPT_CACHE_LINE)
+#endif
+
+/* The B-Plus-Tree is accessed by bptree struct. */
 typedef struct __bptree bptree;
 struct __bptree
 {
-	/* root node of the tree */
+	/* root node of the tree, NULL for an empty tree */
 	bpt_node* root;
 
-	/* Head of the link list of leaf nodes */
-	TAILQ_HEAD (rec_list, bpt_node) rec_list_head;
+	/* Head of the link list of leaf nodes, ordered by the key value */
+	TAILQ_HEAD (rec_list, __bpt_node) rec_list_head;
+
+	/* Allocator of the nodes */
+	bpt_allocator* alloc;
+
+	/* State of thread-safe mode, NULL if not enabled. See bpt_olc.h. */
+	struct bpt_olc* olc;
+
+	/* Append mode, see bpt_set_append */
+	int append;
+
+	/* Set once append mode split a node at the right edge, so the right 
+	 * most nodes may have less than the min number of entries.
+	 */
+	int ragged_right;
+
+	/* Underflow policy of deletes, see bpt_set_underflow */
+	bpt_underflow_t underflow;
+
+	/* Set once a relaxed policy is used, so any non-root node may have 
+	 * less than the min number of entries. Cleared by bpt_compact.
+	 */
+	int underfull;
+
+	/* Counters of structure modifications, never reset by the tree */
+	struct bpt_smo smo;
+};
+
+/* Max levels of the tree. A tree of this height holds at least 
+ * 2 ^ (BPT_MAX_HEIGHT - 1) keys, since each non-root index node has at least
+ * two children.
+ */
+#define BPT_MAX_HEIGHT 64
 
-	/* Function to insert a (k, v) pair into bptree */
-	void (*insert) (bpt_node** root, long k, bpt_record_t* v);
+/* The root-to-leaf path of a descent. Nodes have no parent pointers, so 
+ * inserts and deletes record the path and restructure the tree from it.
+ */
+typedef struct __bpt_path bpt_path;
+struct __bpt_path
+{
+	/* Number of nodes on the path; node[0] is the root, node[depth - 1] is
+	 * the leaf.
+	 */
+	int depth;
+	bpt_node* node[BPT_MAX_HEIGHT];
 
-	/* Function to remove a (k, v) pair from bptree */
-	void (*remove) (bpt_node** root, long k, bpt_record_t* v);
+	/* slot[i] is the index of node[i] in the children of node[i - 1];
+	 * slot[0] is not used.
+	 */
+	int slot[BPT_MAX_HEIGHT];
+};
 
-	/* Function to print the bptree */
-	void (*print) (bpt_node** root);
+/* Cursor for the ordered scan of records. It moves from leaf to leaf by the 
+ * link list of leaf nodes, so it does not search from the root again.
+ * The tree should not be changed while the cursor is used.
+ */
+typedef struct __bpt_cursor bpt_cursor;
+struct __bpt_cursor
+{
+	/* Current leaf node, NULL if the cursor is out of the tree */
+	bpt_node* leaf;
 
-	/* Function to init the bptree */
-	void (*init) (struct __bptree bpt);
+	/* Index of current record in the leaf node */
+	int ind;
 
+	/* If has_end is set, the cursor stops before the first key >= end */
+	int has_end;
+	bpt_key_t end;
 };
 
+/* Functions of the B-Plus-Tree, implemented in bptree.c */
+void bpt_init (bptree* t);
+void bpt_init_alloc (bptree* t, bpt_allocator* a);
+void bpt_destroy (bptree* t);
+int bpt_empty (bptree* t);
+int bpt_is_leaf (bpt_node* p);
+int bpt_num_of_key (bpt_node* n);
+bpt_node* bpt_query (bptree* t, bpt_key_t k);
+bpt_record_t* bpt_get (bptree* t, bpt_key_t k);
+void bpt_insert (bptree* t, bpt_key_t k, bpt_record_t* v);
+void bpt_delete (bptree* t, bpt_key_t k, bpt_record_t* v);
+void bpt_print_tree (bptree* t);
+
+#ifdef BPT_VALUE_BYTES
+/* Copy the value of key k into out, return 0 if there is no such key. Unlike
+ * the pointer returned by bpt_get, the copy is safe in thread-safe mode.
+ */
+int bpt_get_value (bptree* t, bpt_key_t k, bpt_record_t* out);
+#endif
+
+#ifdef BPT_COUNTS
+/* Order statistics, see BPT_COUNTS. bpt_rank returns the number of records 
+ * with keys < k. bpt_select returns the record at rank i(0 for the first one)
+ * and sets *k to its key, NULL if i is out of [0, number of records). 
+ * bpt_count_range returns the number of records with keys in [lo, hi).
+ */
+long bpt_rank (bptree* t, bpt_key_t k);
+bpt_record_t* bpt_select (bptree* t, long i, bpt_key_t* k);
+long bpt_count_range (bptree* t, bpt_key_t lo, bpt_key_t hi);
+#endif
+
+/* Switch append mode on(on != 0) or off. For keys inserted mostly in 
+ * increasing order(timestamps, sequence numbers): a key >= the max key is 
+ * appended to the right most leaf without descending from the root, and 
+ * splits at the right edge leave the old node full, so the tree is nearly 
+ * 100% filled instead of half filled.
+ */
+void bpt_set_append (bptree* t, int on);
+
+/* Set the underflow policy of deletes. Under the default policy a node that
+ * drops below ceil(M/2) entries merges with its sibling or borrows from it at
+ * once, so churn around the same keys may merge and split the same nodes 
+ * over and over. BPT_UNDERFLOW_QUARTER lets nodes shrink to ceil(M/4), and
+ * BPT_UNDERFLOW_EMPTY frees a leaf only when it is empty; the tree is then
+ * compacted by bpt_compact when the caller chooses, eg. after a purge or 
+ * in an idle period.
+ */
+void bpt_set_underflow (bptree* t, bpt_underflow_t policy);
+
+/* Merge or rebalance every non-root node with less than ceil(M/2) entries,
+ * bottom up, so the tree is as after the default policy. It visits all the 
+ * index nodes. Not in thread-safe mode.
+ */
+void bpt_compact (bptree* t);
+
+/* Batch operations on n keys, keys[i] goes with recs[i]. If sorted is not 0,
+ * the keys should be in increasing order, otherwise they are sorted first.
+ * Keys in the same leaf are handled together, and the descent for the next
+ * leaf starts from the lowest common ancestor instead of the root. 
+ * bpt_get_batch sets recs[i] to the record of keys[i], NULL if not found.
+ */
+void bpt_insert_batch (bptree* t, bpt_key_t* keys, bpt_record_t** recs, long n,
+		int sorted);
+void bpt_delete_batch (bptree* t, bpt_key_t* keys, bpt_record_t** recs, long n,
+		int sorted);
+void bpt_get_batch (bptree* t, bpt_key_t* keys, bpt_record_t** recs, long n,
+		int sorted);
+
+/* Delete all the records with keys in [lo, hi), and return their number. The
+ * subtrees inside the range are freed whole, and only the nodes on the two 
+ * edges of the range are rebalanced. Not in thread-safe mode.
+ */
+long bpt_delete_range (bptree* t, bpt_key_t lo, bpt_key_t hi);
+
+/* Get the records of n independent keys into recs[i], NULL if not found. 
+ * Unlike bpt_get_batch the keys are not sorted: the lookups run in groups, 
+ * prefetching the next node of each lookup before switching to the next one,
+ * so the cache misses of a group overlap.
+ */
+void bpt_multi_get (bptree* t, bpt_key_t* keys, bpt_record_t** recs, long n);
+void bpt_multi_get_group (bptree* t, bpt_key_t* keys, bpt_record_t** recs,
+		long n, int group);
+
+/* Internal functions shared by the modules of the tree, in bptree.c */
+int bpt_is_root (bptree* t, bpt_node* n);
+int bpt_is_full (bpt_node* l);
+int bpt_max_rec (bpt_node* n);
+int bpt_min_rec (bpt_node* n);
+int bpt_underflow_min (bptree* t, bpt_node* n);
+void bpt_init_root (bptree* t);
+void bpt_insert_in_leaf (bpt_node* l, bpt_key_t k, bpt_record_t* v);
+bpt_node* bpt_query_path (bptree* t, bpt_key_t k, bpt_path* path);
+bpt_node* bpt_query_lower (bptree* t, bpt_key_t k);
+bpt_node* bpt_query_path_lower (bptree* t, bpt_key_t k, bpt_path* path);
+int bpt_leaf_seek (bpt_node** l, bpt_key_t k);
+int bpt_child_ind (bptree* t, bpt_node* n, bpt_key_t k);
+int bpt_path_high (bpt_path* path, int lv, bpt_key_t* hi);
+bpt_node* bpt_path_step_leaf (bpt_path* path, int d);
+void bpt_path_count (bpt_path* path, long d);
+int bpt_locate_in_path (bpt_path* path, bpt_key_t k, bpt_record_t* v);
+void bpt_split_leaf (bptree* t, bpt_path* path, bpt_key_t k, bpt_record_t* v);
+int bpt_get_close_sibling (bpt_path* path, int lv, bpt_node** n1, bpt_key_t* k);
+int bpt_find_in_leaf (bpt_node* n, bpt_key_t k, bpt_record_t* v);
+void bpt_delete_in_leaf_at (bpt_node* n, int ind);
+void bpt_delete_entry (bptree* t, bpt_path* path, int lv, int ind);
+
+/* Reader of the (key, record) pairs for bulk loading. Return 0 at the end. */
+typedef int (*bpt_bulk_next) (void* arg, bpt_key_t* k, bpt_record_t** v);
+
+/* Bulk loading from sorted input, implemented in bptree.c */
+void bpt_bulk_load (bptree* t, bpt_key_t* keys, bpt_record_t** recs, long n, 
+		double fill);
+void bpt_bulk_load_stream (bptree* t, bpt_bulk_next next, void* arg, 
+		double fill);
+
+/* Cursor functions, implemented in bptree.c */
+void bpt_cursor_seek (bptree* t, bpt_cursor* c, bpt_key_t k);
+void bpt_cursor_set_end (bpt_cursor* c, bpt_key_t end);
+int bpt_cursor_valid (bpt_cursor* c);
+bpt_key_t bpt_cursor_key (bpt_cursor* c);
+bpt_record_t* bpt_cursor_record (bpt_cursor* c);
+void bpt_cursor_next (bpt_cursor* c);
+void bpt_cursor_prev (bpt_cursor* c);
+
 #endif /* end of _BPT_H */
@@ -0,0 +1,1903 @@
+/* Copyright(c) Brayden Zhang
+ * Mail: pczhang2010@gmail.com
+ */
+
+/* Benchmarks of the B-Plus-Tree. Usage:
+ *   bpt_bench <benchmark> [number of keys]
+ * Run without arguments to list the benchmarks.
+ */
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "bptree.h"
+#include "bpt_olc.h"
+#include "bpt_pool.h"
+#include "bpt_image.h"
+#include "bpt_wal.h"
+#include "bpt_str.h"
+#include "bpt_dup.h"
+#include "bpt_cow.h"
+#include "bpt_shard.h"
+#include "bpt_beps.h"
+#include "bpt_learn.h"
+#include "bpt_frozen.h"
+
+struct bpt_record_t
+{
+	long v;
+#if defined(BPT_VALUE_BYTES) && BPT_VALUE_BYTES > 8
+	char pad[BPT_VALUE_BYTES - 8];
+#endif
+};
+
+/* Current time in nanoseconds */
+static double
+now_ns()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/* xorshift64 random generator, so that runs are repeatable */
+static unsigned long long rand_state = 88172645463325252ULL;
+
+static long
+rand_key()
+{
+	rand_state ^= rand_state << 13;
+	rand_state ^= rand_state >> 7;
+	rand_state ^= rand_state << 17;
+	return (long) (rand_state >> 1);
+}
+
+/* Allocate n records, record[i] holds value i */
+static bpt_record_t*
+new_records(long n)
+{
+	long i;
+	bpt_record_t* recs = (bpt_record_t*) my_calloc(n * sizeof(bpt_record_t));
+	for(i = 0; i < n; i++)
+		recs[i].v = i;
+	return recs;
+}
+
+/* Levels of the tree, a leaf root has height 1 */
+static int
+tree_height(bptree* t)
+{
+	bpt_node* root = t->root;
+	int h = 1;
+	while(! bpt_is_leaf(root)){
+		root = root->recs.i_rec.c_arr[0];
+		h++;
+	}
+	return h;
+}
+
+/* Insert n random keys, then query them in another random order. The fanouts
+ * are fixed at compile time, see bptree_bench.sh for a sweep over them.
+ */
+static void
+bench_fanout(long n)
+{
+	long i;
+	bpt_key_t* keys = (bpt_key_t*) my_calloc(n * sizeof(bpt_key_t));
+	bpt_record_t* recs = new_records(n);
+	bptree t;
+
+	bpt_init(&t);
+	for(i = 0; i < n; i++)
+		keys[i] = rand_key();
+
+	double t0 = now_ns();
+	for(i = 0; i < n; i++)
+		bpt_insert(&t, keys[i], recs + i);
+	double t1 = now_ns();
+
+	/* Shuffle, so that lookups do not follow the insert order */
+	for(i = n - 1; i > 0; i--){
+		long j = rand_key() % (i + 1);
+		long k = keys[i];
+		keys[i] = keys[j];
+		keys[j] = k;
+	}
+
+	long found = 0;
+	double t2 = now_ns();
+	for(i = 0; i < n; i++){
+		bpt_node* l = bpt_query(&t, keys[i]);
+		found += get_1st_ge_key(l->recs.l_rec.key, l->num_of_rec, 
+				keys[i]) < l->num_of_rec;
+	}
+	double t3 = now_ns();
+
+	printf("leaf_fanout=%d index_fanout=%d leaf_bytes=%zu index_bytes=%zu "
+		"height=%d insert_ns=%.1f query_ns=%.1f found=%ld\n",
+		BPT_MAX_LEAF_REC_NO, BPT_MAX_INDEX_REC_NO,
+		(size_t) BPT_LEAF_NODE_SIZE, (size_t) BPT_INDEX_NODE_SIZE,
+		tree_height(&t), (t1 - t0) / n, (t3 - t2) / n, found);
+
+	free(keys);
+	free(recs);
+}
+
+/* Time one key search implementation: n searches over sorted arrays of len
+ * keys, the arrays together are bigger than L1 cache.
+ */
+static double
+time_search(int (*search) (long a[], int len, long k), long* arr, int len, 
+		int num_arr, long n, long* sum)
+{
+	long i;
+	double t0 = now_ns();
+	for(i = 0; i < n; i++){
+		long* a = arr + (i % num_arr) * len;
+		*sum += search(a, len, a[(i * 7) % len] + (i & 1));
+	}
+	return (now_ns() - t0) / n;
+}
+
+/* Compare the key search implementations on arrays of node fanout sizes */
+static void
+bench_search(long n)
+{
+	int sizes[] = {4, 8, 16, 32, 64, 128, 254};
+	int num_arr = 256;
+	int s, i;
+	long sum = 0;
+
+	for(s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++){
+		int len = sizes[s];
+		long* arr = (long*) my_calloc(num_arr * len * sizeof(long));
+		for(i = 0; i < num_arr * len; i++)
+			arr[i] = (i % len) * 2;
+
+		printf("len=%d scalar_ns=%.2f bsearch_ns=%.2f", len,
+			time_search(get_1st_ge_scalar, arr, len, num_arr, n, &sum),
+			time_search(get_1st_ge_bsearch, arr, len, num_arr, n, &sum));
+#ifdef BPT_HAVE_SIMD_SEARCH
+		if(__builtin_cpu_supports("sse4.2"))
+			printf(" sse4.2_ns=%.2f", time_search(get_1st_ge_sse42,
+				arr, len, num_arr, n, &sum));
+		if(__builtin_cpu_supports("avx2"))
+			printf(" avx2_ns=%.2f", time_search(get_1st_ge_avx2,
+				arr, len, num_arr, n, &sum));
+#endif
+		printf("\n");
+		free(arr);
+	}
+	/* Keep the searches from being optimized away */
+	if(sum == 42)
+		printf("\n");
+}
+
+static int
+cmp_long(const void* a, const void* b)
+{
+	long x = *(const long*) a, y = *(const long*) b;
+	return x < y ? -1 : x > y;
+}
+
+/* Range scans of 1000 records: the cursor walks the leaf link list, compared
+ * with searching every key from the root.
+ */
+static void
+bench_scan(long n)
+{
+	long i, j, len = 1000, scans = 1000;
+	long* keys = (long*) my_calloc(n * sizeof(long));
+	bpt_record_t* recs = new_records(n);
+	bptree t;
+	bpt_cursor c;
+	long sum = 0;
+
+	bpt_init(&t);
+	for(i = 0; i < n; i++){
+		keys[i] = rand_key();
+		bpt_insert(&t, keys[i], recs + i);
+	}
+	qsort(keys, n, sizeof(long), cmp_long);
+
+	double t0 = now_ns();
+	for(i = 0; i < scans; i++){
+		long start = rand_key() % (n - len);
+		bpt_cursor_seek(&t, &c, keys[start]);
+		bpt_cursor_set_end(&c, keys[start + len]);
+		for(; bpt_cursor_valid(&c); bpt_cursor_next(&c))
+			sum += bpt_cursor_record(&c)->v;
+	}
+	double t1 = now_ns();
+	for(i = 0; i < scans; i++){
+		long start = rand_key() % (n - len);
+		for(j = start; j < start + len; j++){
+			bpt_node* l = bpt_query(&t, keys[j]);
+			int ind = get_1st_ge_key(l->recs.l_rec.key, 
+					l->num_of_rec, keys[j]);
+			sum += bpt_value_rec(&l->recs.l_rec.r_arr[ind])->v;
+		}
+	}
+	double t2 = now_ns();
+
+	printf("scan_len=%ld cursor_ns_per_rec=%.1f query_ns_per_rec=%.1f\n",
+		len, (t1 - t0) / (scans * len), (t2 - t1) / (scans * len));
+	if(sum == 42)
+		printf("\n");
+	free(keys);
+	free(recs);
+}
+
+/* Number of leaf nodes and index nodes under node n */
+static void
+count_nodes(bpt_node* n, long* leaves, long* indexes)
+{
+	int i;
+	if(bpt_is_leaf(n)){
+		(*leaves)++;
+		return;
+	}
+	(*indexes)++;
+	for(i = 0; i < n->num_of_rec; i++)
+		count_nodes(n->recs.i_rec.c_arr[i], leaves, indexes);
+}
+
+/* Build a tree from n sorted keys, by inserting one by one and by bulk 
+ * loading with different fill factors.
+ */
+static void
+bench_bulk(long n)
+{
+	double fill[] = {0.7, 0.9, 1.0};
+	long i;
+	int f;
+	bpt_key_t* keys = (bpt_key_t*) my_calloc(n * sizeof(bpt_key_t));
+	bpt_record_t* recs = new_records(n);
+	bpt_record_t** rec_ptrs = (bpt_record_t**) my_calloc(n * sizeof(void*));
+	bptree t;
+	long leaves = 0, indexes = 0;
+
+	for(i = 0; i < n; i++){
+		keys[i] = i * 8;
+		rec_ptrs[i] = recs + i;
+	}
+
+	bpt_init(&t);
+	double t0 = now_ns();
+	for(i = 0; i < n; i++)
+		bpt_insert(&t, keys[i], rec_ptrs[i]);
+	double t1 = now_ns();
+	count_nodes(t.root, &leaves, &indexes);
+	printf("insert      ns_per_key=%.1f height=%d leaves=%ld indexes=%ld\n",
+		(t1 - t0) / n, tree_height(&t), leaves, indexes);
+
+	for(f = 0; f < sizeof(fill) / sizeof(fill[0]); f++){
+		bpt_init(&t);
+		t0 = now_ns();
+		bpt_bulk_load(&t, keys, rec_ptrs, n, fill[f]);
+		t1 = now_ns();
+		leaves = indexes = 0;
+		count_nodes(t.root, &leaves, &indexes);
+		printf("bulk_%.2f   ns_per_key=%.1f height=%d leaves=%ld "
+			"indexes=%ld\n", fill[f], (t1 - t0) / n, 
+			tree_height(&t), leaves, indexes);
+	}
+	free(keys);
+	free(recs);
+	free(rec_ptrs);
+}
+
+/* Random lookups on a bulk loaded tree of n keys, which should not fit in the
+ * cache: a loop of bpt_get against bpt_multi_get with different group sizes.
+ */
+static void
+bench_multiget(long n)
+{
+	long i, ops = 1 << 22;
+	int g;
+	bpt_key_t* keys = (bpt_key_t*) my_calloc(n * sizeof(bpt_key_t));
+	bpt_key_t* qkeys = (bpt_key_t*) my_calloc(ops * sizeof(bpt_key_t));
+	bpt_record_t* recs = new_records(n);
+	bpt_record_t** rec_ptrs = (bpt_record_t**) my_calloc(n * sizeof(void*));
+	bpt_record_t** out = (bpt_record_t**) my_calloc(ops * sizeof(void*));
+	bptree t;
+	long sum = 0;
+
+	for(i = 0; i < n; i++){
+		keys[i] = i * 8;
+		rec_ptrs[i] = recs + i;
+	}
+	bpt_init_alloc(&t, bpt_slab_allocator_create(0));
+	bpt_bulk_load(&t, keys, rec_ptrs, n, 1.0);
+	for(i = 0; i < ops; i++)
+		qkeys[i] = keys[rand_key() % n];
+
+	double t0 = now_ns();
+	for(i = 0; i < ops; i++)
+		out[i] = bpt_get(&t, qkeys[i]);
+	double t1 = now_ns();
+	for(i = 0; i < ops; i++)
+		sum += out[i]->v;
+	printf("get          height=%d ns_per_get=%.1f\n", tree_height(&t),
+		(t1 - t0) / ops);
+
+	for(g = 1; g <= BPT_MULTIGET_MAX_GROUP; g *= 2){
+		t0 = now_ns();
+		bpt_multi_get_group(&t, qkeys, out, ops, g);
+		t1 = now_ns();
+		for(i = 0; i < ops; i++)
+			sum -= out[i]->v;
+		printf("multi_get    group=%-2d ns_per_get=%.1f\n", g, 
+			(t1 - t0) / ops);
+	}
+	/* Keep the lookups from being optimized away */
+	if(sum == 42)
+		printf("\n");
+	bpt_destroy(&t);
+	free(keys);
+	free(qkeys);
+	free(recs);
+	free(rec_ptrs);
+	free(out);
+}
+
+/* Random gets on a persistent tree of n keys, with buffer pools smaller than
+ * the tree. A page read from the file is a miss of the pool; the hit rate is
+ * counted over the nodes visited by the gets(height per get).
+ */
+static void
+bench_pool(long n)
+{
+	const char* path = "bpt_bench.db";
+	double frac[] = {1.0 / 64, 1.0 / 16, 1.0 / 4, 1.0 / 2, 1.1};
+	long i, ops = 1 << 18;
+	long pages = 0, leaves = 0, indexes = 0;
+	int f, h;
+	bpt_key_t* keys = (bpt_key_t*) my_calloc(n * sizeof(bpt_key_t));
+	bpt_record_t* recs = new_records(n);
+	bpt_record_t** rec_ptrs = (bpt_record_t**) my_calloc(n * sizeof(void*));
+	struct bpt_pool_stats s0, s1;
+	bptree t;
+
+	if(BPT_PAGE_BYTES >= 2 * BPT_LEAF_NODE_SIZE){
+		printf("pool: nodes are much smaller than pages, compile with "
+			"-DBPT_NODE_BYTES=4096\n");
+		return;
+	}
+	/* The pointers to the records are stored as values in the file */
+	for(i = 0; i < n; i++){
+		keys[i] = i * 8;
+		rec_ptrs[i] = recs + i;
+	}
+	unlink(path);
+	if(bpt_open(&t, path, 1024) != 0){
+		perror(path);
+		return;
+	}
+	bpt_bulk_load(&t, keys, rec_ptrs, n, 1.0);
+	count_nodes(t.root, &leaves, &indexes);
+	pages = leaves + indexes;
+	h = tree_height(&t);
+	bpt_close(&t);
+	printf("pages=%ld height=%d\n", pages, h);
+
+	for(f = 0; f < sizeof(frac) / sizeof(frac[0]); f++){
+		long pool = pages * frac[f];
+		bpt_open(&t, path, pool);
+		/* Warm up the pool */
+		for(i = 0; i < ops / 4; i++)
+			bpt_get(&t, keys[rand_key() % n]);
+		bpt_pool_get_stats(&t, &s0);
+		double t0 = now_ns();
+		for(i = 0; i < ops; i++)
+			if(bpt_get(&t, keys[rand_key() % n]) == NULL)
+				printf("pool: key not found\n");
+		double t1 = now_ns();
+		bpt_pool_get_stats(&t, &s1);
+		bpt_close(&t);
+		printf("pool=%-7ld pool/tree=%.3f ns_per_get=%.1f "
+			"reads_per_get=%.3f hit_rate=%.4f\n", pool,
+			(double) pool / pages, (t1 - t0) / ops,
+			(double) (s1.reads - s0.reads) / ops,
+			1 - (double) (s1.reads - s0.reads) / ((double) ops * h));
+	}
+	unlink(path);
+	free(keys);
+	free(recs);
+	free(rec_ptrs);
+}
+
+/* Startup of trees of n / 16, n / 4 and n keys: rebuild by inserting the
+ * keys, against opening a saved image. Then gets and a full scan of the 
+ * mapped image.
+ */
+static void
+bench_image(long n)
+{
+	const char* path = "bpt_bench.img";
+	long i, m, ops = 1 << 20;
+	bpt_key_t* keys = (bpt_key_t*) my_calloc(n * sizeof(bpt_key_t));
+	bpt_record_t* recs = new_records(n);
+	bpt_record_t** rec_ptrs = (bpt_record_t**) my_calloc(n * sizeof(void*));
+	bpt_image_cursor c;
+	bpt_image im;
+	bptree t;
+	long sum = 0;
+
+	for(i = 0; i < n; i++){
+		keys[i] = i * 8;
+		rec_ptrs[i] = recs + i;
+	}
+	for(m = n / 16; m <= n; m *= 4){
+		bpt_init_alloc(&t, bpt_slab_allocator_create(0));
+		double t0 = now_ns();
+		for(i = 0; i < m; i++)
+			bpt_insert(&t, keys[i], rec_ptrs[i]);
+		double t1 = now_ns();
+		bpt_image_save(&t, path);
+		double t2 = now_ns();
+		bpt_destroy(&t);
+
+		double t3 = now_ns();
+		for(i = 0; i < 100; i++){
+			bpt_image_open(&im, path);
+			sum += (long) bpt_image_get(&im, keys[rand_key() % m]);
+			bpt_image_close(&im);
+		}
+		double t4 = now_ns();
+
+		bpt_image_open(&im, path);
+		double t5 = now_ns();
+		for(i = 0; i < ops; i++)
+			sum += (long) bpt_image_get(&im, keys[rand_key() % m]);
+		double t6 = now_ns();
+		for(bpt_image_cursor_seek(&im, &c, 0); 
+				bpt_image_cursor_valid(&c); 
+				bpt_image_cursor_next(&c))
+			sum += bpt_image_cursor_key(&c);
+		double t7 = now_ns();
+		printf("keys=%-9ld insert_ms=%.1f save_ms=%.1f "
+			"open_get_us=%.1f get_ns=%.1f scan_ns=%.1f\n", m,
+			(t1 - t0) / 1e6, (t2 - t1) / 1e6, (t4 - t3) / 100 / 1e3,
+			(t6 - t5) / ops, (t7 - t6) / m);
+		bpt_image_close(&im);
+	}
+	/* Keep the lookups from being optimized away */
+	if(sum == 42)
+		printf("\n");
+	unlink(path);
+	free(keys);
+	free(recs);
+	free(rec_ptrs);
+}
+
+struct wal_arg
+{
+	bpt_wal* w;
+	bpt_record_t* recs;
+	long ops;
+	long id;
+	long nthreads;
+};
+
+/* Insert keys id, id + nthreads, ..., and commit each */
+static void*
+wal_worker(void* p)
+{
+	struct wal_arg* a = p;
+	long i;
+
+	for(i = 0; i < a->ops; i++){
+		long k = i * a->nthreads + a->id;
+		bpt_wal_commit(a->w, bpt_wal_insert(a->w, k, a->recs + k));
+	}
+	return NULL;
+}
+
+/* Durable inserts into a persistent tree with a write-ahead log. First one
+ * thread commits every b inserts, then t threads commit every insert, and
+ * group commit shares an fsync among the threads waiting for it: group is
+ * the inserts per fsync. The tree is in the current directory.
+ */
+static void
+bench_wal(long n)
+{
+	const char* path = "bpt_bench.db";
+	const char* wal_path = "bpt_bench.db.wal";
+	pthread_t threads[32];
+	struct wal_arg args[32];
+	long i, b, nt, ops;
+	bpt_record_t* recs = new_records(n);
+	bpt_wal w;
+
+	for(b = 1; b <= 1024; b *= 4){
+		unlink(path);
+		unlink(wal_path);
+		if(bpt_wal_open(&w, path, 16384) != 0){
+			perror(path);
+			return;
+		}
+		double t0 = now_ns();
+		for(i = 0; i < n; i++){
+			long lsn = bpt_wal_insert(&w, i, recs + i);
+			if((i + 1) % b == 0 || i == n - 1)
+				bpt_wal_commit(&w, lsn);
+		}
+		double t1 = now_ns();
+		printf("threads=1  commit_every=%-5ld inserts_per_s=%-9.0f "
+			"syncs=%ld\n", b, n / ((t1 - t0) / 1e9), w.syncs);
+		bpt_wal_close(&w);
+	}
+
+	for(nt = 1; nt <= 32; nt *= 2){
+		unlink(path);
+		unlink(wal_path);
+		if(bpt_wal_open(&w, path, 16384) != 0){
+			perror(path);
+			return;
+		}
+		ops = n / nt;
+		long syncs = w.syncs;
+		double t0 = now_ns();
+		for(i = 0; i < nt; i++){
+			args[i].w = &w;
+			args[i].recs = recs;
+			args[i].ops = ops;
+			args[i].id = i;
+			args[i].nthreads = nt;
+			pthread_create(&threads[i], NULL, wal_worker, &args[i]);
+		}
+		for(i = 0; i < nt; i++)
+			pthread_join(threads[i], NULL);
+		double t1 = now_ns();
+		syncs = w.syncs - syncs;
+		printf("threads=%-2ld commit_every=1     inserts_per_s=%-9.0f "
+			"group=%.1f\n", nt, ops * nt / ((t1 - t0) / 1e9),
+			(double) ops * nt / (syncs ? syncs : 1));
+		bpt_wal_close(&w);
+	}
+	unlink(path);
+	unlink(wal_path);
+	free(recs);
+}
+
+/* Key i of n of the key type: distinct random integers, or a random UUID, or
+ * the key of a random lowercase string of 4 to 16 letters.
+ */
+static bpt_key_t
+bench_key(long i, long n, const char* kind)
+{
+	bpt_key_t k = 0;
+	char s[17];
+	int j, len;
+
+	if(strcmp(kind, "uuid") == 0){
+		/* 15 random bytes, so the key is not negative */
+		for(j = 0; j < 15; j++)
+			k = k << 8 | (rand_key() & 0xff);
+		return k;
+	}
+	if(strcmp(kind, "str") == 0){
+		len = 4 + rand_key() % 13;
+		for(j = 0; j < len; j++)
+			s[j] = 'a' + rand_key() % 26;
+		s[len] = '\0';
+		return bpt_key_from_str(s);
+	}
+	/* i times an odd number, modulo a power of 2 >= n, is a permutation */
+	long m = 1;
+	while(m < n)
+		m *= 2;
+	return (bpt_key_t) ((i * 0x9e3779b97f4a7c15UL) & (m - 1));
+}
+
+/* Trees of the key type of the build(-DBPT_KEY_TYPE, see bptree_bench.sh):
+ * inserts of n random keys, random gets and a full scan, and the bytes of 
+ * the nodes per key. 16-byte keys run both random UUIDs and short strings.
+ */
+static void
+bench_keys(long n)
+{
+	const char* kinds[] = {"int", "uuid", "str"};
+	long i, ops = 1 << 22;
+	int f;
+	bpt_key_t* keys = (bpt_key_t*) my_calloc(n * sizeof(bpt_key_t));
+	bpt_record_t* recs = new_records(n);
+	long sum = 0;
+	bpt_cursor c;
+	bptree t;
+
+	for(f = 0; f < 3; f++){
+		if((f == 0) != (sizeof(bpt_key_t) <= sizeof(long)))
+			continue;
+		for(i = 0; i < n; i++)
+			keys[i] = bench_key(i, n, kinds[f]);
+
+		long leaves = 0, indexes = 0;
+		bpt_init_alloc(&t, bpt_slab_allocator_create(0));
+		double t0 = now_ns();
+		for(i = 0; i < n; i++)
+			bpt_insert(&t, keys[i], recs + i);
+		double t1 = now_ns();
+		for(i = 0; i < ops; i++)
+			sum += (long) bpt_get(&t, keys[rand_key() % n]);
+		double t2 = now_ns();
+		/* All the keys are not negative */
+		for(bpt_cursor_seek(&t, &c, 0); bpt_cursor_valid(&c); 
+				bpt_cursor_next(&c))
+			sum += bpt_cursor_record(&c)->v;
+		double t3 = now_ns();
+		count_nodes(t.root, &leaves, &indexes);
+		printf("key=%-4s key_bytes=%-2zu leaf_fanout=%d index_fanout=%d "
+			"height=%d insert_ns=%.1f get_ns=%.1f scan_ns=%.1f "
+			"bytes_per_key=%.1f\n", kinds[f], sizeof(bpt_key_t),
+			BPT_MAX_LEAF_REC_NO, BPT_MAX_INDEX_REC_NO, 
+			tree_height(&t), (t1 - t0) / n, (t2 - t1) / ops, 
+			(t3 - t2) / n, (double) (leaves * BPT_LEAF_NODE_SIZE
+				+ indexes * BPT_INDEX_NODE_SIZE) / n);
+		bpt_destroy(&t);
+	}
+	if(sum == 42)
+		printf("\n");
+	free(keys);
+	free(recs);
+}
+
+/* A key of bench_strings: an URL, which shares long prefixes with the other
+ * ones, or 8 to 24 random bytes.
+ */
+static int
+bench_str_key(unsigned char* buf, const char* kind)
+{
+	int i, len;
+	if(strcmp(kind, "url") == 0)
+		return sprintf((char*) buf, "https://www.site%02ld.example.com/"
+			"users/%08lx/posts/%ld", rand_key() % 64, 
+			rand_key() % 1000000, rand_key() % 1000);
+	len = 8 + rand_key() % 17;
+	for(i = 0; i < len; i++)
+		buf[i] = rand_key();
+	return len;
+}
+
+/* Insert n variable length keys into the tree of bpt_str.h, then get them in
+ * random order and scan them. The leaves hold more keys than the key length 
+ * suggests, because of the prefixes cut from them, and the index nodes more 
+ * children, because of the short separators.
+ */
+static void
+bench_strings(long n)
+{
+	const char* kinds[] = {"url", "random"};
+	long i, ops = 1 << 22, key_bytes, leaves, sum = 0;
+	int f, len;
+	unsigned char* buf = (unsigned char*) my_calloc(n * 64);
+	int* off = (int*) my_calloc((n + 1) * sizeof(int));
+	bpt_record_t* recs = new_records(n);
+	bpt_str_cursor c;
+	bpt_str_node* l;
+	bpt_str t;
+
+	for(f = 0; f < 2; f++){
+		for(i = key_bytes = 0; i < n; i++){
+			len = bench_str_key(buf + key_bytes, kinds[f]);
+			off[i] = key_bytes;
+			key_bytes += len;
+		}
+		off[n] = key_bytes;
+
+		bpt_str_init(&t);
+		double t0 = now_ns();
+		for(i = 0; i < n; i++)
+			bpt_str_insert(&t, buf + off[i], off[i + 1] - off[i],
+				recs + i);
+		double t1 = now_ns();
+		for(i = 0; i < ops; i++){
+			long k = rand_key() % n;
+			sum += (long) bpt_str_get(&t, buf + off[k],
+				off[k + 1] - off[k]);
+		}
+		double t2 = now_ns();
+		for(bpt_str_cursor_seek(&t, &c, "", 0); 
+				bpt_str_cursor_valid(&c);
+				bpt_str_cursor_next(&c))
+			sum += bpt_str_cursor_record(&c)->v;
+		double t3 = now_ns();
+		for(l = t.first, leaves = 0; l; l = l->next)
+			leaves++;
+		printf("key=%-6s node_bytes=%d key_len=%.1f height=%d "
+			"keys_per_leaf=%.1f children_per_index=%.1f "
+			"insert_ns=%.1f get_ns=%.1f scan_ns=%.1f "
+			"bytes_per_key=%.1f\n", kinds[f], BPT_STR_NODE_BYTES,
+			(double) key_bytes / n, t.height, (double) t.n / leaves,
+			t.nodes > leaves ? (double) (t.nodes - 1)
+				/ (t.nodes - leaves) : 0.0,
+			(t1 - t0) / n, (t2 - t1) / ops, (t3 - t2) / t.n,
+			(double) t.nodes * BPT_STR_NODE_BYTES / t.n);
+		bpt_str_destroy(&t);
+	}
+	if(sum == 42)
+		printf("\n");
+	free(buf);
+	free(off);
+	free(recs);
+}
+
+/* Records in the leaves: n random keys are inserted with their records, then
+ * gets and a full scan read the records. By default each record is allocated
+ * by the client and the leaves point to it; built with -DBPT_VALUE_BYTES=8 or
+ * 16 the records are copied into the leaves. bytes_per_key counts the nodes
+ * and the records, not the overhead of malloc.
+ */
+static void
+bench_values(long n)
+{
+	long i, ops = 1 << 22;
+	bpt_key_t* keys = (bpt_key_t*) my_calloc(n * sizeof(bpt_key_t));
+	long leaves = 0, indexes = 0, sum = 0;
+	bpt_record_t rec;
+	bpt_cursor c;
+	bptree t;
+
+	memset(&rec, 0, sizeof(rec));
+	bpt_init_alloc(&t, bpt_slab_allocator_create(0));
+	double t0 = now_ns();
+	for(i = 0; i < n; i++){
+		keys[i] = rand_key();
+		rec.v = i;
+#ifdef BPT_VALUE_BYTES
+		bpt_insert(&t, keys[i], &rec);
+#else
+		bpt_record_t* r = (bpt_record_t*) my_calloc(sizeof(rec));
+		*r = rec;
+		bpt_insert(&t, keys[i], r);
+#endif
+	}
+	double t1 = now_ns();
+	for(i = 0; i < ops; i++)
+		sum += bpt_get(&t, keys[rand_key() % n])->v;
+	double t2 = now_ns();
+	for(bpt_cursor_seek(&t, &c, 0); bpt_cursor_valid(&c); 
+			bpt_cursor_next(&c))
+		sum += bpt_cursor_record(&c)->v;
+	double t3 = now_ns();
+
+	count_nodes(t.root, &leaves, &indexes);
+#ifdef BPT_VALUE_BYTES
+	const char* mode = "inline";
+	long rec_bytes = 0;
+#else
+	const char* mode = "pointer";
+	long rec_bytes = n * sizeof(rec);
+#endif
+	printf("records=%-7s value_bytes=%zu insert_ns=%.1f get_ns=%.1f "
+		"scan_ns=%.1f bytes_per_key=%.1f\n", mode, sizeof(rec), 
+		(t1 - t0) / n, (t2 - t1) / ops, (t3 - t2) / n,
+		(double) (leaves * BPT_LEAF_NODE_SIZE 
+			+ indexes * BPT_INDEX_NODE_SIZE + rec_bytes) / n);
+	if(sum == 42)
+		printf("\n");
+#ifndef BPT_VALUE_BYTES
+	for(bpt_cursor_seek(&t, &c, 0); bpt_cursor_valid(&c); 
+			bpt_cursor_next(&c))
+		free(bpt_cursor_record(&c));
+#endif
+	bpt_destroy(&t);
+	free(keys);
+}
+
+/* Churn of inserts and deletes, which splits and merges nodes all the time:
+ * n random keys are inserted, then each op deletes a key and inserts a new 
+ * one. Compare calloc with the slab allocators.
+ */
+static void
+bench_alloc(long n)
+{
+	const char* names[] = {"calloc", "slab", "slab_hugepage"};
+	long i, j, ops = 4 * n;
+	bpt_key_t* keys = (bpt_key_t*) my_calloc(n * sizeof(bpt_key_t));
+	bpt_record_t* recs = new_records(n);
+	bptree t;
+
+	for(j = 0; j < 3; j++){
+		rand_state = 88172645463325252ULL;
+		if(j == 0)
+			bpt_init(&t);
+		else bpt_init_alloc(&t, bpt_slab_allocator_create(
+				j == 2 ? BPT_SLAB_HUGEPAGE : 0));
+
+		double t0 = now_ns();
+		for(i = 0; i < n; i++){
+			keys[i] = rand_key();
+			bpt_insert(&t, keys[i], recs + i);
+		}
+		double t1 = now_ns();
+		for(i = 0; i < ops; i++){
+			long ind = rand_key() % n;
+			bpt_delete(&t, keys[ind], recs + ind);
+			keys[ind] = rand_key();
+			bpt_insert(&t, keys[ind], recs + ind);
+		}
+		double t2 = now_ns();
+		bpt_destroy(&t);
+		double t3 = now_ns();
+		printf("%-14s insert_ns=%.1f churn_ns=%.1f destroy_ms=%.2f\n",
+			names[j], (t1 - t0) / n, (t2 - t1) / ops, 
+			(t3 - t2) / 1e6);
+	}
+	free(keys);
+	free(recs);
+}
+
+/* Insert n increasing keys(like timestamps), with append mode off and on:
+ * throughput, number of nodes and how full the leaves are.
+ */
+static void
+bench_append(long n)
+{
+	long i;
+	int on;
+	bpt_record_t* recs = new_records(n);
+	bptree t;
+
+	for(on = 0; on < 2; on++){
+		long leaves = 0, indexes = 0;
+		bpt_init_alloc(&t, bpt_slab_allocator_create(0));
+		bpt_set_append(&t, on);
+		double t0 = now_ns();
+		for(i = 0; i < n; i++)
+			bpt_insert(&t, i * 8, recs + i);
+		double t1 = now_ns();
+		count_nodes(t.root, &leaves, &indexes);
+		printf("append=%d ns_per_key=%.1f height=%d leaves=%ld "
+			"indexes=%ld leaf_fill=%.1f%%\n", on, (t1 - t0) / n, 
+			tree_height(&t), leaves, indexes, 
+			100.0 * n / (leaves * BPT_MAX_LEAF_REC_NO));
+		bpt_destroy(&t);
+	}
+	free(recs);
+}
+
+/* Per key cost of batch gets, inserts and deletes of random keys, for batch 
+ * sizes from 1 to 64K, on a tree of n keys. Batch size 1 is close to the 
+ * single key calls.
+ */
+static void
+bench_batch(long n)
+{
+	long i, j, b, ops = 1 << 20;
+	bpt_key_t* keys = (bpt_key_t*) my_calloc(n * sizeof(bpt_key_t));
+	bpt_key_t* bkeys = (bpt_key_t*) my_calloc(65536 * sizeof(bpt_key_t));
+	bpt_record_t* recs = new_records(n + 65536);
+	bpt_record_t** brecs = (bpt_record_t**) my_calloc(65536 * sizeof(void*));
+	bptree t;
+
+	bpt_init_alloc(&t, bpt_slab_allocator_create(0));
+	for(i = 0; i < n; i++){
+		keys[i] = rand_key();
+		bpt_insert(&t, keys[i], recs + i);
+	}
+
+	for(b = 1; b <= 65536; b *= 4){
+		double get_ns = 0, ins_ns = 0, del_ns = 0;
+		for(i = 0; i < ops; i += b){
+			/* Get existing keys */
+			for(j = 0; j < b; j++)
+				bkeys[j] = keys[rand_key() % n];
+			double t0 = now_ns();
+			bpt_get_batch(&t, bkeys, brecs, b, 0);
+			double t1 = now_ns();
+
+			/* Insert new keys, then delete them */
+			for(j = 0; j < b; j++){
+				bkeys[j] = rand_key();
+				brecs[j] = recs + n + j;
+			}
+			double t2 = now_ns();
+			bpt_insert_batch(&t, bkeys, brecs, b, 0);
+			double t3 = now_ns();
+			bpt_delete_batch(&t, bkeys, brecs, b, 0);
+			double t4 = now_ns();
+
+			get_ns += t1 - t0;
+			ins_ns += t3 - t2;
+			del_ns += t4 - t3;
+		}
+		printf("batch=%-6ld get_ns=%.1f insert_ns=%.1f delete_ns=%.1f\n",
+			b, get_ns / ops, ins_ns / ops, del_ns / ops);
+	}
+	bpt_destroy(&t);
+	free(keys);
+	free(bkeys);
+	free(recs);
+	free(brecs);
+}
+
+/* Shared state of the bench_concurrent threads */
+struct conc_arg
+{
+	bptree* t;
+	pthread_mutex_t* lock;	/* NULL in thread-safe mode */
+	bpt_key_t* keys;
+	bpt_record_t* recs;
+	long n;
+	long ops;
+	int write_pct;
+	unsigned long long seed;
+};
+
+static void*
+conc_worker(void* p)
+{
+	struct conc_arg* a = p;
+	unsigned long long s = a->seed;
+	long i, sum = 0;
+
+	for(i = 0; i < a->ops; i++){
+		s ^= s << 13;
+		s ^= s >> 7;
+		s ^= s << 17;
+		long ind = (s >> 8) % a->n;
+		int write = (s & 0xff) * 100 < a->write_pct * 256;
+
+		if(a->lock)
+			pthread_mutex_lock(a->lock);
+		if(write){
+			/* Delete and insert back, the key set stays the same */
+			bpt_delete(a->t, a->keys[ind], a->recs + ind);
+			bpt_insert(a->t, a->keys[ind], a->recs + ind);
+		}else{
+			bpt_record_t* r = bpt_get(a->t, a->keys[ind]);
+			sum += r ? r->v : 0;
+		}
+		if(a->lock)
+			pthread_mutex_unlock(a->lock);
+	}
+	return (void*) sum;
+}
+
+/* Throughput of gets mixed with deletes and inserts, by 1 to 8 threads: the
+ * thread-safe mode compared with one mutex around the tree.
+ */
+static void
+bench_concurrent(long n)
+{
+	int threads[] = {1, 2, 4, 8};
+	int write_pcts[] = {0, 10, 50};
+	long i, ops = 1000000;
+	int w, h, j, mode;
+	bpt_key_t* keys = (bpt_key_t*) my_calloc(n * sizeof(bpt_key_t));
+	bpt_record_t* recs = new_records(n);
+	pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+	struct conc_arg args[8];
+	pthread_t th[8];
+	bptree t;
+
+	bpt_init_alloc(&t, bpt_slab_allocator_create(0));
+	for(i = 0; i < n; i++){
+		keys[i] = rand_key();
+		bpt_insert(&t, keys[i], recs + i);
+	}
+
+	for(w = 0; w < sizeof(write_pcts) / sizeof(write_pcts[0]); w++)
+	for(h = 0; h < sizeof(threads) / sizeof(threads[0]); h++)
+	for(mode = 0; mode < 2; mode++){
+		/* Not with BPT_COUNTS */
+		if(mode == 0 && bpt_olc_enable(&t) != 0)
+			continue;
+		double t0 = now_ns();
+		for(j = 0; j < threads[h]; j++){
+			args[j].t = &t;
+			args[j].lock = mode == 0 ? NULL : &lock;
+			args[j].keys = keys;
+			args[j].recs = recs;
+			args[j].n = n;
+			args[j].ops = ops / threads[h];
+			args[j].write_pct = write_pcts[w];
+			args[j].seed = 88172645463325252ULL + j;
+			pthread_create(&th[j], NULL, conc_worker, &args[j]);
+		}
+		for(j = 0; j < threads[h]; j++)
+			pthread_join(th[j], NULL);
+		double t1 = now_ns();
+		if(mode == 0)
+			bpt_olc_disable(&t);
+
+		printf("write_pct=%-3d threads=%d %-5s mops=%.2f\n",
+			write_pcts[w], threads[h], mode == 0 ? "olc" : "mutex",
+			ops / ((t1 - t0) / 1e3));
+	}
+	bpt_destroy(&t);
+	free(keys);
+	free(recs);
+}
+
+/* Purge the oldest 10%, 50% and 90% of the keys of a tree, as an expired time
+ * window: bpt_delete of each key, a sorted batch delete, and bpt_delete_range.
+ */
+static void
+bench_purge(long n)
+{
+	int pcts[] = {10, 50, 90};
+	long i, m;
+	int p, way;
+	bpt_key_t* keys = (bpt_key_t*) my_calloc(n * sizeof(bpt_key_t));
+	bpt_record_t* recs = new_records(n);
+	bpt_record_t** rec_ptrs = (bpt_record_t**) my_calloc(n * sizeof(void*));
+	const char* names[] = {"delete", "batch", "range"};
+	bptree t;
+
+	for(i = 0; i < n; i++){
+		keys[i] = i;
+		rec_ptrs[i] = recs + i;
+	}
+	for(p = 0; p < sizeof(pcts) / sizeof(pcts[0]); p++)
+	for(way = 0; way < 3; way++){
+		m = n / 100 * pcts[p];
+		bpt_init(&t);
+		bpt_bulk_load(&t, keys, rec_ptrs, n, 0.7);
+		double t0 = now_ns();
+		if(way == 0)
+			for(i = 0; i < m; i++)
+				bpt_delete(&t, keys[i], rec_ptrs[i]);
+		else if(way == 1)
+			bpt_delete_batch(&t, keys, rec_ptrs, m, 1);
+		else bpt_delete_range(&t, 0, m);
+		double t1 = now_ns();
+		printf("purge_pct=%-2d %-6s ms=%.2f ns_per_key=%.1f "
+			"height=%d\n", pcts[p], names[way], (t1 - t0) / 1e6,
+			(t1 - t0) / m,
+			tree_height(&t));
+		bpt_destroy(&t);
+	}
+	free(keys);
+	free(recs);
+	free(rec_ptrs);
+}
+
+/* Churn of deletes and inserts around the same keys under each underflow 
+ * policy. A tree of n keys takes n operations of two kinds: a delete of a
+ * random key followed by its insert(reinsert), and a delete or insert of a 
+ * random key of twice the range, whichever applies(toggle). Reports the 
+ * structure modifications per operation, the fill of the leaves after the 
+ * churn, and the time of the compaction that follows.
+ */
+static void
+bench_churn(long n)
+{
+	const char* names[] = {"half", "quarter", "empty"};
+	const char* kinds[] = {"reinsert", "toggle"};
+	bpt_record_t* recs = new_records(2 * n);
+	char* in_tree = (char*) my_calloc(2 * n);
+	long i, k, ops, leaves;
+	int policy, kind;
+	bpt_node* l;
+	bptree t;
+
+	for(kind = 0; kind < 2; kind++)
+	for(policy = BPT_UNDERFLOW_HALF; policy <= BPT_UNDERFLOW_EMPTY; 
+			policy++){
+		rand_state = 88172645463325252ULL;
+		memset(in_tree, 0, 2 * n);
+		bpt_init(&t);
+		for(i = 0; i < n; i++){
+			k = 2 * (rand_key() % n);
+			if(! in_tree[k]){
+				bpt_insert(&t, k, recs + k);
+				in_tree[k] = 1;
+			}
+		}
+		bpt_set_underflow(&t, policy);
+		struct bpt_smo s = t.smo;
+		double t0 = now_ns();
+		for(i = 0, ops = 0; i < n; i++){
+			k = rand_key() % (2 * n);
+			if(kind == 0){
+				if(! in_tree[k])
+					continue;
+				bpt_delete(&t, k, recs + k);
+				bpt_insert(&t, k, recs + k);
+				ops += 2;
+			}else{
+				if(in_tree[k])
+					bpt_delete(&t, k, recs + k);
+				else bpt_insert(&t, k, recs + k);
+				in_tree[k] = ! in_tree[k];
+				ops++;
+			}
+		}
+		double t1 = now_ns();
+		long smo = t.smo.splits - s.splits + t.smo.merges - s.merges
+			+ t.smo.borrows - s.borrows;
+		leaves = 0;
+		TAILQ_FOREACH(l, &t.rec_list_head, recs.l_rec.n)
+			leaves++;
+		for(i = 0, k = 0; i < 2 * n; i++)
+			k += in_tree[i];
+		double fill = (double) k / leaves / BPT_MAX_LEAF_REC_NO;
+
+		double t2 = now_ns();
+		bpt_compact(&t);
+		double t3 = now_ns();
+		printf("churn=%-8s policy=%-7s Mops=%.2f smo_per_op=%.4f "
+			"splits=%ld merges=%ld borrows=%ld leaf_fill=%.2f "
+			"compact_ms=%.2f\n", kinds[kind], names[policy], 
+			ops / ((t1 - t0) / 1e3), (double) smo / ops,
+			t.smo.splits - s.splits, t.smo.merges - s.merges,
+			t.smo.borrows - s.borrows, fill, (t3 - t2) / 1e6);
+		bpt_destroy(&t);
+	}
+	free(recs);
+	free(in_tree);
+}
+
+/* Max gets timed by a reader of bench_cow */
+#define COW_MAX_LAT 1000000
+
+/* Arguments of the threads of bench_cow. With c set, the tree is the
+ * copy-on-write one, otherwise t under a mutex.
+ */
+struct cow_arg
+{
+	bpt_cow* c;
+	bptree* t;
+	pthread_mutex_t* lock;
+	bpt_record_t* recs;
+	long n;
+	int* done;
+
+	/* Writer: operations and their latencies. Reader: scans and their
+	 * time, and the latencies of the gets between them.
+	 */
+	long ops;
+	long scans;
+	double scan_ns;
+	long* lat;
+	long n_lat;
+};
+
+/* Delete or insert random keys of [0, 2n), whichever applies */
+static void*
+cow_writer(void* p)
+{
+	struct cow_arg* a = (struct cow_arg*) p;
+	unsigned long long s = 88172645463325252ULL;
+	char* in_tree = (char*) my_calloc(2 * a->n);
+	long i, k;
+
+	for(i = 0; i < a->n; i++)
+		in_tree[2 * i] = 1;
+	for(i = 0; i < a->ops; i++){
+		s ^= s << 13;
+		s ^= s >> 7;
+		s ^= s << 17;
+		k = (s >> 1) % (2 * a->n);
+		double t0 = now_ns();
+		if(a->c == NULL)
+			pthread_mutex_lock(a->lock);
+		if(in_tree[k]){
+			if(a->c)
+				bpt_cow_delete(a->c, k, a->recs + k);
+			else bpt_delete(a->t, k, a->recs + k);
+		}else if(a->c)
+			bpt_cow_insert(a->c, k, a->recs + k);
+		else bpt_insert(a->t, k, a->recs + k);
+		if(a->c == NULL)
+			pthread_mutex_unlock(a->lock);
+		a->lat[i] = (long) (now_ns() - t0);
+		in_tree[k] = ! in_tree[k];
+	}
+	free(in_tree);
+	return NULL;
+}
+
+/* Scan the whole tree, then time 1000 gets of random keys in one snapshot(or
+ * each one under the mutex), until the writer is done. The time of taking
+ * the snapshot is counted in the first get.
+ */
+static void*
+cow_reader(void* p)
+{
+	struct cow_arg* a = (struct cow_arg*) p;
+	unsigned long long s = 0x9E3779B97F4A7C15ULL ^ (long) p;
+	long i, sum = 0;
+	bpt_snap* x = NULL;
+
+	while(! __atomic_load_n(a->done, __ATOMIC_ACQUIRE)){
+		double t0 = now_ns();
+		if(a->c){
+			bpt_snap_cursor c;
+			x = bpt_snapshot(a->c);
+			for(bpt_snap_cursor_seek(x, &c, 0);
+					bpt_snap_cursor_valid(&c);
+					bpt_snap_cursor_next(&c))
+				sum += bpt_snap_cursor_record(&c)->v;
+			bpt_snapshot_release(a->c, x);
+		}else{
+			bpt_cursor c;
+			pthread_mutex_lock(a->lock);
+			for(bpt_cursor_seek(a->t, &c, 0); bpt_cursor_valid(&c);
+					bpt_cursor_next(&c))
+				sum += bpt_cursor_record(&c)->v;
+			pthread_mutex_unlock(a->lock);
+		}
+		a->scan_ns += now_ns() - t0;
+		a->scans++;
+
+		for(i = 0; i < 1000 && a->n_lat < COW_MAX_LAT; i++){
+			s ^= s << 13;
+			s ^= s >> 7;
+			s ^= s << 17;
+			long k = (s >> 1) % (2 * a->n);
+			bpt_record_t* r;
+			double t1 = now_ns();
+			if(a->c){
+				if(i == 0)
+					x = bpt_snapshot(a->c);
+				r = bpt_snap_get(x, k);
+				sum += r ? r->v : 0;
+			}else{
+				pthread_mutex_lock(a->lock);
+				r = bpt_get(a->t, k);
+				sum += r ? r->v : 0;
+				pthread_mutex_unlock(a->lock);
+			}
+			a->lat[a->n_lat++] = (long) (now_ns() - t1);
+		}
+		if(a->c && i > 0)
+			bpt_snapshot_release(a->c, x);
+	}
+	return (void*) sum;
+}
+
+/* A writer of random deletes and inserts, with 0 or 2 readers which scan the
+ * whole tree and time gets between the scans: the copy-on-write tree with
+ * snapshots, compared with a plain tree under one mutex, where the writer
+ * waits for the scans.
+ */
+static void
+bench_cow(long n)
+{
+	int readers[] = {0, 2};
+	bpt_record_t* recs = new_records(2 * n);
+	long* lat = (long*) my_calloc(2 * COW_MAX_LAT * sizeof(long));
+	long* wlat = (long*) my_calloc(n * sizeof(long));
+	pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+	struct cow_arg args[3];
+	pthread_t th[3];
+	int r, j, mode, done;
+	long i, n_lat, scans;
+	double scan_ns;
+	bptree t;
+	bpt_cow c;
+
+	for(mode = 0; mode < 2; mode++)
+	for(r = 0; r < sizeof(readers) / sizeof(readers[0]); r++){
+		if(mode == 0){
+			bpt_cow_init(&c);
+			for(i = 0; i < n; i++)
+				bpt_cow_insert(&c, 2 * i, recs + 2 * i);
+		}else{
+			bpt_init(&t);
+			for(i = 0; i < n; i++)
+				bpt_insert(&t, 2 * i, recs + 2 * i);
+		}
+		done = 0;
+		for(j = 0; j <= readers[r]; j++){
+			memset(&args[j], 0, sizeof(args[j]));
+			args[j].c = mode == 0 ? &c : NULL;
+			args[j].t = &t;
+			args[j].lock = &lock;
+			args[j].recs = recs;
+			args[j].n = n;
+			args[j].done = &done;
+			args[j].ops = n;
+			args[j].lat = j == 0 ? wlat 
+				: lat + (j - 1) * COW_MAX_LAT;
+		}
+		long copies = mode == 0 ? c.copies : 0;
+		for(j = 1; j <= readers[r]; j++)
+			pthread_create(&th[j], NULL, cow_reader, &args[j]);
+		double t0 = now_ns();
+		cow_writer(&args[0]);
+		double t1 = now_ns();
+		__atomic_store_n(&done, 1, __ATOMIC_RELEASE);
+		n_lat = scans = 0;
+		scan_ns = 0;
+		for(j = 1; j <= readers[r]; j++){
+			pthread_join(th[j], NULL);
+			/* The samples of the readers side by side */
+			memmove(lat + n_lat, args[j].lat,
+					args[j].n_lat * sizeof(long));
+			n_lat += args[j].n_lat;
+			scans += args[j].scans;
+			scan_ns += args[j].scan_ns;
+		}
+		qsort(lat, n_lat, sizeof(long), cmp_long);
+		qsort(wlat, n, sizeof(long), cmp_long);
+
+		printf("mode=%-5s readers=%d writer_mops=%.2f "
+			"write_p99_ns=%ld write_max_us=%.1f", mode == 0 
+			? "cow" : "mutex", readers[r], n / ((t1 - t0) / 1e3),
+			wlat[n * 99 / 100], wlat[n - 1] / 1e3);
+		if(mode == 0)
+			printf(" copies_per_write=%.3f", 
+				(double) (c.copies - copies) / n);
+		if(n_lat > 0)
+			printf(" scans=%ld scan_ms=%.1f get_p50_ns=%ld "
+				"get_p99_ns=%ld get_max_us=%.1f", scans, 
+				scan_ns / scans / 1e6, lat[n_lat / 2], 
+				lat[n_lat * 99 / 100], lat[n_lat - 1] / 1e3);
+		printf("\n");
+		if(mode == 0)
+			bpt_cow_destroy(&c);
+		else bpt_destroy(&t);
+	}
+	free(recs);
+	free(lat);
+	free(wlat);
+}
+
+/* Range of the keys of bench_shard */
+#define SHARD_RANGE 1000000000L
+
+/* Arguments of the threads of bench_shard, which insert keys[0 .. n) into
+ * the sharded tree s, or else the tree t, under the mutex if lock is set.
+ */
+struct shard_arg
+{
+	bpt_shards* s;
+	bptree* t;
+	pthread_mutex_t* lock;
+	bpt_key_t* keys;
+	bpt_record_t* recs;
+	long n;
+	int* done;
+};
+
+static void*
+shard_producer(void* p)
+{
+	struct shard_arg* a = (struct shard_arg*) p;
+	long i;
+
+	for(i = 0; i < a->n; i++){
+		if(a->s)
+			bpt_shards_insert(a->s, a->keys[i], a->recs + i);
+		else if(a->lock){
+			pthread_mutex_lock(a->lock);
+			bpt_insert(a->t, a->keys[i], a->recs + i);
+			pthread_mutex_unlock(a->lock);
+		}else bpt_insert(a->t, a->keys[i], a->recs + i);
+	}
+	if(a->s)
+		bpt_shards_flush(a->s);
+	__atomic_fetch_add(a->done, 1, __ATOMIC_SEQ_CST);
+	return NULL;
+}
+
+/* Inserts of random keys by 1 to 8 threads, uniform or skewed(90% of them in
+ * 10% of the range): the sharded tree, which starts with one shard per 
+ * thread and is rebalanced every millisecond, compared with the thread-safe
+ * mode and one mutex around the tree.
+ */
+static void
+bench_shard(long n)
+{
+	int threads[] = {1, 2, 4, 8};
+	const char* dists[] = {"uniform", "skewed"};
+	const char* modes[] = {"shard", "olc", "mutex"};
+	bpt_key_t* keys = (bpt_key_t*) my_calloc(n * sizeof(bpt_key_t));
+	bpt_record_t* recs = new_records(n);
+	pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+	struct shard_arg args[8];
+	pthread_t th[8];
+	int d, h, j, mode, done;
+	long i;
+	bpt_shards s;
+	bptree t;
+
+	for(d = 0; d < 2; d++){
+		for(i = 0; i < n; i++){
+			long k = rand_key();
+			if(d == 1 && k % 10 != 0)
+				keys[i] = k % (SHARD_RANGE / 10);
+			else keys[i] = k % SHARD_RANGE;
+		}
+		for(h = 0; h < sizeof(threads) / sizeof(threads[0]); h++)
+		for(mode = 0; mode < 3; mode++){
+			if(mode == 0)
+				bpt_shards_init(&s, threads[h], 0, SHARD_RANGE);
+			else{
+				bpt_init_alloc(&t, 
+					bpt_slab_allocator_create(0));
+				if(mode == 1 && bpt_olc_enable(&t) != 0){
+					bpt_destroy(&t);
+					continue;
+				}
+			}
+			done = 0;
+			double t0 = now_ns();
+			for(j = 0; j < threads[h]; j++){
+				long lo = n * j / threads[h];
+				args[j].s = mode == 0 ? &s : NULL;
+				args[j].t = &t;
+				args[j].lock = mode == 2 ? &lock : NULL;
+				args[j].keys = keys + lo;
+				args[j].recs = recs + lo;
+				args[j].n = n * (j + 1) / threads[h] - lo;
+				args[j].done = &done;
+				pthread_create(&th[j], NULL, shard_producer, 
+						&args[j]);
+			}
+			while(mode == 0 && __atomic_load_n(&done, 
+					__ATOMIC_SEQ_CST) < threads[h]){
+				bpt_shards_rebalance(&s);
+				usleep(1000);
+			}
+			for(j = 0; j < threads[h]; j++)
+				pthread_join(th[j], NULL);
+			double t1 = now_ns();
+
+			printf("dist=%-7s threads=%d %-5s mops=%.2f", dists[d],
+				threads[h], modes[mode], n / ((t1 - t0) / 1e3));
+			if(mode == 0){
+				printf(" shards=%d splits=%ld merges=%ld", 
+					s.map->n, s.splits, s.merges);
+				bpt_shards_destroy(&s);
+			}else{
+				if(mode == 1)
+					bpt_olc_disable(&t);
+				bpt_destroy(&t);
+			}
+			printf("\n");
+		}
+	}
+	free(keys);
+	free(recs);
+}
+
+/* Random inserts of n keys, then gets of them in random order: the plain 
+ * tree, and the buffered tree with buffers of 64 to 1024 messages. Reports
+ * the batches moved down the buffered tree and the messages applied to the
+ * leaves by the inserts, and the get latency with the messages still in the
+ * buffers and after bpt_beps_sync.
+ */
+static void
+bench_beps(long n)
+{
+	int sizes[] = {0, 64, 256, 1024};
+	bpt_key_t* keys = (bpt_key_t*) my_calloc(n * sizeof(bpt_key_t));
+	bpt_record_t* recs = new_records(n);
+	long i, sum = 0;
+	int j;
+	bptree t;
+	bpt_beps b;
+
+	for(i = 0; i < n; i++)
+		keys[i] = rand_key();
+	for(j = 0; j < sizeof(sizes) / sizeof(sizes[0]); j++){
+		double t0 = now_ns();
+		if(sizes[j] == 0){
+			bpt_init(&t);
+			for(i = 0; i < n; i++)
+				bpt_insert(&t, keys[i], recs + i);
+		}else{
+			bpt_beps_init(&b);
+			b.buf_size = sizes[j];
+			for(i = 0; i < n; i++)
+				bpt_beps_insert(&b, keys[i], recs + i);
+		}
+		double t1 = now_ns();
+		for(i = 0; i < n; i++){
+			bpt_key_t k = keys[(i * 7919) % n];
+			bpt_record_t* r = sizes[j] ? bpt_beps_get(&b, k) 
+				: bpt_get(&t, k);
+			sum += r->v;
+		}
+		double t2 = now_ns();
+
+		if(sizes[j] == 0){
+			printf("tree=plain    insert_mops=%.2f get_ns=%.1f\n",
+				n / ((t1 - t0) / 1e3), (t2 - t1) / n);
+			bpt_destroy(&t);
+			continue;
+		}
+		printf("tree=buffered buf=%-4d insert_mops=%.2f get_ns=%.1f "
+			"flushes=%ld applied=%ld", sizes[j], 
+			n / ((t1 - t0) / 1e3), (t2 - t1) / n, b.flushes, 
+			b.applied);
+		double t3 = now_ns();
+		bpt_beps_sync(&b);
+		double t4 = now_ns();
+		for(i = 0; i < n; i++)
+			sum += bpt_beps_get(&b, keys[(i * 7919) % n])->v;
+		double t5 = now_ns();
+		printf(" sync_ms=%.1f synced_get_ns=%.1f\n", (t4 - t3) / 1e6,
+			(t5 - t4) / n);
+		bpt_beps_destroy(&b);
+	}
+	if(sum == 42)
+		printf("\n");
+	free(keys);
+	free(recs);
+}
+
+/* Key of bench_learn: uniform random, dense(a permutation of 0..n), log-normal,
+ * or in clusters of 1000 consecutive keys at random places.
+ */
+static bpt_key_t
+bench_learn_key(long i, long n, const char* dist)
+{
+	if(strcmp(dist, "dense") == 0)
+		return bench_key(i, n, "int");
+	if(strcmp(dist, "lognormal") == 0){
+		/* Box-Muller, then exp(2 * normal) times 1e6 */
+		double u = (rand_key() + 1.0) / 9.3e18, v = rand_key() / 9.3e18;
+		return (bpt_key_t) (1e6 * exp(2 * sqrt(-2 * log(u)) 
+					* cos(2 * M_PI * v)));
+	}
+	if(strcmp(dist, "cluster") == 0){
+		if(i % 1000 == 0)
+			rand_state ^= rand_key() & ~0xfffffUL;
+		return (bpt_key_t) ((rand_state >> 1 & ~0xfffffUL) + i % 1000);
+	}
+	return rand_key();
+}
+
+/* Learned index over the leaves against the index levels, on n keys of each
+ * distribution inserted in random order: random gets by bpt_get and by
+ * bpt_learn_get, the bytes of the index nodes and of the model, and the gets
+ * after n / 100 more inserts made segments stale.
+ */
+static void
+bench_learn(long n)
+{
+	const char* dists[] = {"uniform", "dense", "lognormal", "cluster"};
+	long i, ops = 1 << 22, extra = n / 100, sum = 0;
+	bpt_key_t* keys = (bpt_key_t*) my_calloc((n + extra) 
+			* sizeof(bpt_key_t));
+	bpt_key_t* qkeys = (bpt_key_t*) my_calloc(ops * sizeof(bpt_key_t));
+	bpt_record_t* recs = new_records(n + extra);
+	int f;
+	bpt_learn m;
+	bptree t;
+
+	for(f = 0; f < sizeof(dists) / sizeof(dists[0]); f++){
+		long leaves = 0, indexes = 0;
+		for(i = 0; i < n + extra; i++)
+			keys[i] = bench_learn_key(i, n + extra, dists[f]);
+		/* Shuffle, the clusters are made in order */
+		for(i = n + extra - 1; i > 0; i--){
+			long j = rand_key() % (i + 1);
+			bpt_key_t k = keys[i];
+			keys[i] = keys[j];
+			keys[j] = k;
+		}
+		for(i = 0; i < ops; i++)
+			qkeys[i] = keys[rand_key() % n];
+
+		bpt_init(&t);
+		for(i = 0; i < n; i++)
+			bpt_insert(&t, keys[i], recs + i);
+		count_nodes(t.root, &leaves, &indexes);
+		double t0 = now_ns();
+		bpt_learn_init(&m, &t);
+		double t1 = now_ns();
+		for(i = 0; i < ops; i++)
+			sum += (long) bpt_get(&t, qkeys[i]);
+		double t2 = now_ns();
+		for(i = 0; i < ops; i++)
+			sum += (long) bpt_learn_get(&m, qkeys[i]);
+		double t3 = now_ns();
+		printf("keys=%-9s height=%d leaves=%ld segments=%ld "
+			"fit_ms=%.1f index_bytes=%ld model_bytes=%ld "
+			"tree_get_ns=%.1f learned_get_ns=%.1f", dists[f], 
+			tree_height(&t), leaves, m.n_seg, (t1 - t0) / 1e6, 
+			indexes * (long) BPT_INDEX_NODE_SIZE, 
+			bpt_learn_bytes(&m), (t2 - t1) / ops, (t3 - t2) / ops);
+
+		for(i = n; i < n + extra; i++)
+			bpt_learn_insert(&m, keys[i], recs + i);
+		long stale = m.stale_leaves, fb = m.fallbacks;
+		double t4 = now_ns();
+		for(i = 0; i < ops; i++)
+			sum += (long) bpt_learn_get(&m, qkeys[i]);
+		double t5 = now_ns();
+		printf(" stale_leaves=%ld stale_get_ns=%.1f fallbacks=%ld "
+			"refreshes=%ld\n", stale, (t5 - t4) / ops, 
+			m.fallbacks - fb, m.refreshes);
+		bpt_learn_destroy(&m);
+		bpt_destroy(&t);
+	}
+	if(sum == 42)
+		printf("\n");
+	free(keys);
+	free(qkeys);
+	free(recs);
+}
+
+/* A tree of n random keys inserted in random order, the same keys bulk
+ * loaded into full nodes, and the frozen tree of them: the bytes, random
+ * gets, full scans, and range queries of 100 keys. The scans do not read the
+ * records, which are in different orders.
+ */
+static void
+bench_freeze(long n)
+{
+	const char* kinds[] = {"inserted", "bulk_1.00", "frozen"};
+	long i, ops = 1 << 22, sum = 0;
+	bpt_key_t* keys = (bpt_key_t*) my_calloc(n * sizeof(bpt_key_t));
+	bpt_key_t* sorted = (bpt_key_t*) my_calloc(n * sizeof(bpt_key_t));
+	bpt_key_t* qkeys = (bpt_key_t*) my_calloc(ops * sizeof(bpt_key_t));
+	bpt_record_t* recs = new_records(n);
+	bpt_record_t** rec_ptrs = (bpt_record_t**) my_calloc(n * sizeof(void*));
+	bpt_frozen_cursor fc;
+	bpt_frozen f;
+	bpt_cursor c;
+	bptree t;
+	int j;
+
+	for(i = 0; i < n; i++){
+		keys[i] = sorted[i] = rand_key();
+		rec_ptrs[i] = recs + i;
+	}
+	qsort(sorted, n, sizeof(bpt_key_t), cmp_long);
+	for(i = 0; i < ops; i++)
+		qkeys[i] = keys[rand_key() % n];
+
+	for(j = 0; j < 3; j++){
+		long leaves = 0, indexes = 0, bytes;
+		double freeze_ms = 0;
+
+		bpt_init(&t);
+		if(j == 1)
+			bpt_bulk_load(&t, sorted, rec_ptrs, n, 1.0);
+		else for(i = 0; i < n; i++)
+			bpt_insert(&t, keys[i], recs + i);
+		count_nodes(t.root, &leaves, &indexes);
+		bytes = leaves * BPT_LEAF_NODE_SIZE 
+			+ indexes * BPT_INDEX_NODE_SIZE;
+		if(j == 2){
+			double t0 = now_ns();
+			bpt_freeze(&t, &f);
+			freeze_ms = (now_ns() - t0) / 1e6;
+			bytes = bpt_frozen_bytes(&f);
+		}
+
+		double t1 = now_ns();
+		for(i = 0; i < ops; i++)
+			sum += (long) (j == 2 ? bpt_frozen_get(&f, qkeys[i])
+				: bpt_get(&t, qkeys[i]));
+		double t2 = now_ns();
+		if(j == 2)
+			for(bpt_frozen_cursor_seek(&f, &fc, sorted[0]);
+					bpt_frozen_cursor_valid(&fc);
+					bpt_frozen_cursor_next(&fc))
+				sum += (long) bpt_frozen_cursor_record(&fc);
+		else for(bpt_cursor_seek(&t, &c, sorted[0]); 
+				bpt_cursor_valid(&c); bpt_cursor_next(&c))
+			sum += (long) bpt_cursor_record(&c);
+		double t3 = now_ns();
+		for(i = 0; i < ops / 100; i++){
+			long a = rand_key() % (n - 100);
+			if(j == 2){
+				bpt_frozen_cursor_seek(&f, &fc, sorted[a]);
+				bpt_frozen_cursor_set_end(&fc, sorted[a + 100]);
+				for(; bpt_frozen_cursor_valid(&fc);
+						bpt_frozen_cursor_next(&fc))
+					sum += (long) 
+					bpt_frozen_cursor_record(&fc);
+				continue;
+			}
+			bpt_cursor_seek(&t, &c, sorted[a]);
+			bpt_cursor_set_end(&c, sorted[a + 100]);
+			for(; bpt_cursor_valid(&c); bpt_cursor_next(&c))
+				sum += (long) bpt_cursor_record(&c);
+		}
+		double t4 = now_ns();
+		printf("tree=%-9s bytes_per_key=%.1f freeze_ms=%.1f "
+			"get_ns=%.1f scan_ns=%.2f range100_ns=%.1f\n", 
+			kinds[j], (double) bytes / n, freeze_ms,
+			(t2 - t1) / ops, (t3 - t2) / n,
+			(t4 - t3) / (ops / 100));
+		if(j == 2)
+			bpt_frozen_destroy(&f);
+		bpt_destroy(&t);
+	}
+	if(sum == 42)
+		printf("\n");
+	free(keys);
+	free(sorted);
+	free(qkeys);
+	free(recs);
+	free(rec_ptrs);
+}
+
+/* Keys with many duplicates(dups values each): records of equal keys in the
+ * tree, compared with the posting lists of bpt_dup. Inserts in random order,
+ * gets of all the values of a key, and deletes of half of the pairs.
+ */
+static void
+bench_dups(long n)
+{
+	long dups = 1000, nkeys = n / dups, i, j, cnt, sum = 0;
+	long* perm = (long*) my_calloc(n * sizeof(long));
+	bpt_record_t* recs = new_records(n);
+	bpt_value* v;
+	bpt_cursor c;
+	bptree t;
+	bpt_dup m;
+
+	/* Record i goes with key i % nkeys */
+	for(i = 0; i < n; i++)
+		perm[i] = i;
+	for(i = n - 1; i > 0; i--){
+		j = rand_key() % (i + 1);
+		long k = perm[i];
+		perm[i] = perm[j];
+		perm[j] = k;
+	}
+
+	bpt_init(&t);
+	double t0 = now_ns();
+	for(i = 0; i < n; i++)
+		bpt_insert(&t, perm[i] % nkeys, recs + perm[i]);
+	double t1 = now_ns();
+	for(i = 0; i < nkeys; i++){
+		bpt_cursor_seek(&t, &c, i);
+		bpt_cursor_set_end(&c, i + 1);
+		for(; bpt_cursor_valid(&c); bpt_cursor_next(&c))
+			sum += bpt_cursor_record(&c)->v;
+	}
+	double t2 = now_ns();
+	for(i = 0; i < n / 2; i++)
+		bpt_delete(&t, perm[i] % nkeys, recs + perm[i]);
+	double t3 = now_ns();
+	printf("dups=%ld tree    insert_ns=%.1f get_all_ns_per_value=%.2f "
+		"delete_ns=%.1f\n", dups, (t1 - t0) / n, (t2 - t1) / n, 
+		(t3 - t2) / (n / 2));
+	bpt_destroy(&t);
+
+	bpt_dup_init(&m);
+	t0 = now_ns();
+	for(i = 0; i < n; i++)
+		bpt_dup_insert(&m, perm[i] % nkeys, recs + perm[i]);
+	t1 = now_ns();
+	for(i = 0; i < nkeys; i++){
+		v = bpt_dup_get(&m, i, &cnt);
+		for(j = 0; j < cnt; j++)
+			sum += bpt_value_rec(&v[j])->v;
+	}
+	t2 = now_ns();
+	for(i = 0; i < n / 2; i++)
+		bpt_dup_delete(&m, perm[i] % nkeys, recs + perm[i]);
+	t3 = now_ns();
+	printf("dups=%ld posting insert_ns=%.1f get_all_ns_per_value=%.2f "
+		"delete_ns=%.1f\n", dups, (t1 - t0) / n, (t2 - t1) / n, 
+		(t3 - t2) / (n / 2));
+	bpt_dup_destroy(&m);
+
+	if(sum == 42)
+		printf("\n");
+	free(perm);
+	free(recs);
+}
+
+#ifdef BPT_COUNTS
+/* Counts of the records in key ranges of several lengths: bpt_count_range 
+ * from the counts in the index nodes, compared with a cursor scan of the 
+ * range. Then random ranks and selects.
+ */
+static void
+bench_rank(long n)
+{
+	long lens[] = {10, 1000, 100000, 1000000};
+	long i, len, qs, sum = 0;
+	int l;
+	long* keys = (long*) my_calloc(n * sizeof(long));
+	bpt_record_t* recs = new_records(n);
+	bptree t;
+	bpt_cursor c;
+	bpt_key_t k;
+
+	bpt_init(&t);
+	for(i = 0; i < n; i++){
+		keys[i] = rand_key();
+		bpt_insert(&t, keys[i], recs + i);
+	}
+	qsort(keys, n, sizeof(long), cmp_long);
+
+	for(l = 0; l < sizeof(lens) / sizeof(lens[0]) && lens[l] < n; l++){
+		len = lens[l];
+		qs = 10000000 / len < 1000 ? 1000 : 10000000 / len;
+		double t0 = now_ns();
+		for(i = 0; i < qs; i++){
+			long start = rand_key() % (n - len);
+			sum += bpt_count_range(&t, keys[start], 
+					keys[start + len]);
+		}
+		double t1 = now_ns();
+		for(i = 0; i < qs; i++){
+			long start = rand_key() % (n - len);
+			bpt_cursor_seek(&t, &c, keys[start]);
+			bpt_cursor_set_end(&c, keys[start + len]);
+			for(; bpt_cursor_valid(&c); bpt_cursor_next(&c))
+				sum++;
+		}
+		double t2 = now_ns();
+		printf("range_len=%ld count_range_ns=%.1f scan_ns=%.1f\n",
+			len, (t1 - t0) / qs, (t2 - t1) / qs);
+	}
+
+	qs = 1000000;
+	double t0 = now_ns();
+	for(i = 0; i < qs; i++)
+		sum += bpt_rank(&t, keys[rand_key() % n]);
+	double t1 = now_ns();
+	for(i = 0; i < qs; i++)
+		sum += bpt_select(&t, rand_key() % n, &k)->v;
+	double t2 = now_ns();
+	printf("rank_ns=%.1f select_ns=%.1f\n", (t1 - t0) / qs, 
+			(t2 - t1) / qs);
+	if(sum == 42)
+		printf("\n");
+	bpt_destroy(&t);
+	free(keys);
+	free(recs);
+}
+#endif
+
+struct bench
+{
+	const char* name;
+	void (*run) (long n);
+	long default_n;
+};
+
+static struct bench benches[] = {
+	{"fanout", bench_fanout, 1000000},
+	{"search", bench_search, 10000000},
+	{"scan", bench_scan, 1000000},
+	{"bulk", bench_bulk, 10000000},
+	{"alloc", bench_alloc, 1000000},
+	{"concurrent", bench_concurrent, 1000000},
+	{"append", bench_append, 10000000},
+	{"batch", bench_batch, 1000000},
+	{"multiget", bench_multiget, 16000000},
+	{"pool", bench_pool, 8000000},
+	{"image", bench_image, 16000000},
+	{"wal", bench_wal, 20000},
+	{"values", bench_values, 4000000},
+	{"keys", bench_keys, 4000000},
+	{"strings", bench_strings, 4000000},
+	{"dups", bench_dups, 1000000},
+	{"purge", bench_purge, 10000000},
+	{"churn", bench_churn, 1000000},
+	{"cow", bench_cow, 1000000},
+	{"shard", bench_shard, 4000000},
+	{"beps", bench_beps, 4000000},
+	{"learn", bench_learn, 4000000},
+	{"freeze", bench_freeze, 4000000},
+#ifdef BPT_COUNTS
+	{"rank", bench_rank, 4000000},
+#endif
+};
+
+int
+main(int argc, char** argv)
+{
+	int i;
+	int num = sizeof(benches) / sizeof(benches[0]);
+	for(i = 0; argc > 1 && i < num; i++){
+		if(strcmp(argv[1], benches[i].name) == 0){
+			benches[i].run(argc > 2
+				? atol(argv[2]) : benches[i].default_n);
+			return 0;
+		}
+	}
+	fprintf(stderr, "Usage: %s <benchmark> [number of keys]\n", argv[0]);
+	for(i = 0; i < num; i++)
+		fprintf(stderr, "  %s\n", benches[i].name);
+	return 1;
+}
@@ -0,0 +1,46 @@
+#!/bin/sh
+# Sweep the leaf and index fanouts and the key types of the B-Plus-Tree. They
+# are compile time constants, so the benchmark is rebuilt for each one.
+#   ./bptree_bench.sh [number of keys]
+
+N=${1:-1000000}
+CC=${CC:-gcc}
+BIN=./bpt_bench_sweep
+SRCS="bptree.c bpt_alloc.c bpt_olc.c bpt_pool.c bpt_image.c bpt_wal.c"
+SRCS="$SRCS bpt_str.c bpt_dup.c bpt_cow.c bpt_shard.c bpt_beps.c bpt_learn.c bpt_frozen.c"
+SRCS="$SRCS bptree_bench.c"
+
+for leaf in 4 8 16 32 64 128 254; do
+	for index in 4 8 16 32 64 128 255; do
+		$CC -O2 -DNDEBUG -DBPT_MAX_LEAF_REC_NO=$leaf \
+			-DBPT_MAX_INDEX_REC_NO=$index \
+			-o $BIN $SRCS -lm -lpthread || exit 1
+		$BIN fanout $N
+	done
+done
+
+# Node sized to whole cache lines or a page
+for bytes in 128 256 512 1024 4096; do
+	$CC -O2 -DNDEBUG -DBPT_NODE_BYTES=$bytes \
+		-o $BIN $SRCS -lm -lpthread || exit 1
+	printf "node_bytes=%d " $bytes
+	$BIN fanout $N
+done
+
+# Key types, each one specializes the tree
+for key in int long __int128; do
+	$CC -O2 -DNDEBUG -DBPT_NODE_BYTES=256 -DBPT_KEY_TYPE=$key \
+		-o $BIN $SRCS -lm -lpthread || exit 1
+	$BIN keys $N
+done
+
+# Counts of the subtrees in the index nodes, and their cost on inserts
+for counts in "" -DBPT_COUNTS; do
+	$CC -O2 -DNDEBUG -DBPT_NODE_BYTES=256 $counts \
+		-o $BIN $SRCS -lm -lpthread || exit 1
+	printf "counts=%s " ${counts:-no}
+	$BIN fanout $N
+done
+$BIN rank $N
+
+rm -f $BIN
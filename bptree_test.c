@@ -1,14 +1,48 @@
+#include <errno.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/wait.h>
+
 #include "bptree.h"
+#include "bpt_olc.h"
+#include "bpt_pool.h"
+#include "bpt_image.h"
+#include "bpt_wal.h"
+#include "bpt_str.h"
+#include "bpt_dup.h"
+#include "bpt_cow.h"
+#include "bpt_shard.h"
+#include "bpt_beps.h"
+#include "bpt_learn.h"
+#include "bpt_frozen.h"
 
 struct bpt_record_t
 {
 	long v;
+#if defined(BPT_VALUE_BYTES) && BPT_VALUE_BYTES > 8
+	char pad[BPT_VALUE_BYTES - 8];
+#endif
 };
 
 bpt_record_t* new_record(long v)
 {
 	bpt_record_t* brtp = (bpt_record_t*) my_calloc(sizeof(bpt_record_t));
 	brtp->v = v;
+	return brtp;
+}
+
+/* If record r returned by a tree is v. With inline values(BPT_VALUE_BYTES)
+ * r points into a leaf, so compare the bytes.
+ */
+static int
+rec_is(bpt_record_t* r, bpt_record_t* v)
+{
+#ifdef BPT_VALUE_BYTES
+	if(r != NULL && v != NULL)
+		return memcmp(r, v, BPT_VALUE_BYTES) == 0;
+#endif
+	return r == v;
 }
 
 /* Show the process of insert 100 records into bptree */
@@ -16,14 +50,16 @@ int
 test1()
 {
 	int i;
-	bpt_node* root = NULL;
+	bptree t;
 	bpt_record_t* rec[100];
+	bpt_init(&t);
 	for(i = 0; i < 100; i++)
 		rec[i] = new_record(i);
 	for(i = 0; i < 100; i++){
-		bpt_insert(&root, i, rec[i]);
-		bpt_print_tree(root);
+		bpt_insert(&t, i, rec[i]);
+		bpt_print_tree(&t);
 	}
+	bpt_destroy(&t);
 	for(i = 0; i < 100; i++)
 		free(rec[i]);
 	return 0;
@@ -36,17 +72,19 @@ int
 test2()
 {
 	int i;
-	bpt_node* root = NULL;
+	bptree t;
 	bpt_record_t* rec[100];
+	bpt_init(&t);
 	for(i = 0; i < 100; i++)
 		rec[i] = new_record(i);
 	for(i = 0 ;i < 100; i++)
-		bpt_insert(&root, i, rec[i]);
-	bpt_print_tree(root);
+		bpt_insert(&t, i, rec[i]);
+	bpt_print_tree(&t);
 	for(i = 99; i >= 0; i--){
-		bpt_delete(&root, i, rec[i]);
-		bpt_print_tree(root);
+		bpt_delete(&t, i, rec[i]);
+		bpt_print_tree(&t);
 	}
+	bpt_destroy(&t);
 	for(i = 0; i < 100; i++)
 		free(rec[i]);
 	return 0;
@@ -58,27 +96,2876 @@ int
 test3()
 {
 	long i;
-	bpt_node* root = NULL;
+	bptree t;
 	bpt_record_t* rec[100];
+	bpt_init(&t);
 	for(i = 0; i < 100; i++)
 		rec[i] = new_record(i);
 	for(i = 0 ;i < 100; i++)
-		bpt_insert(&root, i, rec[i]);
-	bpt_print_tree(root);
+		bpt_insert(&t, i, rec[i]);
+	bpt_print_tree(&t);
 	for(i = 0; i < 100; i++){
-		bpt_delete(&root, i, rec[i]);
-		bpt_print_tree(root);
+		bpt_delete(&t, i, rec[i]);
+		bpt_print_tree(&t);
 	}
+	bpt_destroy(&t);
 	for(i = 0; i < 100; i++)
 		free(rec[i]);
 	return 0;
 }
 
-int 
-main()
+/* Check that all key search implementations return the same index as the 
+ * scalar search, for sorted arrays with duplicated keys.
+ */
+int
+test4()
 {
-	//test1();
-	//test2();
-	test3();
+	struct {
+		const char* name;
+		int (*search) (long a[], int len, long k);
+		int supported;
+	} impl[] = {
+		{"bsearch", get_1st_ge_bsearch, 1},
+		{"dispatch", get_1st_ge, 1},
+#ifdef BPT_HAVE_SIMD_SEARCH
+		{"sse4.2", get_1st_ge_sse42, __builtin_cpu_supports("sse4.2")},
+		{"avx2", get_1st_ge_avx2, __builtin_cpu_supports("avx2")},
+#endif
+	};
+	int num = sizeof(impl) / sizeof(impl[0]);
+	long a[300];
+	int len, i, j;
+
+	srand(4);
+	for(len = 0; len < 300; len++){
+		/* Sorted keys with duplicates and negative keys */
+		a[0] = rand() % 16 - 8;
+		for(i = 1; i < len; i++)
+			a[i] = a[i - 1] + rand() % 3;
+		for(i = 0; i < 64; i++){
+			long k = (len ? a[rand() % len] : 0) + rand() % 3 - 1;
+			int expect = get_1st_ge_scalar(a, len, k);
+			for(j = 0; j < num; j++)
+				if(impl[j].supported 
+					&& impl[j].search(a, len, k) != expect){
+					printf("test4: %s failed, len %d, key %ld\n",
+						impl[j].name, len, k);
+					return 1;
+				}
+		}
+	}
+	printf("test4: all key search implementations agree\n");
+	return 0;
+}
+
+/* Insert and delete random keys, then check the range scans of the cursor 
+ * against the keys left in the tree, forward and backward.
+ */
+int
+test5()
+{
+	long i, k;
+	bptree t;
+	bpt_record_t* rec[1000];
+	char in_tree[1000] = {0};
+	bpt_cursor c;
+
+	bpt_init(&t);
+	for(i = 0; i < 1000; i++)
+		rec[i] = new_record(i);
+	srand(5);
+	for(i = 0; i < 5000; i++){
+		k = rand() % 1000;
+		if(in_tree[k])
+			bpt_delete(&t, k, rec[k]);
+		else bpt_insert(&t, k, rec[k]);
+		in_tree[k] = ! in_tree[k];
+	}
+
+	for(i = 0; i < 200; i++){
+		long lo = rand() % 1100 - 50, hi = lo + rand() % 300;
+
+		/* Forward scan of [lo, hi) */
+		k = lo < 0 ? 0 : lo;
+		bpt_cursor_seek(&t, &c, lo);
+		bpt_cursor_set_end(&c, hi);
+		for(; bpt_cursor_valid(&c); bpt_cursor_next(&c), k++){
+			while(k < 1000 && ! in_tree[k])
+				k++;
+			if(bpt_cursor_key(&c) != k || ! rec_is(
+					bpt_cursor_record(&c), rec[k])){
+				printf("test5: forward scan failed at %ld\n", k);
+				return 1;
+			}
+		}
+		while(k < hi && k < 1000 && ! in_tree[k])
+			k++;
+		if(k < hi && k < 1000){
+			printf("test5: forward scan stopped early at %ld\n", k);
+			return 1;
+		}
+
+		/* Backward scan from the last key < lo */
+		bpt_cursor_seek(&t, &c, lo);
+		k = lo < 1000 ? lo - 1 : 999;
+		if(c.leaf)
+			bpt_cursor_prev(&c);
+		else{
+			/* lo is bigger than all keys, start from the last one */
+			c.leaf = TAILQ_LAST(&t.rec_list_head, rec_list);
+			c.ind = c.leaf->num_of_rec - 1;
+		}
+		for(; bpt_cursor_valid(&c); bpt_cursor_prev(&c), k--){
+			while(k >= 0 && ! in_tree[k])
+				k--;
+			if(bpt_cursor_key(&c) != k){
+				printf("test5: backward scan failed at %ld\n", k);
+				return 1;
+			}
+		}
+		while(k >= 0 && ! in_tree[k])
+			k--;
+		if(k >= 0){
+			printf("test5: backward scan stopped early at %ld\n", k);
+			return 1;
+		}
+	}
+	bpt_destroy(&t);
+	for(i = 0; i < 1000; i++)
+		free(rec[i]);
+	printf("test5: cursor scans match the inserted keys\n");
+	return 0;
+}
+
+/* Check the leaves of a bulk loaded tree: each one has the records of the
+ * fill factor, but the last two which share the rest, and no non-root leaf
+ * has less than the min.
+ */
+static int
+test6_fill(bptree* t, double fill)
+{
+	long target = (long) (fill * BPT_MAX_LEAF_REC_NO + 0.5);
+	bpt_node* l;
+
+	if(target < BPT_MIN_LEAF_REC_NO)
+		target = BPT_MIN_LEAF_REC_NO;
+	if(target > BPT_MAX_LEAF_REC_NO)
+		target = BPT_MAX_LEAF_REC_NO;
+	TAILQ_FOREACH(l, &t->rec_list_head, recs.l_rec.n){
+		bpt_node* next = TAILQ_NEXT(l, recs.l_rec.n);
+		if(l->num_of_rec > BPT_MAX_LEAF_REC_NO || (l != t->root
+				&& l->num_of_rec < BPT_MIN_LEAF_REC_NO)
+				|| (next && TAILQ_NEXT(next, recs.l_rec.n)
+				&& l->num_of_rec != target))
+			return 1;
+	}
+	return 0;
+}
+
+/* Bulk load sorted keys with different fill factors, then check that all 
+ * records can be found and scanned in order, also after more inserts.
+ */
+int
+test6()
+{
+	double fill[] = {0.5, 0.75, 1.0};
+	bpt_key_t keys[1000];
+	bpt_record_t* rec[1000];
+	bpt_record_t* more[1000];
+	long i, n, k;
+	int f;
+	bpt_cursor c;
+
+	for(i = 0; i < 1000; i++){
+		keys[i] = i * 2;
+		rec[i] = new_record(i * 2);
+		more[i] = new_record(i * 2 + 1);
+	}
+	for(f = 0; f < 3; f++){
+		for(n = 0; n <= 1000; n += 111){
+			bptree t;
+			bpt_init(&t);
+			bpt_bulk_load(&t, keys, rec, n, fill[f]);
+			if(test6_fill(&t, fill[f])){
+				printf("test6: leaves are not filled, n %ld\n",
+					n);
+				return 1;
+			}
+
+			/* Insert the odd keys between the loaded ones */
+			for(i = 0; i < n; i += 3)
+				bpt_insert(&t, i * 2 + 1, more[i]);
+
+			k = 0;
+			bpt_cursor_seek(&t, &c, 0);
+			for(; bpt_cursor_valid(&c); bpt_cursor_next(&c)){
+				if(bpt_cursor_record(&c)->v != bpt_cursor_key(&c)
+					|| bpt_cursor_key(&c) < k){
+					printf("test6: scan failed, n %ld\n", n);
+					return 1;
+				}
+				k = bpt_cursor_key(&c) + 1;
+				bpt_node* l = bpt_query(&t, bpt_cursor_key(&c));
+				if(l != c.leaf){
+					printf("test6: query failed, n %ld\n", n);
+					return 1;
+				}
+			}
+			bpt_destroy(&t);
+		}
+	}
+	for(i = 0; i < 1000; i++){
+		free(rec[i]);
+		free(more[i]);
+	}
+	printf("test6: bulk loaded trees are searchable and scannable\n");
+	return 0;
+}
+
+/* Insert and delete random keys in trees whose nodes come from slab 
+ * allocators, then check the records by a scan. Destroy the trees at once.
+ */
+int
+test7()
+{
+	int flags[] = {0, BPT_SLAB_HUGEPAGE};
+	bpt_record_t* rec[2000];
+	char in_tree[2000];
+	long i, k;
+	int f;
+	bptree t;
+	bpt_cursor c;
+
+	for(i = 0; i < 2000; i++)
+		rec[i] = new_record(i);
+	srand(7);
+	for(f = 0; f < 2; f++){
+		bpt_init_alloc(&t, bpt_slab_allocator_create(flags[f]));
+		memset(in_tree, 0, sizeof(in_tree));
+		for(i = 0; i < 20000; i++){
+			k = rand() % 2000;
+			if(in_tree[k])
+				bpt_delete(&t, k, rec[k]);
+			else bpt_insert(&t, k, rec[k]);
+			in_tree[k] = ! in_tree[k];
+		}
+
+		k = 0;
+		bpt_cursor_seek(&t, &c, 0);
+		for(; bpt_cursor_valid(&c); bpt_cursor_next(&c), k++){
+			while(! in_tree[k])
+				k++;
+			if(! rec_is(bpt_cursor_record(&c), rec[k])){
+				printf("test7: scan failed at %ld\n", k);
+				return 1;
+			}
+		}
+		bpt_destroy(&t);
+		if(! bpt_empty(&t)){
+			printf("test7: tree is not empty after destroy\n");
+			return 1;
+		}
+	}
+	for(i = 0; i < 2000; i++)
+		free(rec[i]);
+	printf("test7: trees on slab allocators are correct\n");
+	return 0;
+}
+
+/* Shared state of test8 threads. Key k is changed by writer k % 4 if it is
+ * less than 3, keys k % 4 == 3 stay in the tree.
+ */
+#define TEST8_KEYS 40000
+struct test8_arg
+{
+	bptree* t;
+	bpt_record_t** rec;
+	char* in_tree;
+	int id;
+	int* done;
+	int failed;
+};
+
+static void*
+test8_writer(void* p)
+{
+	struct test8_arg* a = p;
+	unsigned int seed = a->id;
+	long i, k;
+
+	for(i = 0; i < 200000; i++){
+		k = (rand_r(&seed) % (TEST8_KEYS / 4)) * 4 + a->id;
+		if(a->in_tree[k])
+			bpt_delete(a->t, k, a->rec[k]);
+		else bpt_insert(a->t, k, a->rec[k]);
+		a->in_tree[k] = ! a->in_tree[k];
+	}
+	return NULL;
+}
+
+static void*
+test8_reader(void* p)
+{
+	struct test8_arg* a = p;
+	unsigned int seed = a->id;
+	long k;
+
+	while(! __atomic_load_n(a->done, __ATOMIC_ACQUIRE)){
+		k = rand_r(&seed) % TEST8_KEYS;
+#ifdef BPT_VALUE_BYTES
+		/* A writer may move the value in the leaf, copy it */
+		bpt_record_t v;
+		bpt_record_t* r = bpt_get_value(a->t, k, &v) ? &v : NULL;
+#else
+		bpt_record_t* r = bpt_get(a->t, k);
+#endif
+		if(k % 4 == 3 ? ! rec_is(r, a->rec[k])
+				: r && ! rec_is(r, a->rec[k]))
+			a->failed = 1;
+	}
+	return NULL;
+}
+
+/* Thread-safe mode: 3 writers and 2 readers at the same time */
+int
+test8()
+{
+	bpt_record_t* rec[TEST8_KEYS];
+	char in_tree[TEST8_KEYS];
+	struct test8_arg args[5];
+	pthread_t th[5];
+	int done = 0;
+	long i, k;
+	bptree t;
+	bpt_cursor c;
+
+	bpt_init_alloc(&t, bpt_slab_allocator_create(0));
+	memset(in_tree, 0, sizeof(in_tree));
+	for(i = 0; i < TEST8_KEYS; i++){
+		rec[i] = new_record(i);
+		if(i % 4 == 3){
+			bpt_insert(&t, i, rec[i]);
+			in_tree[i] = 1;
+		}
+	}
+
+	bpt_olc_enable(&t);
+	for(i = 0; i < 5; i++){
+		args[i].t = &t;
+		args[i].rec = rec;
+		args[i].in_tree = in_tree;
+		args[i].id = i;
+		args[i].done = &done;
+		args[i].failed = 0;
+		pthread_create(&th[i], NULL, i < 3 ? test8_writer 
+			: test8_reader, &args[i]);
+	}
+	for(i = 0; i < 3; i++)
+		pthread_join(th[i], NULL);
+	__atomic_store_n(&done, 1, __ATOMIC_RELEASE);
+	for(i = 3; i < 5; i++){
+		pthread_join(th[i], NULL);
+		if(args[i].failed){
+			printf("test8: reader %ld got a wrong record\n", i);
+			return 1;
+		}
+	}
+	bpt_olc_disable(&t);
+
+	k = 0;
+	bpt_cursor_seek(&t, &c, 0);
+	for(; bpt_cursor_valid(&c); bpt_cursor_next(&c), k++){
+		while(k < TEST8_KEYS && ! in_tree[k])
+			k++;
+		if(k == TEST8_KEYS || ! rec_is(bpt_cursor_record(&c), rec[k])){
+			printf("test8: scan failed at %ld\n", k);
+			return 1;
+		}
+	}
+	for(; k < TEST8_KEYS; k++)
+		if(in_tree[k]){
+			printf("test8: key %ld is lost\n", k);
+			return 1;
+		}
+	bpt_destroy(&t);
+	for(i = 0; i < TEST8_KEYS; i++)
+		free(rec[i]);
+	printf("test8: concurrent inserts, deletes and gets are correct\n");
+	return 0;
+}
+
+/* Number of leaf nodes of the tree */
+static long
+count_leaves(bptree* t)
+{
+	long n = 0;
+	bpt_node* l;
+	TAILQ_FOREACH(l, &t->rec_list_head, recs.l_rec.n)
+		n++;
+	return n;
+}
+
+/* Append mode: increasing keys fill the leaves, then random deletes and out
+ * of order inserts still keep the tree correct.
+ */
+int
+test9()
+{
+	bpt_record_t* rec[10000];
+	char in_tree[10000];
+	long i, k;
+	bptree t;
+	bpt_cursor c;
+
+	bpt_init(&t);
+	bpt_set_append(&t, 1);
+	for(i = 0; i < 10000; i++){
+		rec[i] = new_record(i);
+		/* Leave the odd keys for later */
+		if(i % 2 == 0)
+			bpt_insert(&t, i, rec[i]);
+		in_tree[i] = i % 2 == 0;
+	}
+	if(count_leaves(&t) != (5000 + BPT_MAX_LEAF_REC_NO - 1) 
+			/ BPT_MAX_LEAF_REC_NO){
+		printf("test9: leaves are not full, %ld leaves\n", 
+				count_leaves(&t));
+		return 1;
+	}
+
+	srand(9);
+	for(i = 0; i < 20000; i++){
+		k = rand() % 10000;
+		if(in_tree[k])
+			bpt_delete(&t, k, rec[k]);
+		else bpt_insert(&t, k, rec[k]);
+		in_tree[k] = ! in_tree[k];
+	}
+	for(i = 0; i < 10000; i++)
+		if(! rec_is(bpt_get(&t, i), in_tree[i] ? rec[i] : NULL)){
+			printf("test9: get failed at %ld\n", i);
+			return 1;
+		}
+
+	k = 0;
+	bpt_cursor_seek(&t, &c, 0);
+	for(; bpt_cursor_valid(&c); bpt_cursor_next(&c), k++){
+		while(! in_tree[k])
+			k++;
+		if(! rec_is(bpt_cursor_record(&c), rec[k])){
+			printf("test9: scan failed at %ld\n", k);
+			return 1;
+		}
+	}
+	bpt_destroy(&t);
+	for(i = 0; i < 10000; i++)
+		free(rec[i]);
+	printf("test9: append mode fills the leaves and stays correct\n");
+	return 0;
+}
+
+/* Batch inserts, deletes and gets, sorted and unsorted, compared with the 
+ * keys in the tree.
+ */
+int
+test10()
+{
+	bpt_record_t* rec[5000];
+	char in_tree[5000];
+	int batch_of[5000];
+	bpt_key_t keys[500];
+	bpt_record_t* recs[500];
+	bpt_record_t* out[500];
+	long i, j, k, m, len;
+	int op, sorted;
+	bptree t;
+
+	bpt_init(&t);
+	memset(in_tree, 0, sizeof(in_tree));
+	for(i = 0; i < 5000; i++){
+		rec[i] = new_record(i);
+		batch_of[i] = -1;
+	}
+
+	srand(10);
+	for(i = 0; i < 2000; i++){
+		op = rand() % 3;
+		sorted = i % 2;
+		len = rand() % 500;
+		/* Sorted batches take a run of keys, unsorted ones take random
+		 * keys. A key is taken once by a batch.
+		 */
+		k = rand() % (5000 - len);
+		for(j = m = 0; j < len; j++){
+			long x = sorted ? k + j : rand() % 5000;
+			if(batch_of[x] == i || (op == 0 && in_tree[x]) 
+					|| (op == 1 && ! in_tree[x]))
+				continue;
+			batch_of[x] = i;
+			keys[m] = x;
+			recs[m++] = rec[x];
+		}
+		if(op == 0)
+			bpt_insert_batch(&t, keys, recs, m, sorted);
+		else if(op == 1)
+			bpt_delete_batch(&t, keys, recs, m, sorted);
+		else bpt_get_batch(&t, keys, out, m, sorted);
+
+		for(j = 0; j < m; j++){
+			if(op == 2 && ! rec_is(out[j], in_tree[keys[j]]
+					? rec[keys[j]] : NULL)){
+				printf("test10: get failed at %ld\n",
+					(long) keys[j]);
+				return 1;
+			}
+			if(op != 2)
+				in_tree[keys[j]] = op == 0;
+		}
+	}
+	for(i = 0; i < 5000; i++)
+		if(! rec_is(bpt_get(&t, i), in_tree[i] ? rec[i] : NULL)){
+			printf("test10: key %ld is wrong\n", i);
+			return 1;
+		}
+	bpt_destroy(&t);
+	for(i = 0; i < 5000; i++)
+		free(rec[i]);
+	printf("test10: batch inserts, deletes and gets are correct\n");
+	return 0;
+}
+
+/* Multi gets of random keys, present or not, with all group sizes agree with
+ * bpt_get, on a tree with random inserts and deletes and on an empty tree.
+ */
+int
+test11()
+{
+	bpt_record_t* rec[5000];
+	bpt_key_t keys[300];
+	bpt_record_t* out[300];
+	long i, j;
+	int g;
+	bptree t;
+
+	bpt_init(&t);
+	for(j = 0; j < 300; j++)
+		keys[j] = rand() % 6000 - 500;
+	bpt_multi_get(&t, keys, out, 300);
+	for(j = 0; j < 300; j++)
+		if(out[j] != NULL){
+			printf("test11: get on empty tree failed\n");
+			return 1;
+		}
+
+	for(i = 0; i < 5000; i++)
+		rec[i] = new_record(i);
+	for(i = 0; i < 20000; i++){
+		long k = rand() % 5000;
+		if(bpt_get(&t, k) == NULL)
+			bpt_insert(&t, k, rec[k]);
+		else bpt_delete(&t, k, rec[k]);
+	}
+	for(g = 1; g <= BPT_MULTIGET_MAX_GROUP; g++){
+		long n = rand() % 300;
+		for(j = 0; j < n; j++)
+			keys[j] = rand() % 6000 - 500;
+		bpt_multi_get_group(&t, keys, out, n, g);
+		for(j = 0; j < n; j++)
+			if(out[j] != bpt_get(&t, keys[j])){
+				printf("test11: group %d get failed at %ld\n",
+					g, (long) keys[j]);
+				return 1;
+			}
+	}
+	bpt_destroy(&t);
+	for(i = 0; i < 5000; i++)
+		free(rec[i]);
+	printf("test11: multi gets are correct\n");
+	return 0;
+}
+
+/* Random inserts and deletes on a persistent tree with a small buffer pool,
+ * then open the file again and check the keys by get and by a scan.
+ */
+int
+test12()
+{
+	const char* path = "bpt_test12.db";
+	bpt_record_t* rec[3000];
+	char in_tree[3000];
+	struct bpt_pool_stats st;
+	bpt_cursor c;
+	long i, k, n = 0;
+	bptree t;
+
+	unlink(path);
+	if(bpt_open(&t, path, BPT_POOL_MIN_PAGES) != 0){
+		printf("test12: can not open %s\n", path);
+		return 1;
+	}
+	memset(in_tree, 0, sizeof(in_tree));
+	for(i = 0; i < 3000; i++)
+		rec[i] = new_record(i);
+	for(i = 0; i < 10000; i++){
+		k = rand() % 3000;
+		if(in_tree[k])
+			bpt_delete(&t, k, rec[k]);
+		else bpt_insert(&t, k, rec[k]);
+		in_tree[k] = ! in_tree[k];
+	}
+	/* A pinned page stays in the pool while the others are evicted */
+	bpt_pool_pin(&t, t.root);
+	for(i = 0; i < 3000; i++)
+		if(! rec_is(bpt_get(&t, i), in_tree[i] ? rec[i] : NULL)){
+			printf("test12: key %ld is wrong\n", i);
+			return 1;
+		}
+	bpt_pool_unpin(&t, t.root);
+	bpt_pool_get_stats(&t, &st);
+	bpt_close(&t);
+	if(st.evictions == 0 || st.reads == 0){
+		printf("test12: the pool did not evict pages\n");
+		return 1;
+	}
+
+	/* The record pointers are still valid in this process */
+	if(bpt_open(&t, path, BPT_POOL_MIN_PAGES) != 0){
+		printf("test12: can not open %s again\n", path);
+		return 1;
+	}
+	for(i = 0; i < 3000; i++)
+		if(! rec_is(bpt_get(&t, i), in_tree[i] ? rec[i] : NULL)){
+			printf("test12: key %ld is wrong after open\n", i);
+			return 1;
+		}
+	k = -1;
+	for(bpt_cursor_seek(&t, &c, 0); bpt_cursor_valid(&c); 
+			bpt_cursor_next(&c)){
+		if(bpt_cursor_key(&c) <= k 
+				|| ! in_tree[bpt_cursor_key(&c)]){
+			printf("test12: scan failed at %ld\n", 
+				(long) bpt_cursor_key(&c));
+			return 1;
+		}
+		k = bpt_cursor_key(&c);
+		n++;
+	}
+	for(i = 0; i < 3000; i++)
+		n -= in_tree[i];
+	if(n != 0){
+		printf("test12: scan missed keys\n");
+		return 1;
+	}
+	bpt_close(&t);
+	unlink(path);
+	for(i = 0; i < 3000; i++)
+		free(rec[i]);
+	printf("test12: persistent tree with a buffer pool is correct\n");
+	return 0;
+}
+
+/* Write v at offset off of the image at path, or truncate it to v bytes if
+ * off < 0. Return the value it replaced.
+ */
+static long
+test13_change(const char* path, long off, long v)
+{
+	int fd = open(path, O_RDWR);
+	long old = 0;
+
+	if(fd < 0 || (off >= 0 ? pread(fd, &old, sizeof(old), off) 
+				!= sizeof(old) 
+			|| pwrite(fd, &v, sizeof(v), off) != sizeof(v)
+			: ftruncate(fd, v) != 0)){
+		printf("test13: can not change the image\n");
+		exit(1);
+	}
+	close(fd);
+	return old;
+}
+
+/* Whether the image at path is opened, or refused as not valid */
+static int
+test13_opens(const char* path)
+{
+	bpt_image im;
+
+	if(bpt_image_open(&im, path) != 0){
+		if(errno != EINVAL){
+			printf("test13: can not open the image\n");
+			exit(1);
+		}
+		return 0;
+	}
+	bpt_image_close(&im);
+	return 1;
+}
+
+/* Save a tree of three levels of image blocks, and check gets and scans of
+ * the mapped image. Keys are even numbers, the records are values. A corrupt
+ * child offset or a truncated image are not opened.
+ */
+int
+test13()
+{
+	const char* path = "bpt_test13.db";
+	/* Two thirds of the keys fill more leaves than an index block holds */
+	long n = 2L * BPT_IMAGE_LEAF_NO * BPT_IMAGE_INDEX_NO;
+	bpt_key_t* keys = my_calloc(n * sizeof(bpt_key_t));
+	bpt_record_t** recs = my_calloc(n * sizeof(void*));
+	bpt_record_t* vals = my_calloc(n * sizeof(bpt_record_t));
+	bpt_image_cursor c;
+	bpt_image im;
+	long i, k, child, old;
+	bptree t;
+
+	/* An empty tree */
+	bpt_init(&t);
+	if(bpt_image_save(&t, path) != 0 || bpt_image_open(&im, path) != 0){
+		printf("test13: can not save an empty tree\n");
+		return 1;
+	}
+	bpt_image_cursor_seek(&im, &c, 0);
+	if(bpt_image_get(&im, 0) != NULL || bpt_image_cursor_valid(&c)){
+		printf("test13: empty image is not empty\n");
+		return 1;
+	}
+	bpt_image_close(&im);
+
+	for(i = 0; i < n; i++){
+		keys[i] = 2 * i;
+		vals[i].v = i;
+		recs[i] = &vals[i];
+	}
+	bpt_bulk_load(&t, keys, recs, n, 0.7);
+	/* Leave leaves of different sizes */
+	for(i = 0; i < n; i += 3)
+		bpt_delete(&t, keys[i], recs[i]);
+	if(bpt_image_save(&t, path) != 0 || bpt_image_open(&im, path) != 0){
+		printf("test13: can not save the tree\n");
+		return 1;
+	}
+	bpt_destroy(&t);
+	if(im.hdr->height != 3){
+		printf("test13: image height is %ld\n", im.hdr->height);
+		return 1;
+	}
+
+	for(k = -3; k < 2 * n + 3; k++){
+		i = k / 2;
+		if(! rec_is(bpt_image_get(&im, k), k >= 0 && k % 2 == 0
+				&& i < n && i % 3 ? recs[i] : NULL)){
+			printf("test13: get of %ld failed\n", k);
+			return 1;
+		}
+	}
+
+	/* Scan [k, k + 1000) forward, then back from its last key */
+	for(i = 0; i < 100; i++){
+		long lo = rand() % (2 * n + 100) - 50, last = -1, m = 0;
+		bpt_image_cursor_seek(&im, &c, lo);
+		bpt_image_cursor_set_end(&c, lo + 1000);
+		for(k = lo < 0 ? 0 : lo; k < lo + 1000 && k < 2 * n; k++){
+			if(k % 2 || (k / 2) % 3 == 0)
+				continue;
+			if(! bpt_image_cursor_valid(&c) 
+					|| bpt_image_cursor_key(&c) != k
+					|| ! rec_is(bpt_image_cursor_record(&c),
+						recs[k / 2])){
+				printf("test13: scan from %ld failed at %ld\n",
+					lo, k);
+				return 1;
+			}
+			last = k;
+			m++;
+			bpt_image_cursor_next(&c);
+		}
+		if(bpt_image_cursor_valid(&c)){
+			printf("test13: scan from %ld does not end\n", lo);
+			return 1;
+		}
+		if(last < 0)
+			continue;
+		bpt_image_cursor_seek(&im, &c, last);
+		for(; c.leaf && m > 0; m--, bpt_image_cursor_prev(&c))
+			if(bpt_image_cursor_key(&c) != last){
+				printf("test13: backward scan failed at %ld\n",
+					last);
+				return 1;
+			}else do last -= 2; while(last >= 0 
+					&& (last / 2) % 3 == 0);
+		if(m != 0){
+			printf("test13: backward scan stops early\n");
+			return 1;
+		}
+	}
+
+	/* Child 0 of the root out of the file, then at a leaf */
+	child = im.hdr->root + offsetof(struct bpt_image_index, child);
+	k = im.size;
+	bpt_image_close(&im);
+	old = test13_change(path, child, 1L << 40);
+	if(test13_opens(path)){
+		printf("test13: child out of the image is opened\n");
+		return 1;
+	}
+	test13_change(path, child, BPT_IMAGE_BLOCK_BYTES);
+	if(test13_opens(path)){
+		printf("test13: index child at a leaf is opened\n");
+		return 1;
+	}
+	test13_change(path, child, old);
+	if(! test13_opens(path)){
+		printf("test13: restored image is not opened\n");
+		return 1;
+	}
+	/* Without the root, then without the last leaves */
+	test13_change(path, -1, k - BPT_IMAGE_BLOCK_BYTES);
+	if(test13_opens(path)){
+		printf("test13: image without the root is opened\n");
+		return 1;
+	}
+	test13_change(path, -1, k / 2);
+	if(test13_opens(path)){
+		printf("test13: truncated image is opened\n");
+		return 1;
+	}
+	unlink(path);
+	free(keys);
+	free(recs);
+	free(vals);
+	printf("test13: mapped image is correct\n");
+	return 0;
+}
+
+/* The record v of test14, not dereferenced as a pointer. Inline values are
+ * copied from the record, so it is put in buf.
+ */
+static bpt_record_t*
+test14_rec(bpt_record_t* buf, long v)
+{
+#ifdef BPT_VALUE_BYTES
+	memset(buf, 0, sizeof(*buf));
+	buf->v = v;
+	return buf;
+#else
+	(void) buf;
+	return (bpt_record_t*) v;
+#endif
+}
+
+/* Pages of the pool of test14. With big nodes the keys fill few pages, the
+ * pool is smaller to take checkpoints.
+ */
+#define TEST14_POOL (BPT_MAX_LEAF_REC_NO < 64 ? 64 : 16)
+
+struct test14_arg
+{
+	bpt_wal* w;
+	long id;
+};
+
+/* Writer thread of test14: insert the keys 4 * i + id, and commit each */
+static void*
+test14_writer(void* arg)
+{
+	struct test14_arg* a = (struct test14_arg*) arg;
+	bpt_record_t buf;
+	long i, k;
+
+	for(i = 0; i < 1000; i++){
+		k = 4 * i + a->id;
+		bpt_wal_commit(a->w, bpt_wal_insert(a->w, k,
+			test14_rec(&buf, k + 1)));
+	}
+	return NULL;
+}
+
+/* Check the keys of test14 after recovery */
+static int
+test14_check(bpt_wal* w, const char* when)
+{
+	bpt_record_t buf;
+	long k;
+
+	for(k = 0; k < 4000; k++)
+		if(! rec_is(bpt_wal_get(w, k), k % 3 ? test14_rec(&buf, k + 1)
+				: NULL)){
+			printf("test14: key %ld is wrong %s\n", k, when);
+			return 1;
+		}
+	for(k = 100000; k < 100100; k++)
+		if(bpt_wal_get(w, k) != NULL
+				&& ! rec_is(bpt_wal_get(w, k),
+					test14_rec(&buf, k))){
+			printf("test14: uncommitted key %ld is wrong\n", k);
+			return 1;
+		}
+	return 0;
+}
+
+/* A child process inserts by 4 threads which commit each insert, deletes 
+ * with one commit, then exits without closing the log, as if it crashed. The
+ * tree is recovered from the log, then again after a torn write at the end 
+ * of the log.
+ */
+int
+test14()
+{
+	const char* path = "bpt_test14.db";
+	const char* wal_path = "bpt_test14.db.wal";
+	int status, fd;
+	pid_t pid;
+	bpt_wal w;
+	long k, lsn = 0;
+
+	unlink(path);
+	unlink(wal_path);
+	pid = fork();
+	if(pid == 0){
+		struct test14_arg arg[4];
+		bpt_record_t buf;
+		pthread_t th[4];
+		int i;
+
+		/* A small pool, so checkpoints are taken on the way */
+		if(bpt_wal_open(&w, path, TEST14_POOL) != 0)
+			_exit(1);
+		for(i = 0; i < 4; i++){
+			arg[i].w = &w;
+			arg[i].id = i;
+			pthread_create(&th[i], NULL, test14_writer, &arg[i]);
+		}
+		for(i = 0; i < 4; i++)
+			pthread_join(th[i], NULL);
+		for(k = 0; k < 4000; k += 3)
+			lsn = bpt_wal_delete(&w, k, test14_rec(&buf, k + 1));
+		bpt_wal_commit(&w, lsn);
+		for(k = 100000; k < 100100; k++)
+			bpt_wal_insert(&w, k, test14_rec(&buf, k));
+		_exit(w.checkpoints > 1 ? 0 : 2);
+	}
+	if(waitpid(pid, &status, 0) != pid || ! WIFEXITED(status)
+			|| WEXITSTATUS(status) != 0){
+		printf("test14: writer process failed\n");
+		return 1;
+	}
+
+	if(bpt_wal_open(&w, path, TEST14_POOL) != 0){
+		printf("test14: can not recover %s\n", path);
+		return 1;
+	}
+	if(test14_check(&w, "after recovery"))
+		return 1;
+	bpt_wal_close(&w);
+
+	/* Half a record at the end of the log */
+	fd = open(wal_path, O_WRONLY | O_APPEND);
+	if(fd < 0 || write(fd, "torn record", 11) != 11){
+		printf("test14: can not write %s\n", wal_path);
+		return 1;
+	}
+	close(fd);
+	if(bpt_wal_open(&w, path, TEST14_POOL) != 0 
+			|| test14_check(&w, "after a torn write"))
+		return 1;
+	bpt_wal_close(&w);
+	unlink(path);
+	unlink(wal_path);
+	printf("test14: write-ahead log recovers committed changes\n");
+	return 0;
+}
+
+/* Check the keys of the tree against in_tree, key k has record value k % 16 */
+static int
+test15_check(bptree* t, char* in_tree, int n)
+{
+	bpt_cursor c;
+	long i, k = 0;
+
+	for(i = 0; i < n; i++){
+		bpt_record_t* r = bpt_get(t, i);
+		if(in_tree[i] ? r == NULL || r->v != i % 16 : r != NULL){
+			printf("test15: key %ld is wrong\n", i);
+			return 1;
+		}
+	}
+	for(bpt_cursor_seek(t, &c, 0); bpt_cursor_valid(&c); 
+			bpt_cursor_next(&c), k++){
+		while(k < n && ! in_tree[k])
+			k++;
+		if(bpt_cursor_key(&c) != k 
+				|| bpt_cursor_record(&c)->v != k % 16){
+			printf("test15: scan is wrong at %ld\n", k);
+			return 1;
+		}
+	}
+	while(k < n && ! in_tree[k])
+		k++;
+	if(k != n){
+		printf("test15: scan stops before %ld\n", k);
+		return 1;
+	}
+	return 0;
+}
+
+/* Many keys share a record: deletes should remove the given key only. With 
+ * -DBPT_VALUE_BYTES the records are inline values, which are copied into the
+ * leaves and compared by bytes.
+ */
+int
+test15()
+{
+	bpt_record_t* rec[16];
+	char in_tree[3000];
+	bpt_key_t keys[100];
+	bpt_record_t* recs[100];
+	long i, j, k, m;
+	bptree t;
+
+	bpt_init(&t);
+	memset(in_tree, 0, sizeof(in_tree));
+	for(i = 0; i < 16; i++)
+		rec[i] = new_record(i);
+
+	/* Gets of a batch on the empty tree */
+	for(i = 0; i < 100; i++){
+		keys[i] = 99 - i;
+		recs[i] = rec[0];
+	}
+	bpt_get_batch(&t, keys, recs, 100, 0);
+	for(i = 0; i < 100; i++)
+		if(recs[i] != NULL){
+			printf("test15: get of an empty tree failed\n");
+			return 1;
+		}
+
+	srand(15);
+	for(i = 0; i < 20000; i++){
+		k = rand() % 3000;
+		if(in_tree[k])
+			bpt_delete(&t, k, rec[k % 16]);
+		else bpt_insert(&t, k, rec[k % 16]);
+		in_tree[k] = ! in_tree[k];
+	}
+	if(test15_check(&t, in_tree, 3000))
+		return 1;
+
+	/* Batches of keys with the same record */
+	for(i = 0; i < 100; i++){
+		for(j = m = 0; j < 100; j++){
+			k = (i * 16 + j * 37) % 3000;
+			if(in_tree[k] == i % 2)
+				continue;
+			keys[m] = k;
+			recs[m++] = rec[k % 16];
+			in_tree[k] = i % 2;
+		}
+		if(i % 2)
+			bpt_insert_batch(&t, keys, recs, m, 0);
+		else bpt_delete_batch(&t, keys, recs, m, 0);
+	}
+	if(test15_check(&t, in_tree, 3000))
+		return 1;
+
+#ifdef BPT_VALUE_BYTES
+	/* Records are in the leaves, not the ones inserted */
+	bpt_record_t v;
+	for(i = 0; i < 3000; i++){
+		if(in_tree[i] && bpt_get(&t, i) == rec[i % 16]){
+			printf("test15: record of %ld is not inline\n", i);
+			return 1;
+		}
+		if(bpt_get_value(&t, i, &v) != in_tree[i]
+				|| (in_tree[i] && v.v != i % 16)){
+			printf("test15: value of %ld is wrong\n", i);
+			return 1;
+		}
+	}
+#endif
+	bpt_destroy(&t);
+	for(i = 0; i < 16; i++)
+		free(rec[i]);
+	printf("test15: deletes of keys sharing records are correct\n");
+	return 0;
+}
+
+static int
+test16_cmp(const void* a, const void* b)
+{
+	return strcmp(*(char* const*) a, *(char* const*) b);
+}
+
+/* String keys of up to sizeof(bpt_key_t) bytes: a scan returns the strings 
+ * in strcmp order.
+ */
+int
+test16()
+{
+	char* words[] = {"pear", "ape", "b", "", "fig", "bat", "apes", "app",
+		"zoo", "a", "pea", "ab", "kiwi", "aa", "z~", "A"};
+	int i, n = sizeof(words) / sizeof(words[0]);
+	char buf[sizeof(bpt_key_t) + 1];
+	bpt_record_t* rec = new_record(0);
+	bpt_cursor c;
+	bptree t;
+
+	bpt_init(&t);
+	for(i = 0; i < n; i++)
+		bpt_insert(&t, bpt_key_from_str(words[i]), rec);
+	qsort(words, n, sizeof(char*), test16_cmp);
+	bpt_cursor_seek(&t, &c, bpt_key_from_str(""));
+	for(i = 0; i < n; i++, bpt_cursor_next(&c)){
+		if(! bpt_cursor_valid(&c) || strcmp(words[i], 
+				bpt_key_to_str(bpt_cursor_key(&c), buf)) != 0){
+			printf("test16: scan failed at %s\n", words[i]);
+			return 1;
+		}
+	}
+	if(bpt_cursor_valid(&c)){
+		printf("test16: scan does not stop\n");
+		return 1;
+	}
+	bpt_destroy(&t);
+	free(rec);
+	printf("test16: string keys are in order\n");
 	return 0;
 }
+
+/* Key i of test17: one of the prefixes, i in hex, and random bytes(zeros 
+ * too). The prefixes start with no hex digit, so the keys are different.
+ */
+static int
+test17_key(unsigned char* buf, int i)
+{
+	static char lng[BPT_STR_MAX_KEY];
+	const char* pre[] = {"", "http://example.com/", "http://example.com/x/",
+		"zz/", lng};
+	int len, n;
+
+	/* Long keys, up to the max length */
+	if(lng[0] == 0){
+		memset(lng, 'q', BPT_STR_MAX_KEY - 42);
+		lng[BPT_STR_MAX_KEY - 42] = '/';
+	}
+	len = sprintf((char*) buf, "%s%x/", pre[i % 5], i);
+	for(n = rand() % 32; n > 0 && len < BPT_STR_MAX_KEY; n--)
+		buf[len++] = rand() % 4 == 0 ? 0 : rand();
+	return len;
+}
+
+/* Key i of group g of test17: a long run of one letter for the group and i */
+static int
+test17_group_key(unsigned char* buf, long g, long i)
+{
+	memset(buf, 'a' + g, BPT_STR_MAX_KEY - 8);
+	return BPT_STR_MAX_KEY - 8 + sprintf((char*) buf + BPT_STR_MAX_KEY - 8,
+		"%05ld", i);
+}
+
+/* Count of the empty leaves, but the root */
+static long
+test17_empty(bpt_str* t)
+{
+	bpt_str_node* l;
+	long c = 0;
+
+	for(l = t->first; l; l = l->next)
+		c += l->n == 0 && l != t->root;
+	return c;
+}
+
+struct test17_key
+{
+	unsigned char* k;
+	int len;
+	long i;
+};
+
+static int
+test17_cmp(const void* a, const void* b)
+{
+	const struct test17_key* x = a;
+	const struct test17_key* y = b;
+	int c = memcmp(x->k, y->k, x->len < y->len ? x->len : y->len);
+	return c ? c : x->len - y->len;
+}
+
+/* Random inserts and deletes of variable length keys, then check gets, and
+ * scans in both directions and with an end key.
+ */
+int
+test17()
+{
+	enum { N = 20000 };
+	struct test17_key keys[N];
+	bpt_record_t* rec = (bpt_record_t*) my_calloc(N * sizeof(*rec));
+	char in_tree[N];
+	unsigned char buf[BPT_STR_MAX_KEY + 1];
+	bpt_str_cursor c;
+	const unsigned char* k;
+	long i, j, m;
+	int len;
+	bpt_str t;
+
+	srand(17);
+	for(i = 0; i < N; i++){
+		keys[i].len = test17_key(buf, i);
+		keys[i].k = (unsigned char*) my_calloc(keys[i].len + 1);
+		memcpy(keys[i].k, buf, keys[i].len);
+		keys[i].i = i;
+	}
+	bpt_str_init(&t);
+	memset(in_tree, 0, sizeof(in_tree));
+	if(bpt_str_insert(&t, buf, BPT_STR_MAX_KEY + 1, rec) != -1){
+		printf("test17: a too long key is inserted\n");
+		return 1;
+	}
+	for(i = 0; i < 4 * N; i++){
+		j = rand() % N;
+		if(in_tree[j]){
+			if(bpt_str_delete(&t, keys[j].k, keys[j].len) != 1){
+				printf("test17: delete failed at %ld\n", j);
+				return 1;
+			}
+		}else
+			bpt_str_insert(&t, keys[j].k, keys[j].len, rec + j);
+		in_tree[j] = ! in_tree[j];
+	}
+
+	for(i = m = 0; i < N; i++){
+		if(bpt_str_get(&t, keys[i].k, keys[i].len) 
+				!= (in_tree[i] ? rec + i : NULL)){
+			printf("test17: get failed at %ld\n", i);
+			return 1;
+		}
+		if(in_tree[i])
+			keys[m++] = keys[i];
+		else
+			free(keys[i].k);
+	}
+	if(m != t.n){
+		printf("test17: %ld keys, should be %ld\n", t.n, m);
+		return 1;
+	}
+	qsort(keys, m, sizeof(keys[0]), test17_cmp);
+
+	/* Forward from the empty key, then backward from the end */
+	bpt_str_cursor_seek(&t, &c, "", 0);
+	for(i = 0; i <= m; i++, bpt_str_cursor_next(&c)){
+		if(i == m ? bpt_str_cursor_valid(&c) : ! bpt_str_cursor_valid(&c)
+				|| bpt_str_cursor_record(&c) != rec + keys[i].i
+				|| (k = bpt_str_cursor_key(&c, &len), 
+				len != keys[i].len 
+				|| memcmp(k, keys[i].k, len) != 0)){
+			printf("test17: forward scan failed at %ld\n", i);
+			return 1;
+		}
+		if(i == m)
+			break;
+	}
+	bpt_str_cursor_seek(&t, &c, keys[m - 1].k, keys[m - 1].len);
+	for(i = m - 1; i >= 0; i--, bpt_str_cursor_prev(&c)){
+		if(! bpt_str_cursor_valid(&c)
+				|| bpt_str_cursor_record(&c) != rec + keys[i].i){
+			printf("test17: backward scan failed at %ld\n", i);
+			return 1;
+		}
+	}
+	if(bpt_str_cursor_valid(&c)){
+		printf("test17: backward scan does not stop\n");
+		return 1;
+	}
+
+	/* Ranges between keys in the tree, and between the prefixes */
+	for(j = 0; j < 100; j++){
+		long lo = rand() % m, hi = lo + rand() % (m - lo);
+		bpt_str_cursor_seek(&t, &c, keys[lo].k, keys[lo].len);
+		bpt_str_cursor_set_end(&c, keys[hi].k, keys[hi].len);
+		for(i = lo; bpt_str_cursor_valid(&c); bpt_str_cursor_next(&c))
+			if(bpt_str_cursor_record(&c) != rec + keys[i++].i)
+				break;
+		if(i != hi){
+			printf("test17: range scan failed at %ld\n", lo);
+			return 1;
+		}
+	}
+	bpt_str_cursor_seek(&t, &c, "http://example.com/", 19);
+	bpt_str_cursor_set_end(&c, "http://example.com/x/", 21);
+	for(i = 0; bpt_str_cursor_valid(&c); bpt_str_cursor_next(&c))
+		i++;
+	for(j = 0; j < m; j++)
+		if(keys[j].i % 5 == 1)
+			i--;
+	if(i != 0){
+		printf("test17: prefix scan failed\n");
+		return 1;
+	}
+
+	/* Delete in random order, no leaf but the root is left empty */
+	for(i = m - 1; i > 0; i--){
+		struct test17_key x = keys[i];
+		j = rand() % (i + 1);
+		keys[i] = keys[j];
+		keys[j] = x;
+	}
+	for(i = 0; i < m; i++){
+		bpt_str_delete(&t, keys[i].k, keys[i].len);
+		free(keys[i].k);
+		if(i % 100 == 0 && test17_empty(&t) > 0){
+			printf("test17: empty leaves after deletes\n");
+			return 1;
+		}
+	}
+	if(t.root != NULL || t.nodes != 0){
+		printf("test17: nodes are left after deleting all keys\n");
+		return 1;
+	}
+
+	/* Keys of 3 groups, each with a long prefix of its own. A leaf of the
+	 * middle group emptied has long fences, and its neighbours do not fit
+	 * in one node with its fences.
+	 */
+	for(j = 0; j < 3; j++)
+		for(i = 0; i < (j == 1 ? 19 : 10); i++)
+			bpt_str_insert(&t, buf, test17_group_key(buf, j, i),
+				&rec[i]);
+	for(i = 0; i < 19; i++)
+		bpt_str_delete(&t, buf, test17_group_key(buf, 1, i));
+	if(test17_empty(&t) > 0){
+		printf("test17: empty leaves after deleting a group\n");
+		return 1;
+	}
+	for(j = 0; j < 3; j += 2)
+		for(i = 0; i < 10; i++)
+			bpt_str_delete(&t, buf, test17_group_key(buf, j, i));
+	if(t.root != NULL || t.nodes != 0){
+		printf("test17: nodes are left after deleting the groups\n");
+		return 1;
+	}
+	bpt_str_destroy(&t);
+	free(rec);
+	printf("test17: variable length keys are correct\n");
+	return 0;
+}
+
+#ifdef BPT_COUNTS
+/* Check the count of each child in the index nodes, return the count of n */
+static long
+test18_count(bpt_node* n)
+{
+	long c = 0, c1;
+	int i;
+
+	if(bpt_is_leaf(n))
+		return n->num_of_rec;
+	for(i = 0; i < n->num_of_rec; i++){
+		c1 = test18_count(n->recs.i_rec.c_arr[i]);
+		if(c1 < 0 || c1 != n->recs.i_rec.cnt[i])
+			return -1;
+		c += c1;
+	}
+	return c;
+}
+
+/* Compare rank, select and count_range with the keys in the tree */
+static int
+test18_check(bptree* t, char* in_tree, int n, const char* when)
+{
+	long total = 0, r;
+	bpt_key_t k;
+	int i, j;
+
+	if(! bpt_empty(t) && test18_count(t->root) < 0){
+		printf("test18: counts are wrong after %s\n", when);
+		return 1;
+	}
+	for(i = 0; i < n; i++){
+		if(bpt_rank(t, i) != total){
+			printf("test18: rank of %d is wrong after %s\n", i, 
+					when);
+			return 1;
+		}
+		if(in_tree[i] && (bpt_select(t, total++, &k) == NULL 
+					|| k != i)){
+			printf("test18: select of %d is wrong after %s\n", i, 
+					when);
+			return 1;
+		}
+	}
+	if(bpt_select(t, total, &k) != NULL || bpt_select(t, -1, &k) != NULL
+			|| bpt_rank(t, n) != total){
+		printf("test18: ranks out of the tree are wrong after %s\n", 
+				when);
+		return 1;
+	}
+	for(i = 0; i < 200; i++){
+		int lo = rand() % (n + 2) - 1, hi = rand() % (n + 2) - 1;
+		for(r = 0, j = lo < 0 ? 0 : lo; j < hi && j < n; j++)
+			r += in_tree[j];
+		if(bpt_count_range(t, lo, hi) != r){
+			printf("test18: count of [%d, %d) is wrong after %s\n",
+					lo, hi, when);
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/* Order statistics(-DBPT_COUNTS): the counts in the index nodes stay right
+ * through inserts and deletes, batches, append mode and bulk loading.
+ */
+int
+test18()
+{
+	bpt_record_t* rec[5000];
+	char in_tree[5000];
+	bpt_key_t keys[5000];
+	bpt_record_t* recs[5000];
+	long i, k, m;
+	bptree t;
+
+	for(i = 0; i < 5000; i++)
+		rec[i] = new_record(i);
+	memset(in_tree, 0, sizeof(in_tree));
+	bpt_init(&t);
+	if(test18_check(&t, in_tree, 5000, "init"))
+		return 1;
+
+	srand(18);
+	for(i = 0; i < 40000; i++){
+		k = rand() % 5000;
+		if(in_tree[k])
+			bpt_delete(&t, k, rec[k]);
+		else bpt_insert(&t, k, rec[k]);
+		in_tree[k] = ! in_tree[k];
+	}
+	if(test18_check(&t, in_tree, 5000, "inserts and deletes"))
+		return 1;
+
+	/* Batches */
+	for(i = 0; i < 40; i++){
+		for(k = m = 0; k < 5000; k++){
+			if(rand() % 4 || in_tree[k] == i % 2)
+				continue;
+			keys[m] = k;
+			recs[m++] = rec[k];
+			in_tree[k] = i % 2;
+		}
+		if(i % 2)
+			bpt_insert_batch(&t, keys, recs, m, 1);
+		else bpt_delete_batch(&t, keys, recs, m, 1);
+	}
+	if(test18_check(&t, in_tree, 5000, "batches"))
+		return 1;
+
+	/* Delete all the keys */
+	for(k = 0; k < 5000; k++)
+		if(in_tree[k]){
+			bpt_delete(&t, k, rec[k]);
+			in_tree[k] = 0;
+		}
+	if(test18_check(&t, in_tree, 5000, "deleting all"))
+		return 1;
+	bpt_destroy(&t);
+
+	/* Append mode, then deletes from the front */
+	bpt_init(&t);
+	bpt_set_append(&t, 1);
+	for(k = 0; k < 5000; k++){
+		bpt_insert(&t, k, rec[k]);
+		in_tree[k] = 1;
+	}
+	for(k = 0; k < 2000; k++){
+		bpt_delete(&t, k, rec[k]);
+		in_tree[k] = 0;
+	}
+	if(test18_check(&t, in_tree, 5000, "append mode"))
+		return 1;
+	bpt_destroy(&t);
+
+	/* Bulk load, then random changes */
+	for(k = 0; k < 5000; k++){
+		keys[k] = k;
+		recs[k] = rec[k];
+		in_tree[k] = 1;
+	}
+	bpt_init(&t);
+	bpt_bulk_load(&t, keys, recs, 5000, 0.7);
+	if(test18_check(&t, in_tree, 5000, "bulk load"))
+		return 1;
+	for(i = 0; i < 10000; i++){
+		k = rand() % 5000;
+		if(in_tree[k])
+			bpt_delete(&t, k, rec[k]);
+		else bpt_insert(&t, k, rec[k]);
+		in_tree[k] = ! in_tree[k];
+	}
+	if(test18_check(&t, in_tree, 5000, "bulk load and changes"))
+		return 1;
+	bpt_destroy(&t);
+
+	for(i = 0; i < 5000; i++)
+		free(rec[i]);
+	printf("test18: rank, select and range counts are correct\n");
+	return 0;
+}
+#endif
+
+/* Order of the values of a key in bpt_dup: by address of the records, or
+ * by bytes of inline values
+ */
+static int
+test19_cmp(bpt_value* a, bpt_value* b)
+{
+#ifdef BPT_VALUE_BYTES
+	return memcmp(a, b, sizeof(bpt_value));
+#else
+	return bpt_value_rec(a) < bpt_value_rec(b) ? -1
+		: bpt_value_rec(a) > bpt_value_rec(b);
+#endif
+}
+
+/* Check the values of each key in the multimap against in[key][value] */
+static int
+test19_check(bpt_dup* m, char (*in)[1000], bpt_record_t** rec)
+{
+	bpt_cursor c;
+	long i, j, n, cnt, keys = 0, values = 0;
+
+	for(i = 0; i < 100; i++){
+		bpt_value* v = bpt_dup_get(m, i, &n);
+		for(j = cnt = 0; j < 1000; j++)
+			cnt += in[i][j];
+		if(n != cnt || (n == 0) != (v == NULL)){
+			printf("test19: key %ld has %ld values, not %ld\n", i, 
+					n, cnt);
+			return 1;
+		}
+		for(j = 0; j < n; j++){
+			bpt_record_t* r = bpt_value_rec(&v[j]);
+			if(! in[i][r->v] || ! rec_is(r, rec[r->v]) || (j > 0
+					&& test19_cmp(&v[j - 1], &v[j]) >= 0)){
+				printf("test19: values of key %ld are wrong\n",
+						i);
+				return 1;
+			}
+		}
+		keys += n > 0;
+		values += n;
+	}
+	i = 0;
+	for(bpt_cursor_seek(&m->t, &c, 0); bpt_cursor_valid(&c); 
+			bpt_cursor_next(&c), i++){
+		bpt_dup_values(&c, &n);
+		values -= n;
+	}
+	if(i != keys || m->keys != keys || values != 0){
+		printf("test19: scan of the keys is wrong\n");
+		return 1;
+	}
+	return 0;
+}
+
+/* Check the gets of keys 0 to 10 of a tree of duplicated keys: a record of
+ * key k(v % 10 == k) is found iff cnt[k] > 0, by bpt_get, bpt_get_batch and 
+ * bpt_multi_get.
+ */
+static int
+test19_gets(bptree* t, long* cnt)
+{
+	bpt_key_t keys[11];
+	bpt_record_t* r1[11];
+	bpt_record_t* r2[11];
+	int k;
+
+	for(k = 0; k < 11; k++)
+		keys[k] = k;
+	bpt_get_batch(t, keys, r1, 11, 1);
+	bpt_multi_get(t, keys, r2, 11);
+	for(k = 0; k < 11; k++){
+		bpt_record_t* r = bpt_get(t, k);
+		if((r != NULL) != (cnt[k] > 0) || (r && r->v % 10 != k)
+				|| (r1[k] != NULL) != (cnt[k] > 0) 
+				|| (r2[k] != NULL) != (cnt[k] > 0)){
+			printf("test19: gets of key %d are wrong\n", k);
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/* Duplicated keys: in the tree, the records of a key span several leaves and
+ * gets and deletes find them, also after deletes leave the records of a key
+ * only before an equal split key. In a multimap, the values of a key are in a
+ * posting list.
+ */
+int
+test19()
+{
+	bpt_record_t* rec[1000];
+	bpt_key_t keys[1000];
+	bpt_record_t* recs[1000];
+	long perm[1000], cnt[11];
+	static char in[100][1000];
+	char in_tree[1000];
+	long i, j, k, n;
+	bptree t;
+	bpt_dup m;
+
+	for(i = 0; i < 1000; i++){
+		rec[i] = new_record(i);
+		perm[i] = i;
+	}
+
+	/* 10 keys of 100 records each, deleted in random order, one by one
+	 * and in a batch
+	 */
+	srand(19);
+	for(i = 999; i > 0; i--){
+		j = rand() % (i + 1);
+		k = perm[i];
+		perm[i] = perm[j];
+		perm[j] = k;
+	}
+	bpt_init(&t);
+	for(i = 0; i < 1000; i++){
+		bpt_insert(&t, i % 10, rec[i]);
+		in_tree[i] = 1;
+	}
+	for(k = 0; k < 11; k++)
+		cnt[k] = k < 10 ? 100 : 0;
+
+	/* A churn of inserts and deletes, the second half in thread-safe 
+	 * mode, then all the records are back
+	 */
+	for(i = 0; i < 40000; i++){
+#ifndef BPT_COUNTS
+		if(i == 20000)
+			bpt_olc_enable(&t);
+#endif
+		j = rand() % 1000;
+		if(in_tree[j])
+			bpt_delete(&t, j % 10, rec[j]);
+		else bpt_insert(&t, j % 10, rec[j]);
+		in_tree[j] = ! in_tree[j];
+		cnt[j % 10] += in_tree[j] ? 1 : -1;
+		if(i % 50 == 0 && test19_gets(&t, cnt))
+			return 1;
+	}
+#ifndef BPT_COUNTS
+	bpt_olc_disable(&t);
+#endif
+	for(j = 0; j < 1000; j++)
+		if(! in_tree[j]){
+			bpt_insert(&t, j % 10, rec[j]);
+			cnt[j % 10]++;
+		}
+
+	for(i = 0; i < 500; i++){
+		bpt_delete(&t, perm[i] % 10, rec[perm[i]]);
+		cnt[perm[i] % 10]--;
+		if(test19_gets(&t, cnt))
+			return 1;
+	}
+	for(i = 500, n = 0; i < 1000; i++){
+		keys[n] = perm[i] % 10;
+		recs[n++] = rec[perm[i]];
+	}
+	bpt_delete_batch(&t, keys, recs, n, 0);
+	if(t.root->num_of_rec != 0){
+		printf("test19: deletes of duplicated keys failed\n");
+		return 1;
+	}
+	bpt_destroy(&t);
+
+	/* Random pairs in a multimap, with up to 1000 values per key */
+	bpt_dup_init(&m);
+	memset(in, 0, sizeof(in));
+	for(i = 0; i < 200000; i++){
+		k = rand() % 100;
+		j = k < 10 ? rand() % 1000 : rand() % 20;
+		if(rand() % 3 == 0){
+			if(bpt_dup_delete(&m, k, rec[j]) != in[k][j]){
+				printf("test19: delete of (%ld, %ld) failed\n",
+						k, j);
+				return 1;
+			}
+			in[k][j] = 0;
+		}else{
+			if(bpt_dup_insert(&m, k, rec[j]) == in[k][j]){
+				printf("test19: insert of (%ld, %ld) failed\n",
+						k, j);
+				return 1;
+			}
+			in[k][j] = 1;
+		}
+	}
+	if(test19_check(&m, in, rec))
+		return 1;
+
+	/* Delete all but one value of each key, then all */
+	for(k = 0; k < 100; k++)
+		for(j = 1; j < 1000; j++)
+			if(in[k][j]){
+				bpt_dup_delete(&m, k, rec[j]);
+				in[k][j] = 0;
+			}
+	if(test19_check(&m, in, rec))
+		return 1;
+	for(k = 0; k < 100; k++)
+		if(in[k][0]){
+			bpt_dup_delete(&m, k, rec[0]);
+			in[k][0] = 0;
+		}
+	if(test19_check(&m, in, rec) || m.values != 0)
+		return 1;
+	bpt_dup_destroy(&m);
+
+	for(i = 0; i < 1000; i++)
+		free(rec[i]);
+	printf("test19: duplicated keys and multimaps are correct\n");
+	return 0;
+}
+
+/* Check the structure under node n: all the leaves at depth h, nodes other
+ * than the root at least half full, keys in order and in [lo, hi] of the
+ * split keys around n. *leaf is the next leaf of the leaf list.
+ */
+static int
+test20_node(bptree* t, bpt_node* n, int h, bpt_key_t lo, bpt_key_t hi,
+		bpt_node** leaf)
+{
+	int i, nk;
+
+	if(n != t->root && n->num_of_rec < (t->underfull
+			? bpt_underflow_min(t, n) : bpt_min_rec(n)))
+		return 1;
+	if(bpt_is_leaf(n)){
+		if(h != 0 || n != *leaf)
+			return 1;
+		*leaf = TAILQ_NEXT(n, recs.l_rec.n);
+		for(i = 0; i < n->num_of_rec; i++)
+			if(n->recs.l_rec.key[i] < lo
+					|| n->recs.l_rec.key[i] > hi
+					|| (i > 0 && n->recs.l_rec.key[i - 1]
+						> n->recs.l_rec.key[i]))
+				return 1;
+		return 0;
+	}
+	nk = bpt_num_of_key(n);
+	for(i = 0; i < n->num_of_rec; i++)
+		if(test20_node(t, n->recs.i_rec.c_arr[i], h - 1,
+				i > 0 ? n->recs.i_rec.key[i - 1] : lo,
+				i < nk ? n->recs.i_rec.key[i] : hi, leaf))
+			return 1;
+	return 0;
+}
+
+/* Check the tree after range deletes: its structure, and copies records of 
+ * each key k < n with in_tree[k] set, in the scan.
+ */
+static int
+test20_check(bptree* t, char* in_tree, int n, int copies, const char* when)
+{
+	bpt_node* leaf = TAILQ_FIRST(&t->rec_list_head);
+	bpt_cursor c;
+	long i = 0, k = -1;
+	int h = 0;
+	bpt_node* r;
+
+	for(r = t->root; ! bpt_is_leaf(r); h++)
+		r = r->recs.i_rec.c_arr[0];
+	if((! bpt_is_leaf(t->root) && t->root->num_of_rec < 2)
+			|| test20_node(t, t->root, h, -1, n, &leaf)
+			|| leaf != NULL){
+		printf("test20: tree is broken after %s\n", when);
+		return 1;
+	}
+	for(bpt_cursor_seek(t, &c, 0); bpt_cursor_valid(&c); 
+			bpt_cursor_next(&c), i++){
+		if(i % copies == 0)
+			for(k++; k < n && ! in_tree[k]; k++)
+				;
+		if(bpt_cursor_key(&c) != k){
+			printf("test20: scan is wrong at %ld after %s\n", k, 
+					when);
+			return 1;
+		}
+	}
+	for(k++; k < n && ! in_tree[k]; k++)
+		;
+	if(i % copies != 0 || k != n){
+		printf("test20: scan stops before %ld after %s\n", k, when);
+		return 1;
+	}
+#ifdef BPT_COUNTS
+	if(test18_count(t->root) < 0){
+		printf("test20: counts are wrong after %s\n", when);
+		return 1;
+	}
+#endif
+	return 0;
+}
+
+/* Range deletes of random ranges from random trees, from small ones inside a
+ * leaf to all of the tree, check the structure and the keys after each one.
+ */
+int
+test20()
+{
+	bpt_record_t* rec[20000];
+	char in_tree[20000];
+	long i, j, k, lo, hi, d;
+	bptree t;
+
+	for(i = 0; i < 20000; i++)
+		rec[i] = new_record(i);
+	srand(20);
+	for(j = 0; j < 200; j++){
+		int n = j % 2 ? 20000 : 1 + rand() % 2000;
+		bpt_init(&t);
+		memset(in_tree, 0, n);
+		for(i = 0; i < n; i++)
+			if(rand() % 4){
+				bpt_insert(&t, i, rec[i]);
+				in_tree[i] = 1;
+			}
+		for(i = 0; i < 5; i++){
+			lo = rand() % (n + 1);
+			hi = lo + (rand() % 4 == 0 ? rand() % 10 
+				: rand() % (n + 1));
+			if(rand() % 10 == 0){
+				lo = -1;
+				hi = n + 1;
+			}
+			for(k = lo < 0 ? 0 : lo, d = 0; k < hi && k < n; k++){
+				d += in_tree[k];
+				in_tree[k] = 0;
+			}
+			if(bpt_delete_range(&t, lo, hi) != d){
+				printf("test20: delete of [%ld, %ld) returns "
+						"wrong number\n", lo, hi);
+				return 1;
+			}
+			if(test20_check(&t, in_tree, n, 1, "a range delete"))
+				return 1;
+		}
+		/* The tree is usable after that */
+		for(i = 0; i < n; i += 7)
+			if(! in_tree[i]){
+				bpt_insert(&t, i, rec[i]);
+				in_tree[i] = 1;
+			}
+		if(test20_check(&t, in_tree, n, 1, "inserts"))
+			return 1;
+		bpt_destroy(&t);
+	}
+
+	/* 50 keys of 100 records each */
+	bpt_init(&t);
+	memset(in_tree, 1, 50);
+	for(i = 0; i < 5000; i++)
+		bpt_insert(&t, i % 50, rec[i]);
+	for(i = 0; i < 25; i++){
+		lo = rand() % 50;
+		hi = lo + rand() % 5;
+		for(k = lo, d = 0; k < hi && k < 50; k++){
+			d += in_tree[k] * 100;
+			in_tree[k] = 0;
+		}
+		if(bpt_delete_range(&t, lo, hi) != d){
+			printf("test20: delete of [%ld, %ld) of duplicated "
+					"keys returns wrong number\n", lo, hi);
+			return 1;
+		}
+		if(test20_check(&t, in_tree, 50, 100, 
+				"a range delete of duplicated keys"))
+			return 1;
+	}
+	bpt_destroy(&t);
+
+	for(i = 0; i < 20000; i++)
+		free(rec[i]);
+	printf("test20: range deletes are correct\n");
+	return 0;
+}
+
+/* Churn of inserts and deletes of random keys under each underflow policy,
+ * then a purge of most of the keys and a compaction. The relaxed policies
+ * should not merge and borrow more than the default one; with big nodes none
+ * of them may have to.
+ */
+int
+test21()
+{
+	bpt_record_t* rec[20000];
+	char in_tree[20000];
+	bpt_key_t keys[100];
+	bpt_record_t* recs[100];
+	long i, j, k, smo[3];
+	int policy, m, r = 1;
+	bptree t;
+
+	for(i = 0; i < 20000; i++)
+		rec[i] = new_record(i);
+	srand(21);
+	for(policy = BPT_UNDERFLOW_HALF; policy <= BPT_UNDERFLOW_EMPTY; 
+			policy++){
+		bpt_init(&t);
+		bpt_set_underflow(&t, policy);
+		memset(in_tree, 0, sizeof(in_tree));
+		for(i = 0; i < 20000; i += 2){
+			bpt_insert(&t, i, rec[i]);
+			in_tree[i] = 1;
+		}
+		smo[policy] = t.smo.merges + t.smo.borrows;
+		for(i = 0; i < 200000; i++){
+			k = rand() % 20000;
+			if(in_tree[k])
+				bpt_delete(&t, k, rec[k]);
+			else bpt_insert(&t, k, rec[k]);
+			in_tree[k] = ! in_tree[k];
+			if(i % 20000 == 0 && test20_check(&t, in_tree, 20000,
+					1, "churn"))
+				goto out;
+		}
+		smo[policy] = t.smo.merges + t.smo.borrows - smo[policy];
+
+		/* Purge 90% of the keys, partly by sorted batches */
+		for(i = 0; i < 20000; i += 100){
+			for(j = i, m = 0; j < i + 90; j++)
+				if(in_tree[j]){
+					keys[m] = j;
+					recs[m++] = rec[j];
+					in_tree[j] = 0;
+				}
+			if(i % 200 == 0)
+				bpt_delete_batch(&t, keys, recs, m, 1);
+			else for(j = 0; j < m; j++)
+				bpt_delete(&t, keys[j], recs[j]);
+		}
+		if(test20_check(&t, in_tree, 20000, 1, "a purge"))
+			goto out;
+
+		/* Back to the default policy, no node is left underfull */
+		bpt_set_underflow(&t, BPT_UNDERFLOW_HALF);
+		bpt_compact(&t);
+		if(t.underfull || test20_check(&t, in_tree, 20000, 1, 
+					"compaction"))
+			goto out;
+		for(i = 0; i < 20000; i += 3)
+			if(! in_tree[i]){
+				bpt_insert(&t, i, rec[i]);
+				in_tree[i] = 1;
+			}
+		if(test20_check(&t, in_tree, 20000, 1, "inserts"))
+			goto out;
+		bpt_destroy(&t);
+	}
+	if(smo[BPT_UNDERFLOW_QUARTER] > smo[BPT_UNDERFLOW_HALF]
+			|| smo[BPT_UNDERFLOW_EMPTY] 
+				> smo[BPT_UNDERFLOW_QUARTER]){
+		printf("test21: merges and borrows of the churn are %ld, %ld "
+				"and %ld\n", smo[0], smo[1], smo[2]);
+		goto out;
+	}
+	printf("test21: underflow policies are correct\n");
+	r = 0;
+out:
+	bpt_destroy(&t);
+	for(i = 0; i < 20000; i++)
+		free(rec[i]);
+	return r;
+}
+
+/* Scan snapshot s, it should have the keys k < n with in_tree[k] set, each 
+ * one with record rec[k]. Return the number of keys, -1 if it is wrong.
+ */
+static long
+test22_scan(bpt_snap* s, bpt_record_t** rec, char* in_tree, long n)
+{
+	bpt_snap_cursor c;
+	long k = -1, cnt = 0;
+
+	for(bpt_snap_cursor_seek(s, &c, 0); bpt_snap_cursor_valid(&c);
+			bpt_snap_cursor_next(&c), cnt++){
+		for(k++; k < n && ! in_tree[k]; k++)
+			;
+		if(k == n || bpt_snap_cursor_key(&c) != k
+				|| ! rec_is(bpt_snap_cursor_record(&c), rec[k]))
+			return -1;
+	}
+	for(k++; k < n && ! in_tree[k]; k++)
+		;
+	return k == n ? cnt : -1;
+}
+
+struct test22_arg
+{
+	bpt_cow* c;
+	bpt_record_t** rec;
+	char* in_tree;
+	long ops;
+};
+
+/* Toggle random keys of the tree */
+static void*
+test22_writer(void* p)
+{
+	struct test22_arg* a = (struct test22_arg*) p;
+	unsigned int seed = 22;
+	long i, k;
+
+	for(i = 0; i < a->ops; i++){
+		k = rand_r(&seed) % 20000;
+		if(a->in_tree[k])
+			bpt_cow_delete(a->c, k, a->rec[k]);
+		else bpt_cow_insert(a->c, k, a->rec[k]);
+		a->in_tree[k] = ! a->in_tree[k];
+	}
+	return NULL;
+}
+
+/* Snapshots of a copy-on-write tree keep their keys while the tree changes,
+ * released ones are reclaimed; then snapshots scanned while a writer runs.
+ */
+int
+test22()
+{
+	bpt_record_t* rec[20000];
+	char in_tree[3][20000];
+	struct test22_arg arg;
+	bpt_snap* s[3];
+	bpt_cow c;
+	pthread_t th;
+	long i, j, k, cnt;
+
+	for(i = 0; i < 20000; i++)
+		rec[i] = new_record(i);
+	srand(22);
+	bpt_cow_init(&c);
+	memset(in_tree, 0, sizeof(in_tree));
+	for(i = 0; i < 20000; i++){
+		k = rand() % 10000 * 2;
+		if(! in_tree[0][k]){
+			bpt_cow_insert(&c, k, rec[k]);
+			in_tree[0][k] = 1;
+		}
+	}
+
+	/* Snapshot j of the keys in_tree[j], then churn the tree */
+	for(j = 0; j < 2; j++){
+		s[j] = bpt_snapshot(&c);
+		memcpy(in_tree[j + 1], in_tree[j], 20000);
+		for(i = 0; i < 30000; i++){
+			k = rand() % 20000;
+			/* The second churn only deletes below 15000 */
+			if(j == 1 && k < 15000 && ! in_tree[2][k])
+				continue;
+			if(in_tree[j + 1][k])
+				bpt_cow_delete(&c, k, rec[k]);
+			else bpt_cow_insert(&c, k, rec[k]);
+			in_tree[j + 1][k] = ! in_tree[j + 1][k];
+		}
+	}
+	s[2] = bpt_snapshot(&c);
+	if(bpt_snapshot(&c) != s[2]){
+		printf("test22: snapshots without writes are not shared\n");
+		return 1;
+	}
+	for(j = 0; j < 3; j++)
+		if(test22_scan(s[j], rec, in_tree[j], 20000) < 0){
+			printf("test22: snapshot %ld changed\n", j);
+			return 1;
+		}
+	for(k = 0; k < 20000; k += 7)
+		if((bpt_snap_get(s[0], k) != NULL) != in_tree[0][k]){
+			printf("test22: get of %ld in snapshot 0 is wrong\n",
+					k);
+			return 1;
+		}
+	if(test20_check(&c.t, in_tree[2], 20000, 1, "copy-on-write"))
+		return 1;
+
+	/* Release the middle one first */
+	bpt_snapshot_release(&c, s[1]);
+	if(test22_scan(s[0], rec, in_tree[0], 20000) < 0
+			|| test22_scan(s[2], rec, in_tree[2], 20000) < 0){
+		printf("test22: a snapshot changed after a release\n");
+		return 1;
+	}
+	bpt_snapshot_release(&c, s[0]);
+	bpt_snapshot_release(&c, s[2]);
+	bpt_snapshot_release(&c, s[2]);
+	if(c.oldest != NULL || c.reclaimed == 0){
+		printf("test22: snapshots are not reclaimed\n");
+		return 1;
+	}
+
+	/* A writer, and snapshots scanned twice meanwhile */
+	arg.c = &c;
+	arg.rec = rec;
+	arg.in_tree = in_tree[2];
+	arg.ops = 200000;
+	pthread_create(&th, NULL, test22_writer, &arg);
+	for(i = 0; i < 50; i++){
+		bpt_snap* x = bpt_snapshot(&c);
+		bpt_snap_cursor cur;
+		bpt_key_t last = -1;
+
+		cnt = 0;
+		for(bpt_snap_cursor_seek(x, &cur, 0); 
+				bpt_snap_cursor_valid(&cur);
+				bpt_snap_cursor_next(&cur), cnt++){
+			k = bpt_snap_cursor_key(&cur);
+			if(k <= last || ! rec_is(bpt_snap_cursor_record(&cur),
+					rec[k])){
+				printf("test22: snapshot is wrong at %ld\n", k);
+				return 1;
+			}
+			last = k;
+		}
+		for(k = 0, j = 0; k < 20000; k++)
+			j += bpt_snap_get(x, k) != NULL;
+		if(j != cnt){
+			printf("test22: snapshot changed while scanned\n");
+			return 1;
+		}
+		bpt_snapshot_release(&c, x);
+	}
+	pthread_join(th, NULL);
+	s[0] = bpt_snapshot(&c);
+	if(test22_scan(s[0], rec, in_tree[2], 20000) < 0
+			|| test20_check(&c.t, in_tree[2], 20000, 1, 
+				"concurrent copy-on-write")){
+		printf("test22: tree is wrong after the writer\n");
+		return 1;
+	}
+	bpt_snapshot_release(&c, s[0]);
+	bpt_cow_destroy(&c);
+
+	for(i = 0; i < 20000; i++)
+		free(rec[i]);
+	printf("test22: snapshots of copy-on-write tree are correct\n");
+	return 0;
+}
+
+struct test23_arg
+{
+	bpt_shards* s;
+	bpt_record_t** rec;
+	int id;
+	int del;
+	int* done;
+};
+
+/* Insert the keys k < 40000 with k % 4 == id, or delete the ones >= 4000 */
+static void*
+test23_producer(void* p)
+{
+	struct test23_arg* a = (struct test23_arg*) p;
+	long k;
+
+	for(k = a->id; k < 40000; k += 4)
+		if(! a->del)
+			bpt_shards_insert(a->s, k, a->rec[k]);
+		else if(k >= 4000)
+			bpt_shards_delete(a->s, k, a->rec[k]);
+	bpt_shards_flush(a->s);
+	__atomic_fetch_add(a->done, 1, __ATOMIC_SEQ_CST);
+	return NULL;
+}
+
+struct test23_scan_arg
+{
+	bpt_record_t** rec;
+	bpt_key_t last;
+	int bad;
+};
+
+static void
+test23_scan_fn(void* p, bpt_key_t k, bpt_record_t* v)
+{
+	struct test23_scan_arg* a = (struct test23_scan_arg*) p;
+	if(k <= a->last || ! rec_is(v, a->rec[k]))
+		a->bad = 1;
+	a->last = k;
+}
+
+/* Keys 0 .. n - 1 should be in the shards, each one with record rec[k] */
+static int
+test23_check(bpt_shards* s, bpt_record_t** rec, long n, const char* when)
+{
+	struct test23_scan_arg a = {rec, -1, 0};
+	long k, cnt;
+
+	for(k = 0; k < 40000; k++)
+		if(! rec_is(bpt_shards_get(s, k), k < n ? rec[k] : NULL)){
+			printf("test23: get of %ld is wrong %s\n", k, when);
+			return 1;
+		}
+	cnt = bpt_shards_scan(s, 0, 400000, test23_scan_fn, &a);
+	if(cnt != n || a.bad){
+		printf("test23: scan is wrong %s\n", when);
+		return 1;
+	}
+	a.last = 999;
+	if(bpt_shards_scan(s, 1000, 3000, test23_scan_fn, &a) != 2000
+			|| a.bad){
+		printf("test23: range scan is wrong %s\n", when);
+		return 1;
+	}
+	return 0;
+}
+
+/* Scan function of test23 which checks the order of the keys only */
+static void
+test23_order_fn(void* p, bpt_key_t k, bpt_record_t* v)
+{
+	struct test23_scan_arg* a = (struct test23_scan_arg*) p;
+	(void) v;
+	if(k <= a->last)
+		a->bad = 1;
+	a->last = k;
+}
+
+struct test23_churn_arg
+{
+	bpt_shards* s;
+	bpt_record_t** rec;
+	/* Keys lo + j * step with record rec[j], j < 1000, in[j] if in the
+	 * tree
+	 */
+	long lo;
+	long step;
+	char in[1000];
+	int slow;
+	int* stop;
+};
+
+/* Insert and delete keys of a churn of test23 until stopped, slowly if its
+ * keys should go to shards which get little
+ */
+static void*
+test23_churner(void* p)
+{
+	struct test23_churn_arg* a = (struct test23_churn_arg*) p;
+	unsigned int seed = a->lo;
+	long j;
+
+	while(! __atomic_load_n(a->stop, __ATOMIC_ACQUIRE)){
+		j = rand_r(&seed) % 1000;
+		if(a->in[j])
+			bpt_shards_delete(a->s, a->lo + j * a->step, a->rec[j]);
+		else bpt_shards_insert(a->s, a->lo + j * a->step, a->rec[j]);
+		a->in[j] = ! a->in[j];
+		if(a->slow)
+			usleep(20);
+	}
+	bpt_shards_flush(a->s);
+	return NULL;
+}
+
+/* Shards merged and split while two threads keep pushing to them: a fast
+ * one to a hot range, a slow one to the cold shards below it, which merge.
+ * The keys k % 5 == 0 are loaded before.
+ */
+static int
+test23_churn(bpt_record_t** rec)
+{
+	struct test23_churn_arg arg[2];
+	struct test23_scan_arg sa = {NULL, -1, 0};
+	pthread_t th[2];
+	bpt_shards s;
+	long i, k, cnt = 10000;
+	int stop = 0;
+
+	bpt_shards_init(&s, 32, 0, 400000);
+	for(i = 0; i < 10000; i++)
+		bpt_shards_insert(&s, 200000 + i * 5, rec[i]);
+	for(i = 0; i < 2; i++){
+		arg[i].s = &s;
+		arg[i].rec = rec + 10000 + i * 1000;
+		arg[i].lo = i ? 1 : 250001;
+		arg[i].step = i ? 150 : 5;
+		memset(arg[i].in, 0, sizeof(arg[i].in));
+		arg[i].slow = i;
+		arg[i].stop = &stop;
+		pthread_create(&th[i], NULL, test23_churner, &arg[i]);
+	}
+	for(i = 0; i < 5000 && s.merges < 16; i++){
+		bpt_shards_rebalance(&s);
+		usleep(500);
+	}
+	__atomic_store_n(&stop, 1, __ATOMIC_RELEASE);
+	for(i = 0; i < 2; i++)
+		pthread_join(th[i], NULL);
+	if(s.merges < 16){
+		printf("test23: %ld merges while pushing\n", s.merges);
+		return 1;
+	}
+
+	for(i = 0; i < 2; i++)
+		for(k = 0; k < 1000; k++){
+			cnt += arg[i].in[k];
+			bpt_key_t x = arg[i].lo + k * arg[i].step;
+			if(! rec_is(bpt_shards_get(&s, x), arg[i].in[k]
+					? arg[i].rec[k] : NULL)){
+				printf("test23: get of %ld is wrong in churn\n",
+					(long) x);
+				return 1;
+			}
+		}
+	for(i = 0; i < 10000; i += 7)
+		if(! rec_is(bpt_shards_get(&s, 200000 + i * 5), rec[i])){
+			printf("test23: loaded key %ld is lost in churn\n",
+				200000 + i * 5);
+			return 1;
+		}
+	if(bpt_shards_scan(&s, 0, 400000, test23_order_fn, &sa) != cnt
+			|| sa.bad){
+		printf("test23: scan is wrong after churn\n");
+		return 1;
+	}
+	bpt_shards_destroy(&s);
+	return 0;
+}
+
+/* Producers insert into one shard of two and then delete most keys, while
+ * the shards are rebalanced: the hot shard splits, the emptied ones merge.
+ */
+int
+test23()
+{
+	bpt_record_t* rec[40000];
+	struct test23_arg arg[4];
+	pthread_t th[4];
+	bpt_shards s;
+	int i, del, done;
+
+	for(i = 0; i < 40000; i++)
+		rec[i] = new_record(i);
+	bpt_shards_init(&s, 2, 0, 400000);
+	for(del = 0; del < 2; del++){
+		done = 0;
+		for(i = 0; i < 4; i++){
+			arg[i].s = &s;
+			arg[i].rec = rec;
+			arg[i].id = i;
+			arg[i].del = del;
+			arg[i].done = &done;
+			pthread_create(&th[i], NULL, test23_producer, &arg[i]);
+		}
+		while(__atomic_load_n(&done, __ATOMIC_SEQ_CST) < 4){
+			bpt_shards_rebalance(&s);
+			usleep(200);
+		}
+		for(i = 0; i < 4; i++)
+			pthread_join(th[i], NULL);
+		if(test23_check(&s, rec, del ? 4000 : 40000,
+				del ? "after deletes" : "after inserts"))
+			return 1;
+		if(del == 0)
+			while(bpt_shards_rebalance(&s) && s.splits < 16)
+				;
+	}
+	/* The gets of the check made the emptied shards hot, the first one
+	 * starts a new count.
+	 */
+	bpt_shards_rebalance(&s);
+	while(bpt_shards_rebalance(&s))
+		;
+	if(s.splits == 0 || s.merges == 0){
+		printf("test23: shards are not rebalanced\n");
+		return 1;
+	}
+	if(test23_check(&s, rec, 4000, "after rebalances"))
+		return 1;
+	bpt_shards_destroy(&s);
+	if(test23_churn(rec))
+		return 1;
+
+	for(i = 0; i < 40000; i++)
+		free(rec[i]);
+	printf("test23: sharded tree is correct\n");
+	return 0;
+}
+
+struct test24_arg
+{
+	bpt_record_t** model;
+	bpt_key_t last;
+	int bad;
+};
+
+static void
+test24_scan_fn(void* p, bpt_key_t k, bpt_record_t* v)
+{
+	struct test24_arg* a = (struct test24_arg*) p;
+	if(k <= a->last || ! rec_is(v, a->model[k]))
+		a->bad = 1;
+	a->last = k;
+}
+
+/* The buffered tree should hold the records model[k] of the keys k < n */
+static int
+test24_check(bpt_beps* b, bpt_record_t** model, long n, const char* when)
+{
+	struct test24_arg a = {model, -1, 0};
+	long k, cnt = 0, lo = rand() % n, hi = lo + rand() % 2000;
+
+	for(k = 0; k < n; k++){
+		if(! rec_is(bpt_beps_get(b, k), model[k])){
+			printf("test24: get of %ld is wrong %s\n", k, when);
+			return 1;
+		}
+		cnt += model[k] != NULL;
+	}
+	if(bpt_beps_scan(b, 0, n, test24_scan_fn, &a) != cnt || a.bad){
+		printf("test24: scan is wrong %s\n", when);
+		return 1;
+	}
+	for(k = lo, cnt = 0; k < hi && k < n; k++)
+		cnt += model[k] != NULL;
+	a.last = lo - 1;
+	if(bpt_beps_scan(b, lo, hi, test24_scan_fn, &a) != cnt || a.bad){
+		printf("test24: range scan is wrong %s\n", when);
+		return 1;
+	}
+	return 0;
+}
+
+/* Random inserts, upserts and deletes through the buffers of a buffered 
+ * tree, with small and default buffers, checked against a model; then the
+ * messages are applied and the tree checked.
+ */
+int
+test24()
+{
+	bpt_record_t* rec[40000];
+	bpt_record_t* model[20000];
+	char in_tree[20000];
+	int sizes[] = {4, BPT_BEPS_BUF};
+	long i, j, k;
+	bpt_beps b;
+
+	for(i = 0; i < 40000; i++)
+		rec[i] = new_record(i);
+	srand(24);
+	for(j = 0; j < 2; j++){
+		bpt_beps_init(&b);
+		b.buf_size = sizes[j];
+		memset(model, 0, sizeof(model));
+		for(i = 0; i < 200000; i++){
+			k = rand() % 20000;
+			switch(rand() % 4){
+			case 0:
+			case 1:
+				bpt_beps_insert(&b, k, rec[k]);
+				if(model[k] == NULL)
+					model[k] = rec[k];
+				break;
+			case 2:
+				model[k] = rec[k + 20000 * (rand() % 2)];
+				bpt_beps_upsert(&b, k, model[k]);
+				break;
+			default:
+				bpt_beps_delete(&b, k);
+				model[k] = NULL;
+			}
+			/* Grow, then shrink the tree */
+			if(i == 100000)
+				for(k = 0; k < 20000; k++)
+					if(k % 16 != 0){
+						bpt_beps_delete(&b, k);
+						model[k] = NULL;
+					}
+			if(i % 25000 == 0 
+				&& test24_check(&b, model, 20000, "in churn"))
+				return 1;
+		}
+		if(b.flushes == 0 || test24_check(&b, model, 20000, "at end"))
+			return 1;
+		bpt_beps_sync(&b);
+		for(k = 0; k < 20000; k++)
+			in_tree[k] = model[k] != NULL;
+		if(test24_check(&b, model, 20000, "after sync")
+				|| test20_check(&b.t, in_tree, 20000, 1, 
+					"buffered tree"))
+			return 1;
+		for(k = 0; k < 20000; k++)
+			if(! rec_is(bpt_get(&b.t, k), model[k])){
+				printf("test24: record of %ld is wrong\n", k);
+				return 1;
+			}
+		bpt_beps_destroy(&b);
+	}
+
+	for(i = 0; i < 40000; i++)
+		free(rec[i]);
+	printf("test24: buffered tree is correct\n");
+	return 0;
+}
+
+/* Key j of a distribution of test25: dense, quadratic, or in clusters */
+static long
+test25_key(long j, int dist)
+{
+	if(dist == 0)
+		return 3 * j;
+	if(dist == 1)
+		return j * j;
+	return j / 100 * 1000000 + j % 100;
+}
+
+/* The learned index should find what the tree finds, for the keys and for
+ * the keys around them.
+ */
+static int
+test25_check(bpt_learn* m, long n, int dist, const char* when)
+{
+	bpt_cursor c, c1;
+	long j, d;
+
+	for(j = 0; j < n; j++)
+		for(d = -1; d <= 1; d++){
+			long k = test25_key(j, dist) + d;
+			bpt_record_t* r = bpt_get(m->t, k);
+			bpt_node* l = bpt_learn_query(m, k);
+			if(bpt_learn_get(m, k) != r || (r != NULL
+					&& bpt_find_in_leaf(l, k, r) < 0)){
+				printf("test25: get of %ld is wrong %s\n", k,
+						when);
+				return 1;
+			}
+			bpt_cursor_seek(m->t, &c, k);
+			bpt_learn_cursor_seek(m, &c1, k);
+			if(c.leaf != c1.leaf || (c.leaf && c.ind != c1.ind)){
+				printf("test25: seek of %ld is wrong %s\n", k,
+						when);
+				return 1;
+			}
+		}
+	return 0;
+}
+
+/* The segments of a fresh model should predict the position of each leaf
+ * within the error.
+ */
+static int
+test25_error(bpt_learn* m)
+{
+	long s, i;
+
+	for(s = 0; s < m->n_seg; s++){
+		struct bpt_seg* g = &m->seg[s];
+		long end = s + 1 < m->n_seg ? m->seg[s + 1].first : m->n_leaf;
+		if(g->stale)
+			return 1;
+		for(i = g->first; i < end; i++){
+			double y = g->y + g->slope * ((double) m->lo[i]
+					- (double) m->seg_k[s]);
+			if(fabs(y - i) > m->eps + 1e-6)
+				return 1;
+		}
+	}
+	return 0;
+}
+
+/* A learned index over trees of keys of three distributions: lookups after
+ * fitting it, through random inserts and deletes which make it stale and
+ * refresh it, and after direct changes of the tree.
+ */
+int
+test25()
+{
+	int n = 20000, dist;
+	bpt_record_t** rec = (bpt_record_t**) my_calloc(n * sizeof(void*));
+	char* in_tree = (char*) my_calloc(n);
+	long i, j, k;
+	bpt_learn m;
+	bptree t;
+
+	for(i = 0; i < n; i++)
+		rec[i] = new_record(i);
+	srand(25);
+	for(dist = 0; dist < 3; dist++){
+		bpt_init(&t);
+		memset(in_tree, 0, n);
+		for(i = 0; i < n; i++)
+			if(rand() % 2){
+				bpt_insert(&t, test25_key(i, dist), rec[i]);
+				in_tree[i] = 1;
+			}
+		bpt_learn_init(&m, &t);
+		if(m.n_seg == 0 || test25_error(&m)){
+			printf("test25: model is off the leaves\n");
+			return 1;
+		}
+		if(test25_check(&m, n, dist, "after fitting")
+				|| m.fallbacks != 0)
+			return 1;
+
+		for(i = 0; i < 100000; i++){
+			j = rand() % n;
+			k = test25_key(j, dist);
+			if(in_tree[j])
+				bpt_learn_delete(&m, k, rec[j]);
+			else bpt_learn_insert(&m, k, rec[j]);
+			in_tree[j] = ! in_tree[j];
+			for(k = 0; k < 4; k++){
+				bpt_record_t* r;
+				j = rand() % n;
+				r = in_tree[j] ? rec[j] : NULL;
+				if(! rec_is(bpt_learn_get(&m, test25_key(j,
+						dist)), r)){
+					printf("test25: get is wrong in "
+							"churn\n");
+					return 1;
+				}
+			}
+			if(i % 25000 == 0 
+				&& test25_check(&m, n, dist, "in churn"))
+				return 1;
+		}
+		if(m.refreshes == 0 || m.fallbacks == 0 
+				|| m.fallbacks == m.lookups){
+			printf("test25: model is not refreshed\n");
+			return 1;
+		}
+
+		bpt_learn_refresh(&m);
+		if(test25_error(&m)){
+			printf("test25: refreshed model is off the leaves\n");
+			return 1;
+		}
+		j = m.fallbacks;
+		if(test25_check(&m, n, dist, "after refresh")
+				|| m.fallbacks != j)
+			return 1;
+
+		/* Changes not through the learned index */
+		for(i = 0; i < n; i++)
+			if(! in_tree[i] && rand() % 2){
+				bpt_insert(&t, test25_key(i, dist), rec[i]);
+				in_tree[i] = 1;
+			}else if(in_tree[i] && rand() % 4 == 0){
+				bpt_delete(&t, test25_key(i, dist), rec[i]);
+				in_tree[i] = 0;
+			}
+		if(test25_check(&m, n, dist, "after direct changes"))
+			return 1;
+		bpt_learn_destroy(&m);
+		bpt_destroy(&t);
+	}
+
+	for(i = 0; i < n; i++)
+		free(rec[i]);
+	free(rec);
+	free(in_tree);
+	printf("test25: learned index finds the leaves\n");
+	return 0;
+}
+
+/* A frozen tree of the keys 2 * i, i < n, should find each of them, none of
+ * the odd keys, and count and scan any range.
+ */
+static int
+test26_small(long n)
+{
+	bpt_record_t** rec = (bpt_record_t**) my_calloc((n + 1) 
+			* sizeof(void*));
+	bpt_frozen_cursor c;
+	bpt_frozen f;
+	bptree t;
+	long i, k;
+
+	bpt_init(&t);
+	for(i = 0; i < n; i++){
+		rec[i] = new_record(2 * i);
+		bpt_insert(&t, 2 * i, rec[i]);
+	}
+	bpt_freeze(&t, &f);
+	if(! bpt_empty(&t) && t.root->num_of_rec > 0){
+		printf("test26: tree is not empty after freezing\n");
+		return 1;
+	}
+	for(k = -1; k <= 2 * n; k++){
+		bpt_record_t* r = bpt_frozen_get(&f, k);
+		if(! rec_is(r, k >= 0 && k % 2 == 0 && k < 2 * n ? rec[k / 2]
+				: NULL)
+				|| bpt_frozen_count_range(&f, k, 2 * n)
+					!= n - (k + 1) / 2){
+			printf("test26: key %ld of %ld is wrong\n", k, n);
+			return 1;
+		}
+	}
+	for(bpt_frozen_cursor_seek(&f, &c, 1), i = n > 0; 
+			bpt_frozen_cursor_valid(&c); 
+			bpt_frozen_cursor_next(&c), i++)
+		if(! rec_is(bpt_frozen_cursor_record(&c), rec[i]))
+			break;
+	if(bpt_frozen_cursor_valid(&c) || i != n){
+		printf("test26: scan of %ld keys is wrong\n", n);
+		return 1;
+	}
+	for(bpt_frozen_cursor_prev(&c), i--; bpt_frozen_cursor_valid(&c);
+			bpt_frozen_cursor_prev(&c), i--)
+		if(bpt_frozen_cursor_key(&c) != 2 * i)
+			break;
+	if(i != -1){
+		printf("test26: scan of %ld keys is wrong\n", n);
+		return 1;
+	}
+	bpt_frozen_destroy(&f);
+	bpt_destroy(&t);
+	for(i = 0; i < n; i++)
+		free(rec[i]);
+	free(rec);
+	return 0;
+}
+
+/* The records of f in [lo, hi) should be the ones of key[i] with in[i] set,
+ * in key order.
+ */
+static int
+test26_check(bpt_frozen* f, long* key, bpt_record_t** rec, char* in, 
+		long n, long lo, long hi)
+{
+	bpt_frozen_cursor c;
+	long i, cnt = 0, k = lo - 1;
+
+	for(i = 0; i < n; i++)
+		if(in[i] && key[i] >= lo && key[i] < hi){
+			bpt_record_t* r = bpt_frozen_get(f, key[i]);
+			if(r == NULL || key[r->v] != key[i])
+				return 1;
+			cnt++;
+		}
+	if(bpt_frozen_count_range(f, lo, hi) != cnt)
+		return 1;
+	bpt_frozen_cursor_seek(f, &c, lo);
+	bpt_frozen_cursor_set_end(&c, hi);
+	for(; bpt_frozen_cursor_valid(&c); bpt_frozen_cursor_next(&c), cnt--){
+		bpt_record_t* r = bpt_frozen_cursor_record(&c);
+		if(bpt_frozen_cursor_key(&c) < k || ! in[r->v] 
+				|| key[r->v] != bpt_frozen_cursor_key(&c))
+			return 1;
+		k = bpt_frozen_cursor_key(&c);
+	}
+	return cnt != 0;
+}
+
+/* Freeze trees of the sizes around the node widths, then a range of a tree 
+ * of duplicated keys, and the rest of the tree.
+ */
+int
+test26()
+{
+	long sizes[] = {0, 1, 7, 8, 9, 72, 73, 81, 82, 1000, 20000};
+	long n = 20000, i, k, d;
+	long* key = (long*) my_calloc(n * sizeof(long));
+	bpt_record_t** rec = (bpt_record_t**) my_calloc(n * sizeof(void*));
+	char* in = (char*) my_calloc(n);
+	bpt_frozen f1, f2;
+	bpt_cursor c;
+	bptree t;
+
+	for(i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+		if(test26_small(sizes[i]))
+			return 1;
+
+	srand(26);
+	bpt_init(&t);
+	for(i = 0; i < n; i++){
+		key[i] = rand() % 50000;
+		rec[i] = new_record(i);
+		bpt_insert(&t, key[i], rec[i]);
+		in[i] = key[i] >= 10000 && key[i] < 30000;
+	}
+	bpt_freeze_range(&t, &f1, 10000, 30000);
+	if(test26_check(&f1, key, rec, in, n, 10000, 30000)
+			|| test26_check(&f1, key, rec, in, n, 0, 50000)){
+		printf("test26: frozen range is wrong\n");
+		return 1;
+	}
+	for(i = 0; i < 1000; i++){
+		k = rand() % 50000;
+		d = rand() % 1000;
+		if(test26_check(&f1, key, rec, in, n, k, k + d)){
+			printf("test26: range [%ld, %ld) is wrong\n", k, k + d);
+			return 1;
+		}
+	}
+
+	/* The rest is in the tree */
+	for(i = 0; i < n; i++)
+		in[i] = ! in[i];
+	for(bpt_cursor_seek(&t, &c, 0), d = 0; bpt_cursor_valid(&c);
+			bpt_cursor_next(&c), d++)
+		if(! in[bpt_cursor_record(&c)->v])
+			break;
+	for(i = k = 0; i < n; i++)
+		k += in[i];
+	if(d != k){
+		printf("test26: tree is wrong after freezing a range\n");
+		return 1;
+	}
+	bpt_freeze(&t, &f2);
+	if(test26_check(&f2, key, rec, in, n, 0, 50000) 
+			|| f1.n + f2.n != n){
+		printf("test26: frozen tree is wrong\n");
+		return 1;
+	}
+	bpt_frozen_destroy(&f1);
+	bpt_frozen_destroy(&f2);
+	bpt_destroy(&t);
+
+	for(i = 0; i < n; i++)
+		free(rec[i]);
+	free(rec);
+	free(key);
+	free(in);
+	printf("test26: frozen trees are correct\n");
+	return 0;
+}
+
+int 
+main()
+{
+	int r = 0;
+
+	//test1();
+	//test2();
+	r |= test3();
+	r |= test4();
+	r |= test5();
+	r |= test6();
+	r |= test7();
+#ifndef BPT_COUNTS
+	/* Thread-safe mode does not keep the counts */
+	r |= test8();
+#endif
+	r |= test9();
+	r |= test10();
+	r |= test11();
+	r |= test12();
+	r |= test13();
+	r |= test14();
+	r |= test15();
+	r |= test16();
+	r |= test17();
+#ifdef BPT_COUNTS
+	r |= test18();
+#endif
+	r |= test19();
+	r |= test20();
+	r |= test21();
+	r |= test22();
+	r |= test23();
+	r |= test24();
+	r |= test25();
+	r |= test26();
+	return r != 0;
+}